@@ -9,11 +9,14 @@
 #include "editor.h"
 #include "menu.h"
 #include "build.h"
+#include "diag.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct AutoBackup;
+
 typedef struct AppState {
     EditorState **editors;
     size_t editor_count;
@@ -21,8 +24,13 @@ typedef struct AppState {
     size_t active_editor;
     Config config;
     BuildConfig build;
+    BuildProcess build_proc;        /* Build or run in progress (GUI) */
+    BuildOutput build_output;       /* Its output, for the output pane */
+    DiagList diags;                 /* Diagnostics parsed from that output */
+    BuildCache build_cache;         /* Skips builds whose inputs are unchanged */
     MenuSet menus;
     char exe_dir[260];
+    struct AutoBackup *autobackup;  /* Scheduled backups (NULL when off) */
     int running;
     int gui_mode;
 } AppState;
@@ -37,6 +45,14 @@ int app_close_editor(AppState *app, size_t index);
 int app_open_file(AppState *app, const char *path);
 int app_save_file(AppState *app, const char *path);
 
+/* Make the editor holding path active (opening it in a new editor if no
+ * editor has it) and move its cursor to line/col (1-based) */
+EditorState *app_goto_location(AppState *app, const char *path, size_t line, size_t col);
+
+/* Output file of building path ({out} of build_cmd). Returns -1 when
+ * build_cmd has no {out}, so the result cannot be checked or cached. */
+int app_build_target(AppState *app, const char *path, char *out, size_t max);
+
 #ifdef __cplusplus
 }
 #endif
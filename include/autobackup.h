@@ -0,0 +1,52 @@
+/*
+ * autobackup.h - Scheduled background backups
+ *
+ * Runs the [schedule] destination of backup.ini every `interval` seconds
+ * on a worker thread while the editor keeps running. Before each run the
+ * project is walked and compared with its manifest (sizes and mtimes
+ * only), so an unchanged project costs one directory walk. The worker
+ * drops to idle CPU and I/O priority (Linux) and the archive stream can
+ * be held under rate_limit_kb so interactive work stays responsive.
+ *
+ *   [schedule]
+ *   interval=900
+ *   destination=local
+ *   rate_limit_kb=20480
+ *
+ * Native Windows builds have no worker thread; autobackup_poll runs a
+ * due backup inline from the UI loop instead.
+ */
+#ifndef TEDIT_AUTOBACKUP_H
+#define TEDIT_AUTOBACKUP_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AutoBackup AutoBackup;
+
+/* Start the scheduler for project_dir. Returns NULL when backup.ini is
+ * missing, interval is 0 or there is no [schedule] destination. */
+AutoBackup *autobackup_start(const char *ini_path, const char *project_dir);
+
+/* Stop the scheduler, waiting for a backup in progress to finish */
+void autobackup_stop(AutoBackup *ab);
+
+/* Run as soon as possible instead of waiting for the interval */
+void autobackup_trigger(AutoBackup *ab);
+
+/* Call once per UI iteration (cheap when nothing is due) */
+void autobackup_poll(AutoBackup *ab);
+
+/* Status bar text: progress while a backup runs, then the outcome of
+ * the last one. Returns 0 (and an empty string) when there is nothing
+ * to show yet. */
+int autobackup_status(AutoBackup *ab, char *out, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEDIT_AUTOBACKUP_H */
@@ -8,7 +8,10 @@
 #define TEDIT_BACKUP_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <time.h>
+#include "walk.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,6 +22,9 @@ extern "C" {
 #define BACKUP_MAX_CMD 512
 #define BACKUP_MAX_PATH 260
 
+/* Longest archive member name (PATH_MAX); longer ones fail the backup */
+#define ARCHIVE_MAX_NAME 4096
+
 /* Backup destination (from backup.ini) */
 typedef struct BackupDest {
     char name[BACKUP_MAX_NAME];     /* Destination name (e.g., "local", "s3") */
@@ -29,23 +35,101 @@ typedef struct BackupDest {
 typedef struct BackupSettings {
     int threshold_mb;               /* Prompt when history exceeds this */
     int interval;                   /* Auto-backup interval in seconds (0 = disabled) */
-    char archive_format[16];        /* "tar.gz" or "zip" */
+    char archive_format[16];        /* "tar" or "tar.gz" */
     char temp_dir[BACKUP_MAX_PATH]; /* Temporary directory */
     char default_dest[BACKUP_MAX_NAME]; /* Default destination */
+    int threads;                    /* Archive reader threads (0 = one per CPU) */
+    int compression_level;          /* Deflate level for tar.gz (0-9) */
+    int zero_copy;                  /* Kernel-side file copies for plain tar */
+    WalkRules exclude;              /* exclude= patterns (default: dotfiles) */
+    int rate_limit_kb;              /* Scheduled backups: KB/s of archive data (0 = unlimited) */
+    int low_priority;               /* Scheduled backups: idle CPU and I/O priority */
+    int scheduled_incremental;      /* Scheduled backups are incremental */
 } BackupSettings;
 
+/* Records written so far out of total; called by the archive writer */
+typedef void (*BackupProgressFn)(void *ctx, size_t done, size_t total);
+
+/* Archive build statistics */
+typedef struct ArchiveStats {
+    size_t files;                   /* Records written */
+    size_t skipped;                 /* Entries that could not be read */
+    size_t bytes;                   /* File payload bytes */
+    size_t archive_bytes;           /* Total tar stream size */
+    size_t output_bytes;            /* Bytes written (after compression) */
+    int threads;                    /* Reader threads (1 = serial) */
+    double seconds;
+    int streamed;                   /* Written into a pipe, not a file */
+    size_t zero_copy_bytes;         /* Moved by copy_file_range/sendfile */
+    size_t stalls;                  /* Waits for a full pipe to drain */
+    double stall_seconds;           /* Time spent in those waits */
+} ArchiveStats;
+
+/* Changes found by comparing a project with its manifest */
+typedef struct BackupDiffStats {
+    size_t files;                   /* Files in the project */
+    size_t unchanged;
+    size_t added;
+    size_t modified;
+    size_t deleted;
+    size_t unreadable;              /* Kept at their last known state */
+    size_t hashed;                  /* Files read to compute a hash */
+    double seconds;
+} BackupDiffStats;
+
+/* Deduplicating repository statistics (backup, restore or verify) */
+typedef struct BackupRepoStats {
+    size_t files;
+    size_t reused;                  /* Unchanged files taken from the last snapshot */
+    size_t skipped;                 /* Files that could not be read or written */
+    size_t outside;                 /* Restore: entries outside files/, not written */
+    size_t chunks;                  /* Chunks referenced or checked */
+    size_t new_chunks;              /* Chunks added to the repository */
+    size_t errors;                  /* Verify: missing or corrupt chunks */
+    uint64_t bytes;                 /* File bytes */
+    uint64_t new_bytes;             /* Bytes added to pack files */
+    int threads;
+    double seconds;
+} BackupRepoStats;
+
 /* Backup configuration */
 typedef struct BackupConfig {
     BackupSettings settings;
     BackupDest destinations[BACKUP_MAX_DESTINATIONS];
     size_t dest_count;
     char ini_path[BACKUP_MAX_PATH]; /* Path to backup.ini */
+    ArchiveStats last_stats;        /* Archive built by the last backup_project */
+    BackupDiffStats last_diff;      /* Changes since the previous backup */
+    int last_incremental;           /* Last backup was incremental */
+    char last_archive[BACKUP_MAX_PATH]; /* Archive created (empty if none) */
+    int last_to_repo;               /* Last backup went to a repo: destination */
+    BackupRepoStats last_repo;      /* Its statistics (last_archive = snapshot) */
+    WalkStats last_walk;            /* Directory walk of the last backup */
+    BackupProgressFn progress;      /* Optional, for archive destinations */
+    void *progress_ctx;
+    uint64_t rate_limit;            /* Archive bytes per second (0 = unlimited) */
 } BackupConfig;
 
+/* Trailing members of every archive: a text index of the records
+ * ("<header offset> <size> <xxh64|-> <path>" per line) and a one-block
+ * locator giving the index's offset, so readers can seek to any member
+ * (see restore.h) */
+#define ARCHIVE_INDEX_NAME   ".tedit-backup/index"
+#define ARCHIVE_LOCATOR_NAME ".tedit-backup/locator"
+#define ARCHIVE_LOCATOR_MAGIC "tedit-index"
+
 /* Archive entry */
 typedef struct ArchiveEntry {
-    char path[BACKUP_MAX_PATH];     /* Relative path in archive */
-    char source[BACKUP_MAX_PATH];   /* Source file path */
+    char *path;                     /* Relative path in archive */
+    char *source;                   /* Source file path */
+    char *data;                     /* In-memory contents instead of source */
+    size_t data_len;
+    uint64_t size;                  /* Captured by the directory walk when has_stat */
+    int64_t mtime;
+    unsigned int mode;              /* Permission bits */
+    int has_stat;                   /* size/mtime/mode are valid; no need to stat */
+    uint64_t hash;                  /* XXH64 of the contents when has_hash */
+    int has_hash;                   /* Known from the manifest scan */
 } ArchiveEntry;
 
 /* Archive builder */
@@ -54,6 +138,15 @@ typedef struct Archive {
     ArchiveEntry *entries;
     size_t entry_count;
     size_t entry_capacity;
+    time_t mtime;                   /* Header mtime shared by every record */
+    int threads;                    /* Reader threads (0 = one per CPU, 1 = serial) */
+    int compress;                   /* Write tar.gz instead of tar */
+    int level;                      /* Deflate level when compressing */
+    int zero_copy;                  /* Let the kernel copy large files (Linux) */
+    uint64_t rate_limit;            /* Tar stream bytes per second (0 = unlimited) */
+    BackupProgressFn progress;
+    void *progress_ctx;
+    ArchiveStats stats;             /* Filled in by archive_finalize */
 } Archive;
 
 /* Configuration */
@@ -64,15 +157,29 @@ BackupDest *backup_config_get_dest(BackupConfig *cfg, const char *name);
 /* Archive creation */
 Archive *archive_create(const char *output_path);
 void archive_destroy(Archive *ar);
+/* Returns -1 if dest_path is longer than ARCHIVE_MAX_NAME */
 int archive_add_file(Archive *ar, const char *source, const char *dest_path);
 int archive_add_directory(Archive *ar, const char *dir, const char *prefix);
-int archive_finalize(Archive *ar);  /* Create the actual archive file */
+int archive_add_data(Archive *ar, const char *dest_path, const char *data, size_t len);
+
+/* Create the actual archive file. Reader threads prefetch entries into a
+ * bounded ring while one writer emits records in entry order, so the
+ * output is identical for any thread count. With compress set the tar
+ * stream is gzipped in the same pass (see deflate.h). */
+int archive_finalize(Archive *ar);
+
+/* Same, but write to an open stream (such as a popen pipe) instead of
+ * ar->path. Output bypasses the FILE's buffer; on a pipe, time spent
+ * waiting for the reader is recorded as stalls in ar->stats. */
+int archive_finalize_to(Archive *ar, FILE *out);
 
 /* Backup execution */
 int backup_execute(BackupConfig *cfg, const char *dest_name,
                    const char *project_dir, const char *archive_path);
 
-/* Variable substitution for backup commands */
+/* Variable substitution for backup commands. {stdin} expands to nothing;
+ * its presence streams the archive into the command's standard input
+ * instead of writing a file first. */
 typedef struct BackupVars {
     char archive[BACKUP_MAX_PATH];  /* {archive} - Generated archive path */
     char project[BACKUP_MAX_PATH];  /* {p} - Project directory */
@@ -89,9 +196,21 @@ void backup_vars_init(BackupVars *vars, const char *archive,
 int backup_substitute(char *out, size_t out_size, 
                       const char *template_cmd, BackupVars *vars);
 
-/* High-level backup operations */
+/* High-level backup operations. Both record a manifest next to
+ * backup.ini; an incremental backup archives only files added or changed
+ * since that manifest plus a deletion list, and falls back to a full
+ * backup when there is no manifest yet. A destination of the form
+ * "repo:<path>" stores a snapshot in a deduplicating repository instead
+ * (see dedup.h); snapshots are always incremental in storage. */
 int backup_project(BackupConfig *cfg, const char *dest_name,
                    const char *project_dir, int include_history);
+int backup_project_incremental(BackupConfig *cfg, const char *dest_name,
+                               const char *project_dir);
+
+/* 1 if the project differs from its manifest by path, size or mtime (or
+ * has no manifest yet), 0 if a backup would find nothing to do. Only
+ * walks the tree; no file is read. */
+int backup_project_changed(BackupConfig *cfg, const char *project_dir);
 
 /* Get default backup.ini path */
 void backup_get_default_ini_path(char *out, size_t out_size, const char *exe_dir);
@@ -0,0 +1,77 @@
+/*
+ * blocks.h - Bracket and block nesting index
+ *
+ * Maintains line start offsets and the opener/closer events found by
+ * tokenizing each line ({}, (), [], proc/endp, macro/endm, if/endif).
+ * Edits retokenize the touched lines, and the lines after them while a
+ * block comment opened or closed by the edit changes how they lex. Line
+ * offsets, line lookups and partner searches are O(log n), and an edit
+ * costs O(log n) plus the lines it rescans.
+ */
+#ifndef TEDIT_BLOCKS_H
+#define TEDIT_BLOCKS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "buffer.h"
+#include "syntax.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum BlockKind {
+    BLOCK_BRACE = 1,    /* { } */
+    BLOCK_PAREN,        /* ( ) */
+    BLOCK_BRACKET,      /* [ ] */
+    BLOCK_PROC,         /* proc / endp */
+    BLOCK_MACRO,        /* macro / endm */
+    BLOCK_IF,           /* if, ifdef, #if... / endif */
+    BLOCK_KIND_COUNT
+} BlockKind;
+
+typedef struct BlockEvent {
+    uint32_t col;           /* Byte column within the line */
+    uint8_t kind;           /* BlockKind */
+    uint8_t open;           /* 1 = opener, 0 = closer */
+    uint16_t reserved;
+} BlockEvent;
+
+typedef struct BlockChunk BlockChunk;
+
+typedef struct BlockIndex {
+    Language lang;
+    BlockChunk *root;       /* Treap of line chunks in document order */
+    uint32_t seed;          /* For chunk priorities */
+} BlockIndex;
+
+BlockIndex *blocks_create(void);
+void blocks_destroy(BlockIndex *idx);
+
+/* Full rescan (file load, language change) */
+void blocks_rebuild(BlockIndex *idx, Buffer *buf, Language lang);
+
+/* Incremental update after the buffer changed at pos: `removed` bytes
+ * were deleted and `inserted` bytes now follow pos */
+void blocks_edit(BlockIndex *idx, Buffer *buf, size_t pos,
+                 size_t removed, size_t inserted);
+
+/* Line index queries (0-based lines) */
+size_t blocks_line_count(BlockIndex *idx);
+size_t blocks_line_of(BlockIndex *idx, size_t pos);
+size_t blocks_line_start(BlockIndex *idx, size_t line);
+
+/* Find the first opener/closer at or after (line, col) on that line and
+ * return the position of its partner. Returns -1 if none or unmatched. */
+int blocks_find_match(BlockIndex *idx, size_t line, size_t col,
+                      size_t *match_line, size_t *match_col);
+
+/* Last line of the outermost block opened on line and closed on a later
+ * one, or line itself if there is none */
+size_t blocks_block_end(BlockIndex *idx, size_t line);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEDIT_BLOCKS_H */
@@ -25,6 +25,11 @@ void buffer_insert(Buffer *buf, size_t pos, const char *text, size_t len);
 void buffer_delete(Buffer *buf, size_t pos, size_t len);
 size_t buffer_get_text(Buffer *buf, char *out, size_t max);
 char buffer_char_at(Buffer *buf, size_t pos);
+size_t buffer_copy_range(Buffer *buf, size_t pos, size_t len, char *out);
+
+/* First occurrence of text at or after pos, searched in place on both
+ * sides of the gap. Returns -1 if there is none. */
+int buffer_find(Buffer *buf, size_t pos, const char *text, size_t len, size_t *at);
 
 void buffer_clear(Buffer *buf);
 
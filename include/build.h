@@ -1,9 +1,19 @@
 /*
  * build.h - Build system integration
+ *
+ * Builds run as child processes that the UI polls: build_process_start
+ * forks /bin/sh -c <cmd> with stdout and stderr on non-blocking pipes,
+ * and each build_process_poll call reads what has arrived and hands
+ * complete lines to a callback, so a render loop can keep drawing while
+ * a long compile runs. BuildOutput collects those lines for an output
+ * pane.
  */
 #ifndef TEDIT_BUILD_H
 #define TEDIT_BUILD_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -13,14 +23,149 @@ typedef struct BuildConfig {
     char run_cmd[512];
     char clean_cmd[512];
     char assemble_cmd[512];
+    size_t capture_limit;           /* Bytes of output kept by captures (tail) */
 } BuildConfig;
 
 void build_config_defaults(BuildConfig *cfg);
 int build_config_load(BuildConfig *cfg, const char *path);
 
+/* Default capture_limit (capture_limit_kb in build.ini) */
+#define BUILD_CAPTURE_LIMIT (4 * 1024 * 1024)
+
+/* Captured output. Grows as needed up to limit; past that it becomes a
+ * ring holding the last `limit` bytes, so the child is always drained
+ * and the end of a long log (where the errors are) survives. */
+typedef struct BuildCapture {
+    char *data;
+    size_t len;                     /* Bytes held */
+    size_t cap;                     /* Allocated, excluding the NUL */
+    size_t head;                    /* Ring start once full */
+    size_t limit;                   /* 0 = unlimited */
+    uint64_t total;                 /* Bytes produced by the command */
+} BuildCapture;
+
+void build_capture_init(BuildCapture *c, size_t limit);
+void build_capture_free(BuildCapture *c);
+int build_capture_append(BuildCapture *c, const char *data, size_t len);
+
+/* Contiguous NUL-terminated contents (oldest byte first) */
+const char *build_capture_text(BuildCapture *c);
+
+/* Whether the head of the output was dropped */
+int build_capture_truncated(const BuildCapture *c);
+
+/* Build result cache (created in the project root) */
+#define BUILD_CACHE_FILE ".tedit-buildcache"
+
+/* The last successful build of each output file */
+typedef struct BuildCacheEntry {
+    uint64_t key;                   /* build_cache_key of that build */
+    uint64_t out_hash;              /* XXH64 of the output it produced */
+    char out_path[260];
+} BuildCacheEntry;
+
+typedef struct BuildCache {
+    BuildCacheEntry *entries;
+    size_t count;
+    size_t capacity;
+    char path[260];                 /* Cache file, read on first use */
+    int loaded;
+    size_t hits;                    /* Lookups this session */
+    size_t misses;
+} BuildCache;
+
+void build_cache_init(BuildCache *c, const char *path);
+void build_cache_free(BuildCache *c);
+
+/* Key for building input with the expanded command: XXH64 over the
+ * input's contents, the command text and the identity (resolved path,
+ * size, mtime) of the tool it starts. Returns -1 if input is unreadable. */
+int build_cache_key(const char *cmd, const char *input, uint64_t *key);
+
+/* 1 (a hit) if the last build of out_path had this key and out_path still
+ * holds what it produced; 0 otherwise. Updates the hit/miss counters. */
+int build_cache_lookup(BuildCache *c, uint64_t key, const char *out_path);
+
+/* Record a successful build of out_path and save the cache file */
+int build_cache_store(BuildCache *c, uint64_t key, const char *out_path);
+
+/* One output line, without its newline. is_stderr tells the streams apart. */
+typedef void (*BuildLineFn)(void *ctx, const char *line, size_t len, int is_stderr);
+
 int build_run_command(const char *cmd);
+
+/* build_run_command that also hands each output line to on_line */
+int build_run_command_lines(const char *cmd, BuildLineFn on_line, void *ctx);
+
+/* Run cmd to completion with stdout and stderr appended to c as they
+ * arrive. Returns the exit code, or -1 if it could not be started. */
+int build_run_capture(const char *cmd, BuildCapture *c);
+
+/* Fixed-buffer form: output receives the last max - 1 bytes */
 int build_run_command_capture(const char *cmd, char *output, size_t max);
 
+/* Lines longer than this that span reads are delivered in pieces */
+#define BUILD_LINE_MAX 4096
+
+/* Seconds between SIGTERM and SIGKILL when a build is cancelled */
+#define BUILD_CANCEL_GRACE 2.0
+
+typedef struct BuildProcess {
+    int pid;
+    int fds[2];                     /* stdout, stderr pipes (-1 once closed) */
+    char partial[2][BUILD_LINE_MAX];    /* Unterminated line per stream */
+    size_t partial_len[2];
+    BuildLineFn on_line;
+    void *ctx;
+    BuildCapture *capture;          /* Raw output sink (build_run_capture) */
+    int running;
+    int cancelled;
+    int exit_code;                  /* Exit status; 128 + signal if killed */
+    double start;
+    double end;
+    double cancel_time;             /* When SIGTERM was sent */
+} BuildProcess;
+
+/* Start cmd in the background. Returns -1 if it could not be started. */
+int build_process_start(BuildProcess *p, const char *cmd, BuildLineFn on_line, void *ctx);
+
+/* Start cmd in the background with its raw stdout and stderr appended to
+ * capture as they arrive (no line callback) */
+int build_process_start_capture(BuildProcess *p, const char *cmd, BuildCapture *capture);
+
+/* Deliver pending output, waiting up to timeout_ms for some (0 = just
+ * check), and reap the child once it exits. Returns 1 while running. */
+int build_process_poll(BuildProcess *p, int timeout_ms);
+
+/* Poll until the process exits; returns its exit code */
+int build_process_wait(BuildProcess *p);
+
+/* Terminate the build (its whole process group); poll to reap it */
+void build_process_cancel(BuildProcess *p);
+
+/* Seconds since start, or the total once finished */
+double build_process_elapsed(const BuildProcess *p);
+
+/* Lines of build output for display */
+typedef struct BuildOutput {
+    char *text;                     /* NUL-terminated lines, back to back */
+    size_t text_len;
+    size_t text_cap;
+    size_t *lines;                  /* Offset of each line in text */
+    unsigned char *is_stderr;
+    size_t line_count;
+    size_t line_cap;
+} BuildOutput;
+
+void build_output_init(BuildOutput *out);
+void build_output_free(BuildOutput *out);
+void build_output_clear(BuildOutput *out);
+int build_output_append(BuildOutput *out, const char *line, size_t len, int is_stderr);
+const char *build_output_line(const BuildOutput *out, size_t index);
+
+/* BuildLineFn that appends to the BuildOutput passed as ctx */
+void build_output_collect(void *ctx, const char *line, size_t len, int is_stderr);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,97 @@
+/*
+ * buildall.h - Build many files at once
+ *
+ * A BuildBatch expands build_cmd (or assemble_cmd for assembly sources)
+ * for each file and keeps up to one process per CPU running. Each job's
+ * stdout and stderr go to its own BuildCapture, so output from parallel
+ * jobs never interleaves; when a job finishes its output is handed on as
+ * one block, in completion order, for display and diagnostic parsing.
+ * Like a single build the batch is polled, so the GUI keeps drawing.
+ */
+#ifndef TEDIT_BUILDALL_H
+#define TEDIT_BUILDALL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "build.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum BuildJobState {
+    BUILD_JOB_PENDING,
+    BUILD_JOB_RUNNING,
+    BUILD_JOB_DONE,                 /* Ran; see exit_code */
+    BUILD_JOB_CACHED,               /* Output already up to date */
+    BUILD_JOB_FAILED                /* Could not be started */
+} BuildJobState;
+
+typedef struct BuildJob {
+    char input[260];
+    char cmd[1024];
+    char out[260];                  /* {out}, empty if the command has none */
+    BuildJobState state;
+    int exit_code;
+    double seconds;
+    size_t errors;                  /* Diagnostics found in its output */
+    size_t warnings;
+    int cacheable;
+    uint64_t key;                   /* build_cache_key when cacheable */
+    BuildCapture capture;
+    BuildProcess proc;
+} BuildJob;
+
+typedef struct BuildBatch {
+    BuildJob *jobs;
+    size_t count;
+    size_t capacity;
+    int workers;                    /* Processes run at once */
+    size_t next;                    /* First job not started yet */
+    size_t running;
+    size_t finished;
+    int cancelled;
+    double start;
+    double end;
+    BuildCache *cache;              /* Optional: skip up-to-date jobs */
+    BuildLineFn on_line;            /* Receives each finished job's output */
+    void *ctx;
+} BuildBatch;
+
+/* workers 0 = one per CPU. cache may be NULL. */
+void build_batch_init(BuildBatch *b, int workers, BuildCache *cache,
+                      BuildLineFn on_line, void *ctx);
+void build_batch_free(BuildBatch *b);
+
+/* Queue a build of input with cfg's command for its type. Returns -1 if
+ * there is no command for it or out of memory. */
+int build_batch_add(BuildBatch *b, const BuildConfig *cfg, const char *input,
+                    const char *exe_dir);
+
+/* Queue every file matching a shell wildcard pattern. Returns the number
+ * added. */
+size_t build_batch_add_glob(BuildBatch *b, const BuildConfig *cfg, const char *pattern,
+                            const char *exe_dir);
+
+/* Start queued jobs while workers are free, collect output and finish
+ * jobs that exited, waiting up to timeout_ms for activity. Returns 1 while
+ * jobs are pending or running. */
+int build_batch_poll(BuildBatch *b, int timeout_ms);
+
+/* Poll until every job has finished. Returns the number that failed. */
+size_t build_batch_run(BuildBatch *b);
+
+/* Stop starting jobs and terminate the running ones */
+void build_batch_cancel(BuildBatch *b);
+
+/* Jobs that failed to start or exited non-zero */
+size_t build_batch_failed(const BuildBatch *b);
+
+/* Timing table: one line per job and a totals line, sent to emit */
+void build_batch_summary(const BuildBatch *b, BuildLineFn emit, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEDIT_BUILDALL_H */
@@ -0,0 +1,99 @@
+/*
+ * dedup.h - Content-addressed, deduplicating backup repository
+ *
+ * Files are cut into variable-size chunks by a FastCDC chunker (Gear
+ * rolling hash), so an edit only changes the chunks around it. Each
+ * chunk is stored once, keyed by its SHA-256, in append-only pack files;
+ * a backup is just a snapshot listing files and their chunk hashes.
+ *
+ * Repository layout:
+ *
+ *   <repo>/config                          format version
+ *   <repo>/index                           <sha256> <pack> <offset> <length>
+ *   <repo>/packs/pack-000000.pack          raw chunk data
+ *   <repo>/snapshots/<project>-<time>.snap
+ *
+ * Pack data is written before the index lines that refer to it, and a
+ * snapshot last, so an interrupted backup never leaves a snapshot that
+ * points at missing chunks.
+ */
+#ifndef TEDIT_DEDUP_H
+#define TEDIT_DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "backup.h"
+#include "hash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEDUP_CHUNK_MIN  (2 * 1024)
+#define DEDUP_CHUNK_AVG  (8 * 1024)
+#define DEDUP_CHUNK_MAX  (64 * 1024)
+#define DEDUP_PACK_MAX   (64 * 1024 * 1024)
+
+/* One stored chunk */
+typedef struct DedupChunk {
+    uint8_t hash[HASH_SHA256_SIZE];
+    uint32_t pack;
+    uint32_t length;
+    uint64_t offset;
+} DedupChunk;
+
+typedef struct DedupRepo {
+    char path[BACKUP_MAX_PATH];
+    DedupChunk *chunks;             /* Index entries in the order stored */
+    size_t count;
+    size_t capacity;
+    uint32_t *table;                /* Open addressing: chunk index + 1, 0 = empty */
+    size_t table_size;              /* Power of two */
+    uint32_t pack;                  /* Pack receiving new chunks */
+    uint64_t pack_size;
+} DedupRepo;
+
+/* Snapshot summary for listings */
+typedef struct DedupSnapshotInfo {
+    char name[BACKUP_MAX_PATH];     /* File name without .snap */
+    char project[BACKUP_MAX_PATH];
+    int64_t time;
+    size_t files;
+    uint64_t bytes;
+} DedupSnapshotInfo;
+
+/* Length of the next chunk of data[0, len) */
+size_t dedup_chunk_length(const unsigned char *data, size_t len);
+
+/* Open a repository and load its index. With create set, a missing
+ * repository is initialized. Returns -1 if it cannot be opened. */
+int dedup_open(DedupRepo *repo, const char *path, int create);
+void dedup_close(DedupRepo *repo);
+const DedupChunk *dedup_find(const DedupRepo *repo, const uint8_t *hash);
+
+/* Store the entries of ar as a new snapshot of project_name. Files whose
+ * size and mtime match the project's previous snapshot are not read.
+ * Chunking and hashing run on up to `threads` workers (0 = one per CPU).
+ * The snapshot name is copied to snapshot (may be NULL). */
+int dedup_backup(DedupRepo *repo, Archive *ar, const char *project_name,
+                 int threads, char *snapshot, size_t snapshot_size,
+                 BackupRepoStats *stats);
+
+/* Snapshots sorted by name (project, then time). Free with free(). */
+int dedup_list(const DedupRepo *repo, DedupSnapshotInfo **out, size_t *count);
+
+/* Recreate a snapshot's project files (entries under files/, which is
+ * dropped) under dest_dir, checking every chunk's hash. Other entries
+ * are skipped and counted in stats->outside. Returns -1 if the snapshot cannot be read or any file failed. */
+int dedup_restore(DedupRepo *repo, const char *snapshot, const char *dest_dir,
+                  int threads, BackupRepoStats *stats);
+
+/* Re-hash every stored chunk and check that every snapshot only refers
+ * to chunks in the index. Returns 0 when stats->errors is zero. */
+int dedup_verify(DedupRepo *repo, int threads, BackupRepoStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEDIT_DEDUP_H */
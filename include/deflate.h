@@ -0,0 +1,124 @@
+/*
+ * deflate.h - Built-in deflate compressor, gzip stream writer and reader
+ *
+ * The gzip writer works like pigz: input is cut into fixed 128 KB blocks
+ * that are compressed independently (each primed with the 32 KB before
+ * it as a dictionary) on the worker pool and ended with a sync flush, so
+ * the compressed pieces concatenate into one valid deflate stream. The
+ * output does not depend on the thread count.
+ *
+ * The reader inflates any gzip stream (including concatenated members)
+ * incrementally and checks each member's CRC-32 and length.
+ */
+#ifndef TEDIT_DEFLATE_H
+#define TEDIT_DEFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEFLATE_WINDOW      32768
+#define DEFLATE_BLOCK_SIZE  (128 * 1024)
+#define DEFLATE_DEFAULT_LEVEL 6
+
+typedef struct DeflateBuf {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} DeflateBuf;
+
+/* Compress data[dict_len, dict_len + len) as raw deflate, using the
+ * dict_len bytes before it (at most DEFLATE_WINDOW are used) as history.
+ * Level 0 stores, 1-9 trade speed for ratio. A final chunk ends with a
+ * BFINAL block; otherwise output ends with a byte-aligned sync flush.
+ * Output is appended to out. Returns -1 on allocation failure. */
+int deflate_chunk(const unsigned char *data, size_t dict_len, size_t len,
+                  int level, int final, DeflateBuf *out);
+void deflate_buf_free(DeflateBuf *buf);
+
+/* CRC-32 (gzip polynomial) */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+/* Receives compressed output; returns -1 to report a failed write */
+typedef int (*GzipWriteFn)(void *ctx, const void *data, size_t len);
+
+/* Streaming gzip writer */
+typedef struct GzipWriter {
+    GzipWriteFn write;
+    void *ctx;
+    int level;
+    int threads;
+    size_t batch_blocks;        /* Blocks compressed per parallel batch */
+    unsigned char *buf;         /* Dictionary followed by pending input */
+    size_t dict_len;
+    size_t len;                 /* Dictionary + pending bytes */
+    size_t cap;
+    uint32_t crc;
+    uint64_t total_in;
+    uint64_t total_out;
+    int error;
+} GzipWriter;
+
+/* Threads 0 = one per CPU. The header is written immediately. */
+GzipWriter *gzip_writer_create(GzipWriteFn write, void *ctx, int level, int threads);
+int gzip_writer_write(GzipWriter *gz, const void *data, size_t len);
+
+/* Flush the remaining input, write the trailer and free the writer.
+ * Returns -1 if any write failed. */
+int gzip_writer_finish(GzipWriter *gz);
+
+/* Supplies compressed input: bytes read, 0 at end of input, -1 on error */
+typedef int (*GzipReadFn)(void *ctx, void *buf, size_t len);
+
+#define INFLATE_FAST_BITS 10
+
+/* Canonical Huffman decoding table: one lookup for codes up to
+ * INFLATE_FAST_BITS long, a bit-by-bit walk for the rest */
+typedef struct InflateTable {
+    uint16_t fast[1 << INFLATE_FAST_BITS];  /* (symbol << 4) | length, 0 = slow */
+    uint16_t count[16];                     /* Codes of each length */
+    uint16_t symbol[288];                   /* Symbols in canonical order */
+} InflateTable;
+
+/* Streaming gzip reader */
+typedef struct GzipReader {
+    GzipReadFn read;
+    void *ctx;
+    unsigned char in[65536];
+    size_t in_pos;
+    size_t in_len;
+    uint64_t bits;              /* Input bits not yet consumed, LSB first */
+    int bit_count;
+    int state;
+    int final;                  /* Current block is the member's last */
+    size_t stored_left;         /* Bytes left in a stored block */
+    int match_len;              /* Pending copy of an interrupted match */
+    int match_dist;
+    InflateTable lit;
+    InflateTable dist;
+    unsigned char window[DEFLATE_WINDOW];
+    uint64_t member_out;        /* Bytes produced by the current member */
+    uint32_t crc;
+    int members;
+    uint64_t total_in;
+    uint64_t total_out;
+    int error;
+} GzipReader;
+
+GzipReader *gzip_reader_create(GzipReadFn read, void *ctx);
+
+/* Inflate up to len bytes into out. Returns the bytes produced (less
+ * than len only at the end of the stream), or -1 on corrupt or truncated
+ * input, including a CRC or length mismatch. */
+long gzip_reader_read(GzipReader *gz, void *out, size_t len);
+void gzip_reader_free(GzipReader *gz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEDIT_DEFLATE_H */
@@ -0,0 +1,85 @@
+/*
+ * diag.h - Compiler diagnostics from build output
+ *
+ * Build output is fed to diag_parse_line one line at a time as it
+ * arrives, so diagnostics appear while a long build is still running and
+ * no line is ever scanned twice. Two formats are recognised:
+ *
+ *   file:line:col: error: message      (gcc, clang, cosmocc)
+ *   file(line) : error A2008: message  (ml64, MASM)
+ *
+ * Diagnostics keep their output order for next/previous navigation; a
+ * second index, kept sorted by file and line as they arrive, answers
+ * gutter queries with a binary search.
+ */
+#ifndef TEDIT_DIAG_H
+#define TEDIT_DIAG_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIAG_PATH_MAX    260
+#define DIAG_MESSAGE_MAX 256
+
+/* Ordered by importance: a line with several shows the first */
+typedef enum DiagSeverity {
+    DIAG_ERROR,
+    DIAG_WARNING,
+    DIAG_NOTE
+} DiagSeverity;
+
+typedef struct Diagnostic {
+    unsigned file;                  /* Index into DiagList.files */
+    unsigned line;                  /* 1-based */
+    unsigned col;                   /* 1-based, 0 when not given */
+    DiagSeverity severity;
+    size_t output_line;             /* Line of the build output it came from */
+    char message[DIAG_MESSAGE_MAX];
+} Diagnostic;
+
+typedef struct DiagList {
+    Diagnostic *items;              /* In output order */
+    size_t count;
+    size_t capacity;
+    char (*files)[DIAG_PATH_MAX];   /* Distinct file names, as printed */
+    size_t file_count;
+    size_t file_capacity;
+    size_t *by_position;            /* items sorted by file, line, severity */
+    size_t errors;
+    size_t warnings;
+    size_t current;                 /* Navigation position (count = none) */
+} DiagList;
+
+void diag_init(DiagList *list);
+void diag_free(DiagList *list);
+void diag_clear(DiagList *list);
+
+/* Parse one output line (without its newline). Returns 1 if it was a
+ * diagnostic, 0 if not, -1 if out of memory. */
+int diag_parse_line(DiagList *list, const char *line, size_t len, size_t output_line);
+
+const char *diag_file(const DiagList *list, const Diagnostic *d);
+
+/* File index for an editor path (see path_same_file), -1 if none */
+int diag_find_file(const DiagList *list, const char *path);
+
+/* Most important diagnostic on a line of a file, or NULL */
+const Diagnostic *diag_at(const DiagList *list, int file, unsigned line);
+
+/* Step to the next (direction > 0) or previous error or warning in
+ * output order, wrapping around. NULL when there are none. */
+const Diagnostic *diag_step(DiagList *list, int direction);
+
+/* Diagnostic parsed from a given output line, or NULL */
+const Diagnostic *diag_for_output_line(const DiagList *list, size_t output_line);
+
+const char *diag_severity_name(DiagSeverity severity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEDIT_DIAG_H */
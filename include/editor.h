@@ -8,6 +8,8 @@
 #include "buffer.h"
 #include "syntax.h"
 #include "history.h"
+#include "blocks.h"
+#include "fold.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,6 +18,8 @@ extern "C" {
 typedef struct EditorState {
     Buffer *buffer;
     History *history;           /* Write-through operation history */
+    BlockIndex *blocks;         /* Line starts and bracket/block pairs */
+    FoldMap *folds;             /* Folded regions and visible line map */
     char file_path[260];
     size_t cursor_line;
     size_t cursor_col;
@@ -25,6 +29,11 @@ typedef struct EditorState {
     int dirty;
     int readonly;
     int history_enabled;        /* Enable/disable history tracking */
+    int batch_depth;            /* Open editor_begin_batch calls */
+    int pending;                /* Batched edits not yet in blocks/folds: */
+    size_t pending_pos;         /* old [pos, pos + removed) is now */
+    size_t pending_removed;     /* [pos, pos + inserted) */
+    size_t pending_inserted;
 } EditorState;
 
 EditorState *editor_create(void);
@@ -43,14 +52,40 @@ void editor_delete(EditorState *ed, size_t pos, size_t len);
 void editor_undo(EditorState *ed);
 void editor_redo(EditorState *ed);
 
+/* Edits until the matching editor_end_batch are one undo step, flushed
+ * to the history once. The block index and folds are brought up to date
+ * with all the edits made since the last line lookup in one go, so edits
+ * by offset alone cost no more than the buffer change. */
+void editor_begin_batch(EditorState *ed);
+void editor_end_batch(EditorState *ed);
+
+/* First occurrence of text at or after byte offset pos. Returns -1 if
+ * there is none. */
+int editor_find(EditorState *ed, size_t pos, const char *text, size_t len, size_t *at);
+
 /* Selection */
 void editor_select_all(EditorState *ed);
 char *editor_get_selection(EditorState *ed, size_t *len);
 
 /* Cursor */
 void editor_goto_line(EditorState *ed, size_t line);
+void editor_goto(EditorState *ed, size_t line, size_t col);   /* 1-based, clamped */
 void editor_get_cursor_pos(EditorState *ed, size_t *line, size_t *col);
 
+/* Byte offset of a 1-based line and column (clamped), and the reverse */
+size_t editor_offset(EditorState *ed, size_t line, size_t col);
+void editor_goto_offset(EditorState *ed, size_t pos);
+
+/* Bracket/block matching (1-based line and column). Returns -1 if there
+ * is no opener or closer at or after col on that line, or it is unmatched. */
+int editor_find_match(EditorState *ed, size_t line, size_t col,
+                      size_t *match_line, size_t *match_col);
+
+/* Folding (1-based lines). editor_fold folds the region starting at line;
+ * editor_unfold with line 0 unfolds everything. */
+int editor_fold(EditorState *ed, size_t line);
+int editor_unfold(EditorState *ed, size_t line);
+
 /* File operations */
 int editor_load_file(EditorState *ed, const char *path);
 int editor_save_file(EditorState *ed, const char *path);
@@ -0,0 +1,80 @@
+/*
+ * fold.h - Code folding and visible/buffer line mapping
+ *
+ * Hidden lines are tracked as runs of lines with the same cover count
+ * (the number of folds hiding them) in a balanced tree that keeps the
+ * minimum count and the lines at it per subtree. The folds themselves
+ * are a second tree ordered by start line, whose subtrees can be moved
+ * down or up as a whole. Folding, unfolding, mapping between visible
+ * rows and buffer lines, and inserting or deleting lines on an edit are
+ * all O(log n) in the number of folds, plus O(log n) for each fold the
+ * edit drops.
+ */
+#ifndef TEDIT_FOLD_H
+#define TEDIT_FOLD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "buffer.h"
+#include "blocks.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A foldable region: start stays visible, start+1..end are hidden
+ * (0-based buffer lines) */
+typedef struct FoldRange {
+    size_t start;
+    size_t end;
+} FoldRange;
+
+typedef struct FoldRun FoldRun;
+typedef struct FoldNode FoldNode;
+
+typedef struct FoldMap {
+    size_t line_count;
+    FoldRun *root;          /* Runs of lines with equal cover count */
+    FoldRun *spare;         /* Preallocated runs for the next change */
+    int spare_count;
+    uint32_t seed;          /* For run priorities */
+    FoldNode *folds;        /* Folded regions, ordered by start */
+    size_t fold_count;
+} FoldMap;
+
+FoldMap *fold_create(void);
+void fold_destroy(FoldMap *fm);
+
+/* Drop all folds and size the map for line_count lines */
+int fold_reset(FoldMap *fm, size_t line_count);
+
+/* Find the foldable region starting at line: a bracket/proc/macro/if
+ * block opened on that line and closed on a later one, or a run of
+ * comment lines. Returns -1 if the line starts no region. */
+int fold_find_region(BlockIndex *blocks, Buffer *buf, size_t line,
+                     FoldRange *out);
+
+/* Fold or unfold a region (fold_add fails if it is already folded) */
+int fold_add(FoldMap *fm, size_t start, size_t end);
+int fold_remove(FoldMap *fm, size_t start);
+const FoldRange *fold_get(FoldMap *fm, size_t start);
+
+/* First fold starting at or after line, or NULL. Folds are listed with
+ * for (r = fold_next(fm, 0); r; r = fold_next(fm, r->start + 1)). */
+const FoldRange *fold_next(FoldMap *fm, size_t line);
+
+/* Line mapping */
+size_t fold_visible_count(FoldMap *fm);
+size_t fold_visible_to_line(FoldMap *fm, size_t row);
+size_t fold_line_to_visible(FoldMap *fm, size_t line);
+int fold_line_hidden(FoldMap *fm, size_t line);
+
+/* Adjust after an edit replaced old_lines lines at first with new_lines
+ * lines. Folds touching the edited lines are dropped. */
+void fold_edit(FoldMap *fm, size_t first, size_t old_lines, size_t new_lines);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEDIT_FOLD_H */
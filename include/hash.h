@@ -0,0 +1,49 @@
+/*
+ * hash.h - Content hashing: fast XXH64 for change detection and SHA-256
+ * for content addressing
+ */
+#ifndef TEDIT_HASH_H
+#define TEDIT_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* XXH64 of a memory block; output matches the reference xxHash */
+uint64_t hash_xxh64(const void *data, size_t len, uint64_t seed);
+
+/* Incremental XXH64; the digest equals hash_xxh64 over all the input */
+typedef struct HashXxh64 {
+    uint64_t v[4];
+    uint64_t total;
+    uint64_t seed;
+    uint8_t mem[32];                /* Input not yet forming a full stripe */
+    size_t mem_len;
+} HashXxh64;
+
+void hash_xxh64_init(HashXxh64 *st, uint64_t seed);
+void hash_xxh64_update(HashXxh64 *st, const void *data, size_t len);
+uint64_t hash_xxh64_final(const HashXxh64 *st);
+
+/* XXH64 of a file's contents (seed 0). Returns -1 if it cannot be read. */
+int hash_file(const char *path, uint64_t *out);
+
+#define HASH_SHA256_SIZE 32
+
+/* SHA-256 (FIPS 180-4) of a memory block */
+void hash_sha256(const void *data, size_t len, uint8_t out[HASH_SHA256_SIZE]);
+
+/* Lowercase hex of a digest; out holds 2 * len + 1 bytes */
+void hash_to_hex(const uint8_t *digest, size_t len, char *out);
+
+/* Parse 2 * len hex digits. Returns -1 on a malformed string. */
+int hash_from_hex(const char *hex, uint8_t *digest, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEDIT_HASH_H */
@@ -0,0 +1,57 @@
+/*
+ * highlight.h - Headless syntax highlight export
+ *
+ * Renders source files through syntax_tokenize_line into HTML or ANSI
+ * text. Files are independent work items spread across all cores.
+ */
+#ifndef TEDIT_HIGHLIGHT_H
+#define TEDIT_HIGHLIGHT_H
+
+#include <stddef.h>
+#include "syntax.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum HighlightFormat {
+    HIGHLIGHT_HTML,
+    HIGHLIGHT_ANSI
+} HighlightFormat;
+
+/* Growable output buffer */
+typedef struct HighlightBuf {
+    char *data;
+    size_t len;
+    size_t capacity;
+} HighlightBuf;
+
+/* Throughput summary for a batch */
+typedef struct HighlightStats {
+    size_t files;
+    size_t failed;
+    size_t lines;
+    size_t bytes_in;
+    size_t bytes_out;
+    int threads;
+    double seconds;
+} HighlightStats;
+
+int highlight_parse_format(const char *name, HighlightFormat *fmt);
+const char *highlight_extension(HighlightFormat fmt);
+
+/* Render one document into buf (appends); returns lines rendered */
+size_t highlight_render(HighlightFormat fmt, Language lang, const char *name,
+                        const char *text, size_t len, HighlightBuf *buf);
+void highlight_buf_free(HighlightBuf *buf);
+
+/* Highlight each file to <file>.<ext> on up to `threads` workers
+ * (0 = one per CPU). Returns the number of files that failed. */
+size_t highlight_export_files(HighlightFormat fmt, char **files, size_t count,
+                              int threads, HighlightStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEDIT_HIGHLIGHT_H */
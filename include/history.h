@@ -25,6 +25,9 @@ typedef enum {
     OP_DELETE = 2
 } OpType;
 
+/* Set in an op's type byte on disk: undone and redone with the op before */
+#define OP_GROUPED 0x80
+
 /* Single edit operation */
 typedef struct EditOp {
     OpType type;
@@ -32,6 +35,7 @@ typedef struct EditOp {
     uint32_t length;        /* Length of data */
     uint64_t timestamp;     /* Unix timestamp (ms) */
     char *data;             /* Content (for INSERT: new text, DELETE: removed text) */
+    int grouped;            /* Same undo step as the previous op */
     struct EditOp *next;    /* Linked list for in-memory ops */
     struct EditOp *prev;
 } EditOp;
@@ -61,6 +65,8 @@ typedef struct History {
     size_t file_size;           /* History file size in bytes */
     
     int dirty;                  /* Has unsaved ops in memory */
+    int group_depth;            /* Open history_begin_group calls */
+    size_t group_ops;           /* Ops appended to the open group */
 } History;
 
 /* Create/Open/Close */
@@ -71,6 +77,12 @@ void history_close(History *h);
 int history_append(History *h, OpType type, size_t pos, 
                    const char *data, size_t len);
 
+/* Group the ops appended until the matching history_end_group into one
+ * undo step. Grouped ops are still written as they happen but flushed
+ * once, when the outermost group ends. */
+void history_begin_group(History *h);
+void history_end_group(History *h);
+
 /* Undo/Redo - returns the operation to apply (caller must apply to buffer) */
 EditOp *history_undo(History *h);
 EditOp *history_redo(History *h);
@@ -0,0 +1,66 @@
+/*
+ * manifest.h - Backup manifest for incremental backups
+ *
+ * The manifest records the path, size, mtime and XXH64 of every file in
+ * the last backup of a project. Diffing trusts size and mtime: files that
+ * match are never read, and only files whose metadata changed are hashed.
+ */
+#ifndef TEDIT_MANIFEST_H
+#define TEDIT_MANIFEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "backup.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ManifestRecord {
+    char *path;                     /* Archive path */
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;                  /* XXH64 of the contents */
+} ManifestRecord;
+
+typedef struct Manifest {
+    ManifestRecord *records;        /* Sorted by path */
+    size_t count;
+    size_t capacity;
+    char base[BACKUP_MAX_PATH];     /* Full backup the chain starts from */
+    char parent[BACKUP_MAX_PATH];   /* Most recent archive in the chain */
+    int sequence;                   /* Incremental backups since the base */
+} Manifest;
+
+/* Per-entry result of manifest_scan */
+typedef enum ManifestChange {
+    MANIFEST_UNCHANGED = 0,
+    MANIFEST_ADDED,
+    MANIFEST_MODIFIED,
+    MANIFEST_UNREADABLE
+} ManifestChange;
+
+void manifest_init(Manifest *m);
+void manifest_free(Manifest *m);
+int manifest_load(Manifest *m, const char *path);
+int manifest_save(const Manifest *m, const char *path);
+const ManifestRecord *manifest_find(const Manifest *m, const char *path);
+
+/* Compare the entries of ar against old (which may be empty) on up to
+ * `threads` workers (0 = one per CPU). Fills out with the new manifest,
+ * changes[i] for every entry and the paths in old that no longer exist
+ * (deleted, an array of borrowed strings the caller frees). */
+int manifest_scan(const Manifest *old, Archive *ar, int threads,
+                  Manifest *out, unsigned char *changes,
+                  const char ***deleted, BackupDiffStats *diff);
+
+/* Manifest path for a project: <ini dir>/.<project>.manifest (a dotfile,
+ * so the directory walker never archives it) */
+void manifest_get_path(const char *ini_path, const char *project_name,
+                       char *out, size_t out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEDIT_MANIFEST_H */
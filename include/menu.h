@@ -1,5 +1,14 @@
 /*
  * menu.h - INI-based menu system
+ *
+ * menu_load_ini reads menuini.txt into a tree: a top-level Menu for each
+ * [section], and a submenu for each line without a command, holding the
+ * lines indented under it. Strings and submenus live in the set's arena
+ * and item arrays grow as needed, so menus, items and commands have no
+ * fixed limits; only submenu nesting is capped, at 16 levels. Once
+ * loaded, an item is found by id or by accelerator key with one table
+ * lookup. Accelerators are dispatched by the CLI "key" command; the GUI
+ * menu bar is built in the platform layer and does not read this file.
  */
 #ifndef TEDIT_MENU_H
 #define TEDIT_MENU_H
@@ -10,32 +19,71 @@
 extern "C" {
 #endif
 
-#define MAX_MENU_ITEMS 64
-#define MAX_MENUS 16
+/* Accelerator key codes: a key with modifier bits. Printable keys are
+ * their upper-case ASCII code; Tab, Enter, Esc, Space, Backspace and
+ * Delete their control codes. */
+#define MENU_MOD_CTRL       0x10000
+#define MENU_MOD_SHIFT      0x20000
+#define MENU_MOD_ALT        0x40000
+#define MENU_KEY_F1         0x100       /* F1 to F24 follow on */
+#define MENU_KEY_INSERT     0x120
+#define MENU_KEY_HOME       0x121
+#define MENU_KEY_END        0x122
+#define MENU_KEY_PAGEUP     0x123
+#define MENU_KEY_PAGEDOWN   0x124
+#define MENU_KEY_UP         0x125
+#define MENU_KEY_DOWN       0x126
+#define MENU_KEY_LEFT       0x127
+#define MENU_KEY_RIGHT      0x128
+
+typedef struct Menu Menu;
 
 typedef struct MenuItem {
-    char label[128];
-    char command[512];
-    char accelerator[32];
+    const char *label;              /* Without the accelerator */
+    const char *command;            /* "" for separators and submenus */
+    const char *accelerator;        /* As written after a tab, or "" */
+    int accel_key;                  /* menu_parse_accel of it; 0 = none */
     int is_separator;
-    int id;
+    int id;                         /* 0 for separators and submenus */
+    Menu *submenu;                  /* Items indented under this one */
 } MenuItem;
 
-typedef struct Menu {
-    char name[64];
-    MenuItem items[MAX_MENU_ITEMS];
+struct Menu {
+    const char *name;
+    MenuItem *items;
     size_t item_count;
-} Menu;
+    size_t item_capacity;
+};
+
+typedef struct MenuArenaBlock MenuArenaBlock;
 
 typedef struct MenuSet {
-    Menu menus[MAX_MENUS];
+    MenuArenaBlock *arena;          /* Names, labels, commands, submenus */
+    Menu *menus;                    /* Top level, one per [section] */
     size_t menu_count;
+    size_t menu_capacity;
+    MenuItem **by_id;               /* Item with id first_id + i */
+    int first_id;
+    size_t id_count;
+    MenuItem **by_accel;            /* Open addressing on accel_key */
+    size_t accel_capacity;          /* Power of two */
 } MenuSet;
 
+/* Replaces what set held; set must be zeroed or loaded before. Returns
+ * -1 if the file cannot be read or nests submenus more than 16 deep. */
 int menu_load_ini(MenuSet *set, const char *path);
 void menu_free(MenuSet *set);
 
 const MenuItem *menu_find_by_id(MenuSet *set, int id);
+
+/* Item whose accelerator is key (as from menu_parse_accel), or NULL. If
+ * several items share a key the first one loaded wins. */
+const MenuItem *menu_find_by_accel(MenuSet *set, int key);
+
+/* "Ctrl+Shift+B", "F7", "Alt+X": the key code with modifier bits, or 0
+ * if it is not understood */
+int menu_parse_accel(const char *text);
+
 void menu_substitute_vars(char *out, size_t max, const char *cmd,
                           const char *filepath, const char *exe_dir);
 
@@ -44,4 +92,3 @@ void menu_substitute_vars(char *out, size_t max, const char *cmd,
 #endif
 
 #endif /* TEDIT_MENU_H */
-
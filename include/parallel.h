@@ -0,0 +1,29 @@
+/*
+ * parallel.h - Minimal worker pool helpers
+ *
+ * Work is expressed as independent items indexed 0..count-1; worker
+ * threads pull the next unclaimed index until all items are done.
+ */
+#ifndef TEDIT_PARALLEL_H
+#define TEDIT_PARALLEL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*ParallelFn)(size_t index, void *ctx);
+
+/* Number of online CPUs (at least 1) */
+int parallel_cpu_count(void);
+
+/* Run fn(i, ctx) for every i in [0, count) on up to `threads` workers
+ * (0 = one per CPU). Returns once all items have completed. */
+int parallel_for(size_t count, int threads, ParallelFn fn, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEDIT_PARALLEL_H */
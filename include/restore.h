@@ -0,0 +1,60 @@
+/*
+ * restore.h - Restore and verify backup archives
+ *
+ * Archives written by archive_finalize end with an index member listing
+ * every record's header offset, size and XXH64, and a one-block locator
+ * member pointing at the index (see backup.h). A plain tar archive is
+ * mapped and the locator read from its tail, so restoring one file only
+ * touches that file's pages, and verification splits the records across
+ * worker threads. Archives without an index (other tools) are walked
+ * header by header. PAX extended headers are folded into the member
+ * they describe. Compressed archives (.tar.gz) are inflated in one
+ * sequential pass and compared against the index at the end.
+ */
+#ifndef TEDIT_RESTORE_H
+#define TEDIT_RESTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Project files live under this prefix in archives and snapshots */
+#define RESTORE_PREFIX "files/"
+
+typedef struct RestoreStats {
+    size_t members;                 /* Records examined */
+    size_t files;                   /* Files restored or verified */
+    size_t skipped;                 /* Restore: files that could not be written */
+    size_t missing;                 /* Restore: requested paths not in the archive */
+    size_t header_errors;           /* Bad checksums or headers not matching the index */
+    size_t hash_errors;             /* Contents not matching the recorded XXH64 */
+    size_t unhashed;                /* Records with no recorded hash */
+    uint64_t bytes;
+    int indexed;                    /* The archive carried an index */
+    int compressed;
+    int threads;
+    double seconds;
+} RestoreStats;
+
+/* Extract the project files of archive (members under files/, which is
+ * dropped) into dest_dir. With paths, only those files and directories
+ * are restored; they are project-relative ("src/main.c", "src"). Unsafe
+ * member paths are never written. Returns -1 if the archive cannot be
+ * read or any file failed, mismatched its hash or was not found. */
+int archive_restore(const char *archive, const char *dest_dir,
+                    const char *const *paths, size_t path_count,
+                    int threads, RestoreStats *stats);
+
+/* Check every header checksum and every recorded content hash on up to
+ * `threads` workers (0 = one per CPU). Returns 0 if the archive is
+ * intact. */
+int archive_verify(const char *archive, int threads, RestoreStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEDIT_RESTORE_H */
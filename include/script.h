@@ -1,46 +1,123 @@
 /*
  * script.h - QSE script engine
+ *
+ * Scripts are compiled once to bytecode for a small stack machine and
+ * then executed. script_run_file keeps each compiled file, keyed by path,
+ * modification time and size, so running a script again (from a menu,
+ * say) skips reading and parsing it.
+ *
+ * A ScriptContext owns all of a run's state: its variables, interned
+ * strings, open file handles and working directory. Contexts share
+ * nothing but the compiled-file cache, which is locked, so scripts can
+ * run on several threads at once, one context each.
+ *
+ * spawn starts a command without waiting for it, up to max_jobs at once.
+ * Each job's output is captured separately and printed as one block when
+ * it exits; wait collects exit statuses. Inside PARALLEL ... ENDPARALLEL
+ * every run is spawned, and the block ends by waiting for them all.
+ *
+ * goto, find, replace, insert, delete and select work on ctx->editor's
+ * buffer in place. A run's edits are one editor batch: a single undo step
+ * whose history is flushed once, when the run ends.
  */
 #ifndef TEDIT_SCRIPT_H
 #define TEDIT_SCRIPT_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "editor.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define SCRIPT_NAME_MAX   64
+#define SCRIPT_MAX_FILES  16
+#define SCRIPT_INTERN_MAX 256       /* Longer string values get their own copy */
+
 /* Script variable types */
 typedef enum ScriptVarType {
     VAR_INTEGER,
     VAR_STRING
 } ScriptVarType;
 
+/* Variables live in the context's arena, so pointers to them stay valid
+ * until script_free */
 typedef struct ScriptVar {
-    char name[64];
+    const char *name;               /* Interned */
+    uint64_t hash;
     ScriptVarType type;
+    int heap;                       /* value.string is malloc'd, not interned */
     union {
         long integer;
-        char *string;
+        const char *string;
     } value;
 } ScriptVar;
 
+typedef struct ScriptArenaBlock ScriptArenaBlock;
+typedef struct ScriptInterned ScriptInterned;
+typedef struct ScriptJob ScriptJob;
+
 typedef struct ScriptContext {
-    ScriptVar vars[128];
+    ScriptArenaBlock *arena;        /* Names, interned strings and variables */
+    ScriptVar **vars;               /* Open addressing on the name's hash */
     size_t var_count;
-    char cwd[260];
-    char *gettext_result;
+    size_t var_capacity;            /* Power of two */
+    ScriptInterned *strings;        /* Intern table */
+    size_t string_count;
+    size_t string_capacity;
+    FILE *files[SCRIPT_MAX_FILES];  /* fcreate handles; 0 is never used */
+    ScriptJob **jobs;               /* spawn: job id is index + 1 */
+    size_t job_count;
+    size_t job_capacity;
+    size_t jobs_running;
+    int max_jobs;                   /* Jobs running at once; 0 = one per CPU */
+    int block_jobs;                 /* Limit inside the open PARALLEL block */
+    size_t block_start;             /* First job of that block */
+    int in_block;
+    EditorState *editor;            /* What goto, find, insert... edit; may be NULL */
+    int editing;                    /* This run has a batch open on editor */
+    size_t cursor;                  /* editor's cursor as an offset meanwhile */
+    char cwd[260];                  /* Relative paths resolve here */
+    const char *gettext_result;     /* Interned */
     int error;
     char error_msg[256];
 } ScriptContext;
 
+/* Compiled script (opaque) */
+typedef struct ScriptProgram ScriptProgram;
+
 /* Script execution */
 int script_init(ScriptContext *ctx);
 void script_free(ScriptContext *ctx);
 
+/* Variable by name, or NULL */
+ScriptVar *script_find_var(ScriptContext *ctx, const char *name);
+
+/* Copy of s in the context's string pool, shared by equal strings and
+ * freed with the context. NULL if out of memory. */
+const char *script_intern(ScriptContext *ctx, const char *s, size_t len);
+
+/* Returns 0 on success, -1 with ctx->error_msg set on a compile or
+ * runtime error. */
 int script_run_file(ScriptContext *ctx, const char *path);
+
+/* Compile and run one line. Returns 1 if it was `end`. */
 int script_run_line(ScriptContext *ctx, const char *line);
 
+/* Compile source to bytecode. On a syntax error returns NULL and writes
+ * "Line N: message" to error. */
+ScriptProgram *script_compile(const char *source, size_t len, char *error, size_t error_max);
+void script_program_free(ScriptProgram *prog);
+
+/* Run a compiled program. Returns 0 when it runs off the end, 1 when it
+ * stops at `end`, -1 on a runtime error. */
+int script_execute(ScriptContext *ctx, const ScriptProgram *prog);
+
+/* Drop every compiled file kept by script_run_file */
+void script_cache_clear(void);
+
 /* Built-in functions */
 int script_fcreate(ScriptContext *ctx, const char *filename);
 int script_fprint(ScriptContext *ctx, int handle, const char *text);
@@ -50,6 +127,15 @@ int script_getfolder(ScriptContext *ctx, const char *prompt, const char *title);
 int script_run_cmd(ScriptContext *ctx, const char *cmd);
 int script_chdir(ScriptContext *ctx, const char *path);
 
+/* Editing ctx->editor at its cursor. Each returns -1 if there is no
+ * editor (or, for changes, it is read-only). */
+int script_goto(ScriptContext *ctx, long line, long col);
+int script_find(ScriptContext *ctx, const char *text);            /* 1, 0 if none */
+long script_replace(ScriptContext *ctx, const char *from, const char *to);  /* Count */
+int script_insert(ScriptContext *ctx, const char *text);
+long script_delete(ScriptContext *ctx, long count);               /* < 0: the selection */
+int script_select(ScriptContext *ctx, long line, long col);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,104 @@
+/*
+ * symindex.h - Project-wide symbol index for "go to definition"
+ *
+ * Source files are scanned in parallel with the syntax tokenizers and the
+ * extracted definitions are written to a .tedit-symbols file sorted by
+ * name, so lookups are a binary search over a memory-mapped table.
+ */
+#ifndef TEDIT_SYMINDEX_H
+#define TEDIT_SYMINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Index file name (created in the project root) and format magic */
+#define SYMINDEX_FILE     ".tedit-symbols"
+#define SYMINDEX_MAGIC    "TSYM0001"
+#define SYMINDEX_VERSION  1
+
+typedef enum SymbolKind {
+    SYM_FUNCTION = 1,   /* C function definition */
+    SYM_PROC,           /* MASM "name proc" */
+    SYM_MACRO,          /* MASM "name macro" */
+    SYM_LABEL,          /* Assembly "name:" */
+    SYM_DEFINE          /* #define, equ, .set */
+} SymbolKind;
+
+/* On-disk layout: header, file table, symbol table (sorted), strings */
+#pragma pack(push, 1)
+typedef struct SymIndexHeader {
+    char magic[8];          /* "TSYM0001" */
+    uint32_t version;
+    uint32_t file_count;
+    uint32_t symbol_count;
+    uint32_t reserved;
+    uint64_t strings_size;
+} SymIndexHeader;
+
+typedef struct SymFileRec {
+    uint32_t path;          /* Offset into string table */
+    uint32_t language;
+    uint64_t size;          /* Source size and mtime at scan time */
+    int64_t mtime;
+} SymFileRec;
+
+typedef struct SymRec {
+    uint32_t name;          /* Offset into string table */
+    uint32_t file;          /* Index into file table */
+    uint32_t line;          /* 1-based line number */
+    uint32_t kind;          /* SymbolKind */
+} SymRec;
+#pragma pack(pop)
+
+/* Opened (memory-mapped) index */
+typedef struct SymIndex {
+    char *data;
+    size_t size;
+    const SymIndexHeader *header;
+    const SymFileRec *files;
+    const SymRec *symbols;
+    const char *strings;
+} SymIndex;
+
+/* Lookup result; strings point into the mapped index */
+typedef struct SymbolMatch {
+    const char *name;
+    const char *file;
+    uint32_t line;
+    SymbolKind kind;
+} SymbolMatch;
+
+/* Build statistics */
+typedef struct SymIndexStats {
+    size_t files;           /* Source files in the project */
+    size_t scanned;         /* Files (re)tokenized this run */
+    size_t reused;          /* Files unchanged since the last index */
+    size_t symbols;         /* Symbols written */
+    double seconds;
+} SymIndexStats;
+
+/* Build or incrementally update the index for project_dir. Files whose
+ * size and mtime match the existing index are not re-read. */
+int symindex_update(const char *project_dir, const char *index_path,
+                    int threads, SymIndexStats *stats);
+
+SymIndex *symindex_open(const char *index_path);
+void symindex_close(SymIndex *idx);
+
+/* Find all definitions of name; returns the total number of matches
+ * (up to max are stored in out) */
+size_t symindex_find(SymIndex *idx, const char *name,
+                     SymbolMatch *out, size_t max);
+
+const char *symindex_kind_name(SymbolKind kind);
+void symindex_get_path(const char *project_dir, char *out, size_t out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEDIT_SYMINDEX_H */
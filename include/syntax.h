@@ -4,6 +4,8 @@
 #ifndef TEDIT_SYNTAX_H
 #define TEDIT_SYNTAX_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -35,7 +37,15 @@ typedef struct SyntaxToken {
     TokenType type;
 } SyntaxToken;
 
+/* Bytes sampled from the start of a file for content-based detection */
+#define SYNTAX_SAMPLE_SIZE 4096
+
 Language syntax_detect_language(const char *filename);
+
+/* Refine extension-based detection by scoring a bounded sample of the
+ * file contents (register names, section directives, operand styles). */
+Language syntax_detect_language_content(const char *filename,
+                                        const char *text, size_t len);
 const char *syntax_language_name(Language lang);
 
 /* Tokenize a line for syntax highlighting */
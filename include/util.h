@@ -21,12 +21,31 @@ const char *path_basename(const char *path);
 const char *path_extension(const char *path);
 void path_dirname(const char *path, char *dir, size_t max);
 void path_join(char *out, size_t max, const char *a, const char *b);
+int path_make_dirs(const char *path);   /* mkdir -p; 0 if it exists afterwards */
+
+/* Whether two spellings name the same file as far as the text shows:
+ * equal, or one is a trailing path of the other ("src/a.c", "/p/src/a.c").
+ * Either separator is accepted and a leading "./" is ignored. */
+int path_same_file(const char *a, const char *b);
+
+/* A relative path that stays inside the directory it is joined to (no
+ * absolute paths, drive letters or ".." components) */
+int path_is_safe(const char *path);
 
 /* File utilities */
 char *file_read_all(const char *path, size_t *len);
 int file_write_all(const char *path, const char *data, size_t len);
 int file_exists(const char *path);
 
+/* Map a file read-only (falls back to a heap copy where mmap is missing).
+ * Empty files map to a shared empty string. Release with file_unmap. */
+char *file_map(const char *path, size_t *len);
+void file_unmap(char *data, size_t len);
+
+/* Time utilities */
+double time_now(void);  /* Monotonic seconds, for measuring durations */
+void time_sleep(double seconds);
+
 #ifdef __cplusplus
 }
 #endif
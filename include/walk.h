@@ -0,0 +1,86 @@
+/*
+ * walk.h - Project directory walker with gitignore-style exclude rules
+ *
+ * One pass over the tree collects every regular file together with its
+ * size, mtime and mode, so later stages (archive writer, manifest diff,
+ * dedup) never stat a file again. Directory entry types come from
+ * readdir's d_type where the filesystem provides it; files are stat'ed
+ * relative to their directory's descriptor with fstatat. Names are
+ * sorted within each directory so archives list files in a stable order.
+ *
+ * Exclude patterns follow .gitignore:
+ *
+ *   *.com          any file or directory named *.com, at any depth
+ *   build/         directories only
+ *   /notes.txt     anchored: only at the project root
+ *   docs/api-*.pdf a pattern containing '/' is matched from the root
+ *   !keep.com      re-include something an earlier pattern excluded
+ *
+ * '*' and '?' never match '/'; '**' matches across directory levels.
+ * The last matching pattern wins. Excluded directories are not entered,
+ * so nothing below them can be re-included.
+ */
+#ifndef TEDIT_WALK_H
+#define TEDIT_WALK_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WALK_MAX_RULES 64
+#define WALK_MAX_PATTERN 128
+
+typedef struct WalkRule {
+    char pattern[WALK_MAX_PATTERN];
+    int negate;                     /* !pattern: re-include */
+    int dir_only;                   /* pattern/: matches directories only */
+    int anchored;                   /* Matched against the path from the root */
+} WalkRule;
+
+typedef struct WalkRules {
+    WalkRule rules[WALK_MAX_RULES];
+    size_t count;
+} WalkRules;
+
+typedef struct WalkStats {
+    size_t dirs;                    /* Directories entered */
+    size_t files;                   /* Files collected */
+    size_t excluded;                /* Files and directories skipped by rules */
+    size_t stats;                   /* fstatat calls */
+    size_t errors;                  /* Files that could not be added */
+    int threads;                    /* Subtree walkers (1 = serial) */
+    double seconds;
+} WalkStats;
+
+struct Archive;
+
+void walk_rules_init(WalkRules *rules);
+
+/* Append one pattern line; blank lines and '#' comments are ignored.
+ * Returns -1 when the rule table is full. */
+int walk_rules_add(WalkRules *rules, const char *pattern);
+
+/* 1 if rel_path (relative to the walk root, '/'-separated) is excluded */
+int walk_rules_match(const WalkRules *rules, const char *rel_path, int is_dir);
+
+/* Glob match: '*' and '?' stop at '/', '**' crosses directories, and
+ * [a-z] / [!a-z] classes */
+int walk_glob(const char *pattern, const char *text);
+
+/* Add every file under dir to ar as prefix/<relative path>. rules may be
+ * NULL. With threads other than 1 (0 = one per CPU), the subdirectories
+ * of dir are walked in parallel; the resulting entry order is the same
+ * as a serial walk. Symbolic links to files are archived as the file;
+ * links to directories are not followed. Returns -1 if dir cannot be
+ * opened or a file could not be added (stats->errors, such as a name
+ * over ARCHIVE_MAX_NAME). */
+int walk_directory(struct Archive *ar, const char *dir, const char *prefix,
+                   const WalkRules *rules, int threads, WalkStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEDIT_WALK_H */
@@ -0,0 +1,90 @@
+#!/bin/bash
+# Benchmark the built-in tar writer: zero-copy vs buffered copies
+#
+# Usage: scripts/bench-archive.sh [tedit binary] [file count]
+#
+# Builds a tree of mixed-size files (mostly small sources, some 64 KB-
+# 4 MB blobs), then archives it with zero_copy=1 and zero_copy=0 and
+# reports wall time and, when strace is installed, syscall counts.
+
+set -e
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+PROJECT_DIR="$(dirname "$SCRIPT_DIR")"
+
+TEDIT="$(realpath "${1:-$PROJECT_DIR/tedit.com}")"
+FILES="${2:-10000}"
+THREADS="${THREADS:-0}"
+RUNS="${RUNS:-3}"
+
+if [ ! -x "$TEDIT" ]; then
+    echo "tedit binary not found: $TEDIT (run 'make cli' first)"
+    exit 1
+fi
+
+WORK="$(mktemp -d "${TMPDIR:-/tmp}/tedit-bench.XXXXXX")"
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+
+# backup.ini is read from the binary's directory
+cp "$TEDIT" ./tedit.com
+mkdir -p temp
+
+echo "Creating $FILES files in $WORK/tree..."
+python3 - "$FILES" <<'EOF'
+import os, random, sys
+random.seed(1)
+count = int(sys.argv[1])
+for i in range(count):
+    d = os.path.join("tree", "d%03d" % (i % 200), "s%02d" % (i % 7))
+    os.makedirs(d, exist_ok=True)
+    r = random.random()
+    if r < 0.80:
+        size = random.randint(100, 16 * 1024)        # sources
+    elif r < 0.97:
+        size = random.randint(16 * 1024, 256 * 1024) # larger sources, assets
+    else:
+        size = random.randint(1024 * 1024, 4 * 1024 * 1024)  # blobs
+    with open(os.path.join(d, "f%05d.dat" % i), "wb") as f:
+        f.write(os.urandom(size))
+EOF
+du -sh tree
+
+run() {
+    local zero_copy="$1"
+    cat > backup.ini <<EOF
+[settings]
+archive_format=tar
+threads=$THREADS
+zero_copy=$zero_copy
+temp_dir=$WORK/temp
+
+[destinations]
+null=true
+EOF
+
+    local best=""
+    for _ in $(seq "$RUNS"); do
+        rm -f temp/*.tar
+        sync
+        local start end
+        start=$(date +%s.%N)
+        ./tedit.com --backup null tree > /dev/null
+        end=$(date +%s.%N)
+        local t
+        t=$(awk "BEGIN { print $end - $start }")
+        if [ -z "$best" ] || awk "BEGIN { exit !($t < $best) }"; then best="$t"; fi
+    done
+    printf "zero_copy=%s  best of %s: %6.3fs\n" "$zero_copy" "$RUNS" "$best"
+
+    if command -v strace > /dev/null; then
+        rm -f temp/*.tar
+        strace -f -c -o "strace-$zero_copy.txt" ./tedit.com --backup null tree > /dev/null
+        grep -E "total|read|write|copy_file_range|sendfile|open|fstat|lseek" \
+            "strace-$zero_copy.txt" | sed 's/^/    /'
+    fi
+    rm -f temp/*.tar
+}
+
+run 1
+run 0
@@ -0,0 +1,98 @@
+#!/bin/bash
+# Check block matching on nested MASM macro and repeat blocks
+#
+# Usage: scripts/test-blocks.sh
+#
+# Compiles a small driver against the core sources, indexes a MASM
+# source with repeat blocks (rept, irp, for, while, ...) inside macros
+# and checks that every opener finds the endm or endp that closes it,
+# before and after an edit inserts another repeat block.
+
+set -e
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+PROJECT_DIR="$(dirname "$SCRIPT_DIR")"
+
+CC="${CC:-cc}"
+
+WORK="$(mktemp -d "${TMPDIR:-/tmp}/tedit-blocks.XXXXXX")"
+trap 'rm -rf "$WORK"' EXIT
+
+cat > "$WORK/driver.c" <<'EOC'
+#include <stdio.h>
+#include <string.h>
+
+#include "blocks.h"
+#include "buffer.h"
+
+static const char *source =
+    "fill macro value, count\n"         /* 0 */
+    "    REPT count\n"                  /* 1 */
+    "        db value\n"
+    "    endm\n"                        /* 3 */
+    "    irp reg, <rax, rbx>\n"         /* 4 */
+    "        push reg\n"
+    "    ENDM\n"                        /* 6 */
+    "endm\n"                            /* 7 */
+    "main proc\n"                       /* 8 */
+    "    for x, <1, 2>\n"               /* 9 */
+    "        forc c, <ab>\n"            /* 10 */
+    "            db '&c'\n"
+    "        endm\n"                    /* 12 */
+    "    endm\n"                        /* 13 */
+    "    while 0\n"                     /* 14 */
+    "    endm\n"                        /* 15 */
+    "    ret\n"
+    "main endp\n";                      /* 17 */
+
+static int failed = 0;
+
+static void expect(BlockIndex *idx, size_t line, size_t partner) {
+    size_t match_line, match_col;
+    if (blocks_find_match(idx, line, 0, &match_line, &match_col) != 0) {
+        printf("FAIL: line %zu has no partner (expected %zu)\n", line + 1, partner + 1);
+        failed = 1;
+    } else if (match_line != partner) {
+        printf("FAIL: line %zu matches line %zu (expected %zu)\n",
+               line + 1, match_line + 1, partner + 1);
+        failed = 1;
+    }
+}
+
+int main(void) {
+    Buffer *buf = buffer_create(256);
+    BlockIndex *idx = blocks_create();
+    if (!buf || !idx) return 1;
+    
+    buffer_insert(buf, 0, source, strlen(source));
+    blocks_rebuild(idx, buf, LANG_MASM64);
+    
+    size_t pairs[][2] = { {0, 7}, {1, 3}, {4, 6}, {8, 17}, {9, 13}, {10, 12}, {14, 15} };
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+        expect(idx, pairs[i][0], pairs[i][1]);
+        expect(idx, pairs[i][1], pairs[i][0]);
+    }
+    
+    /* Insert another repeat block inside the macro */
+    const char *edit = "    irpc ch, <xy>\n    endm\n";
+    size_t pos = blocks_line_start(idx, 7);
+    buffer_insert(buf, pos, edit, strlen(edit));
+    blocks_edit(idx, buf, pos, 0, strlen(edit));
+    expect(idx, 0, 9);
+    expect(idx, 7, 8);
+    expect(idx, 10, 19);
+    
+    blocks_destroy(idx);
+    buffer_destroy(buf);
+    if (!failed) printf("Matched nested macro and repeat blocks\n");
+    return failed;
+}
+EOC
+
+echo "Building blocks driver..."
+SOURCES=$(ls "$PROJECT_DIR"/src/*.c | grep -v '/main\.c$')
+"$CC" -O2 -std=c11 -D_GNU_SOURCE -I"$PROJECT_DIR/include" -o "$WORK/driver" \
+    "$WORK/driver.c" $SOURCES -lpthread
+
+"$WORK/driver"
+echo "OK"
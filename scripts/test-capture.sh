@@ -0,0 +1,114 @@
+#!/bin/bash
+# Check build output capture on a command that writes 100 MB
+#
+# Usage: scripts/test-capture.sh [megabytes]
+#
+# Compiles a small driver against the core sources and runs a command
+# through build_run_capture and build_run_command_capture. The capture
+# must keep the tail of the output (the last line is a marker), count
+# every byte, stay within its limit and finish in linear time; a 1-byte
+# output buffer must come back empty.
+
+set -e
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+PROJECT_DIR="$(dirname "$SCRIPT_DIR")"
+
+MB="${1:-100}"
+CC="${CC:-cc}"
+MAX_SECONDS="${MAX_SECONDS:-30}"
+
+WORK="$(mktemp -d "${TMPDIR:-/tmp}/tedit-capture.XXXXXX")"
+trap 'rm -rf "$WORK"' EXIT
+
+cat > "$WORK/driver.c" <<'EOF'
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "build.h"
+#include "util.h"
+
+#define LIMIT (1024 * 1024)
+#define MARKER "END-OF-CAPTURE\n"
+
+int main(int argc, char **argv) {
+    const char *cmd = argv[1];
+    unsigned long long expect = strtoull(argv[2], NULL, 10);
+    int failed = 0;
+
+    BuildCapture c;
+    build_capture_init(&c, LIMIT);
+    double start = time_now();
+    int status = build_run_capture(cmd, &c);
+    double secs = time_now() - start;
+    const char *text = build_capture_text(&c);
+
+    printf("Captured %llu bytes in %.2fs (%.0f MB/s), kept %zu\n",
+           (unsigned long long)c.total, secs, c.total / 1048576.0 / (secs > 0 ? secs : 1e-9),
+           c.len);
+    if (status != 0) {
+        printf("FAIL: exit status %d\n", status);
+        failed = 1;
+    }
+    if (c.total != expect) {
+        printf("FAIL: expected %llu bytes\n", expect);
+        failed = 1;
+    }
+    size_t keep = expect > LIMIT ? LIMIT : (size_t)expect;
+    if (c.len != keep || build_capture_truncated(&c) != (expect > LIMIT)) {
+        printf("FAIL: capture should hold exactly the last %zu bytes\n", keep);
+        failed = 1;
+    }
+    size_t mlen = strlen(MARKER);
+    if (c.len < mlen || memcmp(text + c.len - mlen, MARKER, mlen) != 0) {
+        printf("FAIL: tail marker missing\n");
+        failed = 1;
+    }
+    build_capture_free(&c);
+
+    /* Fixed-buffer form: the tail, NUL-terminated, never past max */
+    char small[64];
+    memset(small, 'z', sizeof(small));
+    build_run_command_capture(cmd, small, 16);
+    if (strlen(small) != 15 || memcmp(small + 15 - mlen, MARKER, mlen) != 0 ||
+        small[16] != 'z') {
+        printf("FAIL: 16-byte buffer\n");
+        failed = 1;
+    }
+
+    char one[2] = {'z', 'z'};
+    build_run_command_capture(cmd, one, 1);
+    if (one[0] != '\0' || one[1] != 'z') {
+        printf("FAIL: 1-byte buffer\n");
+        failed = 1;
+    }
+
+    printf("%.3f\n", secs);
+    return failed;
+}
+EOF
+
+echo "Building capture driver..."
+SOURCES=$(ls "$PROJECT_DIR"/src/*.c | grep -v '/main\.c$')
+"$CC" -O2 -std=c11 -D_GNU_SOURCE -I"$PROJECT_DIR/include" -o "$WORK/driver" \
+    "$WORK/driver.c" $SOURCES -lpthread
+
+# Lines of 100 bytes, then the marker
+LINES=$((MB * 1024 * 1024 / 100))
+CMD="yes $(printf '%099d' 0) | head -n $LINES; printf 'END-OF-CAPTURE\\n'"
+EXPECT=$((LINES * 100 + 15))
+
+echo "Running a command that writes $MB MB..."
+OUTPUT="$("$WORK/driver" "$CMD" "$EXPECT")" || {
+    echo "$OUTPUT"
+    exit 1
+}
+echo "$OUTPUT" | sed '$d'
+
+SECS="$(echo "$OUTPUT" | tail -n 1)"
+if awk -v s="$SECS" -v m="$MAX_SECONDS" 'BEGIN { exit !(s > m) }'; then
+    echo "FAIL: took ${SECS}s (limit ${MAX_SECONDS}s)"
+    exit 1
+fi
+echo "OK"
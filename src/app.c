@@ -6,6 +6,8 @@
 #include <string.h>
 
 #include "app.h"
+#include "autobackup.h"
+#include "script.h"
 #include "util.h"
 
 int app_init(AppState *app) {
@@ -17,6 +19,9 @@ int app_init(AppState *app) {
     
     config_defaults(&app->config);
     build_config_defaults(&app->build);
+    build_output_init(&app->build_output);
+    diag_init(&app->diags);
+    build_cache_init(&app->build_cache, BUILD_CACHE_FILE);
     
     /* Create initial empty editor */
     if (!app_new_editor(app)) {
@@ -29,6 +34,18 @@ int app_init(AppState *app) {
 }
 
 void app_shutdown(AppState *app) {
+    autobackup_stop(app->autobackup);
+    app->autobackup = NULL;
+    
+    if (app->build_proc.running) {
+        build_process_cancel(&app->build_proc);
+        build_process_wait(&app->build_proc);
+    }
+    build_output_free(&app->build_output);
+    diag_free(&app->diags);
+    build_cache_free(&app->build_cache);
+    script_cache_clear();
+    
     for (size_t i = 0; i < app->editor_count; i++) {
         if (app->editors[i]) {
             editor_destroy(app->editors[i]);
@@ -98,9 +115,9 @@ int app_open_file(AppState *app, const char *path) {
         }
     }
     
+    ed->language = syntax_detect_language_content(path, content, len);
     editor_set_text(ed, content, len);
     strncpy(ed->file_path, path, sizeof(ed->file_path) - 1);
-    ed->language = editor_detect_language(path);
     ed->dirty = 0;
     
     config_add_recent(&app->config, path);
@@ -130,3 +147,33 @@ int app_save_file(AppState *app, const char *path) {
     return 0;
 }
 
+int app_build_target(AppState *app, const char *path, char *out, size_t max) {
+    if (!strstr(app->build.build_cmd, "{out}")) return -1;
+    menu_substitute_vars(out, max, "{out}", path, app->exe_dir);
+    return 0;
+}
+
+EditorState *app_goto_location(AppState *app, const char *path, size_t line, size_t col) {
+    size_t index = app->editor_count;
+    for (size_t i = 0; i < app->editor_count; i++) {
+        if (path_same_file(app->editors[i]->file_path, path)) {
+            index = i;
+            break;
+        }
+    }
+    
+    if (index < app->editor_count) {
+        app->active_editor = index;
+    } else {
+        /* Reuse an empty untitled buffer rather than adding another */
+        EditorState *ed = app_get_active_editor(app);
+        if (!ed || ed->file_path[0] || ed->dirty || editor_get_length(ed) > 0) {
+            if (!app_new_editor(app)) return NULL;
+        }
+        if (app_open_file(app, path) != 0) return NULL;
+    }
+    
+    EditorState *ed = app_get_active_editor(app);
+    editor_goto(ed, line, col);
+    return ed;
+}
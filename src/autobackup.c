@@ -0,0 +1,262 @@
+/*
+ * autobackup.c - Scheduled background backups
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include "autobackup.h"
+#include "backup.h"
+#include "util.h"
+
+/* Wait this long before retrying after a run that could not start */
+#define AUTOBACKUP_RETRY 60.0
+
+struct AutoBackup {
+    char ini_path[BACKUP_MAX_PATH];
+    char project_dir[BACKUP_MAX_PATH];
+    double next_run;                /* time_now() of the next run */
+    int triggered;
+    int stop;
+    int lowered;                    /* Worker already runs at idle priority */
+    
+    /* Progress of the current run, for the status bar */
+    int running;
+    size_t done;
+    size_t total;
+    char status[128];               /* Outcome of the last run */
+#ifndef _WIN32
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+#endif
+};
+
+#ifdef _WIN32
+#define ab_lock(ab) ((void)(ab))
+#define ab_unlock(ab) ((void)(ab))
+#else
+#define ab_lock(ab) pthread_mutex_lock(&(ab)->lock)
+#define ab_unlock(ab) pthread_mutex_unlock(&(ab)->lock)
+#endif
+
+static void autobackup_progress(void *ctx, size_t done, size_t total) {
+    AutoBackup *ab = ctx;
+    ab_lock(ab);
+    ab->done = done;
+    ab->total = total;
+    ab_unlock(ab);
+}
+
+/* Idle scheduling class for the calling thread; archive reader threads it
+ * starts inherit both settings */
+static void autobackup_lower_priority(void) {
+#if defined(__linux__) && defined(SYS_gettid)
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, (id_t)tid, 19);
+#ifdef SYS_ioprio_set
+    /* IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE */
+    syscall(SYS_ioprio_set, 1, (int)tid, 3 << 13);
+#endif
+#endif
+}
+
+/* One scheduled backup. Returns the delay until the next one. */
+static double autobackup_run(AutoBackup *ab) {
+    BackupConfig cfg;
+    char message[128];
+    char clock[16];
+    time_t now = time(NULL);
+    strftime(clock, sizeof(clock), "%H:%M", localtime(&now));
+    
+    /* Reloaded every run so edits to backup.ini take effect */
+    if (backup_config_load(&cfg, ab->ini_path) != 0 || cfg.settings.interval <= 0 ||
+        !cfg.settings.default_dest[0]) {
+        ab_lock(ab);
+        snprintf(ab->status, sizeof(ab->status), "Auto-backup: check [schedule] in backup.ini");
+        ab_unlock(ab);
+        backup_config_free(&cfg);
+        return AUTOBACKUP_RETRY;
+    }
+    
+    if (cfg.settings.low_priority && !ab->lowered) {
+        autobackup_lower_priority();
+        ab->lowered = 1;
+    }
+    
+    const char *dest_name = cfg.settings.default_dest;
+    BackupDest *dest = backup_config_get_dest(&cfg, dest_name);
+    int to_repo = dest && strncmp(dest->command, "repo:", 5) == 0;
+    
+    ab_lock(ab);
+    ab->running = 1;
+    ab->done = 0;
+    ab->total = 0;
+    ab_unlock(ab);
+    
+    /* Repositories keep no manifest; they reuse unchanged files instead */
+    int result = 0;
+    if (!to_repo && !backup_project_changed(&cfg, ab->project_dir)) {
+        snprintf(message, sizeof(message), "Backup %s: no changes", clock);
+    } else {
+        cfg.progress = autobackup_progress;
+        cfg.progress_ctx = ab;
+        if (cfg.settings.rate_limit_kb > 0) {
+            cfg.rate_limit = (uint64_t)cfg.settings.rate_limit_kb * 1024;
+        }
+        
+        result = cfg.settings.scheduled_incremental
+                 ? backup_project_incremental(&cfg, dest_name, ab->project_dir)
+                 : backup_project(&cfg, dest_name, ab->project_dir, 1);
+        
+        if (result != 0) {
+            snprintf(message, sizeof(message), "Backup %s to %s failed", clock, dest_name);
+        } else if (cfg.last_to_repo) {
+            snprintf(message, sizeof(message), "Backup %s: %zu files to %s",
+                     clock, cfg.last_repo.files, dest_name);
+        } else if (!cfg.last_archive[0]) {
+            snprintf(message, sizeof(message), "Backup %s: no changes", clock);
+        } else {
+            snprintf(message, sizeof(message), "Backup %s: %zu files (%.1f MB) to %s",
+                     clock, cfg.last_stats.files, cfg.last_stats.bytes / 1048576.0, dest_name);
+        }
+    }
+    
+    ab_lock(ab);
+    ab->running = 0;
+    snprintf(ab->status, sizeof(ab->status), "%s", message);
+    ab_unlock(ab);
+    
+    double delay = result == 0 ? (double)cfg.settings.interval : AUTOBACKUP_RETRY;
+    backup_config_free(&cfg);
+    return delay;
+}
+
+#ifndef _WIN32
+
+static void *autobackup_thread(void *arg) {
+    AutoBackup *ab = arg;
+    
+    pthread_mutex_lock(&ab->lock);
+    while (!ab->stop) {
+        double now = time_now();
+        if (!ab->triggered && now < ab->next_run) {
+            /* Sleep until due; stop and trigger signal the condition */
+            double wait = ab->next_run - now;
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec += (time_t)wait;
+            ts.tv_nsec += (long)((wait - (double)(time_t)wait) * 1e9);
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&ab->wake, &ab->lock, &ts);
+            continue;
+        }
+        ab->triggered = 0;
+        pthread_mutex_unlock(&ab->lock);
+        
+        double delay = autobackup_run(ab);
+        
+        pthread_mutex_lock(&ab->lock);
+        ab->next_run = time_now() + delay;
+    }
+    pthread_mutex_unlock(&ab->lock);
+    return NULL;
+}
+
+#endif
+
+AutoBackup *autobackup_start(const char *ini_path, const char *project_dir) {
+    BackupConfig cfg;
+    int ok = backup_config_load(&cfg, ini_path) == 0 && cfg.settings.interval > 0 &&
+             cfg.settings.default_dest[0];
+    double interval = cfg.settings.interval;
+    backup_config_free(&cfg);
+    if (!ok) return NULL;
+    
+    AutoBackup *ab = calloc(1, sizeof(AutoBackup));
+    if (!ab) return NULL;
+    strncpy(ab->ini_path, ini_path, BACKUP_MAX_PATH - 1);
+    strncpy(ab->project_dir, project_dir, BACKUP_MAX_PATH - 1);
+    ab->next_run = time_now() + interval;
+
+#ifndef _WIN32
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&ab->lock, NULL);
+    pthread_cond_init(&ab->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    
+    if (pthread_create(&ab->thread, NULL, autobackup_thread, ab) != 0) {
+        pthread_cond_destroy(&ab->wake);
+        pthread_mutex_destroy(&ab->lock);
+        free(ab);
+        return NULL;
+    }
+#endif
+    return ab;
+}
+
+void autobackup_stop(AutoBackup *ab) {
+    if (!ab) return;
+#ifndef _WIN32
+    pthread_mutex_lock(&ab->lock);
+    ab->stop = 1;
+    pthread_cond_signal(&ab->wake);
+    pthread_mutex_unlock(&ab->lock);
+    pthread_join(ab->thread, NULL);
+    pthread_cond_destroy(&ab->wake);
+    pthread_mutex_destroy(&ab->lock);
+#endif
+    free(ab);
+}
+
+void autobackup_trigger(AutoBackup *ab) {
+    if (!ab) return;
+    ab_lock(ab);
+    ab->triggered = 1;
+#ifndef _WIN32
+    pthread_cond_signal(&ab->wake);
+#endif
+    ab_unlock(ab);
+}
+
+void autobackup_poll(AutoBackup *ab) {
+#ifdef _WIN32
+    if (!ab || (!ab->triggered && time_now() < ab->next_run)) return;
+    ab->triggered = 0;
+    ab->next_run = time_now() + autobackup_run(ab);
+#else
+    (void)ab;
+#endif
+}
+
+int autobackup_status(AutoBackup *ab, char *out, size_t size) {
+    if (size) out[0] = '\0';
+    if (!ab || size == 0) return 0;
+    
+    ab_lock(ab);
+    if (ab->running && ab->total) {
+        snprintf(out, size, "Backing up: %zu/%zu files (%d%%)", ab->done, ab->total,
+                 (int)(ab->done * 100 / ab->total));
+    } else if (ab->running) {
+        snprintf(out, size, "Backing up: scanning");
+    } else {
+        snprintf(out, size, "%s", ab->status);
+    }
+    ab_unlock(ab);
+    return out[0] != '\0';
+}
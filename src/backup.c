@@ -2,8 +2,8 @@
  * backup.c - Extensible backup system implementation
  * 
  * Provides basic tar archive creation and backup destination management.
- * Compression uses a simple store method for portability.
- * For full gzip compression, use external tools via command templates.
+ * Archives are plain tar or, with archive_format=tar.gz, gzipped in the
+ * same pass by the built-in deflate (no zlib dependency).
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,16 +13,33 @@
 
 #ifdef _WIN32
 #include <direct.h>
+#include <io.h>
 #define PATH_SEP '\\'
+#define popen _popen
+#define pclose _pclose
+#define PIPE_WRITE_MODE "wb"
 #else
-#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 #define PATH_SEP '/'
+#define PIPE_WRITE_MODE "w"
 #endif
 
 #include "backup.h"
 #include "config.h"
+#include "dedup.h"
+#include "deflate.h"
+#include "hash.h"
+#include "manifest.h"
+#include "parallel.h"
 #include "util.h"
+#include "walk.h"
 
 /* TAR header structure (POSIX ustar format) */
 #pragma pack(push, 1)
@@ -47,6 +64,15 @@ typedef struct TarHeader {
 } TarHeader;
 #pragma pack(pop)
 
+/* Largest value of an 11-digit octal field (size, mtime) */
+#define TAR_OCTAL_MAX 077777777777ULL
+
+/* PAX records: a path of up to ARCHIVE_MAX_NAME, a size and an mtime */
+#define TAR_PAX_MAX (ARCHIVE_MAX_NAME + 128)
+
+/* A PAX header, its blocks of records and the ustar header */
+#define TAR_HEADER_MAX (2 * 512 + (TAR_PAX_MAX + 511) / 512 * 512)
+
 /* Calculate TAR checksum */
 static unsigned int tar_checksum(TarHeader *header) {
     unsigned int sum = 0;
@@ -62,57 +88,142 @@ static unsigned int tar_checksum(TarHeader *header) {
     return sum;
 }
 
-/* Initialize a TAR header for a file */
-static void tar_init_header(TarHeader *header, const char *name, 
-                            size_t size, time_t mtime) {
-    memset(header, 0, sizeof(TarHeader));
+/* Zero-padded octal, NUL-terminated, filling a width-byte field */
+static void tar_octal(char *field, size_t width, uint64_t value) {
+    field[width - 1] = '\0';
+    for (size_t i = width - 1; i-- > 0; ) {
+        field[i] = (char)('0' + (value & 7));
+        value >>= 3;
+    }
+}
+
+/* GNU base-256 for sizes too large for octal (readers also get the
+ * exact value from the PAX header) */
+static void tar_base256(char *field, size_t width, uint64_t value) {
+    for (size_t i = width; i-- > 1; ) {
+        field[i] = (char)(value & 0xff);
+        value >>= 8;
+    }
+    field[0] = (char)0x80;
+}
+
+/* Store name in the ustar name/prefix fields; 0 if it fits exactly */
+static int tar_set_name(TarHeader *header, const char *name, size_t len) {
+    if (len <= 100) {
+        memcpy(header->name, name, len);
+        return 0;
+    }
     
-    /* Handle long names with prefix */
-    size_t name_len = strlen(name);
-    if (name_len <= 100) {
-        strncpy(header->name, name, 100);
-    } else if (name_len <= 255) {
-        /* Split into prefix and name */
-        const char *split = name + name_len - 100;
-        while (split > name && *split != '/' && *split != '\\') {
-            split--;
-        }
-        if (split > name) {
-            size_t prefix_len = split - name;
-            strncpy(header->prefix, name, prefix_len < 155 ? prefix_len : 155);
-            strncpy(header->name, split + 1, 100);
-        } else {
-            strncpy(header->name, name, 100);
-        }
-    } else {
-        strncpy(header->name, name + name_len - 100, 100);
+    /* Split at a '/' leaving at most 155 bytes before it and 100 after */
+    size_t first = len - 101;
+    for (size_t i = first; i < len && i <= 155; i++) {
+        if (name[i] != '/') continue;
+        if (i == 0 || i + 1 == len) break;
+        memcpy(header->prefix, name, i);
+        memcpy(header->name, name + i + 1, len - i - 1);
+        return 0;
     }
     
-    snprintf(header->mode, 8, "%07o", 0644);
-    snprintf(header->uid, 8, "%07o", 0);
-    snprintf(header->gid, 8, "%07o", 0);
-    snprintf(header->size, 12, "%011lo", (unsigned long)size);
-    snprintf(header->mtime, 12, "%011lo", (unsigned long)mtime);
-    header->typeflag = '0';  /* Regular file */
-    memcpy(header->magic, "ustar", 5);
-    header->magic[5] = '\0';
+    /* Readers take the full name from the PAX header */
+    memcpy(header->name, name, 100);
+    return -1;
+}
+
+/* Fill a ustar header; the caller sets the size field */
+static void tar_fill_header(TarHeader *header, int64_t mtime, unsigned int mode, char type) {
+    tar_octal(header->mode, 8, mode & 07777);
+    tar_octal(header->uid, 8, 0);
+    tar_octal(header->gid, 8, 0);
+    tar_octal(header->mtime, 12, mtime < 0 ? 0 :
+              (uint64_t)mtime > TAR_OCTAL_MAX ? TAR_OCTAL_MAX : (uint64_t)mtime);
+    header->typeflag = type;
+    memcpy(header->magic, "ustar", 6);
     memcpy(header->version, "00", 2);
-    strcpy(header->uname, "tedit");
-    strcpy(header->gname, "tedit");
+    memcpy(header->uname, "tedit", 6);
+    memcpy(header->gname, "tedit", 6);
     
     /* Calculate and set checksum */
     unsigned int cksum = tar_checksum(header);
-    snprintf(header->checksum, 8, "%06o", cksum);
-    header->checksum[6] = '\0';
+    tar_octal(header->checksum, 7, cksum);
     header->checksum[7] = ' ';
 }
 
+/* Append one "<length> key=value\n" PAX record; the length counts itself */
+static size_t tar_pax_record(char *out, size_t pos, const char *key, const char *value) {
+    size_t body = strlen(key) + strlen(value) + 3;
+    size_t len = body + 1;
+    for (;;) {
+        size_t digits = 1;
+        for (size_t v = len; v >= 10; v /= 10) digits++;
+        if (len == body + digits) break;
+        len = body + digits;
+    }
+    return pos + (size_t)sprintf(out + pos, "%zu %s=%s\n", len, key, value);
+}
+
+/* Build the header blocks for one record in out (TAR_HEADER_MAX bytes)
+ * and return how many bytes to write. Names the ustar fields cannot
+ * hold, sizes of 8 GiB and up and mtimes outside 0..2^33 get a PAX
+ * extended header in front. No allocation: this runs once per file. */
+static size_t tar_build_header(char *out, const char *name, uint64_t size,
+                               int64_t mtime, unsigned int mode) {
+    TarHeader *header = (TarHeader *)out;
+    memset(header, 0, sizeof(TarHeader));
+    
+    size_t name_len = strlen(name);
+    int long_name = tar_set_name(header, name, name_len) != 0;
+    int big_size = size > TAR_OCTAL_MAX;
+    int wide_time = mtime < 0 || (uint64_t)mtime > TAR_OCTAL_MAX;
+    
+    if (big_size) {
+        tar_base256(header->size, 12, size);
+    } else {
+        tar_octal(header->size, 12, size);
+    }
+    tar_fill_header(header, mtime, mode, '0');
+    if (!long_name && !big_size && !wide_time) return 512;
+    
+    /* Records follow the PAX header; the name is at most ARCHIVE_MAX_NAME */
+    char *records = out + 512;
+    char value[32];
+    size_t len = 0;
+    memset(records, 0, TAR_HEADER_MAX - 2 * 512);
+    if (long_name) len = tar_pax_record(records, len, "path", name);
+    if (big_size) {
+        snprintf(value, sizeof(value), "%llu", (unsigned long long)size);
+        len = tar_pax_record(records, len, "size", value);
+    }
+    if (wide_time) {
+        snprintf(value, sizeof(value), "%lld", (long long)mtime);
+        len = tar_pax_record(records, len, "mtime", value);
+    }
+    
+    /* The file's own header goes after the records */
+    size_t records_size = (len + 511) / 512 * 512;
+    memcpy(out + 512 + records_size, header, 512);
+    
+    /* The extended header is named after the file, as other tools do */
+    TarHeader *pax = (TarHeader *)out;
+    memset(pax, 0, sizeof(TarHeader));
+    const char *base = strrchr(name, '/');
+    base = base ? base + 1 : name;
+    size_t base_len = strlen(base);
+    if (base_len > 89) base_len = 89;
+    memcpy(pax->name, "PaxHeaders/", 11);
+    memcpy(pax->name + 11, base, base_len);
+    tar_octal(pax->size, 12, len);
+    tar_fill_header(pax, wide_time ? 0 : mtime, 0644, 'x');
+    return 2 * 512 + records_size;
+}
+
 /* Create a new archive */
 Archive *archive_create(const char *output_path) {
     Archive *ar = calloc(1, sizeof(Archive));
     if (!ar) return NULL;
     
     strncpy(ar->path, output_path, BACKUP_MAX_PATH - 1);
+    ar->mtime = time(NULL);
+    ar->zero_copy = 1;
     ar->entry_capacity = 64;
     ar->entries = calloc(ar->entry_capacity, sizeof(ArchiveEntry));
     if (!ar->entries) {
@@ -123,9 +234,18 @@ Archive *archive_create(const char *output_path) {
     return ar;
 }
 
+static void archive_entry_free(ArchiveEntry *entry) {
+    free(entry->path);
+    free(entry->source);
+    free(entry->data);
+}
+
 /* Destroy archive builder */
 void archive_destroy(Archive *ar) {
     if (ar) {
+        for (size_t i = 0; i < ar->entry_count; i++) {
+            archive_entry_free(&ar->entries[i]);
+        }
         free(ar->entries);
         free(ar);
     }
@@ -133,6 +253,7 @@ void archive_destroy(Archive *ar) {
 
 /* Add a file to the archive */
 int archive_add_file(Archive *ar, const char *source, const char *dest_path) {
+    if (strlen(dest_path) > ARCHIVE_MAX_NAME) return -1;
     if (!ar || ar->entry_count >= ar->entry_capacity) {
         /* Grow capacity */
         if (ar) {
@@ -147,133 +268,708 @@ int archive_add_file(Archive *ar, const char *source, const char *dest_path) {
         }
     }
     
-    ArchiveEntry *entry = &ar->entries[ar->entry_count++];
-    strncpy(entry->source, source, BACKUP_MAX_PATH - 1);
-    strncpy(entry->path, dest_path, BACKUP_MAX_PATH - 1);
+    ArchiveEntry *entry = &ar->entries[ar->entry_count];
+    memset(entry, 0, sizeof(*entry));
+    entry->source = str_dup(source);
+    entry->path = str_dup(dest_path);
+    if (!entry->source || !entry->path) {
+        archive_entry_free(entry);
+        return -1;
+    }
+    ar->entry_count++;
+    return 0;
+}
+
+/* Add a member whose contents come from memory (copied) */
+int archive_add_data(Archive *ar, const char *dest_path, const char *data, size_t len) {
+    char *copy = malloc(len ? len : 1);
+    if (!copy) return -1;
+    memcpy(copy, data, len);
+    
+    if (archive_add_file(ar, "", dest_path) != 0) {
+        free(copy);
+        return -1;
+    }
     
+    ArchiveEntry *entry = &ar->entries[ar->entry_count - 1];
+    entry->data = copy;
+    entry->data_len = len;
     return 0;
 }
 
-/* Recursively add a directory */
+/* Recursively add a directory, skipping dotfiles (see walk.h for
+ * exclude rules and parallel walks) */
 int archive_add_directory(Archive *ar, const char *dir, const char *prefix) {
+    WalkRules rules;
+    walk_rules_init(&rules);
+    walk_rules_add(&rules, ".*");
+    return walk_directory(ar, dir, prefix, &rules, ar->threads, NULL);
+}
+
+/* Entries up to this size are read whole by the reader threads; larger
+ * files are streamed by the writer so the ring stays bounded. With
+ * zero-copy output, files from ARCHIVE_ZERO_COPY_MIN up are streamed so
+ * the kernel can move their pages straight into the archive. */
+#define ARCHIVE_SLOT_MAX (1024 * 1024)
+#define ARCHIVE_ZERO_COPY_MIN (64 * 1024)
+
+/* Fallback copy buffer, page aligned so reads need no bounce copies */
+#define ARCHIVE_COPY_BUF (1024 * 1024)
+#define ARCHIVE_BUF_ALIGN 4096
+
+/* One prefetched entry */
+typedef struct ArchiveSlot {
+    size_t index;           /* Entry held by this slot */
+    int ready;              /* Filled and waiting for the writer */
+    int skip;               /* Source could not be opened */
+    int stream;             /* Too large to buffer: the writer copies it */
+    size_t size;
+    const char *payload;    /* Contents to write (data or the entry's own) */
+    uint64_t hash;          /* XXH64 of the payload */
+    char *data;
+    size_t data_cap;
+} ArchiveSlot;
+
+static char *archive_buffer_alloc(size_t size) {
 #ifdef _WIN32
-    char pattern[BACKUP_MAX_PATH];
-    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    return _aligned_malloc(size, ARCHIVE_BUF_ALIGN);
+#else
+    void *p = NULL;
+    return posix_memalign(&p, ARCHIVE_BUF_ALIGN, size) == 0 ? p : NULL;
+#endif
+}
+
+static void archive_buffer_free(char *buf) {
+#ifdef _WIN32
+    _aligned_free(buf);
+#else
+    free(buf);
+#endif
+}
+
+/* Make room for size bytes of contents in a slot */
+static int archive_slot_reserve(ArchiveSlot *slot, size_t size) {
+    if (size <= slot->data_cap) return 0;
+    char *data = realloc(slot->data, size);
+    if (!data) return -1;
+    slot->data = data;
+    slot->data_cap = size;
+    return 0;
+}
+
+/* Learn an entry's size and buffer its contents when below stream_min */
+static void archive_read_entry(ArchiveEntry *entry, ArchiveSlot *slot, size_t stream_min) {
+    slot->skip = 0;
+    slot->stream = 0;
+    slot->size = 0;
+    slot->payload = slot->data;
     
-    WIN32_FIND_DATAA fd;
-    HANDLE hFind = FindFirstFileA(pattern, &fd);
-    if (hFind == INVALID_HANDLE_VALUE) return -1;
+    if (entry->data) {
+        slot->size = entry->data_len;
+        slot->payload = entry->data;
+        return;
+    }
     
-    do {
-        if (fd.cFileName[0] == '.') continue;
-        
-        char source[BACKUP_MAX_PATH];
-        char dest[BACKUP_MAX_PATH];
-        snprintf(source, sizeof(source), "%s\\%s", dir, fd.cFileName);
-        
-        if (prefix && prefix[0]) {
-            snprintf(dest, sizeof(dest), "%s/%s", prefix, fd.cFileName);
-        } else {
-            strncpy(dest, fd.cFileName, sizeof(dest) - 1);
+    /* The walk already knows the size: streamed files are left for the
+     * writer to open and empty ones need no open at all */
+    if (entry->has_stat) {
+        slot->size = (size_t)entry->size;
+        if (slot->size > stream_min) {
+            slot->stream = 1;
+            return;
         }
+        if (slot->size == 0) return;
+    }
+
+#ifndef _WIN32
+    int fd = open(entry->source, O_RDONLY);
+    if (fd < 0) {
+        slot->skip = 1;
+        return;
+    }
+    
+    struct stat st;
+    if (!entry->has_stat) {
+        if (fstat(fd, &st) != 0 || st.st_size < 0) {
+            slot->skip = 1;
+            close(fd);
+            return;
+        }
+        slot->size = (size_t)st.st_size;
         
-        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            archive_add_directory(ar, source, dest);
-        } else {
-            archive_add_file(ar, source, dest);
+        /* Only this reader touches the entry until the slot is ready */
+        entry->size = (uint64_t)st.st_size;
+        entry->mtime = (int64_t)st.st_mtime;
+        entry->mode = (unsigned int)(st.st_mode & 07777);
+        entry->has_stat = 1;
+    }
+    
+    if (slot->size > stream_min) {
+        slot->stream = 1;
+    } else if (archive_slot_reserve(slot, slot->size) != 0) {
+        slot->skip = 1;
+    } else {
+        slot->payload = slot->data;
+        
+        size_t got = 0;
+        while (got < slot->size) {
+            ssize_t n = read(fd, slot->data + got, slot->size - got);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            got += (size_t)n;
         }
-    } while (FindNextFileA(hFind, &fd));
+        /* A file that shrank since the walk is zero-filled to the header size */
+        if (got < slot->size) memset(slot->data + got, 0, slot->size - got);
+    }
     
-    FindClose(hFind);
+    close(fd);
 #else
-    DIR *d = opendir(dir);
-    if (!d) return -1;
+    FILE *src = fopen(entry->source, "rb");
+    if (!src) {
+        slot->skip = 1;
+        return;
+    }
     
-    struct dirent *entry;
-    while ((entry = readdir(d)) != NULL) {
-        if (entry->d_name[0] == '.') continue;
+    if (!entry->has_stat) {
+        fseek(src, 0, SEEK_END);
+        long size = ftell(src);
+        fseek(src, 0, SEEK_SET);
+        if (size < 0) {
+            slot->skip = 1;
+            fclose(src);
+            return;
+        }
+        slot->size = (size_t)size;
+    }
+    
+    if (slot->size > stream_min) {
+        slot->stream = 1;
+    } else if (archive_slot_reserve(slot, slot->size) != 0) {
+        slot->skip = 1;
+    } else {
+        slot->payload = slot->data;
         
-        char source[BACKUP_MAX_PATH];
-        char dest[BACKUP_MAX_PATH];
-        snprintf(source, sizeof(source), "%s/%s", dir, entry->d_name);
+        /* A file that shrank since the walk is zero-filled to the header size */
+        size_t got = fread(slot->data, 1, slot->size, src);
+        if (got < slot->size) memset(slot->data + got, 0, slot->size - got);
+    }
+    
+    fclose(src);
+#endif
+}
+
+/* Read an entry and hash the payload for the index, in the reader
+ * threads rather than the writer */
+static void archive_load_entry(ArchiveEntry *entry, ArchiveSlot *slot, size_t stream_min) {
+    archive_read_entry(entry, slot, stream_min);
+    if (!slot->skip && !slot->stream) {
+        slot->hash = hash_xxh64(slot->size ? slot->payload : "", slot->size, 0);
+    }
+}
+
+/* Archive output goes straight to a descriptor through one buffer, so a
+ * pipe's backpressure can be measured; gzip sits on top when enabled */
+#define ARCHIVE_OUT_BUF (256 * 1024)
+
+/* How the writer moves streamed file contents */
+typedef enum ArchiveCopyMode {
+    ARCHIVE_COPY_READ = 0,  /* read() into the aligned buffer */
+    ARCHIVE_COPY_RANGE,     /* copy_file_range: file to file in the kernel */
+    ARCHIVE_COPY_SENDFILE   /* sendfile: file to file or pipe */
+} ArchiveCopyMode;
+
+typedef struct ArchiveSink {
+    int fd;
+    int pipe;               /* Non-blocking pipe: waits are timed as stalls */
+    ArchiveCopyMode copy;   /* Downgraded when the kernel refuses a method */
+    char *buf;
+    size_t len;
+    GzipWriter *gz;
+    ArchiveStats *stats;
+    char *index;            /* Index lines for the records written so far */
+    size_t index_len;
+    size_t index_cap;
+    uint64_t rate_limit;    /* Bytes per second; writes sleep to stay under it */
+    uint64_t rate_bytes;
+    double rate_start;
+    int error;
+} ArchiveSink;
+
+#ifndef _WIN32
+/* The consumer is behind: wait until the pipe drains */
+static void archive_sink_wait(ArchiveSink *sink) {
+    double start = time_now();
+    struct pollfd pfd;
+    pfd.fd = sink->fd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    poll(&pfd, 1, -1);
+    sink->stats->stalls++;
+    sink->stats->stall_seconds += time_now() - start;
+}
+#endif
+
+static void archive_fd_write(ArchiveSink *sink, const char *data, size_t len) {
+    while (len > 0 && !sink->error) {
+#ifdef _WIN32
+        int n = _write(sink->fd, data, (unsigned)len);
+#else
+        ssize_t n = write(sink->fd, data, len);
+#endif
+        if (n > 0) {
+            data += n;
+            len -= (size_t)n;
+            sink->stats->output_bytes += (size_t)n;
+            continue;
+        }
+#ifndef _WIN32
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && sink->pipe && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            archive_sink_wait(sink);
+            continue;
+        }
+#endif
+        sink->error = 1;
+    }
+}
+
+static void archive_sink_flush(ArchiveSink *sink) {
+    archive_fd_write(sink, sink->buf, sink->len);
+    sink->len = 0;
+}
+
+/* Uncompressed bytes to the descriptor */
+static void archive_sink_raw(ArchiveSink *sink, const void *data, size_t len) {
+    if (sink->len + len > ARCHIVE_OUT_BUF) archive_sink_flush(sink);
+    if (len >= ARCHIVE_OUT_BUF) {
+        archive_fd_write(sink, data, len);
+        return;
+    }
+    memcpy(sink->buf + sink->len, data, len);
+    sink->len += len;
+}
+
+static int archive_gzip_out(void *ctx, const void *data, size_t len) {
+    ArchiveSink *sink = ctx;
+    archive_sink_raw(sink, data, len);
+    return sink->error ? -1 : 0;
+}
+
+static void archive_sink_write(ArchiveSink *sink, const void *data, size_t len) {
+    if (sink->rate_limit) {
+        /* Sleep until the stream is back under the limit */
+        sink->rate_bytes += len;
+        double due = sink->rate_start + (double)sink->rate_bytes / (double)sink->rate_limit;
+        double now = time_now();
+        if (due > now) time_sleep(due - now);
+    }
+    
+    if (sink->gz) {
+        gzip_writer_write(sink->gz, data, len);
+    } else {
+        archive_sink_raw(sink, data, len);
+    }
+}
+
+#if defined(__linux__)
+
+/* Move up to size bytes from fd into the archive without a user-space
+ * copy. Returns the bytes moved; the caller reads whatever is left. */
+static size_t archive_copy_kernel(ArchiveSink *sink, int fd, size_t size) {
+    size_t copied = 0;
+    
+    while (copied < size && sink->copy != ARCHIVE_COPY_READ && !sink->error) {
+        size_t want = size - copied;
+        if (want > (1u << 30)) want = 1u << 30;
         
-        if (prefix && prefix[0]) {
-            snprintf(dest, sizeof(dest), "%s/%s", prefix, entry->d_name);
+        ssize_t n;
+        if (sink->copy == ARCHIVE_COPY_RANGE) {
+            n = copy_file_range(fd, NULL, sink->fd, NULL, want, 0);
         } else {
-            strncpy(dest, entry->d_name, sizeof(dest) - 1);
+            n = sendfile(sink->fd, fd, NULL, want);
         }
         
-        struct stat st;
-        if (stat(source, &st) == 0) {
-            if (S_ISDIR(st.st_mode)) {
-                archive_add_directory(ar, source, dest);
-            } else {
-                archive_add_file(ar, source, dest);
-            }
+        if (n > 0) {
+            copied += (size_t)n;
+            sink->stats->output_bytes += (size_t)n;
+            sink->stats->zero_copy_bytes += (size_t)n;
+            continue;
+        }
+        if (n == 0) break;      /* Source shrank */
+        if (errno == EINTR) continue;
+        if (sink->pipe && errno == EAGAIN) {
+            archive_sink_wait(sink);
+            continue;
         }
+        
+        /* Not supported for this pair (pipe output, cross-device, old
+         * kernel): fall back for the rest of the archive */
+        sink->copy = sink->copy == ARCHIVE_COPY_RANGE ? ARCHIVE_COPY_SENDFILE
+                                                      : ARCHIVE_COPY_READ;
     }
+    return copied;
+}
+
+#endif
+
+/* Copy a streamed entry's contents; returns the bytes written. Bytes
+ * that pass through buf are added to hs when it is set. */
+static size_t archive_copy_source(ArchiveSink *sink, const char *source, size_t size,
+                                  char *buf, HashXxh64 *hs) {
+    size_t copied = 0;
+
+#ifndef _WIN32
+    int fd = open(source, O_RDONLY);
+    if (fd < 0) return 0;
+
+#if defined(__linux__)
+    if (!sink->gz && sink->copy != ARCHIVE_COPY_READ) {
+        /* Buffered headers must land before the kernel appends */
+        archive_sink_flush(sink);
+        copied = archive_copy_kernel(sink, fd, size);
+    }
+#endif
     
-    closedir(d);
+    while (copied < size && !sink->error) {
+        size_t want = size - copied < ARCHIVE_COPY_BUF ? size - copied : ARCHIVE_COPY_BUF;
+        ssize_t n = read(fd, buf, want);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        if (hs) hash_xxh64_update(hs, buf, (size_t)n);
+        archive_sink_write(sink, buf, (size_t)n);
+        copied += (size_t)n;
+    }
+    close(fd);
+#else
+    FILE *src = fopen(source, "rb");
+    while (src && copied < size) {
+        size_t want = size - copied < ARCHIVE_COPY_BUF ? size - copied : ARCHIVE_COPY_BUF;
+        size_t n = fread(buf, 1, want, src);
+        if (n == 0) break;
+        if (hs) hash_xxh64_update(hs, buf, n);
+        archive_sink_write(sink, buf, n);
+        copied += n;
+    }
+    if (src) fclose(src);
 #endif
-    return 0;
+    return copied;
 }
 
-/* Finalize and write the archive */
-int archive_finalize(Archive *ar) {
-    if (!ar) return -1;
+/* Append "<offset> <size> <hash> <path>" to the index; hash NULL = unknown */
+static void archive_index_add(ArchiveSink *f, uint64_t offset, size_t size,
+                              const uint64_t *hash, const char *path) {
+    size_t need = strlen(path) + 64;
+    if (f->index_len + need > f->index_cap) {
+        size_t cap = f->index_cap ? f->index_cap * 2 : 64 * 1024;
+        while (cap < f->index_len + need) cap *= 2;
+        char *grown = realloc(f->index, cap);
+        if (!grown) {
+            f->error = 1;
+            return;
+        }
+        f->index = grown;
+        f->index_cap = cap;
+    }
     
-    FILE *f = fopen(ar->path, "wb");
-    if (!f) return -1;
+    char hex[17] = "-";
+    if (hash) snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)*hash);
+    f->index_len += (size_t)snprintf(f->index + f->index_len, f->index_cap - f->index_len,
+                                     "%llu %llu %s %s\n", (unsigned long long)offset,
+                                     (unsigned long long)size, hex, path);
+}
+
+/* Emit a record whose contents are in memory */
+static void archive_write_record(Archive *ar, ArchiveSink *f, const char *name,
+                                 const char *data, size_t len, char *buf) {
+    char header[TAR_HEADER_MAX];
+    size_t header_len = tar_build_header(header, name, len, (int64_t)ar->mtime, 0644);
+    archive_sink_write(f, header, header_len);
+    archive_sink_write(f, data, len);
     
-    char buf[4096];
+    size_t padding = (512 - (len % 512)) % 512;
+    memset(buf, 0, padding);
+    archive_sink_write(f, buf, padding);
+    ar->stats.archive_bytes += header_len + len + padding;
+}
+
+/* Emit one tar record (header, contents, padding) */
+static void archive_write_entry(Archive *ar, ArchiveSink *f, ArchiveEntry *entry,
+                                ArchiveSlot *slot, char *buf) {
+    if (slot->skip) {
+        ar->stats.skipped++;
+        return;
+    }
     
-    for (size_t i = 0; i < ar->entry_count; i++) {
-        ArchiveEntry *entry = &ar->entries[i];
-        
-        /* Get file info */
-        FILE *src = fopen(entry->source, "rb");
-        if (!src) continue;
-        
-        fseek(src, 0, SEEK_END);
-        long size = ftell(src);
-        fseek(src, 0, SEEK_SET);
+    uint64_t offset = ar->stats.archive_bytes;
+    uint64_t hash = slot->hash;
+    int hash_known = 1;
+    
+    /* Write header, with the file's own mtime and mode when known */
+    char header[TAR_HEADER_MAX];
+    size_t header_len = tar_build_header(header, entry->path, slot->size,
+                                         entry->has_stat ? entry->mtime : (int64_t)ar->mtime,
+                                         entry->has_stat ? entry->mode : 0644);
+    archive_sink_write(f, header, header_len);
+    
+    /* Write file content */
+    if (!slot->stream) {
+        archive_sink_write(f, slot->payload, slot->size);
+    } else {
+        /* Streamed files are hashed on the way through unless the manifest
+         * scan already did; kernel copies never pass through user space */
+        HashXxh64 hs;
+        hash_xxh64_init(&hs, 0);
+        size_t kernel_before = f->stats->zero_copy_bytes;
+        size_t remaining = slot->size - archive_copy_source(f, entry->source, slot->size, buf,
+                                                            entry->has_hash ? NULL : &hs);
         
-        if (size < 0) {
-            fclose(src);
-            continue;
+        /* Keep the record the size the header promises */
+        memset(buf, 0, ARCHIVE_COPY_BUF);
+        while (remaining > 0) {
+            size_t n = remaining < ARCHIVE_COPY_BUF ? remaining : ARCHIVE_COPY_BUF;
+            hash_xxh64_update(&hs, buf, n);
+            archive_sink_write(f, buf, n);
+            remaining -= n;
         }
         
-        /* Write header */
-        TarHeader header;
-        tar_init_header(&header, entry->path, (size_t)size, time(NULL));
-        fwrite(&header, 1, 512, f);
-        
-        /* Write file content */
-        size_t remaining = (size_t)size;
-        while (remaining > 0) {
-            size_t to_read = remaining < sizeof(buf) ? remaining : sizeof(buf);
-            size_t read = fread(buf, 1, to_read, src);
-            if (read == 0) break;
-            fwrite(buf, 1, read, f);
-            remaining -= read;
+        if (entry->has_hash) {
+            hash = entry->hash;
+        } else if (f->stats->zero_copy_bytes == kernel_before) {
+            hash = hash_xxh64_final(&hs);
+        } else {
+            hash_known = 0;
         }
+    }
+    
+    /* Pad to 512-byte boundary */
+    size_t padding = (512 - (slot->size % 512)) % 512;
+    if (padding > 0) {
+        memset(buf, 0, padding);
+        archive_sink_write(f, buf, padding);
+    }
+    
+    archive_index_add(f, offset, slot->size, hash_known ? &hash : NULL, entry->path);
+    
+    ar->stats.files++;
+    ar->stats.bytes += slot->size;
+    ar->stats.archive_bytes += header_len + slot->size + padding;
+    if (ar->progress) ar->progress(ar->progress_ctx, ar->stats.files, ar->entry_count);
+}
+
+#ifndef _WIN32
+
+/* Reader threads fill slots in claim order; the writer drains them in
+ * entry order, freeing a slot for entry i + ring once entry i is out */
+typedef struct ArchivePipeline {
+    Archive *ar;
+    ArchiveSlot *slots;
+    size_t ring;
+    size_t stream_min;      /* Larger entries are left to the writer */
+    size_t next;            /* Next entry for a reader to claim */
+    size_t written;         /* Entries consumed by the writer */
+    pthread_mutex_t lock;
+    pthread_cond_t slot_free;
+    pthread_cond_t slot_ready;
+} ArchivePipeline;
+
+static void *archive_reader(void *arg) {
+    ArchivePipeline *p = arg;
+    
+    pthread_mutex_lock(&p->lock);
+    while (p->next < p->ar->entry_count) {
+        size_t i = p->next++;
+        while (i >= p->written + p->ring) {
+            pthread_cond_wait(&p->slot_free, &p->lock);
+        }
+        ArchiveSlot *slot = &p->slots[i % p->ring];
+        pthread_mutex_unlock(&p->lock);
         
-        fclose(src);
+        archive_load_entry(&p->ar->entries[i], slot, p->stream_min);
         
-        /* Pad to 512-byte boundary */
-        size_t padding = (512 - (size % 512)) % 512;
-        if (padding > 0) {
-            memset(buf, 0, padding);
-            fwrite(buf, 1, padding, f);
+        pthread_mutex_lock(&p->lock);
+        slot->index = i;
+        slot->ready = 1;
+        pthread_cond_broadcast(&p->slot_ready);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+/* Returns -1 if no reader thread could be started */
+static int archive_write_parallel(Archive *ar, ArchiveSink *f, int threads,
+                                  size_t stream_min, char *buf) {
+    ArchivePipeline p;
+    memset(&p, 0, sizeof(p));
+    p.ar = ar;
+    p.stream_min = stream_min;
+    p.ring = (size_t)threads * 2;
+    p.slots = calloc(p.ring, sizeof(ArchiveSlot));
+    pthread_t *tids = calloc((size_t)threads, sizeof(pthread_t));
+    if (!p.slots || !tids) {
+        free(p.slots);
+        free(tids);
+        return -1;
+    }
+    
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.slot_free, NULL);
+    pthread_cond_init(&p.slot_ready, NULL);
+    
+    int spawned = 0;
+    for (int t = 0; t < threads; t++) {
+        if (pthread_create(&tids[t], NULL, archive_reader, &p) != 0) break;
+        spawned++;
+    }
+    
+    if (spawned > 0) {
+        for (size_t i = 0; i < ar->entry_count; i++) {
+            ArchiveSlot *slot = &p.slots[i % p.ring];
+            
+            pthread_mutex_lock(&p.lock);
+            while (!slot->ready || slot->index != i) {
+                pthread_cond_wait(&p.slot_ready, &p.lock);
+            }
+            pthread_mutex_unlock(&p.lock);
+            
+            archive_write_entry(ar, f, &ar->entries[i], slot, buf);
+            
+            pthread_mutex_lock(&p.lock);
+            slot->ready = 0;
+            p.written++;
+            pthread_cond_broadcast(&p.slot_free);
+            pthread_mutex_unlock(&p.lock);
+        }
+    }
+    
+    for (int t = 0; t < spawned; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    ar->stats.threads = spawned;
+    
+    for (size_t k = 0; k < p.ring; k++) {
+        free(p.slots[k].data);
+    }
+    free(p.slots);
+    free(tids);
+    pthread_cond_destroy(&p.slot_ready);
+    pthread_cond_destroy(&p.slot_free);
+    pthread_mutex_destroy(&p.lock);
+    return spawned > 0 ? 0 : -1;
+}
+
+#endif
+
+int archive_finalize_to(Archive *ar, FILE *out) {
+    if (!ar || !out) return -1;
+    
+    memset(&ar->stats, 0, sizeof(ar->stats));
+    double start = time_now();
+    
+    ArchiveSink sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.fd = fileno(out);
+    sink.stats = &ar->stats;
+    sink.rate_limit = ar->rate_limit;
+    sink.rate_start = start;
+
+#ifndef _WIN32
+    struct stat st;
+    if (fstat(sink.fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        int flags = fcntl(sink.fd, F_GETFL);
+        if (flags >= 0 && fcntl(sink.fd, F_SETFL, flags | O_NONBLOCK) == 0) {
+            sink.pipe = 1;
+        }
+        ar->stats.streamed = 1;
+    }
+#endif
+    
+    char *buf = archive_buffer_alloc(ARCHIVE_COPY_BUF);
+    sink.buf = archive_buffer_alloc(ARCHIVE_OUT_BUF);
+    if (!buf || !sink.buf) {
+        archive_buffer_free(buf);
+        archive_buffer_free(sink.buf);
+        return -1;
+    }
+    
+    int threads = ar->threads > 0 ? ar->threads : parallel_cpu_count();
+    
+    if (ar->compress) {
+        sink.gz = gzip_writer_create(archive_gzip_out, &sink, ar->level, threads);
+        if (!sink.gz) {
+            archive_buffer_free(buf);
+            archive_buffer_free(sink.buf);
+            return -1;
+        }
+    }
+    
+    /* Kernel copies only apply to the raw tar stream */
+    size_t stream_min = ARCHIVE_SLOT_MAX;
+#if defined(__linux__)
+    if (ar->zero_copy && !sink.gz) {
+        sink.copy = sink.pipe ? ARCHIVE_COPY_SENDFILE : ARCHIVE_COPY_RANGE;
+        stream_min = ARCHIVE_ZERO_COPY_MIN;
+    }
+#endif
+    
+    if ((size_t)threads > ar->entry_count) threads = (int)ar->entry_count;
+    
+    int done = -1;
+#ifndef _WIN32
+    if (threads > 1) {
+        done = archive_write_parallel(ar, &sink, threads, stream_min, buf);
+    }
+#endif
+    
+    /* Serial path: read and write each entry in turn */
+    if (done != 0) {
+        ArchiveSlot slot;
+        memset(&slot, 0, sizeof(slot));
+        for (size_t i = 0; i < ar->entry_count; i++) {
+            archive_load_entry(&ar->entries[i], &slot, stream_min);
+            archive_write_entry(ar, &sink, &ar->entries[i], &slot, buf);
         }
+        free(slot.data);
+        ar->stats.threads = 1;
     }
     
+    /* Trailing index, then the locator pointing at it */
+    uint64_t index_offset = ar->stats.archive_bytes;
+    archive_write_record(ar, &sink, ARCHIVE_INDEX_NAME, sink.index ? sink.index : "",
+                         sink.index_len, buf);
+    
+    char locator[128];
+    int locator_len = snprintf(locator, sizeof(locator), "%s %llu %llu\n",
+                               ARCHIVE_LOCATOR_MAGIC, (unsigned long long)index_offset,
+                               (unsigned long long)sink.index_len);
+    archive_write_record(ar, &sink, ARCHIVE_LOCATOR_NAME, locator, (size_t)locator_len, buf);
+    free(sink.index);
+    
     /* Write two empty blocks to end archive */
     memset(buf, 0, 1024);
-    fwrite(buf, 1, 1024, f);
+    archive_sink_write(&sink, buf, 1024);
+    ar->stats.archive_bytes += 1024;
     
-    fclose(f);
-    return 0;
+    int result = 0;
+    if (sink.gz && gzip_writer_finish(sink.gz) != 0) result = -1;
+    archive_sink_flush(&sink);
+    if (sink.error) result = -1;
+    
+    archive_buffer_free(buf);
+    archive_buffer_free(sink.buf);
+    ar->stats.seconds = time_now() - start;
+    return result;
+}
+
+/* Finalize and write the archive */
+int archive_finalize(Archive *ar) {
+    if (!ar) return -1;
+    
+    FILE *f = fopen(ar->path, "wb");
+    if (!f) return -1;
+    
+    int result = archive_finalize_to(ar, f);
+    if (fclose(f) != 0) result = -1;
+    return result;
 }
 
 /* Initialize backup variables */
@@ -336,6 +1032,8 @@ int backup_substitute(char *out, size_t out_size,
                     value = vars->date;
                 } else if (strncmp(src + 1, "time", var_len) == 0) {
                     value = vars->time_str;
+                } else if (strncmp(src + 1, "stdin", var_len) == 0) {
+                    value = "";     /* Marker only: see backup_stream */
                 }
                 
                 if (value) {
@@ -367,6 +1065,13 @@ int backup_config_load(BackupConfig *cfg, const char *ini_path) {
     cfg->settings.threshold_mb = 100;
     cfg->settings.interval = 0;
     strcpy(cfg->settings.archive_format, "tar");
+    cfg->settings.compression_level = DEFLATE_DEFAULT_LEVEL;
+    cfg->settings.zero_copy = 1;
+    cfg->settings.low_priority = 1;
+    cfg->settings.scheduled_incremental = 1;
+    walk_rules_init(&cfg->settings.exclude);
+    walk_rules_add(&cfg->settings.exclude, ".*");
+    int custom_exclude = 0;
     
     FILE *f = fopen(ini_path, "r");
     if (!f) return -1;
@@ -406,6 +1111,19 @@ int backup_config_load(BackupConfig *cfg, const char *ini_path) {
                         sizeof(cfg->settings.archive_format) - 1);
             } else if (strcmp(key, "temp_dir") == 0) {
                 strncpy(cfg->settings.temp_dir, value, BACKUP_MAX_PATH - 1);
+            } else if (strcmp(key, "threads") == 0) {
+                cfg->settings.threads = atoi(value);
+            } else if (strcmp(key, "compression_level") == 0) {
+                cfg->settings.compression_level = atoi(value);
+            } else if (strcmp(key, "zero_copy") == 0) {
+                cfg->settings.zero_copy = atoi(value);
+            } else if (strcmp(key, "exclude") == 0) {
+                /* Any exclude= line replaces the dotfile default */
+                if (!custom_exclude) {
+                    walk_rules_init(&cfg->settings.exclude);
+                    custom_exclude = 1;
+                }
+                walk_rules_add(&cfg->settings.exclude, value);
             }
         } else if (strcmp(section, "destinations") == 0) {
             if (cfg->dest_count < BACKUP_MAX_DESTINATIONS) {
@@ -416,6 +1134,14 @@ int backup_config_load(BackupConfig *cfg, const char *ini_path) {
         } else if (strcmp(section, "schedule") == 0) {
             if (strcmp(key, "destination") == 0) {
                 strncpy(cfg->settings.default_dest, value, BACKUP_MAX_NAME - 1);
+            } else if (strcmp(key, "interval") == 0) {
+                cfg->settings.interval = atoi(value);
+            } else if (strcmp(key, "rate_limit_kb") == 0) {
+                cfg->settings.rate_limit_kb = atoi(value);
+            } else if (strcmp(key, "low_priority") == 0) {
+                cfg->settings.low_priority = atoi(value);
+            } else if (strcmp(key, "incremental") == 0) {
+                cfg->settings.scheduled_incremental = atoi(value);
             }
         }
     }
@@ -457,11 +1183,207 @@ int backup_execute(BackupConfig *cfg, const char *dest_name,
     return system(cmd);
 }
 
-/* High-level backup operation */
-int backup_project(BackupConfig *cfg, const char *dest_name,
-                   const char *project_dir, int include_history) {
+/* Project name used for archive and manifest names */
+static void backup_project_name(const char *project_dir, char *out, size_t out_size) {
+    char cwd[BACKUP_MAX_PATH];
+    const char *dir = project_dir;
+    
+    /* "." and "./" name the current directory */
+    if (strcmp(dir, ".") == 0 || strcmp(dir, "./") == 0 || dir[0] == '\0') {
+#ifdef _WIN32
+        if (_getcwd(cwd, sizeof(cwd))) dir = cwd;
+#else
+        if (getcwd(cwd, sizeof(cwd))) dir = cwd;
+#endif
+    }
+    
+    const char *name = strrchr(dir, PATH_SEP);
+    if (!name) name = strrchr(dir, '/');
+    if (!name) name = dir;
+    else name++;
+    
+    snprintf(out, out_size, "%s", name[0] ? name : "project");
+}
+
+/* Metadata members stored in incremental archives */
+#define BACKUP_META_DIR ".tedit-backup"
+
+static int backup_add_metadata(Archive *ar, const Manifest *old, const char *archive_name,
+                               const char **deleted, size_t deleted_count) {
+    size_t cap = 256;
+    for (size_t i = 0; i < deleted_count; i++) cap += strlen(deleted[i]) + 1;
+    
+    char *text = malloc(cap);
+    if (!text) return -1;
+    
+    size_t len = 0;
+    for (size_t i = 0; i < deleted_count; i++) {
+        len += (size_t)snprintf(text + len, cap - len, "%s\n", deleted[i]);
+    }
+    int result = archive_add_data(ar, BACKUP_META_DIR "/deleted", text, len);
+    
+    len = (size_t)snprintf(text, cap,
+                           "type=incremental\nbase=%s\nparent=%s\nsequence=%d\narchive=%s\n",
+                           old->base, old->parent, old->sequence + 1, archive_name);
+    if (result == 0) {
+        result = archive_add_data(ar, BACKUP_META_DIR "/chain", text, len);
+    }
+    
+    free(text);
+    return result;
+}
+
+/* archive_format selects gzip; anything else is written as plain tar */
+static int backup_compressed(BackupConfig *cfg) {
+    const char *fmt = cfg->settings.archive_format;
+    return strcmp(fmt, "tar.gz") == 0 || strcmp(fmt, "tgz") == 0;
+}
+
+/* Destinations containing {stdin} read the archive from a pipe */
+static int backup_stream(BackupConfig *cfg, Archive *ar, BackupDest *dest,
+                         const char *project_dir) {
+    BackupVars vars;
+    backup_vars_init(&vars, ar->path, project_dir, NULL, NULL);
+    
+    char cmd[1024];
+    backup_substitute(cmd, sizeof(cmd), dest->command, &vars);
+    
+    fflush(stdout);
+    FILE *pipe = popen(cmd, PIPE_WRITE_MODE);
+    if (!pipe) return -1;
+    
+    /* SIGPIPE is ignored from startup, so a command that exits early
+     * fails the write instead of killing us */
+    int result = archive_finalize_to(ar, pipe);
+    int status = pclose(pipe);
+    
+    cfg->last_stats = ar->stats;
+    if (result != 0 || status != 0) return -1;
+    
+    if (snprintf(cfg->last_archive, sizeof(cfg->last_archive), "%s",
+                 ar->path) >= (int)sizeof(cfg->last_archive)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Write the archive and hand it to the destination command */
+static int backup_send(BackupConfig *cfg, Archive *ar, const char *dest_name,
+                       const char *project_dir) {
+    ar->threads = cfg->settings.threads;
+    ar->compress = backup_compressed(cfg);
+    ar->level = cfg->settings.compression_level;
+    ar->rate_limit = cfg->rate_limit;
+    ar->progress = cfg->progress;
+    ar->progress_ctx = cfg->progress_ctx;
+    
+    /* Kernel copies would bypass the rate limit */
+    ar->zero_copy = cfg->settings.zero_copy && !ar->rate_limit;
+    
+    BackupDest *dest = backup_config_get_dest(cfg, dest_name);
+    if (dest && strstr(dest->command, "{stdin}")) {
+        return backup_stream(cfg, ar, dest, project_dir);
+    }
+    
+    int result = archive_finalize(ar);
+    cfg->last_stats = ar->stats;
+    if (result != 0) return result;
+    
+    if (snprintf(cfg->last_archive, sizeof(cfg->last_archive), "%s",
+                 ar->path) >= (int)sizeof(cfg->last_archive)) {
+        return -1;
+    }
+    return backup_execute(cfg, dest_name, project_dir, ar->path);
+}
+
+/* Collect the project's files under files/ in one walk */
+static int backup_walk(BackupConfig *cfg, Archive *ar, const char *project_dir) {
+    /* Archives are written to the working directory, which is often the
+     * project itself: never back up earlier backups */
+    char project_name[BACKUP_MAX_PATH];
+    char backups[WALK_MAX_PATTERN];
+    char incrementals[WALK_MAX_PATTERN];
+    backup_project_name(project_dir, project_name, sizeof(project_name));
+    
+    int n1 = snprintf(backups, sizeof(backups), "/%s-backup-*.tar*", project_name);
+    int n2 = snprintf(incrementals, sizeof(incrementals), "/%s-incr-*.tar*", project_name);
+    if (n1 < 0 || n1 >= (int)sizeof(backups) ||
+        n2 < 0 || n2 >= (int)sizeof(incrementals)) {
+        return -1;
+    }
+    
+    WalkRules rules = cfg->settings.exclude;
+    if (walk_rules_add(&rules, backups) != 0 ||
+        walk_rules_add(&rules, incrementals) != 0) {
+        return -1;
+    }
+    
+    return walk_directory(ar, project_dir, "files", &rules, cfg->settings.threads,
+                          &cfg->last_walk);
+}
+
+/* Store a snapshot in a deduplicating repository (repo:<path>) */
+static int backup_run_repo(BackupConfig *cfg, const char *repo_template,
+                           const char *project_dir, const char *project_name) {
+    BackupVars vars;
+    backup_vars_init(&vars, NULL, project_dir, NULL, NULL);
+    
+    char repo_path[BACKUP_MAX_PATH];
+    backup_substitute(repo_path, sizeof(repo_path), repo_template, &vars);
+    
+    DedupRepo repo;
+    if (dedup_open(&repo, repo_path, 1) != 0) return -1;
+    
+    Archive *ar = archive_create("");
+    if (!ar) {
+        dedup_close(&repo);
+        return -1;
+    }
+    if (backup_walk(cfg, ar, project_dir) != 0) {
+        archive_destroy(ar);
+        dedup_close(&repo);
+        return -1;
+    }
+    
+    cfg->last_to_repo = 1;
+    int result = dedup_backup(&repo, ar, project_name, cfg->settings.threads,
+                              cfg->last_archive, sizeof(cfg->last_archive),
+                              &cfg->last_repo);
+    
+    archive_destroy(ar);
+    dedup_close(&repo);
+    return result;
+}
+
+static int backup_run(BackupConfig *cfg, const char *dest_name,
+                      const char *project_dir, int incremental) {
     if (!cfg || !dest_name || !project_dir) return -1;
     
+    memset(&cfg->last_stats, 0, sizeof(cfg->last_stats));
+    memset(&cfg->last_diff, 0, sizeof(cfg->last_diff));
+    memset(&cfg->last_repo, 0, sizeof(cfg->last_repo));
+    memset(&cfg->last_walk, 0, sizeof(cfg->last_walk));
+    cfg->last_to_repo = 0;
+    cfg->last_archive[0] = '\0';
+    
+    char project_name[BACKUP_MAX_PATH];
+    backup_project_name(project_dir, project_name, sizeof(project_name));
+    
+    /* Repositories deduplicate on their own; no archive or manifest */
+    BackupDest *dest = backup_config_get_dest(cfg, dest_name);
+    if (dest && strncmp(dest->command, "repo:", 5) == 0) {
+        return backup_run_repo(cfg, dest->command + 5, project_dir, project_name);
+    }
+    
+    /* Previous manifest; an incremental backup needs its base */
+    char manifest_path[BACKUP_MAX_PATH];
+    manifest_get_path(cfg->ini_path, project_name, manifest_path, sizeof(manifest_path));
+    
+    Manifest old;
+    manifest_load(&old, manifest_path);
+    if (incremental && !old.base[0]) incremental = 0;
+    cfg->last_incremental = incremental;
+    
     /* Generate archive name */
     char archive_name[BACKUP_MAX_PATH];
     time_t now = time(NULL);
@@ -469,35 +1391,129 @@ int backup_project(BackupConfig *cfg, const char *dest_name,
     char timestamp[32];
     strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", tm);
     
-    const char *dirname = strrchr(project_dir, PATH_SEP);
-    if (!dirname) dirname = strrchr(project_dir, '/');
-    if (!dirname) dirname = project_dir;
-    else dirname++;
-    
-    snprintf(archive_name, sizeof(archive_name), "%s-backup-%s.tar",
-             dirname, timestamp);
+    int name_len = snprintf(archive_name, sizeof(archive_name), "%s-%s-%s.%s",
+                            project_name, incremental ? "incr" : "backup", timestamp,
+                            backup_compressed(cfg) ? "tar.gz" : "tar");
+    if (name_len < 0 || name_len >= (int)sizeof(archive_name)) {
+        manifest_free(&old);
+        return -1;
+    }
     
     /* Create archive */
     Archive *ar = archive_create(archive_name);
-    if (!ar) return -1;
+    if (!ar) {
+        manifest_free(&old);
+        return -1;
+    }
     
-    /* Add project files (excluding .tedit-history unless requested) */
-    /* For simplicity, add all files in project_dir */
-    archive_add_directory(ar, project_dir, "files");
+    /* Add project files (.tedit-history files are included when present) */
+    if (backup_walk(cfg, ar, project_dir) != 0) {
+        archive_destroy(ar);
+        manifest_free(&old);
+        return -1;
+    }
     
-    /* Optionally add history files */
-    if (include_history) {
-        /* History files are .tedit-history alongside source files */
-        /* They're already included if in project_dir */
+    /* Diff against the manifest: stat everything, hash only what changed */
+    unsigned char *changes = calloc(ar->entry_count ? ar->entry_count : 1, 1);
+    Manifest next;
+    const char **deleted = NULL;
+    if (!changes || manifest_scan(&old, ar, cfg->settings.threads, &next, changes,
+                                  &deleted, &cfg->last_diff) != 0) {
+        free(changes);
+        archive_destroy(ar);
+        manifest_free(&old);
+        return -1;
     }
     
-    int result = archive_finalize(ar);
+    BackupDiffStats *diff = &cfg->last_diff;
+    int changed = diff->added + diff->modified + diff->deleted > 0;
+    int result = 0;
+    
+    if (incremental && changed) {
+        /* Keep only added and modified files */
+        size_t kept = 0;
+        for (size_t i = 0; i < ar->entry_count; i++) {
+            if (changes[i] == MANIFEST_ADDED || changes[i] == MANIFEST_MODIFIED) {
+                ar->entries[kept++] = ar->entries[i];
+            } else {
+                archive_entry_free(&ar->entries[i]);
+            }
+        }
+        ar->entry_count = kept;
+        result = backup_add_metadata(ar, &old, archive_name, deleted, diff->deleted);
+    }
+    
+    /* An incremental backup with nothing changed creates no archive */
+    if (result == 0 && (changed || !incremental)) {
+        result = backup_send(cfg, ar, dest_name, project_dir);
+        
+        /* Advance the chain only once the archive reached its destination */
+        if (result == 0) {
+            const char *base = incremental ? old.base : archive_name;
+            if (snprintf(next.base, sizeof(next.base), "%s", base) >= (int)sizeof(next.base) ||
+                snprintf(next.parent, sizeof(next.parent), "%s",
+                         archive_name) >= (int)sizeof(next.parent)) {
+                result = -1;
+            } else {
+                next.sequence = incremental ? old.sequence + 1 : 0;
+                manifest_save(&next, manifest_path);
+            }
+        }
+    }
+    
+    free(deleted);
+    free(changes);
+    manifest_free(&next);
+    manifest_free(&old);
     archive_destroy(ar);
+    return result;
+}
+
+/* High-level backup operation */
+int backup_project(BackupConfig *cfg, const char *dest_name,
+                   const char *project_dir, int include_history) {
+    /* History files live alongside sources and are always included */
+    (void)include_history;
+    return backup_run(cfg, dest_name, project_dir, 0);
+}
+
+int backup_project_incremental(BackupConfig *cfg, const char *dest_name,
+                               const char *project_dir) {
+    return backup_run(cfg, dest_name, project_dir, 1);
+}
+
+int backup_project_changed(BackupConfig *cfg, const char *project_dir) {
+    char project_name[BACKUP_MAX_PATH];
+    char manifest_path[BACKUP_MAX_PATH];
+    backup_project_name(project_dir, project_name, sizeof(project_name));
+    manifest_get_path(cfg->ini_path, project_name, manifest_path, sizeof(manifest_path));
     
-    if (result != 0) return result;
+    Manifest old;
+    if (manifest_load(&old, manifest_path) != 0) return 1;
+    
+    Archive *ar = archive_create("");
+    if (!ar) {
+        manifest_free(&old);
+        return 1;
+    }
+    if (backup_walk(cfg, ar, project_dir) != 0) {
+        archive_destroy(ar);
+        manifest_free(&old);
+        return 1;
+    }
     
-    /* Execute backup destination command */
-    return backup_execute(cfg, dest_name, project_dir, archive_name);
+    /* Same number of files and every one found unchanged: nothing deleted */
+    int changed = ar->entry_count != old.count;
+    for (size_t i = 0; i < ar->entry_count && !changed; i++) {
+        const ArchiveEntry *entry = &ar->entries[i];
+        const ManifestRecord *rec = manifest_find(&old, entry->path);
+        changed = !rec || !entry->has_stat || rec->size != entry->size ||
+                  rec->mtime != entry->mtime;
+    }
+    
+    archive_destroy(ar);
+    manifest_free(&old);
+    return changed;
 }
 
 /* Get default backup.ini path */
@@ -0,0 +1,772 @@
+/*
+ * blocks.c - Bracket and block nesting index
+ *
+ * Lines are kept in chunks of up to BLOCKS_CHUNK_LINES, each holding the
+ * length, event count and lexer state of its lines and their events. The
+ * chunks form a treap in document order; every node also holds the line
+ * and byte totals of its subtree and, per kind, how many openers it leaves
+ * unclosed and closers unopened. Offsets are found by summing those totals
+ * on the way down, and a partner by skipping whole subtrees whose pending
+ * counts cannot close the search, so lookups are O(log n) and an edit
+ * only rebuilds the chunks holding the lines it touched.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "blocks.h"
+
+#define BLOCKS_MAX_TOKENS 256
+#define BLOCKS_MAX_LINE_EVENTS 256
+#define BLOCKS_CHUNK_LINES 64
+
+/* Lexer state at the start of a line */
+#define LEX_CODE    0
+#define LEX_COMMENT 1   /* Inside a C block comment */
+
+/* Keyword openers/closers (matched case-insensitively) */
+typedef struct BlockWord {
+    const char *word;
+    uint8_t kind;
+    uint8_t open;
+} BlockWord;
+
+/* Repeat blocks (rept, irp, for, ...) end with endm like macros */
+static const BlockWord masm_words[] = {
+    { "proc",   BLOCK_PROC,  1 }, { "endp",   BLOCK_PROC,  0 },
+    { "macro",  BLOCK_MACRO, 1 }, { "endm",   BLOCK_MACRO, 0 },
+    { "rept",   BLOCK_MACRO, 1 }, { "irp",    BLOCK_MACRO, 1 },
+    { "irpc",   BLOCK_MACRO, 1 }, { "for",    BLOCK_MACRO, 1 },
+    { "forc",   BLOCK_MACRO, 1 }, { "while",  BLOCK_MACRO, 1 },
+    { "if",     BLOCK_IF,    1 }, { "ife",    BLOCK_IF,    1 },
+    { "ifdef",  BLOCK_IF,    1 }, { "ifndef", BLOCK_IF,    1 },
+    { "ifb",    BLOCK_IF,    1 }, { "ifnb",   BLOCK_IF,    1 },
+    { ".if",    BLOCK_IF,    1 }, { "endif",  BLOCK_IF,    0 },
+    { ".endif", BLOCK_IF,    0 },
+    { NULL, 0, 0 }
+};
+
+static const BlockWord gas_words[] = {
+    { ".macro", BLOCK_MACRO, 1 }, { ".endm",  BLOCK_MACRO, 0 },
+    { ".if",    BLOCK_IF,    1 }, { ".ifdef", BLOCK_IF,    1 },
+    { ".ifndef", BLOCK_IF,   1 }, { ".endif", BLOCK_IF,    0 },
+    { NULL, 0, 0 }
+};
+
+/* C preprocessor conditionals, matched after '#' */
+static const BlockWord cpp_words[] = {
+    { "if",     BLOCK_IF,    1 }, { "ifdef",  BLOCK_IF,    1 },
+    { "ifndef", BLOCK_IF,    1 }, { "endif",  BLOCK_IF,    0 },
+    { NULL, 0, 0 }
+};
+
+static const BlockWord *find_word(const BlockWord *list, const char *s, size_t len) {
+    for (int i = 0; list[i].word; i++) {
+        if (strlen(list[i].word) == len && strncasecmp(list[i].word, s, len) == 0) {
+            return &list[i];
+        }
+    }
+    return NULL;
+}
+
+/* Tokenize a stretch of code (no comment open at its start) and collect
+ * its block events, with columns offset by base. Returns the offset just
+ * past a C block comment opener, or SIZE_MAX if none. */
+static size_t scan_code(Language lang, const char *line, size_t len, size_t base,
+                        BlockEvent *out, size_t max, size_t *count) {
+    SyntaxToken tok[BLOCKS_MAX_TOKENS];
+    int n = syntax_tokenize_line(lang, line, len, tok, BLOCKS_MAX_TOKENS);
+    
+    const BlockWord *words = NULL;
+    if (lang == LANG_MASM64 || lang == LANG_MASM32) words = masm_words;
+    else if (lang == LANG_AMD64 || lang == LANG_AARCH64) words = gas_words;
+    
+    for (int t = 0; t < n; t++) {
+        const char *s = line + tok[t].start;
+        uint8_t kind = 0, open = 0;
+        
+        if (tok[t].type == TOK_OPERATOR) {
+            if (lang == LANG_COSMO_C && s[0] == '/' && t + 1 < n &&
+                tok[t+1].start == tok[t].start + 1 && s[1] == '*') {
+                return tok[t].start + 2;
+            }
+            
+            switch (s[0]) {
+                case '{': kind = BLOCK_BRACE;   open = 1; break;
+                case '}': kind = BLOCK_BRACE;   open = 0; break;
+                case '(': kind = BLOCK_PAREN;   open = 1; break;
+                case ')': kind = BLOCK_PAREN;   open = 0; break;
+                case '[': kind = BLOCK_BRACKET; open = 1; break;
+                case ']': kind = BLOCK_BRACKET; open = 0; break;
+                default: break;
+            }
+            
+            /* #if / #ifdef / #ifndef / #endif */
+            if (s[0] == '#' && t == 0 && base == 0 && lang == LANG_COSMO_C && n > 1) {
+                const BlockWord *w = find_word(cpp_words, line + tok[1].start, tok[1].length);
+                if (w) {
+                    kind = w->kind;
+                    open = w->open;
+                }
+            }
+        } else if (words &&
+                   (tok[t].type == TOK_IDENTIFIER || tok[t].type == TOK_DIRECTIVE)) {
+            const BlockWord *w = find_word(words, s, tok[t].length);
+            if (w) {
+                kind = w->kind;
+                open = w->open;
+            }
+        }
+        
+        if (kind && *count < max) {
+            out[*count].col = (uint32_t)(base + tok[t].start);
+            out[*count].kind = kind;
+            out[*count].open = open;
+            out[*count].reserved = 0;
+            (*count)++;
+        }
+    }
+    return SIZE_MAX;
+}
+
+/* Collect the block events of one line. *state is the lexer state at the
+ * start of the line and is left at the state for the next one. */
+static size_t scan_line(Language lang, const char *line, size_t len,
+                        uint8_t *state, BlockEvent *out, size_t max) {
+    size_t count = 0;
+    size_t pos = 0;
+    
+    for (;;) {
+        if (*state == LEX_COMMENT) {
+            /* Comment bodies are skipped as raw text: a quote or bracket
+             * inside one must not be tokenized */
+            size_t i = pos;
+            while (i + 1 < len && !(line[i] == '*' && line[i+1] == '/')) i++;
+            if (i + 1 >= len) break;
+            pos = i + 2;
+            *state = LEX_CODE;
+        }
+        
+        size_t stop = scan_code(lang, line + pos, len - pos, pos, out, max, &count);
+        if (stop == SIZE_MAX) break;
+        pos += stop;
+        *state = LEX_COMMENT;
+    }
+    return count;
+}
+
+typedef struct BlockLine {
+    size_t len;             /* Bytes, including the newline */
+    uint16_t events;        /* Events on the line */
+    uint8_t state;          /* Lexer state at its start */
+} BlockLine;
+
+struct BlockChunk {
+    BlockChunk *left;
+    BlockChunk *right;
+    uint32_t priority;
+    uint32_t line_count;
+    size_t bytes;
+    BlockEvent *events;
+    size_t event_count;
+    uint32_t open[BLOCK_KIND_COUNT];        /* Openers unclosed in the chunk */
+    uint32_t close[BLOCK_KIND_COUNT];       /* Closers unopened in the chunk */
+    size_t sub_lines;                       /* Totals over the subtree */
+    size_t sub_bytes;
+    uint32_t sub_open[BLOCK_KIND_COUNT];
+    uint32_t sub_close[BLOCK_KIND_COUNT];
+    BlockLine lines[BLOCKS_CHUNK_LINES];
+};
+
+/* ==========================================================================
+ * Chunk treap
+ * ========================================================================== */
+
+/* Pending counts of a sequence followed by one with pending bo/bc: b's
+ * closers first close a's open openers */
+static void combine(uint32_t *open, uint32_t *close,
+                    const uint32_t *bo, const uint32_t *bc) {
+    for (int k = 0; k < BLOCK_KIND_COUNT; k++) {
+        uint32_t m = open[k] < bc[k] ? open[k] : bc[k];
+        close[k] += bc[k] - m;
+        open[k] = open[k] - m + bo[k];
+    }
+}
+
+static void update(BlockChunk *c) {
+    c->sub_lines = c->line_count;
+    c->sub_bytes = c->bytes;
+    if (c->left) {
+        c->sub_lines += c->left->sub_lines;
+        c->sub_bytes += c->left->sub_bytes;
+        memcpy(c->sub_open, c->left->sub_open, sizeof(c->sub_open));
+        memcpy(c->sub_close, c->left->sub_close, sizeof(c->sub_close));
+        combine(c->sub_open, c->sub_close, c->open, c->close);
+    } else {
+        memcpy(c->sub_open, c->open, sizeof(c->sub_open));
+        memcpy(c->sub_close, c->close, sizeof(c->sub_close));
+    }
+    if (c->right) {
+        c->sub_lines += c->right->sub_lines;
+        c->sub_bytes += c->right->sub_bytes;
+        combine(c->sub_open, c->sub_close, c->right->sub_open, c->right->sub_close);
+    }
+}
+
+/* a gets the chunks whose first line is before line k, b the rest */
+static void split(BlockChunk *t, size_t k, BlockChunk **a, BlockChunk **b) {
+    if (!t) {
+        *a = *b = NULL;
+        return;
+    }
+    size_t left = t->left ? t->left->sub_lines : 0;
+    if (left < k) {
+        size_t through = left + t->line_count;
+        split(t->right, k > through ? k - through : 0, &t->right, b);
+        *a = t;
+    } else {
+        split(t->left, k, a, &t->left);
+        *b = t;
+    }
+    update(t);
+}
+
+static BlockChunk *merge(BlockChunk *a, BlockChunk *b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->priority > b->priority) {
+        a->right = merge(a->right, b);
+        update(a);
+        return a;
+    }
+    b->left = merge(a, b->left);
+    update(b);
+    return b;
+}
+
+static void free_tree(BlockChunk *t) {
+    if (t) {
+        free_tree(t->left);
+        free_tree(t->right);
+        free(t->events);
+        free(t);
+    }
+}
+
+/* Chunk holding line (the last one if line is past the end), with the
+ * line's index in it and the chunk's first line and byte offset */
+static BlockChunk *locate(BlockChunk *t, size_t line, size_t *local,
+                          size_t *chunk_line, size_t *chunk_byte) {
+    size_t base_line = 0, base_byte = 0;
+    for (;;) {
+        size_t left_lines = t->left ? t->left->sub_lines : 0;
+        size_t left_bytes = t->left ? t->left->sub_bytes : 0;
+        if (t->left && line < left_lines) {
+            t = t->left;
+            continue;
+        }
+        line -= left_lines;
+        if (line < t->line_count || !t->right) {
+            if (line >= t->line_count) line = t->line_count - 1;
+            *local = line;
+            *chunk_line = base_line + left_lines;
+            *chunk_byte = base_byte + left_bytes;
+            return t;
+        }
+        line -= t->line_count;
+        base_line += left_lines + t->line_count;
+        base_byte += left_bytes + t->bytes;
+        t = t->right;
+    }
+}
+
+/* First chunk starting at or after line `from` in which `need` more
+ * closers of kind than openers have been seen; *at is its first line.
+ * need is left at what the chunks before it did not close. */
+static BlockChunk *seek_closer(BlockChunk *t, size_t base, size_t from,
+                               int kind, uint32_t *need, size_t *at) {
+    if (!t || base + t->sub_lines <= from) return NULL;
+    if (base >= from && t->sub_close[kind] < *need) {
+        *need = *need - t->sub_close[kind] + t->sub_open[kind];
+        return NULL;
+    }
+    
+    size_t self = base + (t->left ? t->left->sub_lines : 0);
+    BlockChunk *c = seek_closer(t->left, base, from, kind, need, at);
+    if (c) return c;
+    if (self >= from) {
+        if (t->close[kind] >= *need) {
+            *at = self;
+            return t;
+        }
+        *need = *need - t->close[kind] + t->open[kind];
+    }
+    return seek_closer(t->right, self + t->line_count, from, kind, need, at);
+}
+
+/* Mirror of seek_closer: the last chunk ending at or before line `to`
+ * that holds the opener `need` levels out */
+static BlockChunk *seek_opener(BlockChunk *t, size_t base, size_t to,
+                               int kind, uint32_t *need, size_t *at) {
+    if (!t || base >= to) return NULL;
+    if (base + t->sub_lines <= to && t->sub_open[kind] < *need) {
+        *need = *need - t->sub_open[kind] + t->sub_close[kind];
+        return NULL;
+    }
+    
+    size_t self = base + (t->left ? t->left->sub_lines : 0);
+    BlockChunk *c = seek_opener(t->right, self + t->line_count, to, kind, need, at);
+    if (c) return c;
+    if (self + t->line_count <= to) {
+        if (t->open[kind] >= *need) {
+            *at = self;
+            return t;
+        }
+        *need = *need - t->open[kind] + t->close[kind];
+    }
+    return seek_opener(t->left, base, to, kind, need, at);
+}
+
+/* ==========================================================================
+ * Scanning
+ * ========================================================================== */
+
+/* Lines waiting to be packed into chunks, with their events in order */
+typedef struct LineScan {
+    BlockLine *lines;
+    size_t line_count;
+    size_t line_cap;
+    BlockEvent *events;
+    size_t event_count;
+    size_t event_cap;
+    uint8_t state;          /* Lexer state after the last line */
+} LineScan;
+
+static void line_scan_init(LineScan *ls, uint8_t state) {
+    memset(ls, 0, sizeof(*ls));
+    ls->state = state;
+}
+
+static void line_scan_free(LineScan *ls) {
+    free(ls->lines);
+    free(ls->events);
+}
+
+static int line_scan_reserve(LineScan *ls, size_t lines, size_t events) {
+    if (ls->line_count + lines > ls->line_cap) {
+        size_t new_cap = ls->line_cap ? ls->line_cap * 2 : 64;
+        while (new_cap < ls->line_count + lines) new_cap *= 2;
+        BlockLine *l = realloc(ls->lines, new_cap * sizeof(BlockLine));
+        if (!l) return -1;
+        ls->lines = l;
+        ls->line_cap = new_cap;
+    }
+    if (ls->event_count + events > ls->event_cap) {
+        size_t new_cap = ls->event_cap ? ls->event_cap * 2 : 64;
+        while (new_cap < ls->event_count + events) new_cap *= 2;
+        BlockEvent *ev = realloc(ls->events, new_cap * sizeof(BlockEvent));
+        if (!ev) return -1;
+        ls->events = ev;
+        ls->event_cap = new_cap;
+    }
+    return 0;
+}
+
+/* Append the lines of text, continuing from the lexer state the last line
+ * left. text holds whole lines; newline says whether one follows it. */
+static int line_scan_add(LineScan *ls, Language lang, const char *text,
+                         size_t len, int newline) {
+    BlockEvent line_ev[BLOCKS_MAX_LINE_EVENTS];
+    size_t pos = 0;
+    for (;;) {
+        const char *nl = memchr(text + pos, '\n', len - pos);
+        size_t line_len = nl ? (size_t)(nl - (text + pos)) : len - pos;
+        
+        uint8_t state = ls->state;
+        size_t n = scan_line(lang, text + pos, line_len, &ls->state, line_ev,
+                             BLOCKS_MAX_LINE_EVENTS);
+        if (line_scan_reserve(ls, 1, n) != 0) return -1;
+        
+        if (n) memcpy(ls->events + ls->event_count, line_ev, n * sizeof(BlockEvent));
+        ls->event_count += n;
+        
+        BlockLine *line = &ls->lines[ls->line_count++];
+        line->len = line_len + (nl || newline ? 1 : 0);
+        line->events = (uint16_t)n;
+        line->state = state;
+        
+        if (!nl) return 0;
+        pos += line_len + 1;
+    }
+}
+
+/* Append lines already scanned, with their events */
+static int line_scan_copy(LineScan *ls, const BlockLine *lines, size_t count,
+                          const BlockEvent *events) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) n += lines[i].events;
+    if (line_scan_reserve(ls, count, n) != 0) return -1;
+    
+    if (count) memcpy(ls->lines + ls->line_count, lines, count * sizeof(BlockLine));
+    if (n) memcpy(ls->events + ls->event_count, events, n * sizeof(BlockEvent));
+    ls->line_count += count;
+    ls->event_count += n;
+    return 0;
+}
+
+/* Append every line of the chunks in t, in order */
+static int line_scan_tree(LineScan *ls, BlockChunk *t) {
+    if (!t) return 0;
+    if (line_scan_tree(ls, t->left) != 0) return -1;
+    if (line_scan_copy(ls, t->lines, t->line_count, t->events) != 0) return -1;
+    return line_scan_tree(ls, t->right);
+}
+
+static uint32_t next_priority(BlockIndex *idx) {
+    /* xorshift32 */
+    uint32_t x = idx->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    idx->seed = x;
+    return x;
+}
+
+/* Pack lines [first, first + count) of ls, events starting at ev, into
+ * one chunk */
+static BlockChunk *make_chunk(BlockIndex *idx, LineScan *ls, size_t first,
+                              size_t count, size_t ev) {
+    BlockChunk *c = calloc(1, sizeof(BlockChunk));
+    if (!c) return NULL;
+    
+    for (size_t i = 0; i < count; i++) {
+        c->lines[i] = ls->lines[first + i];
+        c->bytes += c->lines[i].len;
+        c->event_count += c->lines[i].events;
+    }
+    c->line_count = (uint32_t)count;
+    
+    if (c->event_count) {
+        c->events = malloc(c->event_count * sizeof(BlockEvent));
+        if (!c->events) {
+            free(c);
+            return NULL;
+        }
+        memcpy(c->events, ls->events + ev, c->event_count * sizeof(BlockEvent));
+    }
+    
+    for (size_t e = 0; e < c->event_count; e++) {
+        const BlockEvent *event = &c->events[e];
+        if (event->open) c->open[event->kind]++;
+        else if (c->open[event->kind]) c->open[event->kind]--;
+        else c->close[event->kind]++;
+    }
+    
+    c->priority = next_priority(idx);
+    update(c);
+    return c;
+}
+
+/* Pack the lines of ls into evenly filled chunks */
+static BlockChunk *build_chunks(BlockIndex *idx, LineScan *ls) {
+    size_t chunks = (ls->line_count + BLOCKS_CHUNK_LINES - 1) / BLOCKS_CHUNK_LINES;
+    BlockChunk *tree = NULL;
+    size_t line = 0, ev = 0;
+    
+    for (size_t i = 0; i < chunks; i++) {
+        size_t count = ls->line_count / chunks + (i < ls->line_count % chunks);
+        BlockChunk *c = make_chunk(idx, ls, line, count, ev);
+        if (!c) {
+            free_tree(tree);
+            return NULL;
+        }
+        tree = merge(tree, c);
+        line += count;
+        ev += c->event_count;
+    }
+    return tree;
+}
+
+/* ==========================================================================
+ * Index
+ * ========================================================================== */
+
+BlockIndex *blocks_create(void) {
+    BlockIndex *idx = calloc(1, sizeof(BlockIndex));
+    if (!idx) return NULL;
+    idx->seed = 2463534242u;
+    
+    /* An empty document has one empty line */
+    LineScan ls;
+    line_scan_init(&ls, LEX_CODE);
+    if (line_scan_add(&ls, LANG_NONE, "", 0, 0) == 0) {
+        idx->root = build_chunks(idx, &ls);
+    }
+    line_scan_free(&ls);
+    
+    if (!idx->root) {
+        free(idx);
+        return NULL;
+    }
+    return idx;
+}
+
+void blocks_destroy(BlockIndex *idx) {
+    if (idx) {
+        free_tree(idx->root);
+        free(idx);
+    }
+}
+
+void blocks_rebuild(BlockIndex *idx, Buffer *buf, Language lang) {
+    if (!idx || !buf) return;
+    
+    size_t len = buffer_length(buf);
+    char *text = malloc(len + 1);
+    if (!text) return;
+    buffer_get_text(buf, text, len + 1);
+    
+    LineScan ls;
+    line_scan_init(&ls, LEX_CODE);
+    if (line_scan_add(&ls, lang, text, len, 0) == 0) {
+        BlockChunk *root = build_chunks(idx, &ls);
+        if (root) {
+            free_tree(idx->root);
+            idx->root = root;
+            idx->lang = lang;
+        }
+    }
+    line_scan_free(&ls);
+    free(text);
+}
+
+/* Scan the line of buf starting at start into ls; returns its end */
+static size_t scan_next_line(LineScan *ls, Language lang, Buffer *buf,
+                             size_t start, int *ok) {
+    size_t len = buffer_length(buf);
+    size_t end = start;
+    while (end < len && buffer_char_at(buf, end) != '\n') end++;
+    
+    char *text = malloc(end - start + 1);
+    if (!text || (buffer_copy_range(buf, start, end - start, text),
+                  line_scan_add(ls, lang, text, end - start, end < len) != 0)) {
+        *ok = 0;
+    }
+    free(text);
+    return end;
+}
+
+void blocks_edit(BlockIndex *idx, Buffer *buf, size_t pos,
+                 size_t removed, size_t inserted) {
+    if (!idx || !buf) return;
+    
+    /* Old lines touched by the removed range */
+    size_t first = blocks_line_of(idx, pos);
+    size_t last_old = blocks_line_of(idx, pos + removed);
+    size_t start = blocks_line_start(idx, first);
+    
+    /* Detach the chunks holding them */
+    size_t local, chunk_line, chunk_byte;
+    locate(idx->root, first, &local, &chunk_line, &chunk_byte);
+    BlockChunk *left, *mid, *right;
+    split(idx->root, chunk_line, &left, &mid);
+    split(mid, last_old + 1 - chunk_line, &mid, &right);
+    
+    LineScan old, ls;
+    line_scan_init(&old, LEX_CODE);
+    int ok = line_scan_tree(&old, mid) == 0;
+    
+    /* Unchanged lines before the edit, then the new extent: from the first
+     * line's start to the end of the line holding the last inserted byte */
+    line_scan_init(&ls, ok ? old.lines[first - chunk_line].state : LEX_CODE);
+    if (ok) ok = line_scan_copy(&ls, old.lines, first - chunk_line, old.events) == 0;
+    
+    size_t len = buffer_length(buf);
+    size_t end = pos + inserted;
+    while (end < len && buffer_char_at(buf, end) != '\n') end++;
+    
+    char *text = ok ? malloc(end - start + 1) : NULL;
+    if (text) {
+        buffer_copy_range(buf, start, end - start, text);
+        ok = line_scan_add(&ls, idx->lang, text, end - start, end < len) == 0;
+        free(text);
+    } else {
+        ok = 0;
+    }
+    
+    /* Opening or closing a block comment changes how the following lines
+     * lex: rescan them one at a time until one starts in the state it was
+     * indexed with. Chunks after the detached ones join as needed. */
+    size_t next = last_old - chunk_line + 1;
+    size_t next_ev = 0;
+    for (size_t i = 0; i < next && i < old.line_count; i++) next_ev += old.lines[i].events;
+    
+    while (ok) {
+        if (next == old.line_count) {
+            if (!right) break;
+            BlockChunk *c;
+            split(right, 1, &c, &right);
+            mid = merge(mid, c);
+            ok = line_scan_copy(&old, c->lines, c->line_count, c->events) == 0;
+            continue;
+        }
+        if (ls.state == old.lines[next].state) break;
+        
+        end = scan_next_line(&ls, idx->lang, buf, end + 1, &ok);
+        next_ev += old.lines[next].events;
+        next++;
+    }
+    
+    /* The rest of the detached lines, and a neighbouring chunk if too few
+     * are left to fill one by half */
+    if (ok) ok = line_scan_copy(&ls, old.lines + next, old.line_count - next,
+                                old.events + next_ev) == 0;
+    if (ok && ls.line_count < BLOCKS_CHUNK_LINES / 2 && right) {
+        BlockChunk *c;
+        split(right, 1, &c, &right);
+        mid = merge(mid, c);
+        ok = line_scan_copy(&ls, c->lines, c->line_count, c->events) == 0;
+    }
+    
+    BlockChunk *fresh = ok ? build_chunks(idx, &ls) : NULL;
+    if (fresh) {
+        free_tree(mid);
+        mid = fresh;
+    }
+    idx->root = merge(merge(left, mid), right);
+    line_scan_free(&old);
+    line_scan_free(&ls);
+}
+
+size_t blocks_line_count(BlockIndex *idx) {
+    return idx ? idx->root->sub_lines : 0;
+}
+
+size_t blocks_line_of(BlockIndex *idx, size_t pos) {
+    /* Last line whose start is <= pos */
+    BlockChunk *t = idx->root;
+    size_t base = 0;
+    for (;;) {
+        size_t left_bytes = t->left ? t->left->sub_bytes : 0;
+        size_t left_lines = t->left ? t->left->sub_lines : 0;
+        if (t->left && pos < left_bytes) {
+            t = t->left;
+            continue;
+        }
+        pos -= left_bytes;
+        base += left_lines;
+        if (pos < t->bytes || !t->right) {
+            size_t i = 0;
+            while (i + 1 < t->line_count && pos >= t->lines[i].len) {
+                pos -= t->lines[i].len;
+                i++;
+            }
+            return base + i;
+        }
+        pos -= t->bytes;
+        base += t->line_count;
+        t = t->right;
+    }
+}
+
+size_t blocks_line_start(BlockIndex *idx, size_t line) {
+    if (!idx) return 0;
+    size_t local, chunk_line, start;
+    BlockChunk *c = locate(idx->root, line, &local, &chunk_line, &start);
+    for (size_t i = 0; i < local; i++) start += c->lines[i].len;
+    return start;
+}
+
+/* Events of a line: the chunk holding it and the range of its events */
+static BlockChunk *line_events(BlockIndex *idx, size_t line, size_t *chunk_line,
+                               size_t *first, size_t *count) {
+    size_t local, chunk_byte;
+    BlockChunk *c = locate(idx->root, line, &local, chunk_line, &chunk_byte);
+    *first = 0;
+    for (size_t i = 0; i < local; i++) *first += c->lines[i].events;
+    *count = c->lines[local].events;
+    return c;
+}
+
+/* Partner of event e of chunk c (first line chunk_line): its line and
+ * column. Returns -1 if it is unmatched. */
+static int find_partner(BlockIndex *idx, BlockChunk *c, size_t chunk_line,
+                        size_t e, size_t *match_line, size_t *match_col) {
+    int kind = c->events[e].kind;
+    uint32_t need = 1;
+    size_t p = SIZE_MAX;
+    
+    if (c->events[e].open) {
+        for (size_t i = e + 1; i < c->event_count && p == SIZE_MAX; i++) {
+            if (c->events[i].kind != kind) continue;
+            if (c->events[i].open) need++;
+            else if (--need == 0) p = i;
+        }
+        if (p == SIZE_MAX) {
+            c = seek_closer(idx->root, 0, chunk_line + c->line_count, kind, &need, &chunk_line);
+            for (size_t i = 0; c && i < c->event_count && p == SIZE_MAX; i++) {
+                if (c->events[i].kind != kind) continue;
+                if (c->events[i].open) need++;
+                else if (--need == 0) p = i;
+            }
+        }
+    } else {
+        for (size_t i = e; i-- > 0 && p == SIZE_MAX; ) {
+            if (c->events[i].kind != kind) continue;
+            if (!c->events[i].open) need++;
+            else if (--need == 0) p = i;
+        }
+        if (p == SIZE_MAX) {
+            c = seek_opener(idx->root, 0, chunk_line, kind, &need, &chunk_line);
+            for (size_t i = c ? c->event_count : 0; i-- > 0 && p == SIZE_MAX; ) {
+                if (c->events[i].kind != kind) continue;
+                if (!c->events[i].open) need++;
+                else if (--need == 0) p = i;
+            }
+        }
+    }
+    if (p == SIZE_MAX) return -1;
+    
+    size_t line = 0, before = 0;
+    while (before + c->lines[line].events <= p) before += c->lines[line++].events;
+    if (match_line) *match_line = chunk_line + line;
+    if (match_col) *match_col = c->events[p].col;
+    return 0;
+}
+
+int blocks_find_match(BlockIndex *idx, size_t line, size_t col,
+                      size_t *match_line, size_t *match_col) {
+    if (!idx || line >= blocks_line_count(idx)) return -1;
+    
+    size_t chunk_line, first, count;
+    BlockChunk *c = line_events(idx, line, &chunk_line, &first, &count);
+    
+    size_t lo = first;
+    size_t hi = first + count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (c->events[mid].col < col) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo >= first + count) return -1;
+    
+    return find_partner(idx, c, chunk_line, lo, match_line, match_col);
+}
+
+size_t blocks_block_end(BlockIndex *idx, size_t line) {
+    if (!idx || line >= blocks_line_count(idx)) return line;
+    
+    size_t chunk_line, first, count;
+    BlockChunk *c = line_events(idx, line, &chunk_line, &first, &count);
+    
+    size_t best = line;
+    for (size_t e = first; e < first + count; e++) {
+        size_t end;
+        if (c->events[e].open &&
+            find_partner(idx, c, chunk_line, e, &end, NULL) == 0 && end > best) {
+            best = end;
+        }
+    }
+    return best;
+}
@@ -136,6 +136,64 @@ char buffer_char_at(Buffer *buf, size_t pos) {
     }
 }
 
+/* Copy len bytes starting at pos (no terminator); returns bytes copied */
+size_t buffer_copy_range(Buffer *buf, size_t pos, size_t len, char *out) {
+    size_t buf_len = buffer_length(buf);
+    if (pos >= buf_len) return 0;
+    if (pos + len > buf_len) len = buf_len - pos;
+    
+    size_t copied = 0;
+    if (pos < buf->gap_start) {
+        size_t before = buf->gap_start - pos;
+        if (before > len) before = len;
+        memcpy(out, buf->data + pos, before);
+        copied = before;
+    }
+    if (copied < len) {
+        size_t from = pos + copied - buf->gap_start;
+        memcpy(out + copied, buf->data + buf->gap_end + from, len - copied);
+        copied = len;
+    }
+    return copied;
+}
+
+/* Does text occur at pos? (pos + len must be within the buffer) */
+static int buffer_matches(Buffer *buf, size_t pos, const char *text, size_t len) {
+    size_t before = pos < buf->gap_start ? buf->gap_start - pos : 0;
+    if (before > len) before = len;
+    if (memcmp(buf->data + pos, text, before) != 0) return 0;
+    
+    size_t gap = buf->gap_end - buf->gap_start;
+    return memcmp(buf->data + pos + before + gap, text + before, len - before) == 0;
+}
+
+int buffer_find(Buffer *buf, size_t pos, const char *text, size_t len, size_t *at) {
+    size_t buf_len = buffer_length(buf);
+    if (len == 0 || len > buf_len || pos > buf_len - len) return -1;
+    
+    size_t last = buf_len - len;
+    size_t gap = buf->gap_end - buf->gap_start;
+    while (pos <= last) {
+        /* memchr for the first byte within the run before or after the gap */
+        size_t shift = pos < buf->gap_start ? 0 : gap;
+        size_t run_end = pos < buf->gap_start ? buf->gap_start : buf_len;
+        if (run_end > last + 1) run_end = last + 1;
+        
+        const char *hit = memchr(buf->data + pos + shift, text[0], run_end - pos);
+        if (!hit) {
+            pos = run_end;
+            continue;
+        }
+        pos = (size_t)(hit - buf->data) - shift;
+        if (buffer_matches(buf, pos, text, len)) {
+            *at = pos;
+            return 0;
+        }
+        pos++;
+    }
+    return -1;
+}
+
 void buffer_clear(Buffer *buf) {
     buf->gap_start = 0;
     buf->gap_end = buf->capacity;
@@ -5,14 +5,30 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 #include "build.h"
+#include "hash.h"
 #include "util.h"
 
+/* Bytes read from a pipe per call */
+#define BUILD_READ_CHUNK 65536
+
 void build_config_defaults(BuildConfig *cfg) {
     strcpy(cfg->build_cmd, "cosmocc -O2 -o {out} {in}");
     strcpy(cfg->run_cmd, "./{out}");
     strcpy(cfg->clean_cmd, "rm -f {out}");
     strcpy(cfg->assemble_cmd, "");
+    cfg->capture_limit = BUILD_CAPTURE_LIMIT;
 }
 
 int build_config_load(BuildConfig *cfg, const char *path) {
@@ -39,6 +55,8 @@ int build_config_load(BuildConfig *cfg, const char *path) {
             strncpy(cfg->clean_cmd, val, sizeof(cfg->clean_cmd) - 1);
         } else if (strcmp(key, "assemble_cmd") == 0) {
             strncpy(cfg->assemble_cmd, val, sizeof(cfg->assemble_cmd) - 1);
+        } else if (strcmp(key, "capture_limit_kb") == 0) {
+            cfg->capture_limit = (size_t)strtoul(val, NULL, 10) * 1024;
         }
     }
     
@@ -46,26 +64,608 @@ int build_config_load(BuildConfig *cfg, const char *path) {
     return 0;
 }
 
+/* Forwarding target of build_print_line */
+typedef struct BuildTee {
+    BuildLineFn on_line;
+    void *ctx;
+} BuildTee;
+
+static void build_print_line(void *ctx, const char *line, size_t len, int is_stderr) {
+    BuildTee *tee = ctx;
+    fprintf(is_stderr ? stderr : stdout, "%.*s\n", (int)len, line);
+    if (tee->on_line) tee->on_line(tee->ctx, line, len, is_stderr);
+}
+
 int build_run_command(const char *cmd) {
+    return build_run_command_lines(cmd, NULL, NULL);
+}
+
+int build_run_command_lines(const char *cmd, BuildLineFn on_line, void *ctx) {
     printf("$ %s\n", cmd);
-    int result = system(cmd);
-    printf("\n[Exit code: %d]\n", result);
+    
+    BuildTee tee = {on_line, ctx};
+    BuildProcess proc;
+    if (build_process_start(&proc, cmd, build_print_line, &tee) != 0) {
+        printf("[Failed to start]\n");
+        return -1;
+    }
+    int result = build_process_wait(&proc);
+    fflush(stderr);
+    printf("[Exit code: %d, %.2fs]\n", result, build_process_elapsed(&proc));
     return result;
 }
 
 int build_run_command_capture(const char *cmd, char *output, size_t max) {
-    FILE *p = popen(cmd, "r");
-    if (!p) return -1;
+    if (max == 0) return -1;
+    
+    /* A limit of 0 would mean unlimited: with room for the NUL only,
+     * keep one byte and copy none */
+    BuildCapture capture;
+    build_capture_init(&capture, max > 1 ? max - 1 : 1);
+    int status = build_run_capture(cmd, &capture);
+    const char *text = build_capture_text(&capture);
+    size_t len = capture.len < max - 1 ? capture.len : max - 1;
+    memcpy(output, text, len);
+    output[len] = '\0';
+    build_capture_free(&capture);
+    return status;
+}
+
+/* ==========================================================================
+ * Output capture
+ * ========================================================================== */
+
+void build_capture_init(BuildCapture *c, size_t limit) {
+    memset(c, 0, sizeof(*c));
+    c->limit = limit;
+}
+
+void build_capture_free(BuildCapture *c) {
+    free(c->data);
+    build_capture_init(c, c->limit);
+}
+
+static int build_capture_reserve(BuildCapture *c, size_t need) {
+    if (need <= c->cap) return 0;
+    size_t cap = c->cap ? c->cap : 64 * 1024;
+    while (cap < need) cap *= 2;
+    if (c->limit && cap > c->limit) cap = c->limit;
+    char *data = realloc(c->data, cap + 1);
+    if (!data) return -1;
+    c->data = data;
+    c->cap = cap;
+    return 0;
+}
+
+int build_capture_append(BuildCapture *c, const char *data, size_t len) {
+    c->total += len;
     
-    size_t total = 0;
-    char buf[256];
-    while (fgets(buf, sizeof(buf), p) && total + strlen(buf) < max) {
-        strcpy(output + total, buf);
-        total += strlen(buf);
+    /* Only the last limit bytes of this chunk can survive */
+    if (c->limit && len >= c->limit) {
+        if (build_capture_reserve(c, c->limit) != 0) return -1;
+        memcpy(c->data, data + len - c->limit, c->limit);
+        c->len = c->limit;
+        c->head = 0;
+        return 0;
     }
-    output[total] = '\0';
     
-    int status = pclose(p);
-    return status;
+    /* Fill linearly until the limit is reached */
+    size_t room = c->limit ? c->limit - c->len : len;
+    size_t n = len < room ? len : room;
+    if (n > 0) {
+        if (build_capture_reserve(c, c->len + n) != 0) return -1;
+        memcpy(c->data + c->len, data, n);
+        c->len += n;
+        data += n;
+        len -= n;
+    }
+    
+    /* Full: overwrite the oldest bytes */
+    while (len > 0) {
+        size_t run = c->limit - c->head;
+        if (run > len) run = len;
+        memcpy(c->data + c->head, data, run);
+        c->head = (c->head + run) % c->limit;
+        data += run;
+        len -= run;
+    }
+    return 0;
+}
+
+const char *build_capture_text(BuildCapture *c) {
+    if (!c->data) return "";
+    
+    /* Unroll the ring once; later appends continue from a linear buffer */
+    if (c->head != 0) {
+        char *flat = malloc(c->cap + 1);
+        if (!flat) return "";
+        size_t first = c->len - c->head;
+        memcpy(flat, c->data + c->head, first);
+        memcpy(flat + first, c->data, c->head);
+        free(c->data);
+        c->data = flat;
+        c->head = 0;
+    }
+    c->data[c->len] = '\0';
+    return c->data;
+}
+
+int build_capture_truncated(const BuildCapture *c) {
+    return c->total > c->len;
+}
+
+/* ==========================================================================
+ * Asynchronous build processes
+ * ========================================================================== */
+
+/* Split newly read bytes into lines; the tail waits for more input */
+static void build_process_feed(BuildProcess *p, int stream, const char *data, size_t len) {
+    if (p->capture) build_capture_append(p->capture, data, len);
+    if (!p->on_line) return;
+    
+    char *partial = p->partial[stream];
+    size_t *plen = &p->partial_len[stream];
+    
+    while (len > 0) {
+        const char *nl = memchr(data, '\n', len);
+        size_t take = nl ? (size_t)(nl - data) : len;
+        
+        /* Whole line in the input: deliver it without copying */
+        if (nl && *plen == 0) {
+            size_t n = take > 0 && data[take - 1] == '\r' ? take - 1 : take;
+            p->on_line(p->ctx, data, n, stream);
+            data += take + 1;
+            len -= take + 1;
+            continue;
+        }
+        
+        size_t room = BUILD_LINE_MAX - *plen;
+        size_t n = take < room ? take : room;
+        memcpy(partial + *plen, data, n);
+        *plen += n;
+        data += n;
+        len -= n;
+        
+        if (*plen == BUILD_LINE_MAX || (nl && n == take)) {
+            size_t out = *plen;
+            if (nl && out > 0 && partial[out - 1] == '\r') out--;
+            p->on_line(p->ctx, partial, out, stream);
+            *plen = 0;
+            if (nl && n == take) {
+                data++;
+                len--;
+            }
+        }
+    }
+}
+
+/* Deliver an unterminated last line */
+static void build_process_flush(BuildProcess *p, int stream) {
+    if (p->partial_len[stream] == 0) return;
+    if (p->on_line) p->on_line(p->ctx, p->partial[stream], p->partial_len[stream], stream);
+    p->partial_len[stream] = 0;
+}
+
+#ifndef _WIN32
+
+static int build_process_spawn(BuildProcess *p, const char *cmd) {
+    int out[2], err[2];
+    if (pipe(out) != 0) return -1;
+    if (pipe(err) != 0) {
+        close(out[0]);
+        close(out[1]);
+        return -1;
+    }
+    
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(out[0]);
+        close(out[1]);
+        close(err[0]);
+        close(err[1]);
+        return -1;
+    }
+    
+    if (pid == 0) {
+        /* Own process group, so cancel reaches the compiler under sh */
+        setpgid(0, 0);
+        dup2(out[1], STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+        close(out[0]);
+        close(out[1]);
+        close(err[0]);
+        close(err[1]);
+        int devnull = open("/dev/null", O_RDONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDIN_FILENO);
+            close(devnull);
+        }
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    
+    setpgid(pid, pid);
+    close(out[1]);
+    close(err[1]);
+    p->fds[0] = out[0];
+    p->fds[1] = err[0];
+    for (int i = 0; i < 2; i++) {
+        fcntl(p->fds[i], F_SETFL, fcntl(p->fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(p->fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    
+    p->pid = (int)pid;
+    p->running = 1;
+    p->start = time_now();
+    return 0;
+}
+
+/* Read what one pipe has; closes it at end of file */
+static void build_process_read(BuildProcess *p, int stream) {
+    char buf[BUILD_READ_CHUNK];
+    ssize_t n = read(p->fds[stream], buf, sizeof(buf));
+    if (n > 0) {
+        build_process_feed(p, stream, buf, (size_t)n);
+    } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        close(p->fds[stream]);
+        p->fds[stream] = -1;
+        build_process_flush(p, stream);
+    }
+}
+
+int build_process_poll(BuildProcess *p, int timeout_ms) {
+    if (!p->running) return 0;
+    
+    struct pollfd fds[2];
+    int streams[2];
+    int count = 0;
+    for (int i = 0; i < 2; i++) {
+        if (p->fds[i] < 0) continue;
+        fds[count].fd = p->fds[i];
+        fds[count].events = POLLIN;
+        fds[count].revents = 0;
+        streams[count++] = i;
+    }
+    
+    if (count > 0 && poll(fds, (nfds_t)count, timeout_ms) > 0) {
+        for (int i = 0; i < count; i++) {
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                build_process_read(p, streams[i]);
+            }
+        }
+    }
+    
+    if (p->cancelled && time_now() - p->cancel_time > BUILD_CANCEL_GRACE) {
+        kill(-p->pid, SIGKILL);
+    }
+    
+    /* Reap once both pipes are closed (or earlier if it already exited
+     * while something it started keeps the pipes open) */
+    int status;
+    pid_t done = waitpid(p->pid, &status, WNOHANG);
+    if (done == 0 && count == 0 && timeout_ms > 0) {
+        poll(NULL, 0, timeout_ms < 10 ? timeout_ms : 10);
+        done = waitpid(p->pid, &status, WNOHANG);
+    }
+    if (done == p->pid) {
+        /* Drain anything left in the pipes */
+        for (int i = 0; i < 2; i++) {
+            if (p->fds[i] < 0) continue;
+            fcntl(p->fds[i], F_SETFL, fcntl(p->fds[i], F_GETFL) | O_NONBLOCK);
+            while (p->fds[i] >= 0) {
+                char buf[BUILD_READ_CHUNK];
+                ssize_t n = read(p->fds[i], buf, sizeof(buf));
+                if (n > 0) {
+                    build_process_feed(p, i, buf, (size_t)n);
+                    continue;
+                }
+                if (n < 0 && errno == EINTR) continue;
+                close(p->fds[i]);
+                p->fds[i] = -1;
+                build_process_flush(p, i);
+            }
+        }
+        
+        p->exit_code = WIFEXITED(status) ? WEXITSTATUS(status)
+                     : WIFSIGNALED(status) ? 128 + WTERMSIG(status) : -1;
+        p->running = 0;
+        p->end = time_now();
+    } else if (done < 0 && errno != EINTR) {
+        p->exit_code = -1;
+        p->running = 0;
+        p->end = time_now();
+    }
+    return p->running;
+}
+
+void build_process_cancel(BuildProcess *p) {
+    if (!p->running || p->cancelled) return;
+    p->cancelled = 1;
+    p->cancel_time = time_now();
+    kill(-p->pid, SIGTERM);
+}
+
+#else
+
+/* No fork on native Windows: run to completion inside start */
+static int build_process_spawn(BuildProcess *p, const char *cmd) {
+    p->start = time_now();
+    
+    char full[1100];
+    snprintf(full, sizeof(full), "%s 2>&1", cmd);
+    FILE *pipe = _popen(full, "r");
+    if (!pipe) return -1;
+    
+    char buf[BUILD_READ_CHUNK];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), pipe)) > 0) {
+        build_process_feed(p, 0, buf, n);
+    }
+    build_process_flush(p, 0);
+    p->exit_code = _pclose(pipe);
+    p->end = time_now();
+    return 0;
+}
+
+int build_process_poll(BuildProcess *p, int timeout_ms) {
+    (void)timeout_ms;
+    return p->running;
+}
+
+void build_process_cancel(BuildProcess *p) {
+    (void)p;
+}
+
+#endif
+
+int build_process_start(BuildProcess *p, const char *cmd, BuildLineFn on_line, void *ctx) {
+    memset(p, 0, sizeof(*p));
+    p->fds[0] = p->fds[1] = -1;
+    p->on_line = on_line;
+    p->ctx = ctx;
+    return build_process_spawn(p, cmd);
+}
+
+int build_process_start_capture(BuildProcess *p, const char *cmd, BuildCapture *capture) {
+    memset(p, 0, sizeof(*p));
+    p->fds[0] = p->fds[1] = -1;
+    p->capture = capture;
+    return build_process_spawn(p, cmd);
+}
+
+int build_run_capture(const char *cmd, BuildCapture *c) {
+    BuildProcess p;
+    if (build_process_start_capture(&p, cmd, c) != 0) return -1;
+    return build_process_wait(&p);
+}
+
+int build_process_wait(BuildProcess *p) {
+    while (build_process_poll(p, 100)) {}
+    return p->exit_code;
+}
+
+double build_process_elapsed(const BuildProcess *p) {
+    if (p->start == 0) return 0;
+    return (p->running ? time_now() : p->end) - p->start;
+}
+
+/* ==========================================================================
+ * Output pane lines
+ * ========================================================================== */
+
+void build_output_init(BuildOutput *out) {
+    memset(out, 0, sizeof(*out));
+}
+
+void build_output_free(BuildOutput *out) {
+    free(out->text);
+    free(out->lines);
+    free(out->is_stderr);
+    build_output_init(out);
+}
+
+void build_output_clear(BuildOutput *out) {
+    out->text_len = 0;
+    out->line_count = 0;
+}
+
+int build_output_append(BuildOutput *out, const char *line, size_t len, int is_stderr) {
+    if (out->text_len + len + 1 > out->text_cap) {
+        size_t cap = out->text_cap ? out->text_cap * 2 : 64 * 1024;
+        while (cap < out->text_len + len + 1) cap *= 2;
+        char *text = realloc(out->text, cap);
+        if (!text) return -1;
+        out->text = text;
+        out->text_cap = cap;
+    }
+    if (out->line_count == out->line_cap) {
+        size_t cap = out->line_cap ? out->line_cap * 2 : 1024;
+        size_t *lines = realloc(out->lines, cap * sizeof(size_t));
+        if (!lines) return -1;
+        out->lines = lines;
+        unsigned char *flags = realloc(out->is_stderr, cap);
+        if (!flags) return -1;
+        out->is_stderr = flags;
+        out->line_cap = cap;
+    }
+    
+    out->lines[out->line_count] = out->text_len;
+    out->is_stderr[out->line_count] = (unsigned char)(is_stderr != 0);
+    out->line_count++;
+    memcpy(out->text + out->text_len, line, len);
+    out->text[out->text_len + len] = '\0';
+    out->text_len += len + 1;
+    return 0;
+}
+
+const char *build_output_line(const BuildOutput *out, size_t index) {
+    return index < out->line_count ? out->text + out->lines[index] : NULL;
+}
+
+void build_output_collect(void *ctx, const char *line, size_t len, int is_stderr) {
+    build_output_append(ctx, line, len, is_stderr);
+}
+
+/* ==========================================================================
+ * Build result cache
+ * ========================================================================== */
+
+void build_cache_init(BuildCache *c, const char *path) {
+    memset(c, 0, sizeof(*c));
+    strncpy(c->path, path, sizeof(c->path) - 1);
 }
 
+void build_cache_free(BuildCache *c) {
+    free(c->entries);
+    c->entries = NULL;
+    c->count = 0;
+    c->capacity = 0;
+}
+
+/* Resolve the command's first word like the shell would (PATH search) */
+static int build_find_tool(const char *cmd, char *out, size_t max) {
+    char tool[260];
+    size_t n = strcspn(cmd, " \t");
+    if (n == 0 || n >= sizeof(tool)) return -1;
+    memcpy(tool, cmd, n);
+    tool[n] = '\0';
+    
+    struct stat st;
+    if (strchr(tool, '/') || strchr(tool, '\\')) {
+        snprintf(out, max, "%s", tool);
+        return stat(out, &st) == 0 ? 0 : -1;
+    }
+
+#ifdef _WIN32
+    const char *seps = ";";
+    static const char *const exts[] = {"", ".exe", ".cmd", ".bat"};
+#else
+    const char *seps = ":";
+    static const char *const exts[] = {""};
+#endif
+    const char *path = getenv("PATH");
+    while (path && *path) {
+        size_t len = strcspn(path, seps);
+        for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+            snprintf(out, max, "%.*s/%s%s", (int)len, len ? path : ".", tool, exts[i]);
+            if (stat(out, &st) == 0 && S_ISREG(st.st_mode)) return 0;
+        }
+        path += len;
+        if (*path) path++;
+    }
+    return -1;
+}
+
+int build_cache_key(const char *cmd, const char *input, uint64_t *key) {
+    uint64_t input_hash;
+    if (hash_file(input, &input_hash) != 0) return -1;
+    
+    HashXxh64 st;
+    hash_xxh64_init(&st, 0);
+    hash_xxh64_update(&st, &input_hash, sizeof(input_hash));
+    hash_xxh64_update(&st, cmd, strlen(cmd) + 1);
+    
+    /* A reinstalled or upgraded compiler changes size or mtime; hashing
+     * the binary itself would cost more than many builds */
+    char tool[520];
+    struct stat ts;
+    if (build_find_tool(cmd, tool, sizeof(tool)) == 0 && stat(tool, &ts) == 0) {
+        int64_t identity[2] = {(int64_t)ts.st_size, (int64_t)ts.st_mtime};
+        hash_xxh64_update(&st, tool, strlen(tool) + 1);
+        hash_xxh64_update(&st, identity, sizeof(identity));
+    }
+    
+    *key = hash_xxh64_final(&st);
+    return 0;
+}
+
+static void build_cache_load(BuildCache *c) {
+    c->loaded = 1;
+    FILE *f = fopen(c->path, "r");
+    if (!f) return;
+    
+    char line[400];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == ';' || line[0] == '\0') continue;
+        
+        unsigned long long key, out_hash;
+        int offset = 0;
+        if (sscanf(line, "%16llx %16llx %n", &key, &out_hash, &offset) != 2 ||
+            offset == 0 || line[offset] == '\0') {
+            continue;
+        }
+        
+        if (c->count == c->capacity) {
+            size_t cap = c->capacity ? c->capacity * 2 : 16;
+            BuildCacheEntry *entries = realloc(c->entries, cap * sizeof(BuildCacheEntry));
+            if (!entries) break;
+            c->entries = entries;
+            c->capacity = cap;
+        }
+        BuildCacheEntry *e = &c->entries[c->count++];
+        e->key = key;
+        e->out_hash = out_hash;
+        strncpy(e->out_path, line + offset, sizeof(e->out_path) - 1);
+        e->out_path[sizeof(e->out_path) - 1] = '\0';
+    }
+    fclose(f);
+}
+
+static BuildCacheEntry *build_cache_find(BuildCache *c, const char *out_path) {
+    if (!c->loaded) build_cache_load(c);
+    for (size_t i = 0; i < c->count; i++) {
+        if (strcmp(c->entries[i].out_path, out_path) == 0) return &c->entries[i];
+    }
+    return NULL;
+}
+
+int build_cache_lookup(BuildCache *c, uint64_t key, const char *out_path) {
+    BuildCacheEntry *e = build_cache_find(c, out_path);
+    uint64_t out_hash;
+    int hit = e && e->key == key && hash_file(out_path, &out_hash) == 0 &&
+              out_hash == e->out_hash;
+    if (hit) {
+        c->hits++;
+    } else {
+        c->misses++;
+    }
+    return hit;
+}
+
+int build_cache_store(BuildCache *c, uint64_t key, const char *out_path) {
+    uint64_t out_hash;
+    if (hash_file(out_path, &out_hash) != 0) return -1;
+    
+    BuildCacheEntry *e = build_cache_find(c, out_path);
+    if (!e) {
+        if (c->count == c->capacity) {
+            size_t cap = c->capacity ? c->capacity * 2 : 16;
+            BuildCacheEntry *entries = realloc(c->entries, cap * sizeof(BuildCacheEntry));
+            if (!entries) return -1;
+            c->entries = entries;
+            c->capacity = cap;
+        }
+        e = &c->entries[c->count++];
+        memset(e, 0, sizeof(*e));
+        strncpy(e->out_path, out_path, sizeof(e->out_path) - 1);
+    }
+    e->key = key;
+    e->out_hash = out_hash;
+    
+    char tmp[sizeof(c->path) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", c->path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    fprintf(f, "; tedit build cache: key, output hash, output\n");
+    for (size_t i = 0; i < c->count; i++) {
+        fprintf(f, "%016llx %016llx %s\n", (unsigned long long)c->entries[i].key,
+                (unsigned long long)c->entries[i].out_hash, c->entries[i].out_path);
+    }
+    if (fclose(f) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return rename(tmp, c->path) == 0 ? 0 : -1;
+}
@@ -0,0 +1,293 @@
+/*
+ * buildall.c - Build many files at once
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <glob.h>
+#include <poll.h>
+#endif
+
+#include "buildall.h"
+#include "diag.h"
+#include "menu.h"
+#include "parallel.h"
+#include "util.h"
+
+void build_batch_init(BuildBatch *b, int workers, BuildCache *cache,
+                      BuildLineFn on_line, void *ctx) {
+    memset(b, 0, sizeof(*b));
+    b->workers = workers > 0 ? workers : parallel_cpu_count();
+    b->cache = cache;
+    b->on_line = on_line;
+    b->ctx = ctx;
+}
+
+void build_batch_free(BuildBatch *b) {
+    build_batch_cancel(b);
+    while (b->running > 0) build_batch_poll(b, 100);
+    for (size_t i = 0; i < b->count; i++) {
+        build_capture_free(&b->jobs[i].capture);
+    }
+    free(b->jobs);
+    b->jobs = NULL;
+    b->count = 0;
+    b->capacity = 0;
+}
+
+int build_batch_add(BuildBatch *b, const BuildConfig *cfg, const char *input,
+                    const char *exe_dir) {
+    /* Assembly sources use assemble_cmd when one is configured */
+    const char *ext = path_extension(input);
+    const char *template = cfg->build_cmd;
+    if ((strcmp(ext, ".asm") == 0 || strcmp(ext, ".ASM") == 0) && cfg->assemble_cmd[0]) {
+        template = cfg->assemble_cmd;
+    }
+    if (!template[0]) return -1;
+    
+    if (b->count == b->capacity) {
+        size_t cap = b->capacity ? b->capacity * 2 : 16;
+        BuildJob *jobs = realloc(b->jobs, cap * sizeof(BuildJob));
+        if (!jobs) return -1;
+        b->jobs = jobs;
+        b->capacity = cap;
+    }
+    
+    BuildJob *job = &b->jobs[b->count++];
+    memset(job, 0, sizeof(*job));
+    strncpy(job->input, input, sizeof(job->input) - 1);
+    menu_substitute_vars(job->cmd, sizeof(job->cmd), template, input, exe_dir);
+    if (strstr(template, "{out}")) {
+        menu_substitute_vars(job->out, sizeof(job->out), "{out}", input, exe_dir);
+    }
+    build_capture_init(&job->capture, cfg->capture_limit);
+    
+    job->cacheable = b->cache && job->out[0] &&
+                     build_cache_key(job->cmd, input, &job->key) == 0;
+    return 0;
+}
+
+size_t build_batch_add_glob(BuildBatch *b, const BuildConfig *cfg, const char *pattern,
+                            const char *exe_dir) {
+    size_t added = 0;
+#ifndef _WIN32
+    glob_t g;
+    if (glob(pattern, 0, NULL, &g) != 0) return 0;
+    for (size_t i = 0; i < g.gl_pathc; i++) {
+        if (build_batch_add(b, cfg, g.gl_pathv[i], exe_dir) == 0) added++;
+    }
+    globfree(&g);
+#else
+    /* No glob(3); accept a plain file name */
+    if (file_exists(pattern) && build_batch_add(b, cfg, pattern, exe_dir) == 0) added++;
+#endif
+    return added;
+}
+
+static void build_batch_emit(BuildBatch *b, const char *line, size_t len) {
+    if (b->on_line) b->on_line(b->ctx, line, len, 0);
+}
+
+/* Hand a finished job's output on as one block and count its diagnostics */
+static void build_job_report(BuildBatch *b, BuildJob *job) {
+    char line[400];
+    int len;
+    if (job->state == BUILD_JOB_CACHED) {
+        len = snprintf(line, sizeof(line), "== %s: up to date (%s)", job->input, job->out);
+    } else if (job->state == BUILD_JOB_FAILED) {
+        len = snprintf(line, sizeof(line), "== %s: could not start", job->input);
+    } else {
+        len = snprintf(line, sizeof(line), "== %s: %s %d (%.2fs)", job->input,
+                       job->exit_code == 0 ? "ok, exit" : "FAILED, exit",
+                       job->exit_code, job->seconds);
+    }
+    build_batch_emit(b, line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+    
+    if (build_capture_truncated(&job->capture)) {
+        len = snprintf(line, sizeof(line), "[... %llu bytes of earlier output dropped]",
+                       (unsigned long long)(job->capture.total - job->capture.len));
+        build_batch_emit(b, line, (size_t)len);
+    }
+    
+    DiagList diags;
+    diag_init(&diags);
+    const char *text = build_capture_text(&job->capture);
+    const char *end = text + job->capture.len;
+    while (text < end) {
+        const char *nl = memchr(text, '\n', (size_t)(end - text));
+        size_t n = nl ? (size_t)(nl - text) : (size_t)(end - text);
+        size_t shown = n > 0 && text[n - 1] == '\r' ? n - 1 : n;
+        diag_parse_line(&diags, text, shown, 0);
+        build_batch_emit(b, text, shown);
+        text += nl ? n + 1 : n;
+    }
+    job->errors = diags.errors;
+    job->warnings = diags.warnings;
+    diag_free(&diags);
+    
+    /* The output is only needed once */
+    build_capture_free(&job->capture);
+}
+
+static void build_job_finish(BuildBatch *b, BuildJob *job) {
+    job->state = BUILD_JOB_DONE;
+    job->exit_code = job->proc.exit_code;
+    job->seconds = build_process_elapsed(&job->proc);
+    b->running--;
+    b->finished++;
+    if (job->cacheable && job->exit_code == 0 && !job->proc.cancelled) {
+        build_cache_store(b->cache, job->key, job->out);
+    }
+    build_job_report(b, job);
+}
+
+static void build_job_start(BuildBatch *b, BuildJob *job) {
+    if (job->cacheable && build_cache_lookup(b->cache, job->key, job->out)) {
+        job->state = BUILD_JOB_CACHED;
+        b->finished++;
+        build_job_report(b, job);
+        return;
+    }
+    if (build_process_start_capture(&job->proc, job->cmd, &job->capture) != 0) {
+        job->state = BUILD_JOB_FAILED;
+        b->finished++;
+        build_job_report(b, job);
+        return;
+    }
+    job->state = BUILD_JOB_RUNNING;
+    b->running++;
+    
+    /* Native Windows runs the command inside start */
+    if (!job->proc.running) build_job_finish(b, job);
+}
+
+int build_batch_poll(BuildBatch *b, int timeout_ms) {
+    if (b->start == 0) b->start = time_now();
+    
+    while (!b->cancelled && b->next < b->count && b->running < (size_t)b->workers) {
+        build_job_start(b, &b->jobs[b->next++]);
+    }
+
+#ifndef _WIN32
+    /* One wait for output from any running job */
+    struct pollfd fds[128];
+    nfds_t nfds = 0;
+    for (size_t i = 0; i < b->count && nfds + 2 <= 128; i++) {
+        BuildJob *job = &b->jobs[i];
+        if (job->state != BUILD_JOB_RUNNING) continue;
+        for (int s = 0; s < 2; s++) {
+            if (job->proc.fds[s] < 0) continue;
+            fds[nfds].fd = job->proc.fds[s];
+            fds[nfds].events = POLLIN;
+            fds[nfds].revents = 0;
+            nfds++;
+        }
+    }
+    if (b->running > 0 && timeout_ms > 0) {
+        if (nfds > 0) {
+            poll(fds, nfds, timeout_ms);
+        } else {
+            /* Pipes closed, processes not reaped yet */
+            time_sleep(0.005);
+        }
+    }
+#else
+    (void)timeout_ms;
+#endif
+    
+    for (size_t i = 0; i < b->count; i++) {
+        BuildJob *job = &b->jobs[i];
+        if (job->state != BUILD_JOB_RUNNING) continue;
+        if (!build_process_poll(&job->proc, 0)) build_job_finish(b, job);
+    }
+    
+    int active = b->running > 0 || (!b->cancelled && b->next < b->count);
+    if (!active && b->end == 0) b->end = time_now();
+    return active;
+}
+
+size_t build_batch_run(BuildBatch *b) {
+    while (build_batch_poll(b, 100)) {}
+    return build_batch_failed(b);
+}
+
+void build_batch_cancel(BuildBatch *b) {
+    b->cancelled = 1;
+    for (size_t i = 0; i < b->count; i++) {
+        if (b->jobs[i].state == BUILD_JOB_RUNNING) build_process_cancel(&b->jobs[i].proc);
+    }
+}
+
+size_t build_batch_failed(const BuildBatch *b) {
+    size_t failed = 0;
+    for (size_t i = 0; i < b->count; i++) {
+        const BuildJob *job = &b->jobs[i];
+        if (job->state == BUILD_JOB_FAILED ||
+            (job->state == BUILD_JOB_DONE && job->exit_code != 0)) {
+            failed++;
+        }
+    }
+    return failed;
+}
+
+void build_batch_summary(const BuildBatch *b, BuildLineFn emit, void *ctx) {
+    int width = 4;
+    for (size_t i = 0; i < b->count; i++) {
+        int n = (int)strlen(b->jobs[i].input);
+        if (n > width) width = n;
+    }
+    if (width > 48) width = 48;
+    
+    char line[160];
+    int len = snprintf(line, sizeof(line), "%-*s  %-10s %8s %6s %8s", width, "File",
+                       "Result", "Time", "Errors", "Warnings");
+    emit(ctx, line, (size_t)len, 0);
+    
+    double total = 0;
+    size_t cached = 0, skipped = 0;
+    for (size_t i = 0; i < b->count; i++) {
+        const BuildJob *job = &b->jobs[i];
+        char result[16];
+        char seconds[16] = "-";
+        switch (job->state) {
+            case BUILD_JOB_DONE:
+                if (job->exit_code == 0) {
+                    snprintf(result, sizeof(result), "ok");
+                } else {
+                    snprintf(result, sizeof(result), "exit %d", job->exit_code);
+                }
+                snprintf(seconds, sizeof(seconds), "%.2fs", job->seconds);
+                total += job->seconds;
+                break;
+            case BUILD_JOB_CACHED:
+                snprintf(result, sizeof(result), "cached");
+                cached++;
+                break;
+            case BUILD_JOB_FAILED:
+                snprintf(result, sizeof(result), "no start");
+                break;
+            default:
+                snprintf(result, sizeof(result), "skipped");
+                skipped++;
+                break;
+        }
+        
+        /* Long paths keep their tail, which names the file */
+        const char *name = job->input;
+        size_t name_len = strlen(name);
+        if (name_len > (size_t)width) name += name_len - (size_t)width;
+        len = snprintf(line, sizeof(line), "%-*s  %-10s %8s %6zu %8zu", width, name,
+                       result, seconds, job->errors, job->warnings);
+        emit(ctx, line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1, 0);
+    }
+    
+    double wall = (b->end ? b->end : time_now()) - b->start;
+    len = snprintf(line, sizeof(line),
+                   "%zu jobs on %d workers: %zu failed, %zu cached, %zu skipped; "
+                   "%.2fs wall, %.2fs total",
+                   b->count, b->workers, build_batch_failed(b), cached, skipped,
+                   b->start ? wall : 0.0, total);
+    emit(ctx, line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1, 0);
+}
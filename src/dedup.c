@@ -0,0 +1,1081 @@
+/*
+ * dedup.c - Content-addressed, deduplicating backup repository
+ *
+ * Snapshot format (INI-style header, then one record per file followed
+ * by the SHA-256 of each of its chunks):
+ *
+ *   ; tedit backup snapshot
+ *   project=tedit
+ *   time=1700000000
+ *   files=2
+ *   bytes=12345
+ *
+ *   [files]
+ *   <size> <mtime> <chunk count> <path>
+ *   <sha256 hex>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <utime.h>
+#endif
+
+#include "dedup.h"
+#include "parallel.h"
+#include "restore.h"
+#include "util.h"
+
+#define DEDUP_VERSION 1
+
+/* Files chunked per parallel batch; their mappings stay open until the
+ * writer has stored the new chunks */
+#define DEDUP_BATCH_FILES 64
+
+/* FastCDC normalized chunking masks for an 8 KB average: a harder mask
+ * below the average size and an easier one above it */
+#define DEDUP_MASK_S 0x0003590703530000ULL
+#define DEDUP_MASK_L 0x0000d90003530000ULL
+
+static uint64_t gear[256];
+static int gear_ready = 0;
+
+/* Fixed pseudo-random table (splitmix64) so chunk boundaries are stable */
+static void gear_init(void) {
+    uint64_t x = 0x7465646974ULL;
+    for (int i = 0; i < 256; i++) {
+        x += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        gear[i] = z ^ (z >> 31);
+    }
+    gear_ready = 1;
+}
+
+size_t dedup_chunk_length(const unsigned char *data, size_t len) {
+    if (!gear_ready) gear_init();
+    if (len <= DEDUP_CHUNK_MIN) return len;
+    
+    size_t max = len < DEDUP_CHUNK_MAX ? len : DEDUP_CHUNK_MAX;
+    size_t normal = len < DEDUP_CHUNK_AVG ? len : DEDUP_CHUNK_AVG;
+    uint64_t fp = 0;
+    size_t i = DEDUP_CHUNK_MIN;
+    
+    for (; i < normal; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & DEDUP_MASK_S)) return i + 1;
+    }
+    for (; i < max; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & DEDUP_MASK_L)) return i + 1;
+    }
+    return max;
+}
+
+/* ==========================================================================
+ * Paths
+ * ========================================================================== */
+
+/* Both return -1 if the path does not fit in out */
+static int pack_path(const DedupRepo *repo, uint32_t pack, char *out, size_t out_size) {
+    int n = snprintf(out, out_size, "%s/packs/pack-%06u.pack", repo->path, (unsigned)pack);
+    return n >= 0 && (size_t)n < out_size ? 0 : -1;
+}
+
+static int snapshot_path(const DedupRepo *repo, const char *name, char *out, size_t out_size) {
+    int n = snprintf(out, out_size, "%s/snapshots/%s.snap", repo->path, name);
+    return n >= 0 && (size_t)n < out_size ? 0 : -1;
+}
+
+/* ==========================================================================
+ * Chunk index
+ * ========================================================================== */
+
+static size_t hash_slot(const uint8_t *hash, size_t mask) {
+    uint64_t h;
+    memcpy(&h, hash, sizeof(h));
+    return (size_t)h & mask;
+}
+
+static int index_rehash(DedupRepo *repo, size_t size) {
+    uint32_t *table = calloc(size, sizeof(uint32_t));
+    if (!table) return -1;
+    
+    for (size_t i = 0; i < repo->count; i++) {
+        size_t slot = hash_slot(repo->chunks[i].hash, size - 1);
+        while (table[slot]) slot = (slot + 1) & (size - 1);
+        table[slot] = (uint32_t)(i + 1);
+    }
+    free(repo->table);
+    repo->table = table;
+    repo->table_size = size;
+    return 0;
+}
+
+static DedupChunk *index_add(DedupRepo *repo, const uint8_t *hash) {
+    if (repo->count >= repo->capacity) {
+        size_t new_cap = repo->capacity ? repo->capacity * 2 : 1024;
+        DedupChunk *chunks = realloc(repo->chunks, new_cap * sizeof(DedupChunk));
+        if (!chunks) return NULL;
+        repo->chunks = chunks;
+        repo->capacity = new_cap;
+    }
+    
+    /* Keep the table at most half full */
+    if ((repo->count + 1) * 2 > repo->table_size) {
+        size_t size = repo->table_size ? repo->table_size * 2 : 2048;
+        if (index_rehash(repo, size) != 0) return NULL;
+    }
+    
+    DedupChunk *chunk = &repo->chunks[repo->count];
+    memset(chunk, 0, sizeof(*chunk));
+    memcpy(chunk->hash, hash, HASH_SHA256_SIZE);
+    
+    size_t slot = hash_slot(hash, repo->table_size - 1);
+    while (repo->table[slot]) slot = (slot + 1) & (repo->table_size - 1);
+    repo->table[slot] = (uint32_t)(++repo->count);
+    return chunk;
+}
+
+const DedupChunk *dedup_find(const DedupRepo *repo, const uint8_t *hash) {
+    if (!repo->table_size) return NULL;
+    
+    size_t slot = hash_slot(hash, repo->table_size - 1);
+    while (repo->table[slot]) {
+        const DedupChunk *chunk = &repo->chunks[repo->table[slot] - 1];
+        if (memcmp(chunk->hash, hash, HASH_SHA256_SIZE) == 0) return chunk;
+        slot = (slot + 1) & (repo->table_size - 1);
+    }
+    return NULL;
+}
+
+int dedup_open(DedupRepo *repo, const char *path, int create) {
+    memset(repo, 0, sizeof(DedupRepo));
+    
+    /* Leave room for the longest fixed name inside the repository */
+    if (strlen(path) + sizeof("/packs/pack-0000000000.pack") > sizeof(repo->path)) {
+        return -1;
+    }
+    snprintf(repo->path, sizeof(repo->path), "%s", path);
+    if (!gear_ready) gear_init();
+    
+    char file[BACKUP_MAX_PATH];
+    snprintf(file, sizeof(file), "%s/config", path);
+    
+    struct stat st;
+    if (stat(file, &st) != 0) {
+        if (!create) return -1;
+        
+        char dir[BACKUP_MAX_PATH];
+        snprintf(dir, sizeof(dir), "%s/packs", path);
+        if (path_make_dirs(dir) != 0) return -1;
+        snprintf(dir, sizeof(dir), "%s/snapshots", path);
+        if (path_make_dirs(dir) != 0) return -1;
+        
+        FILE *f = fopen(file, "w");
+        if (!f) return -1;
+        fprintf(f, "; tedit backup repository\nversion=%d\n", DEDUP_VERSION);
+        fprintf(f, "chunk_min=%d\nchunk_avg=%d\nchunk_max=%d\n",
+                DEDUP_CHUNK_MIN, DEDUP_CHUNK_AVG, DEDUP_CHUNK_MAX);
+        if (fclose(f) != 0) return -1;
+    }
+    
+    snprintf(file, sizeof(file), "%s/index", path);
+    FILE *f = fopen(file, "r");
+    if (f) {
+        char line[256];
+        while (fgets(line, sizeof(line), f)) {
+            char hex[2 * HASH_SHA256_SIZE + 1];
+            unsigned pack, length;
+            unsigned long long offset;
+            uint8_t hash[HASH_SHA256_SIZE];
+            
+            if (sscanf(line, "%64s %u %llu %u", hex, &pack, &offset, &length) != 4 ||
+                hash_from_hex(hex, hash, HASH_SHA256_SIZE) != 0) {
+                continue;
+            }
+            if (dedup_find(repo, hash)) continue;
+            
+            DedupChunk *chunk = index_add(repo, hash);
+            if (!chunk) {
+                fclose(f);
+                dedup_close(repo);
+                return -1;
+            }
+            chunk->pack = pack;
+            chunk->offset = offset;
+            chunk->length = length;
+            if (pack > repo->pack) repo->pack = pack;
+        }
+        fclose(f);
+    }
+    
+    /* Append after whatever the newest pack already holds */
+    if (pack_path(repo, repo->pack, file, sizeof(file)) != 0) {
+        dedup_close(repo);
+        return -1;
+    }
+    if (stat(file, &st) == 0) repo->pack_size = (uint64_t)st.st_size;
+    return 0;
+}
+
+void dedup_close(DedupRepo *repo) {
+    if (!repo) return;
+    free(repo->chunks);
+    free(repo->table);
+    memset(repo, 0, sizeof(DedupRepo));
+}
+
+/* Read one chunk, keeping the last pack open across calls */
+static int read_chunk(const DedupRepo *repo, const DedupChunk *chunk,
+                      FILE **pack_file, uint32_t *open_pack, unsigned char *buf) {
+    if (!*pack_file || *open_pack != chunk->pack) {
+        if (*pack_file) fclose(*pack_file);
+        char file[BACKUP_MAX_PATH];
+        *pack_file = NULL;
+        if (pack_path(repo, chunk->pack, file, sizeof(file)) != 0) return -1;
+        *pack_file = fopen(file, "rb");
+        *open_pack = chunk->pack;
+        if (!*pack_file) return -1;
+    }
+    
+    if (fseek(*pack_file, (long)chunk->offset, SEEK_SET) != 0) return -1;
+    if (fread(buf, 1, chunk->length, *pack_file) != chunk->length) return -1;
+    
+    uint8_t hash[HASH_SHA256_SIZE];
+    hash_sha256(buf, chunk->length, hash);
+    return memcmp(hash, chunk->hash, HASH_SHA256_SIZE) == 0 ? 0 : -1;
+}
+
+/* ==========================================================================
+ * Snapshots
+ * ========================================================================== */
+
+typedef struct SnapFile {
+    char *path;
+    uint64_t size;
+    int64_t mtime;
+    size_t first;                   /* First hash in Snapshot.hashes */
+    size_t count;
+} SnapFile;
+
+typedef struct Snapshot {
+    char project[BACKUP_MAX_PATH];
+    int64_t time;
+    uint64_t bytes;
+    size_t declared_files;          /* files= from the header */
+    SnapFile *files;                /* Sorted by path */
+    size_t file_count;
+    size_t file_capacity;
+    uint8_t *hashes;                /* HASH_SHA256_SIZE bytes each */
+    size_t hash_count;
+    size_t hash_capacity;
+} Snapshot;
+
+static void snapshot_free(Snapshot *snap) {
+    for (size_t i = 0; i < snap->file_count; i++) {
+        free(snap->files[i].path);
+    }
+    free(snap->files);
+    free(snap->hashes);
+    memset(snap, 0, sizeof(Snapshot));
+}
+
+static SnapFile *snapshot_add_file(Snapshot *snap, const char *path) {
+    if (snap->file_count >= snap->file_capacity) {
+        size_t new_cap = snap->file_capacity ? snap->file_capacity * 2 : 256;
+        SnapFile *files = realloc(snap->files, new_cap * sizeof(SnapFile));
+        if (!files) return NULL;
+        snap->files = files;
+        snap->file_capacity = new_cap;
+    }
+    
+    SnapFile *file = &snap->files[snap->file_count];
+    memset(file, 0, sizeof(*file));
+    file->path = str_dup(path);
+    if (!file->path) return NULL;
+    file->first = snap->hash_count;
+    snap->file_count++;
+    return file;
+}
+
+static int snapshot_add_hash(Snapshot *snap, const uint8_t *hash) {
+    if (snap->hash_count >= snap->hash_capacity) {
+        size_t new_cap = snap->hash_capacity ? snap->hash_capacity * 2 : 1024;
+        uint8_t *hashes = realloc(snap->hashes, new_cap * HASH_SHA256_SIZE);
+        if (!hashes) return -1;
+        snap->hashes = hashes;
+        snap->hash_capacity = new_cap;
+    }
+    memcpy(snap->hashes + snap->hash_count * HASH_SHA256_SIZE, hash, HASH_SHA256_SIZE);
+    snap->hash_count++;
+    return 0;
+}
+
+static const uint8_t *snapshot_hash(const Snapshot *snap, const SnapFile *file, size_t i) {
+    return snap->hashes + (file->first + i) * HASH_SHA256_SIZE;
+}
+
+static int snap_file_compare(const void *a, const void *b) {
+    const SnapFile *fa = a;
+    const SnapFile *fb = b;
+    return strcmp(fa->path, fb->path);
+}
+
+static const SnapFile *snapshot_find(const Snapshot *snap, const char *path) {
+    size_t lo = 0, hi = snap->file_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(snap->files[mid].path, path);
+        if (cmp == 0) return &snap->files[mid];
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+/* Load a snapshot; with header_only the file records are skipped */
+static int snapshot_load(Snapshot *snap, const char *path, int header_only) {
+    memset(snap, 0, sizeof(Snapshot));
+    
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    
+    char line[ARCHIVE_MAX_NAME + 128];
+    int in_files = 0;
+    SnapFile *file = NULL;
+    size_t expect = 0;
+    int result = 0;
+    
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == ';' || line[0] == '\0') continue;
+        
+        if (!in_files) {
+            if (strcmp(line, "[files]") == 0) {
+                if (header_only) break;
+                in_files = 1;
+                continue;
+            }
+            char *eq = strchr(line, '=');
+            if (!eq) continue;
+            *eq = '\0';
+            if (strcmp(line, "project") == 0) {
+                snprintf(snap->project, sizeof(snap->project), "%s", eq + 1);
+            } else if (strcmp(line, "time") == 0) {
+                snap->time = strtoll(eq + 1, NULL, 10);
+            } else if (strcmp(line, "files") == 0) {
+                snap->declared_files = (size_t)strtoull(eq + 1, NULL, 10);
+            } else if (strcmp(line, "bytes") == 0) {
+                snap->bytes = strtoull(eq + 1, NULL, 10);
+            }
+            continue;
+        }
+        
+        if (expect > 0) {
+            uint8_t hash[HASH_SHA256_SIZE];
+            if (hash_from_hex(line, hash, HASH_SHA256_SIZE) != 0 ||
+                snapshot_add_hash(snap, hash) != 0) {
+                result = -1;
+                break;
+            }
+            file->count++;
+            expect--;
+            continue;
+        }
+        
+        unsigned long long size, count;
+        long long mtime;
+        int offset = 0;
+        if (sscanf(line, "%llu %lld %llu %n", &size, &mtime, &count, &offset) != 3 ||
+            offset == 0 || line[offset] == '\0') {
+            result = -1;
+            break;
+        }
+        file = snapshot_add_file(snap, line + offset);
+        if (!file) {
+            result = -1;
+            break;
+        }
+        file->size = size;
+        file->mtime = mtime;
+        expect = (size_t)count;
+    }
+    fclose(f);
+    
+    if (result == 0 && expect > 0) result = -1;
+    if (result != 0) {
+        snapshot_free(snap);
+        return -1;
+    }
+    
+    /* Written sorted, but do not rely on hand-edited files */
+    if (snap->file_count > 1) qsort(snap->files, snap->file_count, sizeof(SnapFile), snap_file_compare);
+    return 0;
+}
+
+static int snapshot_save(const Snapshot *snap, const char *path) {
+    char tmp[BACKUP_MAX_PATH + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    
+    fprintf(f, "; tedit backup snapshot\n");
+    fprintf(f, "project=%s\n", snap->project);
+    fprintf(f, "time=%lld\n", (long long)snap->time);
+    fprintf(f, "files=%zu\n", snap->file_count);
+    fprintf(f, "bytes=%llu\n\n[files]\n", (unsigned long long)snap->bytes);
+    
+    char hex[2 * HASH_SHA256_SIZE + 1];
+    for (size_t i = 0; i < snap->file_count; i++) {
+        const SnapFile *file = &snap->files[i];
+        fprintf(f, "%llu %lld %zu %s\n", (unsigned long long)file->size,
+                (long long)file->mtime, file->count, file->path);
+        for (size_t k = 0; k < file->count; k++) {
+            hash_to_hex(snapshot_hash(snap, file, k), HASH_SHA256_SIZE, hex);
+            fprintf(f, "%s\n", hex);
+        }
+    }
+    
+    if (fclose(f) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    
+    remove(path);
+    return rename(tmp, path) == 0 ? 0 : -1;
+}
+
+static int info_compare(const void *a, const void *b) {
+    const DedupSnapshotInfo *ia = a;
+    const DedupSnapshotInfo *ib = b;
+    return strcmp(ia->name, ib->name);
+}
+
+/* Add one directory entry to the listing if it names a snapshot */
+static int list_add(const DedupRepo *repo, const char *file_name, DedupSnapshotInfo **list,
+                    size_t *count, size_t *capacity) {
+    size_t len = strlen(file_name);
+    if (len <= 5 || strcmp(file_name + len - 5, ".snap") != 0) return 0;
+    
+    if (*count >= *capacity) {
+        size_t new_cap = *capacity ? *capacity * 2 : 32;
+        DedupSnapshotInfo *grown = realloc(*list, new_cap * sizeof(DedupSnapshotInfo));
+        if (!grown) return -1;
+        *list = grown;
+        *capacity = new_cap;
+    }
+    
+    DedupSnapshotInfo *info = &(*list)[*count];
+    memset(info, 0, sizeof(*info));
+    snprintf(info->name, sizeof(info->name), "%.*s", (int)(len - 5), file_name);
+    
+    char path[BACKUP_MAX_PATH];
+    Snapshot snap;
+    if (snapshot_path(repo, info->name, path, sizeof(path)) != 0 ||
+        snapshot_load(&snap, path, 1) != 0) {
+        return 0;
+    }
+    
+    snprintf(info->project, sizeof(info->project), "%s", snap.project);
+    info->time = snap.time;
+    info->files = snap.declared_files;
+    info->bytes = snap.bytes;
+    snapshot_free(&snap);
+    (*count)++;
+    return 0;
+}
+
+int dedup_list(const DedupRepo *repo, DedupSnapshotInfo **out, size_t *count) {
+    DedupSnapshotInfo *list = NULL;
+    size_t n = 0, cap = 0;
+
+#ifdef _WIN32
+    char pattern[BACKUP_MAX_PATH];
+    int len = snprintf(pattern, sizeof(pattern), "%s\\snapshots\\*.snap", repo->path);
+    if (len < 0 || len >= (int)sizeof(pattern)) return -1;
+    
+    WIN32_FIND_DATAA fd;
+    HANDLE hFind = FindFirstFileA(pattern, &fd);
+    if (hFind != INVALID_HANDLE_VALUE) {
+        do {
+            if (list_add(repo, fd.cFileName, &list, &n, &cap) != 0) break;
+        } while (FindNextFileA(hFind, &fd));
+        FindClose(hFind);
+    }
+#else
+    char dir[BACKUP_MAX_PATH];
+    int len = snprintf(dir, sizeof(dir), "%s/snapshots", repo->path);
+    if (len < 0 || len >= (int)sizeof(dir)) return -1;
+    
+    DIR *d = opendir(dir);
+    if (!d) return -1;
+    
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (list_add(repo, entry->d_name, &list, &n, &cap) != 0) break;
+    }
+    closedir(d);
+#endif
+    
+    if (n > 1) qsort(list, n, sizeof(DedupSnapshotInfo), info_compare);
+    *out = list;
+    *count = n;
+    return 0;
+}
+
+/* ==========================================================================
+ * Backup
+ * ========================================================================== */
+
+/* One file of a batch, chunked by a worker and stored by the writer */
+typedef struct DedupJob {
+    ArchiveEntry *entry;
+    const SnapFile *prev;           /* Unchanged file in the previous snapshot */
+    int skip;
+    char *data;                     /* Mapping kept open for the writer */
+    size_t len;
+    int mapped;
+    int64_t mtime;
+    uint8_t *hashes;
+    uint32_t *lengths;
+    unsigned char *novel;           /* Not in the index when the batch began */
+    size_t count;
+    size_t capacity;
+} DedupJob;
+
+typedef struct DedupBatch {
+    const DedupRepo *repo;
+    const Snapshot *prev;
+    DedupJob *jobs;
+} DedupBatch;
+
+static int job_reserve(DedupJob *job) {
+    if (job->count < job->capacity) return 0;
+    size_t new_cap = job->capacity ? job->capacity * 2 : 16;
+    uint8_t *hashes = realloc(job->hashes, new_cap * HASH_SHA256_SIZE);
+    if (hashes) job->hashes = hashes;
+    uint32_t *lengths = realloc(job->lengths, new_cap * sizeof(uint32_t));
+    if (lengths) job->lengths = lengths;
+    unsigned char *novel = realloc(job->novel, new_cap);
+    if (novel) job->novel = novel;
+    if (!hashes || !lengths || !novel) return -1;
+    job->capacity = new_cap;
+    return 0;
+}
+
+static void dedup_chunk_worker(size_t index, void *ctx) {
+    DedupBatch *batch = ctx;
+    DedupJob *job = &batch->jobs[index];
+    ArchiveEntry *entry = job->entry;
+    
+    if (entry->data) {
+        job->data = entry->data;
+        job->len = entry->data_len;
+    } else {
+        uint64_t size = entry->size;
+        job->mtime = entry->mtime;
+        if (!entry->has_stat) {
+            struct stat st;
+            if (stat(entry->source, &st) != 0) {
+                job->skip = 1;
+                return;
+            }
+            size = (uint64_t)st.st_size;
+            job->mtime = (int64_t)st.st_mtime;
+        }
+        
+        /* Same size and mtime as last time, with every chunk still
+         * present: reuse the old chunk list without reading the file */
+        const SnapFile *prev = snapshot_find(batch->prev, entry->path);
+        if (prev && prev->size == size && prev->mtime == job->mtime) {
+            size_t k = 0;
+            while (k < prev->count && dedup_find(batch->repo, snapshot_hash(batch->prev, prev, k))) {
+                k++;
+            }
+            if (k == prev->count) {
+                job->prev = prev;
+                return;
+            }
+        }
+        
+        job->data = file_map(entry->source, &job->len);
+        if (!job->data) {
+            job->skip = 1;
+            return;
+        }
+        job->mapped = 1;
+    }
+    
+    const unsigned char *p = (const unsigned char *)job->data;
+    size_t left = job->len;
+    while (left > 0) {
+        if (job_reserve(job) != 0) {
+            job->skip = 1;
+            return;
+        }
+        size_t n = dedup_chunk_length(p, left);
+        uint8_t *hash = job->hashes + job->count * HASH_SHA256_SIZE;
+        hash_sha256(p, n, hash);
+        job->lengths[job->count] = (uint32_t)n;
+        job->novel[job->count] = dedup_find(batch->repo, hash) == NULL;
+        job->count++;
+        p += n;
+        left -= n;
+    }
+}
+
+static void dedup_job_free(DedupJob *job) {
+    if (job->mapped) file_unmap(job->data, job->len);
+    free(job->hashes);
+    free(job->lengths);
+    free(job->novel);
+}
+
+/* Pack writer state for one backup */
+typedef struct PackWriter {
+    DedupRepo *repo;
+    FILE *f;
+    int error;
+} PackWriter;
+
+static void pack_store(PackWriter *w, const uint8_t *hash, const char *data, uint32_t len) {
+    DedupRepo *repo = w->repo;
+    
+    if (w->f && repo->pack_size + len > DEDUP_PACK_MAX && repo->pack_size > 0) {
+        if (fclose(w->f) != 0) w->error = 1;
+        w->f = NULL;
+        repo->pack++;
+        repo->pack_size = 0;
+    }
+    if (!w->f) {
+        char file[BACKUP_MAX_PATH];
+        if (pack_path(repo, repo->pack, file, sizeof(file)) != 0) {
+            w->error = 1;
+            return;
+        }
+        w->f = fopen(file, "ab");
+        if (!w->f) {
+            w->error = 1;
+            return;
+        }
+    }
+    
+    if (fwrite(data, 1, len, w->f) != len) {
+        w->error = 1;
+        return;
+    }
+    
+    DedupChunk *chunk = index_add(repo, hash);
+    if (!chunk) {
+        w->error = 1;
+        return;
+    }
+    chunk->pack = repo->pack;
+    chunk->offset = repo->pack_size;
+    chunk->length = len;
+    repo->pack_size += len;
+}
+
+/* Append index lines for chunks [first, repo->count) */
+static int index_append(DedupRepo *repo, size_t first) {
+    if (first == repo->count) return 0;
+    
+    char file[BACKUP_MAX_PATH];
+    int len = snprintf(file, sizeof(file), "%s/index", repo->path);
+    if (len < 0 || len >= (int)sizeof(file)) return -1;
+    FILE *f = fopen(file, "a");
+    if (!f) return -1;
+    
+    char hex[2 * HASH_SHA256_SIZE + 1];
+    for (size_t i = first; i < repo->count; i++) {
+        const DedupChunk *chunk = &repo->chunks[i];
+        hash_to_hex(chunk->hash, HASH_SHA256_SIZE, hex);
+        fprintf(f, "%s %u %llu %u\n", hex, (unsigned)chunk->pack,
+                (unsigned long long)chunk->offset, (unsigned)chunk->length);
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/* Most recent snapshot of a project, or an empty snapshot */
+static void load_previous(const DedupRepo *repo, const char *project_name, Snapshot *prev) {
+    memset(prev, 0, sizeof(Snapshot));
+    
+    DedupSnapshotInfo *list;
+    size_t count;
+    if (dedup_list(repo, &list, &count) != 0) return;
+    
+    for (size_t i = count; i > 0; i--) {
+        if (strcmp(list[i - 1].project, project_name) == 0) {
+            char path[BACKUP_MAX_PATH];
+            if (snapshot_path(repo, list[i - 1].name, path, sizeof(path)) == 0) {
+                snapshot_load(prev, path, 0);
+            }
+            break;
+        }
+    }
+    free(list);
+}
+
+int dedup_backup(DedupRepo *repo, Archive *ar, const char *project_name,
+                 int threads, char *snapshot, size_t snapshot_size,
+                 BackupRepoStats *stats) {
+    BackupRepoStats st;
+    memset(&st, 0, sizeof(st));
+    double start = time_now();
+    
+    if (threads <= 0) threads = parallel_cpu_count();
+    st.threads = threads;
+    
+    Snapshot prev, next;
+    load_previous(repo, project_name, &prev);
+    memset(&next, 0, sizeof(next));
+    snprintf(next.project, sizeof(next.project), "%s", project_name);
+    next.time = (int64_t)time(NULL);
+    
+    DedupJob *jobs = calloc(DEDUP_BATCH_FILES, sizeof(DedupJob));
+    if (!jobs) {
+        snapshot_free(&prev);
+        return -1;
+    }
+    
+    PackWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.repo = repo;
+    size_t first_new = repo->count;
+    int result = 0;
+    
+    for (size_t base = 0; base < ar->entry_count && result == 0; base += DEDUP_BATCH_FILES) {
+        size_t n = ar->entry_count - base;
+        if (n > DEDUP_BATCH_FILES) n = DEDUP_BATCH_FILES;
+        
+        memset(jobs, 0, n * sizeof(DedupJob));
+        for (size_t i = 0; i < n; i++) jobs[i].entry = &ar->entries[base + i];
+        
+        DedupBatch batch;
+        batch.repo = repo;
+        batch.prev = &prev;
+        batch.jobs = jobs;
+        parallel_for(n, threads, dedup_chunk_worker, &batch);
+        
+        /* Store new chunks in entry order so packs are reproducible */
+        for (size_t i = 0; i < n && result == 0; i++) {
+            DedupJob *job = &jobs[i];
+            if (job->skip) {
+                st.skipped++;
+                continue;
+            }
+            
+            SnapFile *file = snapshot_add_file(&next, job->entry->path);
+            if (!file) {
+                result = -1;
+                break;
+            }
+            
+            if (job->prev) {
+                for (size_t k = 0; k < job->prev->count && result == 0; k++) {
+                    if (snapshot_add_hash(&next, snapshot_hash(&prev, job->prev, k)) != 0) {
+                        result = -1;
+                    }
+                }
+                file->size = job->prev->size;
+                file->mtime = job->prev->mtime;
+                file->count = job->prev->count;
+                st.reused++;
+            } else {
+                size_t offset = 0;
+                for (size_t k = 0; k < job->count && result == 0; k++) {
+                    const uint8_t *hash = job->hashes + k * HASH_SHA256_SIZE;
+                    if (job->novel[k] && !dedup_find(repo, hash)) {
+                        pack_store(&writer, hash, job->data + offset, job->lengths[k]);
+                        st.new_chunks++;
+                        st.new_bytes += job->lengths[k];
+                    }
+                    if (writer.error || snapshot_add_hash(&next, hash) != 0) result = -1;
+                    offset += job->lengths[k];
+                }
+                file->size = job->len;
+                file->mtime = job->mtime;
+                file->count = job->count;
+            }
+            
+            st.files++;
+            st.chunks += file->count;
+            st.bytes += file->size;
+            next.bytes += file->size;
+        }
+        
+        for (size_t i = 0; i < n; i++) dedup_job_free(&jobs[i]);
+    }
+    free(jobs);
+    
+    /* Pack data first, then the index, then the snapshot */
+    if (writer.f && fclose(writer.f) != 0) result = -1;
+    if (result == 0 && index_append(repo, first_new) != 0) result = -1;
+    
+    if (result == 0) {
+        qsort(next.files, next.file_count, sizeof(SnapFile), snap_file_compare);
+        
+        char name[BACKUP_MAX_PATH];
+        char path[BACKUP_MAX_PATH];
+        char timestamp[32];
+        time_t now = (time_t)next.time;
+        strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", localtime(&now));
+        snprintf(name, sizeof(name), "%s-%s", project_name, timestamp);
+        result = snapshot_path(repo, name, path, sizeof(path));
+        
+        /* Two backups within a second get distinct names */
+        struct stat sst;
+        for (int k = 2; result == 0 && stat(path, &sst) == 0; k++) {
+            snprintf(name, sizeof(name), "%s-%s-%d", project_name, timestamp, k);
+            result = snapshot_path(repo, name, path, sizeof(path));
+        }
+        
+        if (result == 0) result = snapshot_save(&next, path);
+        if (result == 0 && snapshot) snprintf(snapshot, snapshot_size, "%s", name);
+    }
+    
+    snapshot_free(&next);
+    snapshot_free(&prev);
+    st.seconds = time_now() - start;
+    if (stats) *stats = st;
+    return result;
+}
+
+/* ==========================================================================
+ * Restore and verify
+ * ========================================================================== */
+
+typedef struct RestoreCtx {
+    DedupRepo *repo;
+    const Snapshot *snap;
+    const char *dest_dir;
+    unsigned char *failed;          /* Per file: 1 = failed, 2 = outside files/ */
+    size_t *bad_chunks;             /* Per file */
+} RestoreCtx;
+
+static void dedup_restore_worker(size_t index, void *ctx) {
+    RestoreCtx *rc = ctx;
+    const SnapFile *file = &rc->snap->files[index];
+    
+    /* Project files land in dest_dir without the prefix, as --restore does */
+    size_t prefix = strlen(RESTORE_PREFIX);
+    if (strncmp(file->path, RESTORE_PREFIX, prefix) != 0 || !file->path[prefix]) {
+        rc->failed[index] = 2;
+        return;
+    }
+    const char *rel = file->path + prefix;
+    
+    /* Snapshot paths come from the repository: never escape dest_dir */
+    if (!path_is_safe(rel)) {
+        rc->failed[index] = 1;
+        return;
+    }
+    
+    char out_path[BACKUP_MAX_PATH + ARCHIVE_MAX_NAME];
+    char dir[BACKUP_MAX_PATH + ARCHIVE_MAX_NAME];
+    if (strlen(rc->dest_dir) + strlen(rel) + 1 >= sizeof(out_path)) {
+        rc->failed[index] = 1;
+        return;
+    }
+    path_join(out_path, sizeof(out_path), rc->dest_dir, rel);
+    path_dirname(out_path, dir, sizeof(dir));
+    if (dir[0]) path_make_dirs(dir);
+    
+    FILE *out = fopen(out_path, "wb");
+    unsigned char *buf = malloc(DEDUP_CHUNK_MAX);
+    if (!out || !buf) {
+        if (out) fclose(out);
+        free(buf);
+        rc->failed[index] = 1;
+        return;
+    }
+    
+    FILE *pack_file = NULL;
+    uint32_t open_pack = 0;
+    for (size_t k = 0; k < file->count; k++) {
+        const DedupChunk *chunk = dedup_find(rc->repo, snapshot_hash(rc->snap, file, k));
+        if (!chunk || chunk->length > DEDUP_CHUNK_MAX ||
+            read_chunk(rc->repo, chunk, &pack_file, &open_pack, buf) != 0) {
+            rc->bad_chunks[index]++;
+            rc->failed[index] = 1;
+            continue;
+        }
+        if (fwrite(buf, 1, chunk->length, out) != chunk->length) rc->failed[index] = 1;
+    }
+    if (pack_file) fclose(pack_file);
+    free(buf);
+    if (fclose(out) != 0) rc->failed[index] = 1;
+    
+    /* Restored mtimes let the next backup reuse these files unread */
+    struct utimbuf times;
+    times.actime = (time_t)file->mtime;
+    times.modtime = (time_t)file->mtime;
+    utime(out_path, &times);
+}
+
+int dedup_restore(DedupRepo *repo, const char *snapshot, const char *dest_dir,
+                  int threads, BackupRepoStats *stats) {
+    BackupRepoStats st;
+    memset(&st, 0, sizeof(st));
+    double start = time_now();
+    
+    char path[BACKUP_MAX_PATH];
+    Snapshot snap;
+    if (snapshot_path(repo, snapshot, path, sizeof(path)) != 0 ||
+        snapshot_load(&snap, path, 0) != 0) {
+        return -1;
+    }
+    
+    if (threads <= 0) threads = parallel_cpu_count();
+    st.threads = threads;
+    
+    size_t n = snap.file_count;
+    RestoreCtx rc;
+    rc.repo = repo;
+    rc.snap = &snap;
+    rc.dest_dir = dest_dir;
+    rc.failed = calloc(n ? n : 1, 1);
+    rc.bad_chunks = calloc(n ? n : 1, sizeof(size_t));
+    if (!rc.failed || !rc.bad_chunks) {
+        free(rc.failed);
+        free(rc.bad_chunks);
+        snapshot_free(&snap);
+        return -1;
+    }
+    
+    path_make_dirs(dest_dir);
+    parallel_for(n, threads, dedup_restore_worker, &rc);
+    
+    for (size_t i = 0; i < n; i++) {
+        if (rc.failed[i] == 2) {
+            st.outside++;
+        } else if (rc.failed[i]) {
+            st.skipped++;
+        } else {
+            st.files++;
+            st.bytes += snap.files[i].size;
+        }
+        st.chunks += snap.files[i].count;
+        st.errors += rc.bad_chunks[i];
+    }
+    free(rc.failed);
+    free(rc.bad_chunks);
+    snapshot_free(&snap);
+    
+    st.seconds = time_now() - start;
+    if (stats) *stats = st;
+    return st.skipped ? -1 : 0;
+}
+
+/* Chunks grouped by pack and ordered by offset, for sequential reads */
+typedef struct VerifyCtx {
+    DedupRepo *repo;
+    const DedupChunk **order;       /* Sorted by (pack, offset) */
+    size_t *group_start;            /* One group per pack in use */
+    size_t group_count;
+    size_t *bad;                    /* Per group */
+} VerifyCtx;
+
+static int verify_order_compare(const void *a, const void *b) {
+    const DedupChunk *ca = *(const DedupChunk *const *)a;
+    const DedupChunk *cb = *(const DedupChunk *const *)b;
+    if (ca->pack != cb->pack) return ca->pack < cb->pack ? -1 : 1;
+    if (ca->offset != cb->offset) return ca->offset < cb->offset ? -1 : 1;
+    return 0;
+}
+
+static void dedup_verify_worker(size_t index, void *ctx) {
+    VerifyCtx *vc = ctx;
+    unsigned char *buf = malloc(DEDUP_CHUNK_MAX);
+    FILE *pack_file = NULL;
+    uint32_t open_pack = 0;
+    
+    for (size_t i = vc->group_start[index]; i < vc->group_start[index + 1]; i++) {
+        const DedupChunk *chunk = vc->order[i];
+        if (!buf || chunk->length > DEDUP_CHUNK_MAX ||
+            read_chunk(vc->repo, chunk, &pack_file, &open_pack, buf) != 0) {
+            vc->bad[index]++;
+        }
+    }
+    if (pack_file) fclose(pack_file);
+    free(buf);
+}
+
+int dedup_verify(DedupRepo *repo, int threads, BackupRepoStats *stats) {
+    BackupRepoStats st;
+    memset(&st, 0, sizeof(st));
+    double start = time_now();
+    
+    if (threads <= 0) threads = parallel_cpu_count();
+    st.threads = threads;
+    
+    /* Every stored chunk must still hash to its name */
+    size_t n = repo->count;
+    VerifyCtx vc;
+    memset(&vc, 0, sizeof(vc));
+    vc.repo = repo;
+    vc.order = malloc((n ? n : 1) * sizeof(DedupChunk *));
+    vc.group_start = malloc((n + 1) * sizeof(size_t));
+    vc.bad = calloc(n ? n : 1, sizeof(size_t));
+    if (!vc.order || !vc.group_start || !vc.bad) {
+        free(vc.order);
+        free(vc.group_start);
+        free(vc.bad);
+        return -1;
+    }
+    
+    for (size_t i = 0; i < n; i++) vc.order[i] = &repo->chunks[i];
+    qsort(vc.order, n, sizeof(DedupChunk *), verify_order_compare);
+    
+    for (size_t i = 0; i < n; i++) {
+        if (i == 0 || vc.order[i]->pack != vc.order[i - 1]->pack) {
+            vc.group_start[vc.group_count++] = i;
+        }
+    }
+    vc.group_start[vc.group_count] = n;
+    
+    parallel_for(vc.group_count, threads, dedup_verify_worker, &vc);
+    
+    for (size_t g = 0; g < vc.group_count; g++) st.errors += vc.bad[g];
+    for (size_t i = 0; i < n; i++) st.bytes += repo->chunks[i].length;
+    st.chunks = n;
+    free(vc.order);
+    free(vc.group_start);
+    free(vc.bad);
+    
+    /* Every snapshot must refer only to indexed chunks */
+    DedupSnapshotInfo *list;
+    size_t count;
+    if (dedup_list(repo, &list, &count) == 0) {
+        for (size_t i = 0; i < count; i++) {
+            char path[BACKUP_MAX_PATH];
+            Snapshot snap;
+            if (snapshot_path(repo, list[i].name, path, sizeof(path)) != 0 ||
+                snapshot_load(&snap, path, 0) != 0) {
+                st.errors++;
+                continue;
+            }
+            for (size_t k = 0; k < snap.hash_count; k++) {
+                if (!dedup_find(repo, snap.hashes + k * HASH_SHA256_SIZE)) st.errors++;
+            }
+            st.files += snap.file_count;
+            snapshot_free(&snap);
+        }
+        free(list);
+    }
+    
+    st.seconds = time_now() - start;
+    if (stats) *stats = st;
+    return st.errors ? -1 : 0;
+}
@@ -0,0 +1,1240 @@
+/*
+ * deflate.c - Built-in deflate compressor and gzip stream writer
+ *
+ * LZ77 uses hash chains with one step of lazy matching; each deflate
+ * block picks the cheapest of dynamic Huffman, fixed Huffman or stored.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "deflate.h"
+#include "parallel.h"
+
+#define HASH_BITS    15
+#define HASH_SIZE    (1 << HASH_BITS)
+#define MIN_MATCH    3
+#define MAX_MATCH    258
+#define MAX_BITS     15
+#define BLOCK_SYMBOLS 16384     /* LZ77 symbols per deflate block */
+
+#define LITLEN_CODES 286
+#define DIST_CODES   30
+#define CLEN_CODES   19
+
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t clen_order[CLEN_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* Hash chain lengths by level (1-9) */
+static const int chain_limit[10] = { 0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096 };
+
+static int bit_length(uint32_t v) {
+    int n = 0;
+    while (v) {
+        n++;
+        v >>= 1;
+    }
+    return n;
+}
+
+/* Length 3..258 to code 257..285 */
+static int length_code(int len) {
+    int v = len - 3;
+    if (len == 258) return 285;
+    if (v < 8) return 257 + v;
+    int n = bit_length((uint32_t)v) - 1;
+    return 257 + 4 * (n - 1) + ((v >> (n - 2)) & 3);
+}
+
+/* Distance 1..32768 to code 0..29 */
+static int dist_code(int dist) {
+    int v = dist - 1;
+    if (v < 4) return v;
+    int n = bit_length((uint32_t)v) - 1;
+    return 2 * n + ((v >> (n - 1)) & 1);
+}
+
+/* ==========================================================================
+ * Output
+ * ========================================================================== */
+
+static int buf_reserve(DeflateBuf *buf, size_t extra) {
+    if (buf->len + extra <= buf->cap) return 0;
+    size_t new_cap = buf->cap ? buf->cap : 4096;
+    while (new_cap < buf->len + extra) new_cap *= 2;
+    unsigned char *data = realloc(buf->data, new_cap);
+    if (!data) return -1;
+    buf->data = data;
+    buf->cap = new_cap;
+    return 0;
+}
+
+void deflate_buf_free(DeflateBuf *buf) {
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+/* LSB-first bit writer */
+typedef struct BitWriter {
+    DeflateBuf *out;
+    uint64_t bits;
+    int count;
+    int error;
+} BitWriter;
+
+static void put_bits(BitWriter *bw, uint32_t value, int n) {
+    bw->bits |= (uint64_t)value << bw->count;
+    bw->count += n;
+    if (bw->count >= 32) {
+        if (buf_reserve(bw->out, 4) != 0) {
+            bw->error = 1;
+        } else {
+            unsigned char *p = bw->out->data + bw->out->len;
+            p[0] = (unsigned char)bw->bits;
+            p[1] = (unsigned char)(bw->bits >> 8);
+            p[2] = (unsigned char)(bw->bits >> 16);
+            p[3] = (unsigned char)(bw->bits >> 24);
+            bw->out->len += 4;
+        }
+        bw->bits >>= 32;
+        bw->count -= 32;
+    }
+}
+
+/* Pad with zero bits to a byte boundary and flush */
+static void align_bits(BitWriter *bw) {
+    int pad = (8 - (bw->count & 7)) & 7;
+    if (pad) put_bits(bw, 0, pad);
+    while (bw->count > 0) {
+        if (buf_reserve(bw->out, 1) != 0) {
+            bw->error = 1;
+            return;
+        }
+        bw->out->data[bw->out->len++] = (unsigned char)bw->bits;
+        bw->bits >>= 8;
+        bw->count -= 8;
+    }
+    bw->count = 0;
+}
+
+static void put_bytes(BitWriter *bw, const unsigned char *data, size_t len) {
+    if (buf_reserve(bw->out, len) != 0) {
+        bw->error = 1;
+        return;
+    }
+    memcpy(bw->out->data + bw->out->len, data, len);
+    bw->out->len += len;
+}
+
+/* ==========================================================================
+ * Huffman codes
+ * ========================================================================== */
+
+typedef struct HuffLeaf {
+    uint32_t freq;
+    uint16_t sym;
+} HuffLeaf;
+
+static int leaf_compare(const void *a, const void *b) {
+    const HuffLeaf *la = a;
+    const HuffLeaf *lb = b;
+    if (la->freq != lb->freq) return la->freq < lb->freq ? -1 : 1;
+    return (int)la->sym - (int)lb->sym;
+}
+
+/* Code lengths for freq[0..n), limited to `limit` bits */
+static void build_lengths(const uint32_t *freq, int n, int limit, uint8_t *lens) {
+    HuffLeaf leaves[LITLEN_CODES];
+    int m = 0;
+    
+    memset(lens, 0, (size_t)n);
+    for (int i = 0; i < n; i++) {
+        if (freq[i]) {
+            leaves[m].freq = freq[i];
+            leaves[m].sym = (uint16_t)i;
+            m++;
+        }
+    }
+    if (m == 0) return;
+    if (m == 1) {
+        /* Pad to a complete two-code set; inflaters reject a lone
+         * code-length code */
+        lens[leaves[0].sym] = 1;
+        lens[leaves[0].sym == 0 ? 1 : 0] = 1;
+        return;
+    }
+    
+    qsort(leaves, (size_t)m, sizeof(HuffLeaf), leaf_compare);
+    
+    /* Two-queue Huffman build over sorted leaves */
+    uint32_t node_freq[2 * LITLEN_CODES];
+    int parent[2 * LITLEN_CODES];
+    int depth[2 * LITLEN_CODES];
+    for (int i = 0; i < m; i++) node_freq[i] = leaves[i].freq;
+    
+    int next_leaf = 0, next_node = m, end = m;
+    for (int k = 0; k < m - 1; k++) {
+        int pick[2];
+        for (int j = 0; j < 2; j++) {
+            if (next_leaf < m &&
+                (next_node >= end || node_freq[next_leaf] <= node_freq[next_node])) {
+                pick[j] = next_leaf++;
+            } else {
+                pick[j] = next_node++;
+            }
+        }
+        node_freq[end] = node_freq[pick[0]] + node_freq[pick[1]];
+        parent[pick[0]] = end;
+        parent[pick[1]] = end;
+        end++;
+    }
+    
+    depth[end - 1] = 0;
+    for (int i = end - 2; i >= 0; i--) depth[i] = depth[parent[i]] + 1;
+    
+    /* Clamp to the limit and repair the Kraft sum */
+    int count[MAX_BITS + 2] = {0};
+    for (int i = 0; i < m; i++) {
+        count[depth[i] > limit ? limit : depth[i]]++;
+    }
+    uint32_t total = 0;
+    for (int l = 1; l <= limit; l++) total += (uint32_t)count[l] << (limit - l);
+    while (total > (1u << limit)) {
+        count[limit]--;
+        for (int l = limit - 1; l > 0; l--) {
+            if (count[l]) {
+                count[l]--;
+                count[l + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+    
+    /* Least frequent leaves get the longest codes */
+    int leaf = 0;
+    for (int l = limit; l > 0; l--) {
+        for (int c = 0; c < count[l]; c++) {
+            lens[leaves[leaf++].sym] = (uint8_t)l;
+        }
+    }
+}
+
+static uint16_t reverse_bits(uint32_t code, int len) {
+    uint32_t r = 0;
+    for (int i = 0; i < len; i++) {
+        r = (r << 1) | (code & 1);
+        code >>= 1;
+    }
+    return (uint16_t)r;
+}
+
+/* Canonical codes, bit-reversed for the LSB-first writer */
+static void build_codes(const uint8_t *lens, int n, uint16_t *codes) {
+    int count[MAX_BITS + 1] = {0};
+    uint32_t next[MAX_BITS + 1];
+    
+    for (int i = 0; i < n; i++) count[lens[i]]++;
+    count[0] = 0;
+    
+    uint32_t code = 0;
+    for (int bits = 1; bits <= MAX_BITS; bits++) {
+        code = (code + (uint32_t)count[bits - 1]) << 1;
+        next[bits] = code;
+    }
+    for (int i = 0; i < n; i++) {
+        codes[i] = lens[i] ? reverse_bits(next[lens[i]]++, lens[i]) : 0;
+    }
+}
+
+/* ==========================================================================
+ * Block encoding
+ * ========================================================================== */
+
+typedef struct DeflateState {
+    BitWriter bw;
+    const unsigned char *data;
+    uint16_t *lit;              /* Literal byte or match length */
+    uint16_t *dist;             /* Match distance, 0 for literals */
+    size_t sym_count;
+    size_t block_start;         /* First input byte of the pending block */
+    size_t emitted;             /* Input covered by the pending symbols */
+} DeflateState;
+
+/* Run-length encode the code lengths (symbols 16/17/18) */
+static int rle_lengths(const uint8_t *lens, int n, uint8_t *syms, uint8_t *extra) {
+    int out = 0;
+    int i = 0;
+    while (i < n) {
+        int cur = lens[i];
+        int run = 1;
+        while (i + run < n && lens[i + run] == cur) run++;
+        
+        if (cur == 0) {
+            int left = run;
+            while (left >= 11) {
+                int r = left < 138 ? left : 138;
+                syms[out] = 18;
+                extra[out++] = (uint8_t)(r - 11);
+                left -= r;
+            }
+            if (left >= 3) {
+                syms[out] = 17;
+                extra[out++] = (uint8_t)(left - 3);
+                left = 0;
+            }
+            while (left-- > 0) {
+                syms[out] = 0;
+                extra[out++] = 0;
+            }
+        } else {
+            syms[out] = (uint8_t)cur;
+            extra[out++] = 0;
+            int left = run - 1;
+            while (left >= 3) {
+                int r = left < 6 ? left : 6;
+                syms[out] = 16;
+                extra[out++] = (uint8_t)(r - 3);
+                left -= r;
+            }
+            while (left-- > 0) {
+                syms[out] = (uint8_t)cur;
+                extra[out++] = 0;
+            }
+        }
+        i += run;
+    }
+    return out;
+}
+
+static void write_stored(DeflateState *s, size_t start, size_t end, int final) {
+    BitWriter *bw = &s->bw;
+    do {
+        size_t len = end - start < 65535 ? end - start : 65535;
+        int last = start + len == end;
+        put_bits(bw, (last && final) ? 1 : 0, 1);
+        put_bits(bw, 0, 2);
+        align_bits(bw);
+        unsigned char hdr[4] = {
+            (unsigned char)len, (unsigned char)(len >> 8),
+            (unsigned char)~len, (unsigned char)(~len >> 8)
+        };
+        put_bytes(bw, hdr, 4);
+        put_bytes(bw, s->data + start, len);
+        start += len;
+    } while (start < end);
+}
+
+static void write_symbols(DeflateState *s, const uint8_t *ll_lens, const uint16_t *ll_codes,
+                          const uint8_t *d_lens, const uint16_t *d_codes) {
+    BitWriter *bw = &s->bw;
+    for (size_t i = 0; i < s->sym_count; i++) {
+        if (s->dist[i] == 0) {
+            int c = s->lit[i];
+            put_bits(bw, ll_codes[c], ll_lens[c]);
+        } else {
+            int len = s->lit[i];
+            int lc = length_code(len);
+            put_bits(bw, ll_codes[lc], ll_lens[lc]);
+            if (len_extra[lc - 257]) {
+                put_bits(bw, (uint32_t)(len - len_base[lc - 257]), len_extra[lc - 257]);
+            }
+            int d = s->dist[i];
+            int dc = dist_code(d);
+            put_bits(bw, d_codes[dc], d_lens[dc]);
+            if (dist_extra[dc]) {
+                put_bits(bw, (uint32_t)(d - dist_base[dc]), dist_extra[dc]);
+            }
+        }
+    }
+    put_bits(bw, ll_codes[256], ll_lens[256]);
+}
+
+/* Emit the pending symbols as one block in the cheapest encoding */
+static void flush_block(DeflateState *s, int final) {
+    uint32_t ll_freq[LITLEN_CODES] = {0};
+    uint32_t d_freq[DIST_CODES] = {0};
+    uint64_t extra_bits = 0;
+    
+    for (size_t i = 0; i < s->sym_count; i++) {
+        if (s->dist[i] == 0) {
+            ll_freq[s->lit[i]]++;
+        } else {
+            int lc = length_code(s->lit[i]);
+            int dc = dist_code(s->dist[i]);
+            ll_freq[lc]++;
+            d_freq[dc]++;
+            extra_bits += len_extra[lc - 257] + dist_extra[dc];
+        }
+    }
+    ll_freq[256] = 1;
+    
+    /* Dynamic code */
+    uint8_t ll_lens[LITLEN_CODES], d_lens[DIST_CODES];
+    build_lengths(ll_freq, LITLEN_CODES, MAX_BITS, ll_lens);
+    build_lengths(d_freq, DIST_CODES, MAX_BITS, d_lens);
+    
+    /* At least one distance code must be present */
+    int any_dist = 0;
+    for (int i = 0; i < DIST_CODES; i++) any_dist |= d_lens[i];
+    if (!any_dist) d_lens[0] = 1;
+    
+    int hlit = LITLEN_CODES;
+    while (hlit > 257 && ll_lens[hlit - 1] == 0) hlit--;
+    int hdist = DIST_CODES;
+    while (hdist > 1 && d_lens[hdist - 1] == 0) hdist--;
+    
+    uint8_t all_lens[LITLEN_CODES + DIST_CODES];
+    memcpy(all_lens, ll_lens, (size_t)hlit);
+    memcpy(all_lens + hlit, d_lens, (size_t)hdist);
+    
+    uint8_t rle_syms[LITLEN_CODES + DIST_CODES], rle_extra[LITLEN_CODES + DIST_CODES];
+    int rle_count = rle_lengths(all_lens, hlit + hdist, rle_syms, rle_extra);
+    
+    uint32_t cl_freq[CLEN_CODES] = {0};
+    for (int i = 0; i < rle_count; i++) cl_freq[rle_syms[i]]++;
+    uint8_t cl_lens[CLEN_CODES];
+    build_lengths(cl_freq, CLEN_CODES, 7, cl_lens);
+    
+    int hclen = CLEN_CODES;
+    while (hclen > 4 && cl_lens[clen_order[hclen - 1]] == 0) hclen--;
+    
+    uint64_t dyn_bits = 3 + 14 + 3 * (uint64_t)hclen + extra_bits;
+    for (int i = 0; i < rle_count; i++) {
+        int sym = rle_syms[i];
+        dyn_bits += cl_lens[sym] + (sym == 16 ? 2 : sym == 17 ? 3 : sym == 18 ? 7 : 0);
+    }
+    for (int i = 0; i < LITLEN_CODES; i++) dyn_bits += (uint64_t)ll_freq[i] * ll_lens[i];
+    for (int i = 0; i < DIST_CODES; i++) dyn_bits += (uint64_t)d_freq[i] * d_lens[i];
+    
+    /* Fixed code */
+    uint8_t fix_ll[LITLEN_CODES], fix_d[DIST_CODES];
+    for (int i = 0; i < LITLEN_CODES; i++) {
+        fix_ll[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    }
+    memset(fix_d, 5, sizeof(fix_d));
+    uint64_t fix_bits = 3 + extra_bits;
+    for (int i = 0; i < LITLEN_CODES; i++) fix_bits += (uint64_t)ll_freq[i] * fix_ll[i];
+    for (int i = 0; i < DIST_CODES; i++) fix_bits += (uint64_t)d_freq[i] * fix_d[i];
+    
+    /* Stored */
+    size_t raw = s->emitted - s->block_start;
+    uint64_t stored_bits = ((uint64_t)raw + 5 * (raw / 65535 + 1)) * 8 + 7;
+    
+    BitWriter *bw = &s->bw;
+    if (stored_bits <= dyn_bits && stored_bits <= fix_bits) {
+        write_stored(s, s->block_start, s->emitted, final);
+    } else if (fix_bits <= dyn_bits) {
+        uint16_t ll_codes[LITLEN_CODES], d_codes[DIST_CODES];
+        build_codes(fix_ll, LITLEN_CODES, ll_codes);
+        build_codes(fix_d, DIST_CODES, d_codes);
+        put_bits(bw, final ? 1 : 0, 1);
+        put_bits(bw, 1, 2);
+        write_symbols(s, fix_ll, ll_codes, fix_d, d_codes);
+    } else {
+        uint16_t ll_codes[LITLEN_CODES], d_codes[DIST_CODES], cl_codes[CLEN_CODES];
+        build_codes(ll_lens, LITLEN_CODES, ll_codes);
+        build_codes(d_lens, DIST_CODES, d_codes);
+        build_codes(cl_lens, CLEN_CODES, cl_codes);
+        
+        put_bits(bw, final ? 1 : 0, 1);
+        put_bits(bw, 2, 2);
+        put_bits(bw, (uint32_t)(hlit - 257), 5);
+        put_bits(bw, (uint32_t)(hdist - 1), 5);
+        put_bits(bw, (uint32_t)(hclen - 4), 4);
+        for (int i = 0; i < hclen; i++) put_bits(bw, cl_lens[clen_order[i]], 3);
+        for (int i = 0; i < rle_count; i++) {
+            int sym = rle_syms[i];
+            put_bits(bw, cl_codes[sym], cl_lens[sym]);
+            if (sym == 16) put_bits(bw, rle_extra[i], 2);
+            else if (sym == 17) put_bits(bw, rle_extra[i], 3);
+            else if (sym == 18) put_bits(bw, rle_extra[i], 7);
+        }
+        write_symbols(s, ll_lens, ll_codes, d_lens, d_codes);
+    }
+    
+    s->sym_count = 0;
+    s->block_start = s->emitted;
+}
+
+static void emit_literal(DeflateState *s) {
+    s->lit[s->sym_count] = s->data[s->emitted];
+    s->dist[s->sym_count] = 0;
+    s->sym_count++;
+    s->emitted++;
+    if (s->sym_count == BLOCK_SYMBOLS) flush_block(s, 0);
+}
+
+static void emit_match(DeflateState *s, int len, int dist) {
+    s->lit[s->sym_count] = (uint16_t)len;
+    s->dist[s->sym_count] = (uint16_t)dist;
+    s->sym_count++;
+    s->emitted += (size_t)len;
+    if (s->sym_count == BLOCK_SYMBOLS) flush_block(s, 0);
+}
+
+/* ==========================================================================
+ * LZ77
+ * ========================================================================== */
+
+typedef struct Matcher {
+    const unsigned char *data;
+    size_t end;
+    int32_t *head;
+    int32_t *prev;
+    int max_chain;
+} Matcher;
+
+static uint32_t hash3(const unsigned char *p) {
+    return (((uint32_t)p[0] << 10) ^ ((uint32_t)p[1] << 5) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+static void insert_pos(Matcher *m, size_t pos) {
+    if (pos + MIN_MATCH > m->end) return;
+    uint32_t h = hash3(m->data + pos);
+    m->prev[pos] = m->head[h];
+    m->head[h] = (int32_t)pos;
+}
+
+/* Longest match for pos among earlier positions (pos not yet inserted) */
+static int find_match(Matcher *m, size_t pos, int *dist_out) {
+    if (pos + MIN_MATCH > m->end) return 0;
+    
+    const unsigned char *cur = m->data + pos;
+    size_t avail = m->end - pos;
+    int max_len = avail < MAX_MATCH ? (int)avail : MAX_MATCH;
+    int best = MIN_MATCH - 1;
+    int chain = m->max_chain;
+    
+    int32_t cand = m->head[hash3(cur)];
+    while (cand >= 0 && chain-- > 0) {
+        size_t dist = pos - (size_t)cand;
+        if (dist > DEFLATE_WINDOW) break;
+        
+        const unsigned char *p = m->data + cand;
+        if (p[best] == cur[best] && p[0] == cur[0] && p[1] == cur[1]) {
+            int len = 2;
+            while (len < max_len && p[len] == cur[len]) len++;
+            if (len > best) {
+                best = len;
+                *dist_out = (int)dist;
+                if (len == max_len) break;
+            }
+        }
+        cand = m->prev[cand];
+    }
+    return best >= MIN_MATCH ? best : 0;
+}
+
+int deflate_chunk(const unsigned char *data, size_t dict_len, size_t len,
+                  int level, int final, DeflateBuf *out) {
+    if (dict_len > DEFLATE_WINDOW) {
+        data += dict_len - DEFLATE_WINDOW;
+        dict_len = DEFLATE_WINDOW;
+    }
+    if (level < 0) level = DEFLATE_DEFAULT_LEVEL;
+    if (level > 9) level = 9;
+    
+    DeflateState s;
+    memset(&s, 0, sizeof(s));
+    s.bw.out = out;
+    s.data = data;
+    s.block_start = dict_len;
+    s.emitted = dict_len;
+    
+    size_t end = dict_len + len;
+    
+    if (level == 0 || len == 0) {
+        if (len > 0) {
+            write_stored(&s, dict_len, end, final);
+        } else if (final) {
+            /* Empty fixed block carrying BFINAL */
+            put_bits(&s.bw, 1, 1);
+            put_bits(&s.bw, 1, 2);
+            put_bits(&s.bw, 0, 7);
+        }
+    } else {
+        Matcher m;
+        m.data = data;
+        m.end = end;
+        m.max_chain = chain_limit[level];
+        m.head = malloc(HASH_SIZE * sizeof(int32_t));
+        m.prev = malloc(end * sizeof(int32_t));
+        s.lit = malloc(BLOCK_SYMBOLS * sizeof(uint16_t));
+        s.dist = malloc(BLOCK_SYMBOLS * sizeof(uint16_t));
+        if (!m.head || !m.prev || !s.lit || !s.dist) {
+            free(m.head);
+            free(m.prev);
+            free(s.lit);
+            free(s.dist);
+            return -1;
+        }
+        memset(m.head, 0xff, HASH_SIZE * sizeof(int32_t));
+        
+        /* Prime the chains with the dictionary */
+        for (size_t p = 0; p < dict_len; p++) insert_pos(&m, p);
+        
+        /* Lazy matching: a match is only taken if the next position does
+         * not start a longer one */
+        int lazy_limit = level >= 4 ? 32 : 0;
+        size_t pos = dict_len;
+        int prev_len = 0, prev_dist = 0;
+        while (pos < end) {
+            int dist = 0;
+            int match = 0;
+            if (prev_len < lazy_limit || prev_len == 0) {
+                match = find_match(&m, pos, &dist);
+            }
+            insert_pos(&m, pos);
+            
+            if (prev_len >= MIN_MATCH && match <= prev_len) {
+                /* Take the previous position's match */
+                emit_match(&s, prev_len, prev_dist);
+                size_t stop = pos - 1 + (size_t)prev_len;
+                for (size_t p = pos + 1; p < stop; p++) insert_pos(&m, p);
+                pos = stop;
+                prev_len = 0;
+            } else {
+                if (s.emitted < pos) emit_literal(&s);
+                prev_len = match;
+                prev_dist = dist;
+                pos++;
+            }
+        }
+        if (prev_len >= MIN_MATCH) {
+            emit_match(&s, prev_len, prev_dist);
+        } else if (s.emitted < end) {
+            emit_literal(&s);
+        }
+        
+        if (s.sym_count > 0 || final) {
+            if (s.sym_count == 0) {
+                put_bits(&s.bw, 1, 1);
+                put_bits(&s.bw, 1, 2);
+                put_bits(&s.bw, 0, 7);
+            } else {
+                flush_block(&s, final);
+            }
+        }
+        
+        free(m.head);
+        free(m.prev);
+        free(s.lit);
+        free(s.dist);
+    }
+    
+    if (!final) {
+        /* Sync flush: empty stored block ends byte-aligned */
+        put_bits(&s.bw, 0, 3);
+        align_bits(&s.bw);
+        static const unsigned char sync[4] = { 0x00, 0x00, 0xff, 0xff };
+        put_bytes(&s.bw, sync, 4);
+    } else {
+        align_bits(&s.bw);
+    }
+    return s.bw.error ? -1 : 0;
+}
+
+/* ==========================================================================
+ * CRC-32
+ * ========================================================================== */
+
+static uint32_t crc_table[256];
+static int crc_table_ready = 0;
+
+static void crc32_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+    crc_table_ready = 1;
+}
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len) {
+    if (!crc_table_ready) crc32_init();
+    const unsigned char *p = data;
+    crc = ~crc;
+    while (len--) crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+/* GF(2) matrix helpers for crc32_combine (as in zlib) */
+static uint32_t gf2_times(const uint32_t *mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+static void gf2_square(uint32_t *square, const uint32_t *mat) {
+    for (int n = 0; n < 32; n++) square[n] = gf2_times(mat, mat[n]);
+}
+
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+    uint32_t even[32], odd[32];
+    if (len2 == 0) return crc1;
+    
+    /* Operator for one zero bit */
+    odd[0] = 0xEDB88320u;
+    uint32_t row = 1;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2_square(even, odd);      /* Two zero bits */
+    gf2_square(odd, even);      /* Four zero bits */
+    
+    /* Apply len2 zero bytes to crc1 */
+    do {
+        gf2_square(even, odd);
+        if (len2 & 1) crc1 = gf2_times(even, crc1);
+        len2 >>= 1;
+        if (len2 == 0) break;
+        
+        gf2_square(odd, even);
+        if (len2 & 1) crc1 = gf2_times(odd, crc1);
+        len2 >>= 1;
+    } while (len2 != 0);
+    
+    return crc1 ^ crc2;
+}
+
+/* ==========================================================================
+ * Gzip writer
+ * ========================================================================== */
+
+/* One independently compressed block of a batch */
+typedef struct GzipJob {
+    const unsigned char *data;  /* Start of the dictionary */
+    size_t dict_len;
+    size_t len;
+    int final;
+    int level;
+    uint32_t crc;
+    DeflateBuf out;
+    int error;
+} GzipJob;
+
+static void gzip_job_run(size_t index, void *ctx) {
+    GzipJob *job = &((GzipJob *)ctx)[index];
+    job->crc = crc32_update(0, job->data + job->dict_len, job->len);
+    if (deflate_chunk(job->data, job->dict_len, job->len, job->level,
+                      job->final, &job->out) != 0) {
+        job->error = 1;
+    }
+}
+
+static void gzip_put(GzipWriter *gz, const void *data, size_t len) {
+    if (len && gz->write(gz->ctx, data, len) != 0) gz->error = 1;
+    gz->total_out += len;
+}
+
+/* Compress `len` pending bytes as blocks; `final` marks the stream end */
+static void gzip_compress(GzipWriter *gz, size_t len, int final) {
+    size_t blocks = (len + DEFLATE_BLOCK_SIZE - 1) / DEFLATE_BLOCK_SIZE;
+    if (blocks == 0) blocks = 1;
+    
+    GzipJob *jobs = calloc(blocks, sizeof(GzipJob));
+    if (!jobs) {
+        gz->error = 1;
+        return;
+    }
+    
+    for (size_t b = 0; b < blocks; b++) {
+        size_t start = gz->dict_len + b * DEFLATE_BLOCK_SIZE;
+        size_t dict = start < DEFLATE_WINDOW ? start : DEFLATE_WINDOW;
+        size_t block_len = len - b * DEFLATE_BLOCK_SIZE;
+        if (block_len > DEFLATE_BLOCK_SIZE) block_len = DEFLATE_BLOCK_SIZE;
+        if (len == 0) block_len = 0;
+        
+        jobs[b].data = gz->buf + start - dict;
+        jobs[b].dict_len = dict;
+        jobs[b].len = block_len;
+        jobs[b].final = final && b == blocks - 1;
+        jobs[b].level = gz->level;
+    }
+    
+    parallel_for(blocks, gz->threads, gzip_job_run, jobs);
+    
+    for (size_t b = 0; b < blocks; b++) {
+        if (jobs[b].error) gz->error = 1;
+        gzip_put(gz, jobs[b].out.data, jobs[b].out.len);
+        gz->crc = crc32_combine(gz->crc, jobs[b].crc, jobs[b].len);
+        deflate_buf_free(&jobs[b].out);
+    }
+    free(jobs);
+    
+    /* Keep the last window of input as the next dictionary */
+    size_t total = gz->dict_len + len;
+    size_t keep = total < DEFLATE_WINDOW ? total : DEFLATE_WINDOW;
+    memmove(gz->buf, gz->buf + total - keep, keep);
+    gz->dict_len = keep;
+    gz->len = keep;
+}
+
+GzipWriter *gzip_writer_create(GzipWriteFn write, void *ctx, int level, int threads) {
+    GzipWriter *gz = calloc(1, sizeof(GzipWriter));
+    if (!gz) return NULL;
+    
+    if (threads <= 0) threads = parallel_cpu_count();
+    gz->write = write;
+    gz->ctx = ctx;
+    gz->level = level;
+    gz->threads = threads;
+    gz->batch_blocks = (size_t)threads * 2;
+    gz->cap = DEFLATE_WINDOW + gz->batch_blocks * DEFLATE_BLOCK_SIZE;
+    gz->buf = malloc(gz->cap);
+    if (!gz->buf) {
+        free(gz);
+        return NULL;
+    }
+    
+    /* Build the CRC table before any worker uses it */
+    crc32_update(0, NULL, 0);
+    
+    /* Header: no name, mtime 0 so output is reproducible */
+    static const unsigned char header[10] = {
+        0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3
+    };
+    gzip_put(gz, header, sizeof(header));
+    return gz;
+}
+
+int gzip_writer_write(GzipWriter *gz, const void *data, size_t len) {
+    const unsigned char *p = data;
+    gz->total_in += len;
+    
+    /* Batches are whole blocks, so block boundaries (and the output) do
+     * not depend on the thread count */
+    size_t batch = gz->batch_blocks * DEFLATE_BLOCK_SIZE;
+    while (len > 0) {
+        size_t room = gz->dict_len + batch - gz->len;
+        size_t n = len < room ? len : room;
+        memcpy(gz->buf + gz->len, p, n);
+        gz->len += n;
+        p += n;
+        len -= n;
+        
+        if (gz->len - gz->dict_len == batch) {
+            gzip_compress(gz, batch, 0);
+        }
+    }
+    return gz->error ? -1 : 0;
+}
+
+int gzip_writer_finish(GzipWriter *gz) {
+    if (!gz) return -1;
+    
+    gzip_compress(gz, gz->len - gz->dict_len, 1);
+    
+    unsigned char trailer[8];
+    uint32_t isize = (uint32_t)gz->total_in;
+    for (int i = 0; i < 4; i++) {
+        trailer[i] = (unsigned char)(gz->crc >> (8 * i));
+        trailer[4 + i] = (unsigned char)(isize >> (8 * i));
+    }
+    gzip_put(gz, trailer, sizeof(trailer));
+    
+    int result = gz->error ? -1 : 0;
+    free(gz->buf);
+    free(gz);
+    return result;
+}
+
+/* ==========================================================================
+ * Gzip reader (inflate)
+ * ========================================================================== */
+
+enum {
+    GZR_HEADER = 0,
+    GZR_BLOCK,
+    GZR_STORED,
+    GZR_CODES,
+    GZR_TRAILER,
+    GZR_END
+};
+
+/* Top up the bit buffer to at least n bits; -1 once input runs out */
+static int gzr_fill(GzipReader *gz, int n) {
+    while (gz->bit_count < n) {
+        if (gz->in_pos == gz->in_len) {
+            int got = gz->read(gz->ctx, gz->in, sizeof(gz->in));
+            if (got <= 0) return -1;
+            gz->in_len = (size_t)got;
+            gz->in_pos = 0;
+            gz->total_in += (uint64_t)got;
+        }
+        gz->bits |= (uint64_t)gz->in[gz->in_pos++] << gz->bit_count;
+        gz->bit_count += 8;
+    }
+    return 0;
+}
+
+static uint32_t gzr_take(GzipReader *gz, int n) {
+    uint32_t v = (uint32_t)(gz->bits & ((1ull << n) - 1));
+    gz->bits >>= n;
+    gz->bit_count -= n;
+    return v;
+}
+
+/* Read n bits (n <= 32), flagging truncated input */
+static uint32_t gzr_bits(GzipReader *gz, int n) {
+    if (gzr_fill(gz, n) != 0) {
+        gz->error = 1;
+        return 0;
+    }
+    return gzr_take(gz, n);
+}
+
+static void gzr_align(GzipReader *gz) {
+    gzr_take(gz, gz->bit_count & 7);
+}
+
+/* Returns -1 for an over-subscribed code; incomplete codes are accepted
+ * and fail only if an unused code turns up */
+static int inflate_table_build(InflateTable *t, const uint8_t *lens, int n) {
+    uint16_t offs[16];
+    memset(t, 0, sizeof(*t));
+    
+    for (int i = 0; i < n; i++) t->count[lens[i]]++;
+    t->count[0] = 0;
+    
+    int left = 1;
+    for (int len = 1; len <= MAX_BITS; len++) {
+        left <<= 1;
+        left -= t->count[len];
+        if (left < 0) return -1;
+    }
+    
+    offs[1] = 0;
+    for (int len = 1; len < MAX_BITS; len++) offs[len + 1] = offs[len] + t->count[len];
+    for (int i = 0; i < n; i++) {
+        if (lens[i]) t->symbol[offs[lens[i]]++] = (uint16_t)i;
+    }
+    
+    /* Fast entries for short codes, replicated over the unused high bits */
+    uint32_t code = 0;
+    int index = 0;
+    for (int len = 1; len <= INFLATE_FAST_BITS; len++) {
+        for (int k = 0; k < t->count[len]; k++) {
+            uint16_t rev = reverse_bits(code + (uint32_t)k, len);
+            uint16_t entry = (uint16_t)((t->symbol[index + k] << 4) | len);
+            for (uint32_t fill = rev; fill < (1u << INFLATE_FAST_BITS); fill += 1u << len) {
+                t->fast[fill] = entry;
+            }
+        }
+        index += t->count[len];
+        code = (code + t->count[len]) << 1;
+    }
+    return 0;
+}
+
+static int gzr_decode(GzipReader *gz, const InflateTable *t) {
+    gzr_fill(gz, MAX_BITS);   /* Near the end fewer bits may be left */
+    
+    uint16_t entry = t->fast[gz->bits & ((1u << INFLATE_FAST_BITS) - 1)];
+    if (entry) {
+        int len = entry & 15;
+        if (len > gz->bit_count) return -1;
+        gzr_take(gz, len);
+        return entry >> 4;
+    }
+    
+    /* Long code: walk the canonical code one bit at a time */
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    uint64_t bits = gz->bits;
+    for (int len = 1; len <= MAX_BITS && len <= gz->bit_count; len++) {
+        code |= (int)(bits & 1);
+        bits >>= 1;
+        int count = t->count[len];
+        if (code - count < first) {
+            gzr_take(gz, len);
+            return t->symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static void gzr_fixed_tables(GzipReader *gz) {
+    uint8_t lens[288];
+    int i = 0;
+    for (; i < 144; i++) lens[i] = 8;
+    for (; i < 256; i++) lens[i] = 9;
+    for (; i < 280; i++) lens[i] = 7;
+    for (; i < 288; i++) lens[i] = 8;
+    inflate_table_build(&gz->lit, lens, 288);
+    for (i = 0; i < 30; i++) lens[i] = 5;
+    inflate_table_build(&gz->dist, lens, 30);
+}
+
+static int gzr_dynamic_tables(GzipReader *gz) {
+    int nlit = (int)gzr_bits(gz, 5) + 257;
+    int ndist = (int)gzr_bits(gz, 5) + 1;
+    int nclen = (int)gzr_bits(gz, 4) + 4;
+    if (gz->error || nlit > LITLEN_CODES || ndist > DIST_CODES) return -1;
+    
+    uint8_t lens[LITLEN_CODES + DIST_CODES];
+    memset(lens, 0, CLEN_CODES);
+    for (int i = 0; i < nclen; i++) lens[clen_order[i]] = (uint8_t)gzr_bits(gz, 3);
+    
+    InflateTable clen;
+    if (gz->error || inflate_table_build(&clen, lens, CLEN_CODES) != 0) return -1;
+    
+    int n = 0;
+    while (n < nlit + ndist) {
+        int sym = gzr_decode(gz, &clen);
+        if (sym < 0) return -1;
+        if (sym < 16) {
+            lens[n++] = (uint8_t)sym;
+            continue;
+        }
+        
+        uint8_t value = 0;
+        int repeat;
+        if (sym == 16) {
+            if (n == 0) return -1;
+            value = lens[n - 1];
+            repeat = 3 + (int)gzr_bits(gz, 2);
+        } else if (sym == 17) {
+            repeat = 3 + (int)gzr_bits(gz, 3);
+        } else {
+            repeat = 11 + (int)gzr_bits(gz, 7);
+        }
+        if (gz->error || n + repeat > nlit + ndist) return -1;
+        while (repeat--) lens[n++] = value;
+    }
+    
+    if (lens[256] == 0) return -1;      /* No end-of-block code */
+    if (inflate_table_build(&gz->lit, lens, nlit) != 0) return -1;
+    if (inflate_table_build(&gz->dist, lens + nlit, ndist) != 0) return -1;
+    return 0;
+}
+
+/* Member header; at a clean end of input after a member, the stream ends */
+static void gzr_header(GzipReader *gz) {
+    if (gz->members > 0 && gzr_fill(gz, 8) != 0) {
+        gz->state = GZR_END;
+        return;
+    }
+    
+    uint32_t id1 = gzr_bits(gz, 8);
+    uint32_t id2 = gzr_bits(gz, 8);
+    uint32_t method = gzr_bits(gz, 8);
+    uint32_t flags = gzr_bits(gz, 8);
+    gzr_bits(gz, 32);           /* mtime */
+    gzr_bits(gz, 16);           /* xfl, os */
+    if (gz->error || id1 != 0x1f || id2 != 0x8b || method != 8) {
+        gz->error = 1;
+        return;
+    }
+    
+    if (flags & 4) {            /* FEXTRA */
+        uint32_t xlen = gzr_bits(gz, 16);
+        while (xlen-- && !gz->error) gzr_bits(gz, 8);
+    }
+    if (flags & 8) {            /* FNAME */
+        while (!gz->error && gzr_bits(gz, 8) != 0) {}
+    }
+    if (flags & 16) {           /* FCOMMENT */
+        while (!gz->error && gzr_bits(gz, 8) != 0) {}
+    }
+    if (flags & 2) gzr_bits(gz, 16);    /* FHCRC */
+    
+    gz->members++;
+    gz->member_out = 0;
+    gz->crc = 0;
+    gz->final = 0;
+    gz->state = GZR_BLOCK;
+}
+
+static void gzr_block(GzipReader *gz) {
+    gz->final = (int)gzr_bits(gz, 1);
+    uint32_t type = gzr_bits(gz, 2);
+    if (gz->error) return;
+    
+    if (type == 0) {
+        gzr_align(gz);
+        uint32_t len = gzr_bits(gz, 16);
+        uint32_t nlen = gzr_bits(gz, 16);
+        if (gz->error || len != (~nlen & 0xffff)) {
+            gz->error = 1;
+            return;
+        }
+        gz->stored_left = len;
+        gz->state = GZR_STORED;
+    } else if (type == 1) {
+        gzr_fixed_tables(gz);
+        gz->state = GZR_CODES;
+    } else if (type == 2) {
+        if (gzr_dynamic_tables(gz) != 0) {
+            gz->error = 1;
+            return;
+        }
+        gz->state = GZR_CODES;
+    } else {
+        gz->error = 1;
+    }
+}
+
+static void gzr_put(GzipReader *gz, unsigned char *out, size_t *produced, unsigned char c) {
+    out[(*produced)++] = c;
+    gz->window[gz->member_out++ & (DEFLATE_WINDOW - 1)] = c;
+}
+
+/* Copy as much of the pending match as fits */
+static void gzr_copy_match(GzipReader *gz, unsigned char *out, size_t *produced, size_t len) {
+    while (gz->match_len > 0 && *produced < len) {
+        unsigned char c = gz->window[(gz->member_out - (uint64_t)gz->match_dist) &
+                                     (DEFLATE_WINDOW - 1)];
+        gzr_put(gz, out, produced, c);
+        gz->match_len--;
+    }
+}
+
+static void gzr_codes(GzipReader *gz, unsigned char *out, size_t *produced, size_t len) {
+    gzr_copy_match(gz, out, produced, len);
+    
+    while (*produced < len && gz->match_len == 0) {
+        int sym = gzr_decode(gz, &gz->lit);
+        if (sym < 0) {
+            gz->error = 1;
+            return;
+        }
+        if (sym < 256) {
+            gzr_put(gz, out, produced, (unsigned char)sym);
+            continue;
+        }
+        if (sym == 256) {
+            gz->state = gz->final ? GZR_TRAILER : GZR_BLOCK;
+            return;
+        }
+        
+        sym -= 257;
+        if (sym >= 29) {
+            gz->error = 1;
+            return;
+        }
+        int match = len_base[sym] + (int)gzr_bits(gz, len_extra[sym]);
+        
+        int dsym = gzr_decode(gz, &gz->dist);
+        if (dsym < 0 || dsym >= 30) {
+            gz->error = 1;
+            return;
+        }
+        int dist = dist_base[dsym] + (int)gzr_bits(gz, dist_extra[dsym]);
+        if (gz->error || (uint64_t)dist > gz->member_out) {
+            gz->error = 1;
+            return;
+        }
+        
+        gz->match_len = match;
+        gz->match_dist = dist;
+        gzr_copy_match(gz, out, produced, len);
+    }
+}
+
+static void gzr_stored(GzipReader *gz, unsigned char *out, size_t *produced, size_t len) {
+    while (gz->stored_left > 0 && *produced < len && !gz->error) {
+        if (gz->bit_count >= 8) {
+            gzr_put(gz, out, produced, (unsigned char)gzr_take(gz, 8));
+            gz->stored_left--;
+            continue;
+        }
+        
+        /* Byte aligned with an empty bit buffer: copy straight from input */
+        if (gz->in_pos == gz->in_len && gzr_fill(gz, 8) != 0) {
+            gz->error = 1;
+            return;
+        }
+        if (gz->bit_count >= 8) continue;
+        
+        size_t n = gz->in_len - gz->in_pos;
+        if (n > gz->stored_left) n = gz->stored_left;
+        if (n > len - *produced) n = len - *produced;
+        for (size_t i = 0; i < n; i++) gzr_put(gz, out, produced, gz->in[gz->in_pos + i]);
+        gz->in_pos += n;
+        gz->stored_left -= n;
+    }
+    if (gz->stored_left == 0) gz->state = gz->final ? GZR_TRAILER : GZR_BLOCK;
+}
+
+GzipReader *gzip_reader_create(GzipReadFn read, void *ctx) {
+    GzipReader *gz = calloc(1, sizeof(GzipReader));
+    if (!gz) return NULL;
+    gz->read = read;
+    gz->ctx = ctx;
+    gz->state = GZR_HEADER;
+    return gz;
+}
+
+long gzip_reader_read(GzipReader *gz, void *out_buf, size_t len) {
+    unsigned char *out = out_buf;
+    size_t produced = 0;
+    size_t crc_from = 0;        /* Output not yet folded into the CRC */
+    
+    while (produced < len && !gz->error && gz->state != GZR_END) {
+        switch (gz->state) {
+            case GZR_HEADER:
+                gzr_header(gz);
+                break;
+            case GZR_BLOCK:
+                gzr_block(gz);
+                break;
+            case GZR_STORED:
+                gzr_stored(gz, out, &produced, len);
+                break;
+            case GZR_CODES:
+                gzr_codes(gz, out, &produced, len);
+                break;
+            case GZR_TRAILER: {
+                gz->crc = crc32_update(gz->crc, out + crc_from, produced - crc_from);
+                crc_from = produced;
+                
+                gzr_align(gz);
+                uint32_t crc = gzr_bits(gz, 32);
+                uint32_t size = gzr_bits(gz, 32);
+                if (gz->error || crc != gz->crc || size != (uint32_t)gz->member_out) {
+                    gz->error = 1;
+                } else {
+                    gz->state = GZR_HEADER;
+                }
+                break;
+            }
+        }
+    }
+    
+    if (gz->error) return -1;
+    gz->crc = crc32_update(gz->crc, out + crc_from, produced - crc_from);
+    gz->total_out += produced;
+    return (long)produced;
+}
+
+void gzip_reader_free(GzipReader *gz) {
+    free(gz);
+}
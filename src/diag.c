@@ -0,0 +1,290 @@
+/*
+ * diag.c - Compiler diagnostics from build output
+ */
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "util.h"
+
+void diag_init(DiagList *list) {
+    memset(list, 0, sizeof(*list));
+}
+
+void diag_free(DiagList *list) {
+    free(list->items);
+    free(list->files);
+    free(list->by_position);
+    diag_init(list);
+}
+
+void diag_clear(DiagList *list) {
+    list->count = 0;
+    list->file_count = 0;
+    list->errors = 0;
+    list->warnings = 0;
+    list->current = 0;
+}
+
+const char *diag_severity_name(DiagSeverity severity) {
+    switch (severity) {
+        case DIAG_ERROR:   return "error";
+        case DIAG_WARNING: return "warning";
+        case DIAG_NOTE:    return "note";
+    }
+    return "?";
+}
+
+const char *diag_file(const DiagList *list, const Diagnostic *d) {
+    return list->files[d->file];
+}
+
+/* ==========================================================================
+ * Line parsing
+ * ========================================================================== */
+
+/* Parse "error", "fatal error", "warning" or "note" at s, followed by ':'
+ * (gcc) or a message code (MASM "error A2008:"). Returns the message
+ * start, or NULL if s does not hold a severity. */
+static const char *parse_severity(const char *s, const char *end, DiagSeverity *severity) {
+    static const struct {
+        const char *word;
+        DiagSeverity severity;
+    } words[] = {
+        {"fatal error", DIAG_ERROR},
+        {"error", DIAG_ERROR},
+        {"warning", DIAG_WARNING},
+        {"note", DIAG_NOTE},
+    };
+    
+    while (s < end && *s == ' ') s++;
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        size_t n = strlen(words[i].word);
+        if ((size_t)(end - s) <= n || strncmp(s, words[i].word, n) != 0) continue;
+        if (s[n] != ':' && s[n] != ' ') continue;
+        
+        *severity = words[i].severity;
+        s += n;
+        if (*s == ':') s++;
+        while (s < end && *s == ' ') s++;
+        return s;
+    }
+    return NULL;
+}
+
+/* Digits at s; returns the first character after them or NULL */
+static const char *parse_number(const char *s, const char *end, unsigned *value) {
+    if (s >= end || !isdigit((unsigned char)*s)) return NULL;
+    unsigned long v = 0;
+    while (s < end && isdigit((unsigned char)*s)) {
+        if (v < 100000000UL) v = v * 10 + (unsigned long)(*s - '0');
+        s++;
+    }
+    *value = (unsigned)v;
+    return s;
+}
+
+/* file:line[:col]: severity: message */
+static int parse_gcc(const char *s, const char *end, Diagnostic *d, size_t *path_len,
+                     const char **message) {
+    /* Skip a drive letter ("C:\src\a.c:3:1: error: ...") */
+    const char *p = s;
+    if (end - s > 2 && isalpha((unsigned char)s[0]) && s[1] == ':' &&
+        (s[2] == '\\' || s[2] == '/')) {
+        p += 2;
+    }
+    
+    for (; p < end; p++) {
+        if (*p != ':' || p == s) continue;
+        
+        const char *q = parse_number(p + 1, end, &d->line);
+        if (!q || q >= end || *q != ':') continue;
+        
+        d->col = 0;
+        const char *r = parse_number(q + 1, end, &d->col);
+        if (r && r < end && *r == ':') q = r;
+        
+        const char *m = parse_severity(q + 1, end, &d->severity);
+        if (!m) continue;
+        
+        *path_len = (size_t)(p - s);
+        *message = m;
+        return 1;
+    }
+    return 0;
+}
+
+/* file(line) : severity code: message */
+static int parse_masm(const char *s, const char *end, Diagnostic *d, size_t *path_len,
+                      const char **message) {
+    for (const char *p = s + 1; p < end; p++) {
+        if (*p != '(') continue;
+        
+        const char *q = parse_number(p + 1, end, &d->line);
+        if (!q || q >= end || *q != ')') continue;
+        q++;
+        while (q < end && *q == ' ') q++;
+        if (q >= end || *q != ':') continue;
+        
+        const char *m = parse_severity(q + 1, end, &d->severity);
+        if (!m) continue;
+        
+        d->col = 0;
+        *path_len = (size_t)(p - s);
+        *message = m;
+        return 1;
+    }
+    return 0;
+}
+
+static int diag_intern_file(DiagList *list, const char *path, size_t len) {
+    if (len >= DIAG_PATH_MAX) len = DIAG_PATH_MAX - 1;
+    for (size_t i = 0; i < list->file_count; i++) {
+        if (strncmp(list->files[i], path, len) == 0 && list->files[i][len] == '\0') {
+            return (int)i;
+        }
+    }
+    
+    if (list->file_count == list->file_capacity) {
+        size_t cap = list->file_capacity ? list->file_capacity * 2 : 8;
+        char (*files)[DIAG_PATH_MAX] = realloc(list->files, cap * DIAG_PATH_MAX);
+        if (!files) return -1;
+        list->files = files;
+        list->file_capacity = cap;
+    }
+    memcpy(list->files[list->file_count], path, len);
+    list->files[list->file_count][len] = '\0';
+    return (int)list->file_count++;
+}
+
+static int diag_position_cmp(const Diagnostic *a, const Diagnostic *b) {
+    if (a->file != b->file) return a->file < b->file ? -1 : 1;
+    if (a->line != b->line) return a->line < b->line ? -1 : 1;
+    if (a->severity != b->severity) return a->severity < b->severity ? -1 : 1;
+    return 0;
+}
+
+/* First slot in by_position not ordered before d */
+static size_t diag_lower_bound(const DiagList *list, const Diagnostic *d) {
+    size_t lo = 0, hi = list->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (diag_position_cmp(&list->items[list->by_position[mid]], d) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int diag_parse_line(DiagList *list, const char *line, size_t len, size_t output_line) {
+    const char *end = line + len;
+    while (end > line && (end[-1] == '\r' || end[-1] == ' ')) end--;
+    while (line < end && *line == ' ') line++;
+    if (line == end) return 0;
+    
+    Diagnostic d;
+    size_t path_len;
+    const char *message;
+    if (!parse_gcc(line, end, &d, &path_len, &message) &&
+        !parse_masm(line, end, &d, &path_len, &message)) {
+        return 0;
+    }
+    if (d.line == 0) return 0;
+    
+    while (path_len > 0 && line[path_len - 1] == ' ') path_len--;
+    int file = diag_intern_file(list, line, path_len);
+    if (file < 0) return -1;
+    
+    if (list->count == list->capacity) {
+        size_t cap = list->capacity ? list->capacity * 2 : 64;
+        Diagnostic *items = realloc(list->items, cap * sizeof(Diagnostic));
+        if (!items) return -1;
+        list->items = items;
+        size_t *order = realloc(list->by_position, cap * sizeof(size_t));
+        if (!order) return -1;
+        list->by_position = order;
+        list->capacity = cap;
+    }
+    
+    d.file = (unsigned)file;
+    d.output_line = output_line;
+    size_t mlen = (size_t)(end - message);
+    if (mlen >= DIAG_MESSAGE_MAX) mlen = DIAG_MESSAGE_MAX - 1;
+    memcpy(d.message, message, mlen);
+    d.message[mlen] = '\0';
+    
+    /* Keep by_position sorted; later duplicates go after earlier ones */
+    Diagnostic after = d;
+    after.severity = (DiagSeverity)(d.severity + 1);
+    size_t slot = diag_lower_bound(list, &after);
+    memmove(list->by_position + slot + 1, list->by_position + slot,
+            (list->count - slot) * sizeof(size_t));
+    list->by_position[slot] = list->count;
+    
+    if (list->current == list->count) list->current++;
+    list->items[list->count++] = d;
+    if (d.severity == DIAG_ERROR) list->errors++;
+    if (d.severity == DIAG_WARNING) list->warnings++;
+    return 1;
+}
+
+/* ==========================================================================
+ * Queries
+ * ========================================================================== */
+
+int diag_find_file(const DiagList *list, const char *path) {
+    if (!path || !path[0]) return -1;
+    for (size_t i = 0; i < list->file_count; i++) {
+        if (path_same_file(list->files[i], path)) return (int)i;
+    }
+    return -1;
+}
+
+const Diagnostic *diag_at(const DiagList *list, int file, unsigned line) {
+    if (file < 0) return NULL;
+    
+    Diagnostic key;
+    key.file = (unsigned)file;
+    key.line = line;
+    key.severity = DIAG_ERROR;
+    size_t slot = diag_lower_bound(list, &key);
+    if (slot == list->count) return NULL;
+    
+    const Diagnostic *d = &list->items[list->by_position[slot]];
+    return d->file == key.file && d->line == line ? d : NULL;
+}
+
+const Diagnostic *diag_step(DiagList *list, int direction) {
+    if (list->errors + list->warnings == 0) return NULL;
+    
+    size_t i = list->current;
+    for (size_t n = 0; n < list->count; n++) {
+        if (direction > 0) {
+            i = i + 1 >= list->count ? 0 : i + 1;
+        } else {
+            i = i == 0 || i > list->count ? list->count - 1 : i - 1;
+        }
+        if (list->items[i].severity != DIAG_NOTE) {
+            list->current = i;
+            return &list->items[i];
+        }
+    }
+    return NULL;
+}
+
+const Diagnostic *diag_for_output_line(const DiagList *list, size_t output_line) {
+    size_t lo = 0, hi = list->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (list->items[mid].output_line < output_line) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < list->count && list->items[lo].output_line == output_line
+           ? &list->items[lo] : NULL;
+}
@@ -8,6 +8,8 @@
 #include "editor.h"
 #include "util.h"
 
+static void editor_sync_index(EditorState *ed);
+
 EditorState *editor_create(void) {
     EditorState *ed = calloc(1, sizeof(EditorState));
     if (!ed) return NULL;
@@ -18,6 +20,16 @@ EditorState *editor_create(void) {
         return NULL;
     }
     
+    ed->blocks = blocks_create();
+    ed->folds = fold_create();
+    if (!ed->blocks || !ed->folds) {
+        blocks_destroy(ed->blocks);
+        fold_destroy(ed->folds);
+        buffer_destroy(ed->buffer);
+        free(ed);
+        return NULL;
+    }
+    
     ed->language = LANG_NONE;
     ed->cursor_line = 1;
     ed->cursor_col = 1;
@@ -30,6 +42,8 @@ EditorState *editor_create(void) {
 void editor_destroy(EditorState *ed) {
     if (ed) {
         buffer_destroy(ed->buffer);
+        blocks_destroy(ed->blocks);
+        fold_destroy(ed->folds);
         if (ed->history) {
             history_close(ed->history);
         }
@@ -46,6 +60,10 @@ int editor_set_text(EditorState *ed, const char *text, size_t len) {
     buffer_insert(ed->buffer, 0, text, len);
     ed->history_enabled = prev_enabled;
     
+    ed->pending = 0;
+    blocks_rebuild(ed->blocks, ed->buffer, ed->language);
+    fold_reset(ed->folds, blocks_line_count(ed->blocks));
+    
     ed->dirty = 1;
     ed->cursor_line = 1;
     ed->cursor_col = 1;
@@ -61,13 +79,62 @@ size_t editor_get_length(EditorState *ed) {
 }
 
 void editor_set_language(EditorState *ed, Language lang) {
+    if (ed->language == lang) return;
     ed->language = lang;
+    editor_sync_index(ed);
+    blocks_rebuild(ed->blocks, ed->buffer, lang);
 }
 
 Language editor_detect_language(const char *filename) {
     return syntax_detect_language(filename);
 }
 
+/* Keep the block index and folds in step with a buffer change at pos */
+static void editor_reindex(EditorState *ed, size_t pos, size_t removed,
+                           size_t inserted) {
+    size_t first = blocks_line_of(ed->blocks, pos);
+    size_t old_lines = blocks_line_of(ed->blocks, pos + removed) - first + 1;
+    size_t old_count = blocks_line_count(ed->blocks);
+    
+    blocks_edit(ed->blocks, ed->buffer, pos, removed, inserted);
+    
+    size_t new_lines = old_lines + blocks_line_count(ed->blocks) - old_count;
+    fold_edit(ed->folds, first, old_lines, new_lines);
+}
+
+static void editor_index_edit(EditorState *ed, size_t pos, size_t removed,
+                              size_t inserted) {
+    if (ed->batch_depth == 0) {
+        editor_reindex(ed, pos, removed, inserted);
+        return;
+    }
+    if (!ed->pending) {
+        ed->pending = 1;
+        ed->pending_pos = pos;
+        ed->pending_removed = removed;
+        ed->pending_inserted = inserted;
+        return;
+    }
+    
+    /* Widen the pending span to cover this edit as well. end is in the
+     * current text; the text before start is unchanged. */
+    size_t start = pos < ed->pending_pos ? pos : ed->pending_pos;
+    size_t end = ed->pending_pos + ed->pending_inserted;
+    if (pos + removed > end) end = pos + removed;
+    size_t old_end = end - ed->pending_inserted + ed->pending_removed;
+    
+    ed->pending_pos = start;
+    ed->pending_removed = old_end - start;
+    ed->pending_inserted = end - removed + inserted - start;
+}
+
+/* Apply batched edits to the index before a line lookup */
+static void editor_sync_index(EditorState *ed) {
+    if (!ed->pending) return;
+    ed->pending = 0;
+    editor_reindex(ed, ed->pending_pos, ed->pending_removed, ed->pending_inserted);
+}
+
 void editor_insert(EditorState *ed, size_t pos, const char *text, size_t len) {
     /* Record to history before modifying buffer */
     if (ed->history_enabled && ed->history) {
@@ -75,6 +142,7 @@ void editor_insert(EditorState *ed, size_t pos, const char *text, size_t len) {
     }
     
     buffer_insert(ed->buffer, pos, text, len);
+    editor_index_edit(ed, pos, 0, len);
     ed->dirty = 1;
 }
 
@@ -93,53 +161,72 @@ void editor_delete(EditorState *ed, size_t pos, size_t len) {
     }
     
     buffer_delete(ed->buffer, pos, len);
+    editor_index_edit(ed, pos, len, 0);
     ed->dirty = 1;
 }
 
-void editor_undo(EditorState *ed) {
-    if (!ed->history || !history_can_undo(ed->history)) return;
-    
-    EditOp *op = history_undo(ed->history);
-    if (!op) return;
-    
-    /* Disable history recording while applying undo */
-    int prev_enabled = ed->history_enabled;
-    ed->history_enabled = 0;
+void editor_begin_batch(EditorState *ed) {
+    if (ed->batch_depth++ > 0) return;
+    history_begin_group(ed->history);
+}
+
+void editor_end_batch(EditorState *ed) {
+    if (ed->batch_depth == 0 || --ed->batch_depth > 0) return;
+    history_end_group(ed->history);
+    editor_sync_index(ed);
+}
+
+/* Apply op to the buffer, or reverse it */
+static void editor_apply(EditorState *ed, const EditOp *op, int reverse) {
+    if (op->type != OP_INSERT && op->type != OP_DELETE) return;
     
-    /* Reverse the operation */
-    if (op->type == OP_INSERT) {
-        /* Undo insert = delete */
-        buffer_delete(ed->buffer, op->position, op->length);
-    } else if (op->type == OP_DELETE) {
-        /* Undo delete = insert */
+    int insert = (op->type == OP_INSERT) != reverse;
+    if (insert) {
         buffer_insert(ed->buffer, op->position, op->data, op->length);
+        editor_index_edit(ed, op->position, 0, op->length);
+    } else {
+        buffer_delete(ed->buffer, op->position, op->length);
+        editor_index_edit(ed, op->position, op->length, 0);
     }
+}
+
+void editor_undo(EditorState *ed) {
+    if (!ed->history || !history_can_undo(ed->history)) return;
+    
+    /* Reverse the operation, and the rest of its group. Undo only touches
+     * the buffer, so nothing is recorded to history. */
+    EditOp *op;
+    editor_begin_batch(ed);
+    do {
+        op = history_undo(ed->history);
+        if (!op) break;
+        editor_apply(ed, op, 1);
+    } while (op->grouped && history_can_undo(ed->history));
+    editor_end_batch(ed);
     
-    ed->history_enabled = prev_enabled;
     ed->dirty = 1;
 }
 
 void editor_redo(EditorState *ed) {
     if (!ed->history || !history_can_redo(ed->history)) return;
     
-    EditOp *op = history_redo(ed->history);
-    if (!op) return;
+    /* Reapply the operation and any grouped with it */
+    EditOp *op;
+    editor_begin_batch(ed);
+    do {
+        op = history_redo(ed->history);
+        if (!op) break;
+        editor_apply(ed, op, 0);
+    } while (history_can_redo(ed->history) && ed->history->current->grouped);
+    editor_end_batch(ed);
     
-    /* Disable history recording while applying redo */
-    int prev_enabled = ed->history_enabled;
-    ed->history_enabled = 0;
-    
-    /* Reapply the operation */
-    if (op->type == OP_INSERT) {
-        buffer_insert(ed->buffer, op->position, op->data, op->length);
-    } else if (op->type == OP_DELETE) {
-        buffer_delete(ed->buffer, op->position, op->length);
-    }
-    
-    ed->history_enabled = prev_enabled;
     ed->dirty = 1;
 }
 
+int editor_find(EditorState *ed, size_t pos, const char *text, size_t len, size_t *at) {
+    return buffer_find(ed->buffer, pos, text, len, at);
+}
+
 void editor_select_all(EditorState *ed) {
     ed->selection_start = 0;
     ed->selection_end = buffer_length(ed->buffer);
@@ -164,21 +251,30 @@ char *editor_get_selection(EditorState *ed, size_t *len) {
 }
 
 void editor_goto_line(EditorState *ed, size_t line) {
-    if (line < 1) line = 1;
-    
-    size_t len = buffer_length(ed->buffer);
-    size_t current_line = 1;
-    size_t pos = 0;
-    
-    while (pos < len && current_line < line) {
-        if (buffer_char_at(ed->buffer, pos) == '\n') {
-            current_line++;
-        }
-        pos++;
-    }
-    
-    ed->cursor_line = current_line;
-    ed->cursor_col = 1;
+    editor_goto(ed, line, 1);
+}
+
+/* Clamp a 1-based line and column to the text; returns the line's start */
+static size_t editor_clamp(EditorState *ed, size_t *line, size_t *col) {
+    /* Clamp against the line index instead of scanning the buffer */
+    editor_sync_index(ed);
+    size_t lines = blocks_line_count(ed->blocks);
+    if (lines == 0) lines = 1;
+    if (*line < 1) *line = 1;
+    if (*line > lines) *line = lines;
+    
+    size_t start = blocks_line_start(ed->blocks, *line - 1);
+    size_t end = *line < lines ? blocks_line_start(ed->blocks, *line) - 1
+                               : buffer_length(ed->buffer);
+    if (*col < 1) *col = 1;
+    if (*col > end - start + 1) *col = end - start + 1;
+    return start;
+}
+
+void editor_goto(EditorState *ed, size_t line, size_t col) {
+    editor_clamp(ed, &line, &col);
+    ed->cursor_line = line;
+    ed->cursor_col = col;
 }
 
 void editor_get_cursor_pos(EditorState *ed, size_t *line, size_t *col) {
@@ -186,6 +282,49 @@ void editor_get_cursor_pos(EditorState *ed, size_t *line, size_t *col) {
     *col = ed->cursor_col;
 }
 
+size_t editor_offset(EditorState *ed, size_t line, size_t col) {
+    return editor_clamp(ed, &line, &col) + col - 1;
+}
+
+void editor_goto_offset(EditorState *ed, size_t pos) {
+    size_t len = buffer_length(ed->buffer);
+    if (pos > len) pos = len;
+    editor_sync_index(ed);
+    size_t line = blocks_line_of(ed->blocks, pos);
+    ed->cursor_line = line + 1;
+    ed->cursor_col = pos - blocks_line_start(ed->blocks, line) + 1;
+}
+
+int editor_fold(EditorState *ed, size_t line) {
+    FoldRange r;
+    if (line < 1) return -1;
+    editor_sync_index(ed);
+    if (fold_find_region(ed->blocks, ed->buffer, line - 1, &r) != 0) return -1;
+    return fold_add(ed->folds, r.start, r.end);
+}
+
+int editor_unfold(EditorState *ed, size_t line) {
+    editor_sync_index(ed);
+    if (line == 0) {
+        return fold_reset(ed->folds, blocks_line_count(ed->blocks));
+    }
+    return fold_remove(ed->folds, line - 1);
+}
+
+int editor_find_match(EditorState *ed, size_t line, size_t col,
+                      size_t *match_line, size_t *match_col) {
+    if (line < 1 || col < 1) return -1;
+    editor_sync_index(ed);
+    
+    size_t ml, mc;
+    if (blocks_find_match(ed->blocks, line - 1, col - 1, &ml, &mc) != 0) {
+        return -1;
+    }
+    if (match_line) *match_line = ml + 1;
+    if (match_col) *match_col = mc + 1;
+    return 0;
+}
+
 /* File operations */
 int editor_load_file(EditorState *ed, const char *path) {
     FILE *f = fopen(path, "rb");
@@ -212,7 +351,9 @@ int editor_load_file(EditorState *ed, const char *path) {
     content[read] = '\0';
     fclose(f);
     
-    /* Set text (without history) */
+    /* Detect language from extension and a sample of the content, then
+     * set text (without history) so the block index uses the new language */
+    ed->language = syntax_detect_language_content(path, content, read);
     editor_set_text(ed, content, read);
     free(content);
     
@@ -220,9 +361,6 @@ int editor_load_file(EditorState *ed, const char *path) {
     strncpy(ed->file_path, path, sizeof(ed->file_path) - 1);
     ed->file_path[sizeof(ed->file_path) - 1] = '\0';
     
-    /* Detect language */
-    ed->language = editor_detect_language(path);
-    
     /* Open/create history file */
     if (ed->history) {
         history_close(ed->history);
@@ -5,8 +5,20 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include "util.h"
 
+static char file_empty[1];
+
 char *file_read_all(const char *path, size_t *len) {
     FILE *f = fopen(path, "rb");
     if (!f) return NULL;
@@ -45,6 +57,46 @@ int file_write_all(const char *path, const char *data, size_t len) {
     return (written == len) ? 0 : -1;
 }
 
+static int make_dir(const char *path) {
+#ifdef _WIN32
+    return _mkdir(path);
+#else
+    return mkdir(path, 0755);
+#endif
+}
+
+int path_make_dirs(const char *path) {
+    char *tmp = str_dup(path);
+    if (!tmp) return -1;
+    
+    for (char *p = tmp[0] ? tmp + 1 : tmp; *p; p++) {
+        if (*p == '/' || *p == '\\') {
+            char sep = *p;
+            *p = '\0';
+            make_dir(tmp);
+            *p = sep;
+        }
+    }
+    make_dir(tmp);
+    
+    struct stat st;
+    int result = stat(tmp, &st) == 0 && (st.st_mode & S_IFDIR) ? 0 : -1;
+    free(tmp);
+    return result;
+}
+
+int path_is_safe(const char *path) {
+    if (path[0] == '/' || path[0] == '\\' || strchr(path, ':')) return 0;
+    const char *p = path;
+    while (*p) {
+        size_t n = strcspn(p, "/\\");
+        if (n == 2 && p[0] == '.' && p[1] == '.') return 0;
+        p += n;
+        if (*p) p++;
+    }
+    return 1;
+}
+
 int file_exists(const char *path) {
     FILE *f = fopen(path, "r");
     if (f) {
@@ -54,3 +106,41 @@ int file_exists(const char *path) {
     return 0;
 }
 
+
+char *file_map(const char *path, size_t *len) {
+#ifdef _WIN32
+    return file_read_all(path, len);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+    
+    if (st.st_size == 0) {
+        close(fd);
+        if (len) *len = 0;
+        return file_empty;
+    }
+    
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+    
+    if (len) *len = (size_t)st.st_size;
+    return data;
+#endif
+}
+
+void file_unmap(char *data, size_t len) {
+    if (!data || data == file_empty) return;
+#ifdef _WIN32
+    (void)len;
+    free(data);
+#else
+    munmap(data, len);
+#endif
+}
@@ -0,0 +1,616 @@
+/*
+ * fold.c - Code folding and visible/buffer line mapping
+ *
+ * Lines are grouped into runs with the same cover count, kept in a treap
+ * in line order. Adjacent runs always differ, so there are at most two
+ * per fold plus one, and inserting or deleting lines grows or shrinks a
+ * run instead of shifting every line after the edit. Folds are a second
+ * treap ordered by start, with a pending shift per subtree for the same
+ * reason and the largest end per subtree to find folds reaching an edit.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fold.h"
+
+#define FOLD_LINE_MAX 1024
+
+/* ==========================================================================
+ * Run treap
+ * ========================================================================== */
+
+/* A run of consecutive lines hidden by the same number of folds. Node
+ * fields include every add applied to the node; add is still owed to its
+ * children. */
+struct FoldRun {
+    FoldRun *left;
+    FoldRun *right;
+    uint32_t priority;
+    int32_t cover;          /* Folds hiding the run */
+    int32_t add;            /* Pending cover count for the children */
+    int32_t min;            /* Subtree minimum cover count */
+    size_t lines;           /* Lines in the run */
+    size_t sub_lines;       /* Lines in the subtree */
+    size_t cnt;             /* Lines in the subtree at that minimum */
+};
+
+static void apply(FoldRun *t, int32_t val) {
+    if (t) {
+        t->cover += val;
+        t->min += val;
+        t->add += val;
+    }
+}
+
+static void push(FoldRun *t) {
+    if (t->add) {
+        apply(t->left, t->add);
+        apply(t->right, t->add);
+        t->add = 0;
+    }
+}
+
+static void update(FoldRun *t) {
+    t->sub_lines = t->lines;
+    t->min = t->cover;
+    t->cnt = t->lines;
+    FoldRun *child[2] = { t->left, t->right };
+    for (int i = 0; i < 2; i++) {
+        FoldRun *c = child[i];
+        if (!c) continue;
+        t->sub_lines += c->sub_lines;
+        if (c->min < t->min) {
+            t->min = c->min;
+            t->cnt = c->cnt;
+        } else if (c->min == t->min) {
+            t->cnt += c->cnt;
+        }
+    }
+}
+
+/* Runs come from fm->spare, refilled by reserve_runs before each change
+ * so a split never fails half way */
+static int reserve_runs(FoldMap *fm, int count) {
+    while (fm->spare_count < count) {
+        FoldRun *r = malloc(sizeof(FoldRun));
+        if (!r) return -1;
+        r->right = fm->spare;
+        fm->spare = r;
+        fm->spare_count++;
+    }
+    return 0;
+}
+
+/* Treap priority for a new run or fold (xorshift32) */
+static uint32_t next_priority(FoldMap *fm) {
+    uint32_t x = fm->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    fm->seed = x;
+    return x;
+}
+
+static FoldRun *new_run(FoldMap *fm, size_t lines, int32_t cover) {
+    FoldRun *r = fm->spare;
+    fm->spare = r->right;
+    fm->spare_count--;
+    
+    memset(r, 0, sizeof(*r));
+    r->priority = next_priority(fm);
+    r->cover = cover;
+    r->lines = lines;
+    update(r);
+    return r;
+}
+
+static void free_runs(FoldRun *t) {
+    if (t) {
+        free_runs(t->left);
+        free_runs(t->right);
+        free(t);
+    }
+}
+
+/* a gets lines [0, k), b the rest; a run straddling k is cut in two */
+static void split(FoldMap *fm, FoldRun *t, size_t k, FoldRun **a, FoldRun **b) {
+    if (!t) {
+        *a = *b = NULL;
+        return;
+    }
+    push(t);
+    size_t left = t->left ? t->left->sub_lines : 0;
+    if (k <= left) {
+        split(fm, t->left, k, a, &t->left);
+        *b = t;
+    } else if (k >= left + t->lines) {
+        split(fm, t->right, k - left - t->lines, &t->right, b);
+        *a = t;
+    } else {
+        /* Same priority keeps the heap order over t's right subtree */
+        FoldRun *tail = new_run(fm, left + t->lines - k, t->cover);
+        tail->priority = t->priority;
+        tail->right = t->right;
+        update(tail);
+        t->right = NULL;
+        t->lines = k - left;
+        *a = t;
+        *b = tail;
+    }
+    update(t);
+}
+
+static FoldRun *merge(FoldRun *a, FoldRun *b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->priority > b->priority) {
+        push(a);
+        a->right = merge(a->right, b);
+        update(a);
+        return a;
+    }
+    push(b);
+    b->left = merge(a, b->left);
+    update(b);
+    return b;
+}
+
+/* Cover count of the first (or last) run of t */
+static int32_t edge_cover(FoldRun *t, int last) {
+    int32_t acc = 0;
+    for (;;) {
+        FoldRun *next = last ? t->right : t->left;
+        if (!next) return acc + t->cover;
+        acc += t->add;
+        t = next;
+    }
+}
+
+/* Add lines to the first (or last) run of t */
+static void grow_edge(FoldRun *t, int last, size_t lines) {
+    push(t);
+    FoldRun *next = last ? t->right : t->left;
+    if (next) grow_edge(next, last, lines);
+    else t->lines += lines;
+    update(t);
+}
+
+/* Merge a and b, joining the runs at the seam if their cover counts are
+ * equal so the number of runs stays bounded by the folds */
+static FoldRun *join(FoldMap *fm, FoldRun *a, FoldRun *b) {
+    if (a && b && edge_cover(a, 1) == edge_cover(b, 0)) {
+        FoldRun *first = b;
+        while (first->left) first = first->left;
+        size_t lines = first->lines;
+        split(fm, b, lines, &first, &b);
+        grow_edge(a, 1, lines);
+        free(first);
+    }
+    return merge(a, b);
+}
+
+/* Visible (zero cover) lines before line r */
+static size_t zeros_before(FoldRun *t, size_t r) {
+    size_t zeros = 0;
+    int32_t acc = 0;
+    while (t && r > 0) {
+        size_t left = t->left ? t->left->sub_lines : 0;
+        if (r <= left) {
+            acc += t->add;
+            t = t->left;
+            continue;
+        }
+        if (t->left && acc + t->add + t->left->min == 0) zeros += t->left->cnt;
+        r -= left;
+        if (acc + t->cover == 0) zeros += r < t->lines ? r : t->lines;
+        if (r <= t->lines) break;
+        r -= t->lines;
+        acc += t->add;
+        t = t->right;
+    }
+    return zeros;
+}
+
+/* Line of the k-th (0-based) visible line */
+static size_t find_kth(FoldRun *t, size_t k) {
+    size_t base = 0;
+    int32_t acc = 0;
+    for (;;) {
+        size_t left = t->left ? t->left->sub_lines : 0;
+        size_t left_zeros = 0;
+        if (t->left && acc + t->add + t->left->min == 0) left_zeros = t->left->cnt;
+        if (k < left_zeros) {
+            acc += t->add;
+            t = t->left;
+            continue;
+        }
+        k -= left_zeros;
+        if (acc + t->cover == 0) {
+            if (k < t->lines) return base + left + k;
+            k -= t->lines;
+        }
+        base += left + t->lines;
+        acc += t->add;
+        t = t->right;
+    }
+}
+
+static int32_t cover_at(FoldRun *t, size_t line) {
+    int32_t acc = 0;
+    for (;;) {
+        size_t left = t->left ? t->left->sub_lines : 0;
+        if (line < left) {
+            acc += t->add;
+            t = t->left;
+        } else if (line < left + t->lines || !t->right) {
+            return acc + t->cover;
+        } else {
+            line -= left + t->lines;
+            acc += t->add;
+            t = t->right;
+        }
+    }
+}
+
+/* Add val to the cover count of lines [start, end) */
+static int cover_range(FoldMap *fm, size_t start, size_t end, int32_t val) {
+    if (reserve_runs(fm, 2) != 0) return -1;
+    
+    FoldRun *a, *m, *b;
+    split(fm, fm->root, start, &a, &m);
+    split(fm, m, end - start, &m, &b);
+    apply(m, val);
+    fm->root = join(fm, join(fm, a, m), b);
+    return 0;
+}
+
+static int hide_range(FoldMap *fm, const FoldRange *r, int32_t val) {
+    return cover_range(fm, r->start + 1, r->end + 1, val);
+}
+
+/* ==========================================================================
+ * Fold treap
+ * ========================================================================== */
+
+/* A folded region. Node fields include every shift applied to the node;
+ * shift is still owed to its children. */
+struct FoldNode {
+    FoldNode *left;
+    FoldNode *right;
+    uint32_t priority;
+    FoldRange range;
+    ptrdiff_t shift;        /* Pending line shift for the children */
+    size_t max_end;         /* Largest end in the subtree */
+};
+
+static void fold_apply(FoldNode *t, ptrdiff_t delta) {
+    if (t) {
+        t->range.start = (size_t)((ptrdiff_t)t->range.start + delta);
+        t->range.end = (size_t)((ptrdiff_t)t->range.end + delta);
+        t->max_end = (size_t)((ptrdiff_t)t->max_end + delta);
+        t->shift += delta;
+    }
+}
+
+static void fold_push(FoldNode *t) {
+    if (t->shift) {
+        fold_apply(t->left, t->shift);
+        fold_apply(t->right, t->shift);
+        t->shift = 0;
+    }
+}
+
+static void fold_update(FoldNode *t) {
+    t->max_end = t->range.end;
+    if (t->left && t->left->max_end > t->max_end) t->max_end = t->left->max_end;
+    if (t->right && t->right->max_end > t->max_end) t->max_end = t->right->max_end;
+}
+
+static void free_folds(FoldNode *t) {
+    if (t) {
+        free_folds(t->left);
+        free_folds(t->right);
+        free(t);
+    }
+}
+
+/* a gets the folds starting before line, b the rest */
+static void fold_split(FoldNode *t, size_t line, FoldNode **a, FoldNode **b) {
+    if (!t) {
+        *a = *b = NULL;
+        return;
+    }
+    fold_push(t);
+    if (t->range.start < line) {
+        fold_split(t->right, line, &t->right, b);
+        *a = t;
+    } else {
+        fold_split(t->left, line, a, &t->left);
+        *b = t;
+    }
+    fold_update(t);
+}
+
+static FoldNode *fold_merge(FoldNode *a, FoldNode *b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->priority > b->priority) {
+        fold_push(a);
+        a->right = fold_merge(a->right, b);
+        fold_update(a);
+        return a;
+    }
+    fold_push(b);
+    b->left = fold_merge(a, b->left);
+    fold_update(b);
+    return b;
+}
+
+/* Unfold and free the folds of t that end at or after line. Only
+ * subtrees holding such a fold are visited. */
+static FoldNode *drop_reaching(FoldMap *fm, FoldNode *t, size_t line, int *failed) {
+    if (!t || t->max_end < line) return t;
+    fold_push(t);
+    t->left = drop_reaching(fm, t->left, line, failed);
+    t->right = drop_reaching(fm, t->right, line, failed);
+    if (t->range.end < line) {
+        fold_update(t);
+        return t;
+    }
+    
+    if (hide_range(fm, &t->range, -1) != 0) *failed = 1;
+    FoldNode *rest = fold_merge(t->left, t->right);
+    free(t);
+    fm->fold_count--;
+    return rest;
+}
+
+/* ==========================================================================
+ * Fold map
+ * ========================================================================== */
+
+FoldMap *fold_create(void) {
+    FoldMap *fm = calloc(1, sizeof(FoldMap));
+    if (!fm) return NULL;
+    fm->seed = 2463534242u;
+    
+    if (fold_reset(fm, 1) != 0) {
+        fold_destroy(fm);
+        return NULL;
+    }
+    return fm;
+}
+
+void fold_destroy(FoldMap *fm) {
+    if (fm) {
+        free_runs(fm->root);
+        while (fm->spare) {
+            FoldRun *next = fm->spare->right;
+            free(fm->spare);
+            fm->spare = next;
+        }
+        free_folds(fm->folds);
+        free(fm);
+    }
+}
+
+int fold_reset(FoldMap *fm, size_t line_count) {
+    if (!fm) return -1;
+    if (line_count == 0) line_count = 1;
+    
+    if (!fm->root) {
+        if (reserve_runs(fm, 1) != 0) return -1;
+        fm->root = new_run(fm, line_count, 0);
+    } else {
+        /* Reuse the root so a reset cannot fail */
+        free_runs(fm->root->left);
+        free_runs(fm->root->right);
+        fm->root->left = fm->root->right = NULL;
+        fm->root->cover = fm->root->add = 0;
+        fm->root->lines = line_count;
+        update(fm->root);
+    }
+    free_folds(fm->folds);
+    fm->folds = NULL;
+    fm->fold_count = 0;
+    fm->line_count = line_count;
+    return 0;
+}
+
+const FoldRange *fold_next(FoldMap *fm, size_t line) {
+    if (!fm) return NULL;
+    FoldNode *t = fm->folds, *best = NULL;
+    while (t) {
+        fold_push(t);
+        if (t->range.start >= line) {
+            best = t;
+            t = t->left;
+        } else {
+            t = t->right;
+        }
+    }
+    return best ? &best->range : NULL;
+}
+
+const FoldRange *fold_get(FoldMap *fm, size_t start) {
+    const FoldRange *r = fold_next(fm, start);
+    return r && r->start == start ? r : NULL;
+}
+
+int fold_add(FoldMap *fm, size_t start, size_t end) {
+    if (!fm || end <= start || end >= fm->line_count) return -1;
+    if (fold_get(fm, start)) return -1;
+    
+    FoldNode *node = calloc(1, sizeof(FoldNode));
+    if (!node) return -1;
+    node->priority = next_priority(fm);
+    node->range.start = start;
+    node->range.end = end;
+    fold_update(node);
+    if (hide_range(fm, &node->range, 1) != 0) {
+        free(node);
+        return -1;
+    }
+    
+    FoldNode *a, *b;
+    fold_split(fm->folds, start, &a, &b);
+    fm->folds = fold_merge(fold_merge(a, node), b);
+    fm->fold_count++;
+    return 0;
+}
+
+int fold_remove(FoldMap *fm, size_t start) {
+    const FoldRange *r = fold_get(fm, start);
+    if (!r || hide_range(fm, r, -1) != 0) return -1;
+    
+    FoldNode *a, *m, *b;
+    fold_split(fm->folds, start, &a, &m);
+    fold_split(m, start + 1, &m, &b);
+    free_folds(m);
+    fm->folds = fold_merge(a, b);
+    fm->fold_count--;
+    return 0;
+}
+
+size_t fold_visible_count(FoldMap *fm) {
+    return fm->root->min == 0 ? fm->root->cnt : 0;
+}
+
+size_t fold_visible_to_line(FoldMap *fm, size_t row) {
+    if (row >= fold_visible_count(fm)) return fm->line_count;
+    return find_kth(fm->root, row);
+}
+
+size_t fold_line_to_visible(FoldMap *fm, size_t line) {
+    if (line >= fm->line_count) line = fm->line_count - 1;
+    size_t row = zeros_before(fm->root, line);
+    
+    /* A hidden line maps to the row of the fold header above it */
+    if (cover_at(fm->root, line) > 0 && row > 0) row--;
+    return row;
+}
+
+int fold_line_hidden(FoldMap *fm, size_t line) {
+    if (line >= fm->line_count) return 0;
+    return cover_at(fm->root, line) > 0;
+}
+
+/* Insert (delta > 0) or delete visible lines at line first */
+static int resize_lines(FoldMap *fm, size_t first, ptrdiff_t delta) {
+    if (reserve_runs(fm, 2) != 0) return -1;
+    
+    FoldRun *a, *m, *b;
+    split(fm, fm->root, first, &a, &b);
+    if (delta > 0) {
+        m = new_run(fm, (size_t)delta, 0);
+        fm->root = join(fm, join(fm, a, m), b);
+    } else {
+        split(fm, b, (size_t)-delta, &m, &b);
+        free_runs(m);
+        fm->root = join(fm, a, b);
+    }
+    fm->line_count = (size_t)((ptrdiff_t)fm->line_count + delta);
+    return 0;
+}
+
+void fold_edit(FoldMap *fm, size_t first, size_t old_lines, size_t new_lines) {
+    if (!fm) return;
+    
+    ptrdiff_t delta = (ptrdiff_t)new_lines - (ptrdiff_t)old_lines;
+    int failed = 0;
+    
+    /* Folds starting above the edit, on the edited lines, and below it */
+    FoldNode *above, *edited, *below;
+    fold_split(fm->folds, first, &above, &edited);
+    fold_split(edited, first + old_lines, &edited, &below);
+    
+    /* An edit within a fold header line keeps that fold; other folds
+     * touching the edited lines are dropped */
+    FoldNode *header = NULL;
+    if (delta == 0 && old_lines == 1) {
+        header = edited;
+        edited = NULL;
+    }
+    drop_reaching(fm, edited, 0, &failed);
+    above = drop_reaching(fm, above, first, &failed);
+    fold_apply(below, delta);
+    fm->folds = fold_merge(fold_merge(above, header), below);
+    
+    /* No fold covers the edited lines any more, so the lines added or
+     * removed are visible ones at first */
+    if (!failed && delta != 0) failed = resize_lines(fm, first, delta) != 0;
+    if (failed) fold_reset(fm, (size_t)((ptrdiff_t)fm->line_count + delta));
+}
+
+/* ==========================================================================
+ * Region discovery
+ * ========================================================================== */
+
+/* Copy a line (truncated to FOLD_LINE_MAX) into out */
+static size_t read_line(BlockIndex *blocks, Buffer *buf, size_t line,
+                        char *out) {
+    size_t start = blocks_line_start(blocks, line);
+    size_t end = line + 1 < blocks_line_count(blocks)
+               ? blocks_line_start(blocks, line + 1) - 1
+               : buffer_length(buf);
+    size_t len = end - start;
+    if (len > FOLD_LINE_MAX) len = FOLD_LINE_MAX;
+    return buffer_copy_range(buf, start, len, out);
+}
+
+/* 1 = line comment, 2 = starts a C block comment, 0 = code or blank */
+static int comment_kind(BlockIndex *blocks, Buffer *buf, size_t line) {
+    char text[FOLD_LINE_MAX];
+    size_t len = read_line(blocks, buf, line, text);
+    
+    SyntaxToken tok[2];
+    int n = syntax_tokenize_line(blocks->lang, text, len, tok, 2);
+    if (n < 1) return 0;
+    if (tok[0].type == TOK_COMMENT) return 1;
+    
+    if (blocks->lang == LANG_COSMO_C && n == 2 &&
+        text[tok[0].start] == '/' && text[tok[1].start] == '*' &&
+        tok[1].start == tok[0].start + 1) {
+        return 2;
+    }
+    return 0;
+}
+
+static int line_closes_comment(BlockIndex *blocks, Buffer *buf, size_t line) {
+    char text[FOLD_LINE_MAX + 1];
+    size_t len = read_line(blocks, buf, line, text);
+    text[len] = '\0';
+    return strstr(text, "*/") != NULL;
+}
+
+int fold_find_region(BlockIndex *blocks, Buffer *buf, size_t line,
+                     FoldRange *out) {
+    size_t lines = blocks_line_count(blocks);
+    if (line >= lines) return -1;
+    
+    /* Outermost block opened on this line and closed further down */
+    size_t best = blocks_block_end(blocks, line);
+    
+    /* Comment runs */
+    if (best == line) {
+        int kind = comment_kind(blocks, buf, line);
+        if (kind == 1 && (line == 0 || comment_kind(blocks, buf, line - 1) != 1)) {
+            while (best + 1 < lines && comment_kind(blocks, buf, best + 1) == 1) {
+                best++;
+            }
+        } else if (kind == 2 && !line_closes_comment(blocks, buf, line)) {
+            while (best + 1 < lines) {
+                best++;
+                if (line_closes_comment(blocks, buf, best)) break;
+            }
+        }
+    }
+    
+    if (best == line) return -1;
+    if (out) {
+        out->start = line;
+        out->end = best;
+    }
+    return 0;
+}
@@ -0,0 +1,285 @@
+/*
+ * hash.c - Content hashing (XXH64, SHA-256)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "util.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+/* Little-endian loads independent of alignment and host byte order */
+static uint64_t read64(const uint8_t *p) {
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+           ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+           ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+           ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static uint32_t read32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint64_t merge_round(uint64_t acc, uint64_t val) {
+    acc ^= round64(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/* Remaining input (under 32 bytes) and the final avalanche */
+static uint64_t xxh64_finish(uint64_t h, const uint8_t *p, const uint8_t *end) {
+    while (p + 8 <= end) {
+        h ^= round64(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        p++;
+    }
+    
+    /* Avalanche */
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t hash_xxh64(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + len;
+    uint64_t h;
+    
+    if (len >= 32) {
+        const uint8_t *limit = end - 32;
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        
+        do {
+            v1 = round64(v1, read64(p));
+            v2 = round64(v2, read64(p + 8));
+            v3 = round64(v3, read64(p + 16));
+            v4 = round64(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    } else {
+        h = seed + PRIME64_5;
+    }
+    
+    h += (uint64_t)len;
+    return xxh64_finish(h, p, end);
+}
+
+void hash_xxh64_init(HashXxh64 *st, uint64_t seed) {
+    memset(st, 0, sizeof(*st));
+    st->seed = seed;
+    st->v[0] = seed + PRIME64_1 + PRIME64_2;
+    st->v[1] = seed + PRIME64_2;
+    st->v[2] = seed;
+    st->v[3] = seed - PRIME64_1;
+}
+
+static void xxh64_stripe(HashXxh64 *st, const uint8_t *p) {
+    st->v[0] = round64(st->v[0], read64(p));
+    st->v[1] = round64(st->v[1], read64(p + 8));
+    st->v[2] = round64(st->v[2], read64(p + 16));
+    st->v[3] = round64(st->v[3], read64(p + 24));
+}
+
+void hash_xxh64_update(HashXxh64 *st, const void *data, size_t len) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + len;
+    st->total += len;
+    
+    if (st->mem_len + len < 32) {
+        memcpy(st->mem + st->mem_len, p, len);
+        st->mem_len += len;
+        return;
+    }
+    
+    if (st->mem_len > 0) {
+        size_t fill = 32 - st->mem_len;
+        memcpy(st->mem + st->mem_len, p, fill);
+        xxh64_stripe(st, st->mem);
+        p += fill;
+        st->mem_len = 0;
+    }
+    
+    while (p + 32 <= end) {
+        xxh64_stripe(st, p);
+        p += 32;
+    }
+    
+    st->mem_len = (size_t)(end - p);
+    memcpy(st->mem, p, st->mem_len);
+}
+
+uint64_t hash_xxh64_final(const HashXxh64 *st) {
+    uint64_t h;
+    if (st->total >= 32) {
+        h = rotl64(st->v[0], 1) + rotl64(st->v[1], 7) +
+            rotl64(st->v[2], 12) + rotl64(st->v[3], 18);
+        h = merge_round(h, st->v[0]);
+        h = merge_round(h, st->v[1]);
+        h = merge_round(h, st->v[2]);
+        h = merge_round(h, st->v[3]);
+    } else {
+        h = st->seed + PRIME64_5;
+    }
+    
+    h += st->total;
+    return xxh64_finish(h, st->mem, st->mem + st->mem_len);
+}
+
+int hash_file(const char *path, uint64_t *out) {
+    size_t len;
+    char *data = file_map(path, &len);
+    if (!data) return -1;
+    
+    *out = hash_xxh64(data, len, 0);
+    file_unmap(data, len);
+    return 0;
+}
+
+/* ==========================================================================
+ * SHA-256
+ * ========================================================================== */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static uint32_t rotr32(uint32_t x, int r) {
+    return (x >> r) | (x << (32 - r));
+}
+
+static void sha256_block(uint32_t *state, const uint8_t *p) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)p[4 * i] << 24) | ((uint32_t)p[4 * i + 1] << 16) |
+               ((uint32_t)p[4 * i + 2] << 8) | (uint32_t)p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) +
+                      ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) +
+                      ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void hash_sha256(const void *data, size_t len, uint8_t out[HASH_SHA256_SIZE]) {
+    uint32_t state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    const uint8_t *p = data;
+    size_t left = len;
+    while (left >= 64) {
+        sha256_block(state, p);
+        p += 64;
+        left -= 64;
+    }
+    
+    /* Final block(s): 0x80, zero padding, bit length big-endian */
+    uint8_t tail[128];
+    memset(tail, 0, sizeof(tail));
+    if (left) memcpy(tail, p, left);
+    tail[left] = 0x80;
+    size_t tail_len = left < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++) {
+        tail[tail_len - 1 - i] = (uint8_t)(bits >> (8 * i));
+    }
+    sha256_block(state, tail);
+    if (tail_len == 128) sha256_block(state, tail + 64);
+    
+    for (int i = 0; i < 8; i++) {
+        out[4 * i] = (uint8_t)(state[i] >> 24);
+        out[4 * i + 1] = (uint8_t)(state[i] >> 16);
+        out[4 * i + 2] = (uint8_t)(state[i] >> 8);
+        out[4 * i + 3] = (uint8_t)state[i];
+    }
+}
+
+void hash_to_hex(const uint8_t *digest, size_t len, char *out) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+        out[2 * i] = digits[digest[i] >> 4];
+        out[2 * i + 1] = digits[digest[i] & 15];
+    }
+    out[2 * len] = '\0';
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+int hash_from_hex(const char *hex, uint8_t *digest, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        int hi = hex_value(hex[2 * i]);
+        int lo = hi < 0 ? -1 : hex_value(hex[2 * i + 1]);
+        if (lo < 0) return -1;
+        digest[i] = (uint8_t)((hi << 4) | lo);
+    }
+    return 0;
+}
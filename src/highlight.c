@@ -0,0 +1,264 @@
+/*
+ * highlight.c - Headless syntax highlight export
+ *
+ * Each input file is memory-mapped, tokenized line by line and rendered
+ * into a private buffer that is written out with a single fwrite, so
+ * workers never share state and throughput scales with the core count.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "highlight.h"
+#include "parallel.h"
+#include "util.h"
+
+#define HL_MAX_TOKENS 512
+
+/* Palette shared with the GUI (see setup_colors in cimgui_backend.c) */
+static const char *html_class[] = {
+    NULL, "kw", "reg", "dir", "num", "str", "com", NULL, NULL
+};
+
+static const char *ansi_color[] = {
+    NULL,
+    "\033[38;2;86;156;214m",    /* TOK_KEYWORD   - blue */
+    "\033[38;2;78;201;176m",    /* TOK_REGISTER  - teal */
+    "\033[38;2;197;134;192m",   /* TOK_DIRECTIVE - purple */
+    "\033[38;2;181;206;168m",   /* TOK_NUMBER    - light green */
+    "\033[38;2;206;145;120m",   /* TOK_STRING    - orange */
+    "\033[38;2;106;153;85m",    /* TOK_COMMENT   - green */
+    NULL,
+    NULL
+};
+
+static const char html_header[] =
+    "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>";
+static const char html_style[] =
+    "</title>\n<style>\n"
+    "pre.tedit{background:#1e1e1e;color:#dcdcdc}\n"
+    ".kw{color:#569cd6}.reg{color:#4ec9b0}.dir{color:#c586c0}\n"
+    ".num{color:#b5cea8}.str{color:#ce9178}.com{color:#6a9955}\n"
+    "</style></head><body>\n<pre class=\"tedit\">";
+static const char html_footer[] = "</pre>\n</body></html>\n";
+
+static int buf_reserve(HighlightBuf *buf, size_t extra) {
+    if (buf->len + extra <= buf->capacity) return 0;
+    
+    size_t new_cap = buf->capacity ? buf->capacity : 4096;
+    while (new_cap < buf->len + extra) new_cap *= 2;
+    
+    char *data = realloc(buf->data, new_cap);
+    if (!data) return -1;
+    buf->data = data;
+    buf->capacity = new_cap;
+    return 0;
+}
+
+static void buf_append(HighlightBuf *buf, const char *s, size_t len) {
+    if (buf_reserve(buf, len) != 0) return;
+    memcpy(buf->data + buf->len, s, len);
+    buf->len += len;
+}
+
+static void buf_puts(HighlightBuf *buf, const char *s) {
+    buf_append(buf, s, strlen(s));
+}
+
+/* Append text, escaping it for HTML when needed */
+static void emit_text(HighlightBuf *buf, HighlightFormat fmt,
+                      const char *s, size_t len) {
+    if (fmt != HIGHLIGHT_HTML) {
+        buf_append(buf, s, len);
+        return;
+    }
+    
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        const char *esc = NULL;
+        switch (s[i]) {
+            case '&': esc = "&amp;"; break;
+            case '<': esc = "&lt;"; break;
+            case '>': esc = "&gt;"; break;
+            case '"': esc = "&quot;"; break;
+            default: continue;
+        }
+        buf_append(buf, s + run, i - run);
+        buf_puts(buf, esc);
+        run = i + 1;
+    }
+    buf_append(buf, s + run, len - run);
+}
+
+static void emit_token(HighlightBuf *buf, HighlightFormat fmt, TokenType type,
+                       const char *s, size_t len) {
+    if (fmt == HIGHLIGHT_HTML && html_class[type]) {
+        buf_puts(buf, "<span class=\"");
+        buf_puts(buf, html_class[type]);
+        buf_puts(buf, "\">");
+        emit_text(buf, fmt, s, len);
+        buf_puts(buf, "</span>");
+    } else if (fmt == HIGHLIGHT_ANSI && ansi_color[type]) {
+        buf_puts(buf, ansi_color[type]);
+        buf_append(buf, s, len);
+        buf_puts(buf, "\033[0m");
+    } else {
+        emit_text(buf, fmt, s, len);
+    }
+}
+
+int highlight_parse_format(const char *name, HighlightFormat *fmt) {
+    if (!name || !fmt) return -1;
+    if (strcmp(name, "html") == 0) {
+        *fmt = HIGHLIGHT_HTML;
+    } else if (strcmp(name, "ansi") == 0) {
+        *fmt = HIGHLIGHT_ANSI;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char *highlight_extension(HighlightFormat fmt) {
+    return fmt == HIGHLIGHT_HTML ? ".html" : ".ansi";
+}
+
+size_t highlight_render(HighlightFormat fmt, Language lang, const char *name,
+                        const char *text, size_t len, HighlightBuf *buf) {
+    SyntaxToken tokens[HL_MAX_TOKENS];
+    size_t lines = 0;
+    
+    /* Output is usually slightly larger than the input */
+    buf_reserve(buf, len + len / 2 + 1024);
+    
+    if (fmt == HIGHLIGHT_HTML) {
+        buf_puts(buf, html_header);
+        emit_text(buf, fmt, name ? name : "", name ? strlen(name) : 0);
+        buf_puts(buf, html_style);
+    }
+    
+    size_t pos = 0;
+    while (pos < len) {
+        const char *line = text + pos;
+        const char *nl = memchr(line, '\n', len - pos);
+        size_t line_len = nl ? (size_t)(nl - line) : len - pos;
+        
+        int count = syntax_tokenize_line(lang, line, line_len, tokens, HL_MAX_TOKENS);
+        
+        /* Whitespace between tokens is copied through unstyled */
+        size_t col = 0;
+        for (int t = 0; t < count; t++) {
+            if (tokens[t].start > col) {
+                emit_text(buf, fmt, line + col, tokens[t].start - col);
+            }
+            emit_token(buf, fmt, tokens[t].type, line + tokens[t].start,
+                       tokens[t].length);
+            col = tokens[t].start + tokens[t].length;
+        }
+        if (col < line_len) {
+            emit_text(buf, fmt, line + col, line_len - col);
+        }
+        
+        if (nl) buf_append(buf, "\n", 1);
+        pos += line_len + 1;
+        lines++;
+    }
+    
+    if (fmt == HIGHLIGHT_HTML) {
+        buf_puts(buf, html_footer);
+    }
+    return lines;
+}
+
+void highlight_buf_free(HighlightBuf *buf) {
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+/* Per-file work item */
+typedef struct HighlightJob {
+    const char *path;
+    int failed;
+    size_t lines;
+    size_t bytes_in;
+    size_t bytes_out;
+} HighlightJob;
+
+typedef struct HighlightBatch {
+    HighlightFormat fmt;
+    HighlightJob *jobs;
+} HighlightBatch;
+
+static void highlight_worker(size_t index, void *ctx) {
+    HighlightBatch *batch = ctx;
+    HighlightJob *job = &batch->jobs[index];
+    
+    size_t len;
+    char *text = file_map(job->path, &len);
+    if (!text) {
+        fprintf(stderr, "Failed to read: %s\n", job->path);
+        job->failed = 1;
+        return;
+    }
+    
+    Language lang = syntax_detect_language_content(job->path, text, len);
+    
+    HighlightBuf buf = {0};
+    job->lines = highlight_render(batch->fmt, lang, path_basename(job->path),
+                                  text, len, &buf);
+    job->bytes_in = len;
+    file_unmap(text, len);
+    
+    char out_path[1024];
+    snprintf(out_path, sizeof(out_path), "%s%s", job->path,
+             highlight_extension(batch->fmt));
+    
+    FILE *f = fopen(out_path, "wb");
+    if (!f || fwrite(buf.data, 1, buf.len, f) != buf.len) {
+        fprintf(stderr, "Failed to write: %s\n", out_path);
+        job->failed = 1;
+    } else {
+        job->bytes_out = buf.len;
+    }
+    if (f && fclose(f) != 0) job->failed = 1;
+    
+    highlight_buf_free(&buf);
+}
+
+size_t highlight_export_files(HighlightFormat fmt, char **files, size_t count,
+                              int threads, HighlightStats *stats) {
+    HighlightJob *jobs = calloc(count ? count : 1, sizeof(HighlightJob));
+    if (!jobs) return count;
+    
+    for (size_t i = 0; i < count; i++) {
+        jobs[i].path = files[i];
+    }
+    
+    if (threads <= 0) threads = parallel_cpu_count();
+    
+    HighlightBatch batch = { fmt, jobs };
+    double start = time_now();
+    parallel_for(count, threads, highlight_worker, &batch);
+    double elapsed = time_now() - start;
+    
+    size_t failed = 0;
+    HighlightStats st;
+    memset(&st, 0, sizeof(st));
+    for (size_t i = 0; i < count; i++) {
+        if (jobs[i].failed) {
+            failed++;
+            continue;
+        }
+        st.files++;
+        st.lines += jobs[i].lines;
+        st.bytes_in += jobs[i].bytes_in;
+        st.bytes_out += jobs[i].bytes_out;
+    }
+    st.failed = failed;
+    st.threads = threads < (int)count ? threads : (int)count;
+    st.seconds = elapsed;
+    
+    if (stats) *stats = st;
+    free(jobs);
+    return failed;
+}
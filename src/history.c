@@ -118,11 +118,13 @@ static int history_read_header(History *h, HistoryHeader *header) {
 static int history_write_op(History *h, EditOp *op) {
     if (!h->file || !op) return -1;
     
-    /* Seek to end */
-    fseek(h->file, 0, SEEK_END);
+    /* Seek to end; later ops of a group follow on from the first */
+    if (h->group_depth == 0 || h->group_ops <= 1) {
+        fseek(h->file, 0, SEEK_END);
+    }
     
     /* Write operation fields */
-    uint8_t type = (uint8_t)op->type;
+    uint8_t type = (uint8_t)op->type | (op->grouped ? OP_GROUPED : 0);
     if (fwrite(&type, sizeof(type), 1, h->file) != 1) return -1;
     if (fwrite(&op->position, sizeof(op->position), 1, h->file) != 1) return -1;
     if (fwrite(&op->length, sizeof(op->length), 1, h->file) != 1) return -1;
@@ -133,7 +135,7 @@ static int history_write_op(History *h, EditOp *op) {
         if (fwrite(op->data, 1, op->length, h->file) != op->length) return -1;
     }
     
-    fflush(h->file);
+    if (h->group_depth == 0) fflush(h->file);
     
     /* Update file size */
     h->file_size += 1 + 4 + 4 + 8 + op->length;
@@ -171,7 +173,8 @@ static EditOp *history_read_op(History *h) {
         return NULL;
     }
     
-    op->type = (OpType)type;
+    op->type = (OpType)(type & ~OP_GROUPED);
+    op->grouped = (type & OP_GROUPED) != 0;
     op->position = position;
     op->length = length;
     op->timestamp = timestamp;
@@ -284,6 +287,7 @@ int history_append(History *h, OpType type, size_t pos,
     /* Create operation */
     EditOp *op = editop_create(type, (uint32_t)pos, data, (uint32_t)len);
     if (!op) return -1;
+    op->grouped = h->group_depth > 0 && h->group_ops++ > 0;
     
     /* If we've undone some operations, discard the redo chain */
     if (h->current) {
@@ -322,6 +326,17 @@ int history_append(History *h, OpType type, size_t pos,
     return 0;
 }
 
+/* Begin/end a group of ops undone as one step */
+void history_begin_group(History *h) {
+    if (!h) return;
+    if (h->group_depth++ == 0) h->group_ops = 0;
+}
+
+void history_end_group(History *h) {
+    if (!h || h->group_depth == 0) return;
+    if (--h->group_depth == 0 && h->file) fflush(h->file);
+}
+
 /* Undo - returns the operation to reverse */
 EditOp *history_undo(History *h) {
     if (!h || !history_can_undo(h)) return NULL;
@@ -508,12 +523,13 @@ int history_export(History *h, const char *output_path) {
         char time_str[64];
         strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&ts));
         
-        fprintf(out, "[%zu] %s at pos %u, len %u (%s)\n",
+        fprintf(out, "[%zu] %s at pos %u, len %u (%s)%s\n",
                 i++,
                 op->type == OP_INSERT ? "INSERT" : "DELETE",
                 op->position,
                 op->length,
-                time_str);
+                time_str,
+                op->grouped ? " +grouped" : "");
         
         if (op->data && op->length > 0) {
             fprintf(out, "    Data: ");
@@ -4,12 +4,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#endif
 
 #include "app.h"
 #include "platform.h"
 #include "editor.h"
 #include "history.h"
 #include "backup.h"
+#include "dedup.h"
+#include "restore.h"
+#include "autobackup.h"
+#include "highlight.h"
 
 static void print_usage(void) {
     printf("tedit-cosmo - Portable code editor\n\n");
@@ -22,6 +29,13 @@ static void print_usage(void) {
     printf("  --history-clear <file>      Clear all history for file\n");
     printf("  --history-info <file>       Show history info for file\n");
     printf("  --backup <destination>      Create backup to destination\n");
+    printf("    [project_dir] [--incremental]  Only changed files since the last backup\n");
+    printf("  --restore <archive> [paths...] [--to <dir>]  Restore files from a backup\n");
+    printf("  --verify <archive>          Check checksums and content hashes of a backup\n");
+    printf("  --repo-list <repo>          List snapshots in a backup repository\n");
+    printf("  --repo-restore <repo> <snapshot> <dir>  Restore a snapshot into dir\n");
+    printf("  --repo-verify <repo>        Check every chunk and snapshot in a repository\n");
+    printf("  --highlight <html|ansi> <files...>  Export highlighted copies\n");
     printf("\n");
 }
 
@@ -116,8 +130,8 @@ static int cmd_history_info(const char *file) {
     return 0;
 }
 
-/* Handle --backup <destination> [project_dir] */
-static int cmd_backup(const char *dest, const char *project_dir) {
+/* Handle --backup <destination> [project_dir] [--incremental] */
+static int cmd_backup(const char *dest, const char *project_dir, int incremental) {
     BackupConfig cfg;
     char ini_path[512];
     
@@ -144,9 +158,67 @@ static int cmd_backup(const char *dest, const char *project_dir) {
     const char *dir = project_dir ? project_dir : ".";
     printf("Creating backup to '%s'...\n", dest);
     
-    int result = backup_project(&cfg, dest, dir, 1);
+    int result = incremental ? backup_project_incremental(&cfg, dest, dir)
+                             : backup_project(&cfg, dest, dir, 1);
     
-    if (result == 0) {
+    WalkStats *walk = &cfg.last_walk;
+    printf("Walked %zu directories in %.3fs on %d threads: %zu files, %zu excluded\n",
+           walk->dirs, walk->seconds, walk->threads, walk->files, walk->excluded);
+    if (walk->errors) {
+        fprintf(stderr, "Could not add %zu files (names over %d bytes or out of memory)\n",
+                walk->errors, ARCHIVE_MAX_NAME);
+    }
+    
+    BackupDiffStats *diff = &cfg.last_diff;
+    if (!cfg.last_to_repo) {
+        printf("Scanned %zu files in %.3fs: %zu added, %zu modified, %zu deleted, "
+               "%zu unchanged (%zu hashed)\n",
+               diff->files, diff->seconds, diff->added, diff->modified, diff->deleted,
+               diff->unchanged, diff->hashed);
+        if (diff->unreadable) {
+            printf("Could not read %zu files; kept them from the last backup\n",
+                   diff->unreadable);
+        }
+    }
+    if (incremental && !cfg.last_incremental && !cfg.last_to_repo) {
+        printf("No previous backup manifest; created a full backup.\n");
+    }
+    
+    if (result == 0 && cfg.last_to_repo) {
+        BackupRepoStats *rs = &cfg.last_repo;
+        double secs = rs->seconds > 0 ? rs->seconds : 1e-9;
+        printf("Stored %zu files (%.1f MB) in %.3fs on %d threads: %.1f MB/s\n",
+               rs->files, rs->bytes / 1048576.0, rs->seconds, rs->threads,
+               rs->bytes / 1048576.0 / secs);
+        printf("%zu unchanged files, %zu chunks, %zu new (%.1f MB added)\n",
+               rs->reused, rs->chunks, rs->new_chunks, rs->new_bytes / 1048576.0);
+        if (rs->skipped) printf("Skipped %zu unreadable files\n", rs->skipped);
+        printf("Snapshot %s created.\n", cfg.last_archive);
+    } else if (result == 0 && !cfg.last_archive[0]) {
+        printf("No changes since the last backup.\n");
+    } else if (result == 0) {
+        ArchiveStats *st = &cfg.last_stats;
+        double secs = st->seconds > 0 ? st->seconds : 1e-9;
+        printf("Archived %zu files (%.1f MB) in %.3fs on %d threads: "
+               "%.0f files/s, %.1f MB/s\n",
+               st->files, st->bytes / 1048576.0, st->seconds, st->threads,
+               st->files / secs, st->bytes / 1048576.0 / secs);
+        if (st->output_bytes < st->archive_bytes) {
+            printf("Compressed %.1f MB to %.1f MB (%.1f%%)\n",
+                   st->archive_bytes / 1048576.0, st->output_bytes / 1048576.0,
+                   100.0 * st->output_bytes / st->archive_bytes);
+        }
+        if (st->zero_copy_bytes) {
+            printf("Copied %.1f MB in the kernel (zero-copy)\n",
+                   st->zero_copy_bytes / 1048576.0);
+        }
+        if (st->streamed) {
+            printf("Streamed %.1f MB to the destination at %.1f MB/s: "
+                   "%zu stalls, %.3fs waiting on the command\n",
+                   st->output_bytes / 1048576.0, st->output_bytes / 1048576.0 / secs,
+                   st->stalls, st->stall_seconds);
+        }
+        if (st->skipped) printf("Skipped %zu unreadable files\n", st->skipped);
         printf("Backup completed successfully.\n");
     } else {
         fprintf(stderr, "Backup failed.\n");
@@ -177,7 +249,186 @@ static int cmd_backup_list(void) {
     return 0;
 }
 
+/* A repository is named by path or by a repo: destination in backup.ini */
+static int open_repo(DedupRepo *repo, const char *name) {
+    BackupConfig cfg;
+    char ini_path[512];
+    char path[BACKUP_MAX_PATH];
+    
+    snprintf(path, sizeof(path), "%s", name);
+    backup_get_default_ini_path(ini_path, sizeof(ini_path), ".");
+    if (backup_config_load(&cfg, ini_path) == 0) {
+        BackupDest *dest = backup_config_get_dest(&cfg, name);
+        if (dest && strncmp(dest->command, "repo:", 5) == 0) {
+            BackupVars vars;
+            backup_vars_init(&vars, NULL, ".", NULL, NULL);
+            backup_substitute(path, sizeof(path), dest->command + 5, &vars);
+        }
+        backup_config_free(&cfg);
+    }
+    
+    if (dedup_open(repo, path, 0) != 0) {
+        fprintf(stderr, "Not a backup repository: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Handle --restore <archive> [paths...] [--to <dir>] */
+static int cmd_restore(const char *archive, const char *const *paths, size_t count,
+                       const char *dir) {
+    RestoreStats st;
+    int result = archive_restore(archive, dir, paths, count, 0, &st);
+    if (result != 0 && st.members == 0) {
+        fprintf(stderr, "Failed to read archive: %s\n", archive);
+        return 1;
+    }
+    
+    double secs = st.seconds > 0 ? st.seconds : 1e-9;
+    printf("Restored %zu files (%.1f MB) in %.3fs on %d threads: %.1f MB/s%s\n",
+           st.files, st.bytes / 1048576.0, st.seconds, st.threads,
+           st.bytes / 1048576.0 / secs, st.indexed ? " (indexed)" : "");
+    if (st.missing) fprintf(stderr, "%zu requested paths not in the archive\n", st.missing);
+    if (st.skipped) fprintf(stderr, "%zu files could not be written\n", st.skipped);
+    if (st.header_errors || st.hash_errors) {
+        fprintf(stderr, "%zu bad headers, %zu hash mismatches\n",
+                st.header_errors, st.hash_errors);
+    }
+    return result == 0 ? 0 : 1;
+}
+
+/* Handle --verify <archive> */
+static int cmd_verify(const char *archive) {
+    RestoreStats st;
+    int result = archive_verify(archive, 0, &st);
+    if (result != 0 && st.members == 0 && st.header_errors == 0) {
+        fprintf(stderr, "Failed to read archive: %s\n", archive);
+        return 1;
+    }
+    
+    double secs = st.seconds > 0 ? st.seconds : 1e-9;
+    printf("Checked %zu records (%.1f MB) in %.3fs on %d threads: %.1f MB/s\n",
+           st.members, st.bytes / 1048576.0, st.seconds, st.threads,
+           st.bytes / 1048576.0 / secs);
+    if (!st.indexed) printf("No index: content hashes not checked.\n");
+    else if (st.unhashed) printf("%zu records have no recorded hash.\n", st.unhashed);
+    if (st.header_errors || st.hash_errors) {
+        fprintf(stderr, "%zu bad headers, %zu hash mismatches\n",
+                st.header_errors, st.hash_errors);
+    } else {
+        printf("Archive OK.\n");
+    }
+    return result == 0 ? 0 : 1;
+}
+
+/* Handle --repo-list <repo> */
+static int cmd_repo_list(const char *name) {
+    DedupRepo repo;
+    if (open_repo(&repo, name) != 0) return 1;
+    
+    DedupSnapshotInfo *list;
+    size_t count;
+    if (dedup_list(&repo, &list, &count) != 0) {
+        fprintf(stderr, "Failed to list snapshots\n");
+        dedup_close(&repo);
+        return 1;
+    }
+    
+    uint64_t stored = 0;
+    for (size_t i = 0; i < repo.count; i++) stored += repo.chunks[i].length;
+    
+    for (size_t i = 0; i < count; i++) {
+        printf("  %-40s %6zu files %10.1f MB\n", list[i].name, list[i].files,
+               list[i].bytes / 1048576.0);
+    }
+    printf("%zu snapshots, %zu chunks, %.1f MB stored\n", count, repo.count,
+           stored / 1048576.0);
+    
+    free(list);
+    dedup_close(&repo);
+    return 0;
+}
+
+/* Handle --repo-restore <repo> <snapshot> <dir> */
+static int cmd_repo_restore(const char *name, const char *snapshot, const char *dir) {
+    DedupRepo repo;
+    if (open_repo(&repo, name) != 0) return 1;
+    
+    BackupRepoStats st;
+    int result = dedup_restore(&repo, snapshot, dir, 0, &st);
+    if (result != 0 && st.files == 0 && st.skipped == 0) {
+        fprintf(stderr, "Failed to read snapshot: %s\n", snapshot);
+    } else {
+        double secs = st.seconds > 0 ? st.seconds : 1e-9;
+        printf("Restored %zu files (%.1f MB) in %.3fs on %d threads: %.1f MB/s\n",
+               st.files, st.bytes / 1048576.0, st.seconds, st.threads,
+               st.bytes / 1048576.0 / secs);
+        if (st.skipped) {
+            fprintf(stderr, "%zu files failed (%zu bad chunks)\n", st.skipped, st.errors);
+        }
+        if (st.outside) {
+            fprintf(stderr, "Skipped %zu entries outside %s\n", st.outside, RESTORE_PREFIX);
+        }
+    }
+    
+    dedup_close(&repo);
+    return result == 0 ? 0 : 1;
+}
+
+/* Handle --repo-verify <repo> */
+static int cmd_repo_verify(const char *name) {
+    DedupRepo repo;
+    if (open_repo(&repo, name) != 0) return 1;
+    
+    BackupRepoStats st;
+    int result = dedup_verify(&repo, 0, &st);
+    double secs = st.seconds > 0 ? st.seconds : 1e-9;
+    printf("Checked %zu chunks (%.1f MB) and %zu snapshot files in %.3fs on %d threads: "
+           "%.1f MB/s\n",
+           st.chunks, st.bytes / 1048576.0, st.files, st.seconds, st.threads,
+           st.bytes / 1048576.0 / secs);
+    if (st.errors) {
+        fprintf(stderr, "%zu errors found\n", st.errors);
+    } else {
+        printf("Repository OK.\n");
+    }
+    
+    dedup_close(&repo);
+    return result == 0 ? 0 : 1;
+}
+
+/* Handle --highlight <format> <files...> */
+static int cmd_highlight(const char *format, char **files, size_t count) {
+    HighlightFormat fmt;
+    if (highlight_parse_format(format, &fmt) != 0) {
+        fprintf(stderr, "Unknown highlight format: %s (use html or ansi)\n", format);
+        return 1;
+    }
+    
+    HighlightStats st;
+    size_t failed = highlight_export_files(fmt, files, count, 0, &st);
+    
+    double secs = st.seconds > 0 ? st.seconds : 1e-9;
+    fprintf(stderr, "Highlighted %zu files (%zu lines, %.1f MB in, %.1f MB out) "
+            "in %.3fs on %d threads\n",
+            st.files, st.lines, st.bytes_in / 1048576.0, st.bytes_out / 1048576.0,
+            st.seconds, st.threads);
+    fprintf(stderr, "Throughput: %.0f files/s, %.1f MB/s, %.0f lines/s\n",
+            st.files / secs, st.bytes_in / 1048576.0 / secs, st.lines / secs);
+    if (failed) {
+        fprintf(stderr, "%zu files failed\n", failed);
+    }
+    
+    return failed ? 1 : 0;
+}
+
 int main(int argc, char **argv) {
+#ifndef _WIN32
+    /* Writes to backup and build commands that exit early must fail,
+     * not kill the process; set once, before any thread starts */
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    
     /* Handle command-line flags */
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
@@ -218,16 +469,75 @@ int main(int argc, char **argv) {
         }
         if (strcmp(argv[i], "--backup") == 0) {
             if (i + 1 >= argc) {
-                fprintf(stderr, "Usage: --backup <destination> [project_dir]\n");
+                fprintf(stderr, "Usage: --backup <destination> [project_dir] [--incremental]\n");
                 return 1;
             }
             const char *dest = argv[i+1];
             const char *dir = (i + 2 < argc && argv[i+2][0] != '-') ? argv[i+2] : NULL;
-            return cmd_backup(dest, dir);
+            int incremental = 0;
+            for (int j = i + 2; j < argc; j++) {
+                if (strcmp(argv[j], "--incremental") == 0) incremental = 1;
+            }
+            return cmd_backup(dest, dir, incremental);
+        }
+        if (strcmp(argv[i], "--highlight") == 0) {
+            if (i + 2 >= argc) {
+                fprintf(stderr, "Usage: --highlight <html|ansi> <files...>\n");
+                return 1;
+            }
+            return cmd_highlight(argv[i+1], argv + i + 2, (size_t)(argc - i - 2));
         }
         if (strcmp(argv[i], "--backup-list") == 0) {
             return cmd_backup_list();
         }
+        if (strcmp(argv[i], "--restore") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Usage: --restore <archive> [paths...] [--to <dir>]\n");
+                return 1;
+            }
+            const char *dir = ".";
+            const char **paths = malloc((size_t)argc * sizeof(char *));
+            size_t count = 0;
+            if (!paths) return 1;
+            for (int j = i + 2; j < argc; j++) {
+                if (strcmp(argv[j], "--to") == 0 && j + 1 < argc) {
+                    dir = argv[++j];
+                } else {
+                    paths[count++] = argv[j];
+                }
+            }
+            int result = cmd_restore(argv[i+1], paths, count, dir);
+            free(paths);
+            return result;
+        }
+        if (strcmp(argv[i], "--verify") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Usage: --verify <archive>\n");
+                return 1;
+            }
+            return cmd_verify(argv[i+1]);
+        }
+        if (strcmp(argv[i], "--repo-list") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Usage: --repo-list <repo>\n");
+                return 1;
+            }
+            return cmd_repo_list(argv[i+1]);
+        }
+        if (strcmp(argv[i], "--repo-restore") == 0) {
+            if (i + 3 >= argc) {
+                fprintf(stderr, "Usage: --repo-restore <repo> <snapshot> <dir>\n");
+                return 1;
+            }
+            return cmd_repo_restore(argv[i+1], argv[i+2], argv[i+3]);
+        }
+        if (strcmp(argv[i], "--repo-verify") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Usage: --repo-verify <repo>\n");
+                return 1;
+            }
+            return cmd_repo_verify(argv[i+1]);
+        }
     }
     
     /* Normal editor startup */
@@ -246,6 +556,11 @@ int main(int argc, char **argv) {
         }
     }
     
+    /* Scheduled backups of the working directory, if backup.ini asks */
+    char ini_path[BACKUP_MAX_PATH];
+    backup_get_default_ini_path(ini_path, sizeof(ini_path), ".");
+    app.autobackup = autobackup_start(ini_path, ".");
+    
     if (platform_init(&app) != 0) {
         fprintf(stderr, "Failed to initialize platform\n");
         app_shutdown(&app);
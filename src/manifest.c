@@ -0,0 +1,284 @@
+/*
+ * manifest.c - Backup manifest for incremental backups
+ *
+ * File format (INI-style header, then one record per line):
+ *
+ *   ; tedit backup manifest
+ *   base=project-backup-20240101-120000.tar
+ *   parent=project-backup-20240102-120000.tar
+ *   sequence=1
+ *
+ *   [files]
+ *   <xxh64 hex> <size> <mtime> <path>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "manifest.h"
+#include "hash.h"
+#include "parallel.h"
+#include "util.h"
+
+void manifest_init(Manifest *m) {
+    memset(m, 0, sizeof(Manifest));
+}
+
+void manifest_free(Manifest *m) {
+    if (!m) return;
+    for (size_t i = 0; i < m->count; i++) {
+        free(m->records[i].path);
+    }
+    free(m->records);
+    manifest_init(m);
+}
+
+static ManifestRecord *manifest_append(Manifest *m) {
+    if (m->count >= m->capacity) {
+        size_t new_cap = m->capacity ? m->capacity * 2 : 256;
+        ManifestRecord *records = realloc(m->records, new_cap * sizeof(ManifestRecord));
+        if (!records) return NULL;
+        m->records = records;
+        m->capacity = new_cap;
+    }
+    ManifestRecord *rec = &m->records[m->count++];
+    memset(rec, 0, sizeof(*rec));
+    return rec;
+}
+
+static int record_compare(const void *a, const void *b) {
+    const ManifestRecord *ra = a;
+    const ManifestRecord *rb = b;
+    return strcmp(ra->path, rb->path);
+}
+
+int manifest_load(Manifest *m, const char *path) {
+    manifest_init(m);
+    
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    
+    char line[ARCHIVE_MAX_NAME + 128];
+    int in_files = 0;
+    
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == ';' || line[0] == '\0') continue;
+        
+        if (strcmp(line, "[files]") == 0) {
+            in_files = 1;
+            continue;
+        }
+        
+        if (!in_files) {
+            char *eq = strchr(line, '=');
+            if (!eq) continue;
+            *eq = '\0';
+            if (strcmp(line, "base") == 0) {
+                strncpy(m->base, eq + 1, sizeof(m->base) - 1);
+            } else if (strcmp(line, "parent") == 0) {
+                strncpy(m->parent, eq + 1, sizeof(m->parent) - 1);
+            } else if (strcmp(line, "sequence") == 0) {
+                m->sequence = atoi(eq + 1);
+            }
+            continue;
+        }
+        
+        unsigned long long hash, size;
+        long long mtime;
+        int offset = 0;
+        if (sscanf(line, "%16llx %llu %lld %n", &hash, &size, &mtime, &offset) != 3 ||
+            offset == 0 || line[offset] == '\0') {
+            continue;
+        }
+        
+        ManifestRecord *rec = manifest_append(m);
+        if (!rec) break;
+        rec->path = str_dup(line + offset);
+        rec->size = size;
+        rec->mtime = mtime;
+        rec->hash = hash;
+        if (!rec->path) m->count--;
+    }
+    
+    fclose(f);
+    
+    /* Written sorted, but do not rely on hand-edited files */
+    qsort(m->records, m->count, sizeof(ManifestRecord), record_compare);
+    return 0;
+}
+
+int manifest_save(const Manifest *m, const char *path) {
+    char tmp[BACKUP_MAX_PATH + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    
+    fprintf(f, "; tedit backup manifest\n");
+    fprintf(f, "base=%s\n", m->base);
+    fprintf(f, "parent=%s\n", m->parent);
+    fprintf(f, "sequence=%d\n\n[files]\n", m->sequence);
+    
+    for (size_t i = 0; i < m->count; i++) {
+        const ManifestRecord *rec = &m->records[i];
+        fprintf(f, "%016llx %llu %lld %s\n", (unsigned long long)rec->hash,
+                (unsigned long long)rec->size, (long long)rec->mtime, rec->path);
+    }
+    
+    if (fclose(f) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    
+    /* Replace atomically so an interrupted save keeps the old manifest */
+    remove(path);
+    return rename(tmp, path) == 0 ? 0 : -1;
+}
+
+const ManifestRecord *manifest_find(const Manifest *m, const char *path) {
+    size_t lo = 0, hi = m->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(m->records[mid].path, path);
+        if (cmp == 0) return &m->records[mid];
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+/* Shared state for the scan workers; each writes only its own slot */
+typedef struct ManifestScan {
+    const Manifest *old;
+    Archive *ar;
+    ManifestRecord *records;        /* One per entry */
+    unsigned char *changes;
+    unsigned char *hashed;
+} ManifestScan;
+
+static void manifest_scan_worker(size_t index, void *ctx) {
+    ManifestScan *scan = ctx;
+    ArchiveEntry *entry = &scan->ar->entries[index];
+    ManifestRecord *rec = &scan->records[index];
+    
+    if (entry->has_stat) {
+        /* Captured by the directory walk */
+        rec->size = entry->size;
+        rec->mtime = entry->mtime;
+    } else {
+        struct stat st;
+        if (stat(entry->source, &st) != 0) {
+            scan->changes[index] = MANIFEST_UNREADABLE;
+            return;
+        }
+        rec->size = (uint64_t)st.st_size;
+        rec->mtime = (int64_t)st.st_mtime;
+    }
+    
+    const ManifestRecord *prev = manifest_find(scan->old, entry->path);
+    if (prev && prev->size == rec->size && prev->mtime == rec->mtime) {
+        /* Metadata match: trust it without reading the file */
+        rec->hash = prev->hash;
+        entry->hash = rec->hash;
+        entry->has_hash = 1;
+        scan->changes[index] = MANIFEST_UNCHANGED;
+        return;
+    }
+    
+    if (hash_file(entry->source, &rec->hash) != 0) {
+        scan->changes[index] = MANIFEST_UNREADABLE;
+        return;
+    }
+    scan->hashed[index] = 1;
+    
+    /* Recorded in the archive index, so large files need not be re-read */
+    entry->hash = rec->hash;
+    entry->has_hash = 1;
+    
+    if (!prev) {
+        scan->changes[index] = MANIFEST_ADDED;
+    } else if (prev->hash != rec->hash || prev->size != rec->size) {
+        scan->changes[index] = MANIFEST_MODIFIED;
+    } else {
+        /* Touched but identical */
+        scan->changes[index] = MANIFEST_UNCHANGED;
+    }
+}
+
+int manifest_scan(const Manifest *old, Archive *ar, int threads,
+                  Manifest *out, unsigned char *changes,
+                  const char ***deleted, BackupDiffStats *diff) {
+    BackupDiffStats d;
+    memset(&d, 0, sizeof(d));
+    double start = time_now();
+    
+    manifest_init(out);
+    *deleted = NULL;
+    
+    size_t n = ar->entry_count;
+    ManifestScan scan;
+    scan.old = old;
+    scan.ar = ar;
+    scan.records = calloc(n ? n : 1, sizeof(ManifestRecord));
+    scan.changes = changes;
+    scan.hashed = calloc(n ? n : 1, 1);
+    if (!scan.records || !scan.hashed) {
+        free(scan.records);
+        free(scan.hashed);
+        return -1;
+    }
+    
+    parallel_for(n, threads, manifest_scan_worker, &scan);
+    
+    /* Collect the new manifest (entries are unique paths) */
+    out->records = scan.records;
+    out->capacity = n ? n : 1;
+    for (size_t i = 0; i < n; i++) {
+        if (scan.hashed[i]) d.hashed++;
+        switch (changes[i]) {
+            case MANIFEST_UNCHANGED: d.unchanged++; break;
+            case MANIFEST_ADDED:     d.added++; break;
+            case MANIFEST_MODIFIED:  d.modified++; break;
+            default: d.unreadable++; break;
+        }
+        ManifestRecord rec = scan.records[i];
+        if (changes[i] == MANIFEST_UNREADABLE) {
+            /* Keep the last known state so the file is not seen as deleted */
+            const ManifestRecord *prev = manifest_find(old, ar->entries[i].path);
+            if (!prev) continue;
+            rec = *prev;
+        }
+        rec.path = str_dup(ar->entries[i].path);
+        if (!rec.path) continue;
+        out->records[out->count++] = rec;
+    }
+    free(scan.hashed);
+    qsort(out->records, out->count, sizeof(ManifestRecord), record_compare);
+    d.files = n;
+    
+    /* Old paths missing from the new manifest were deleted */
+    const char **gone = malloc((old->count ? old->count : 1) * sizeof(char *));
+    if (gone) {
+        for (size_t i = 0; i < old->count; i++) {
+            if (!manifest_find(out, old->records[i].path)) {
+                gone[d.deleted++] = old->records[i].path;
+            }
+        }
+    }
+    *deleted = gone;
+    
+    d.seconds = time_now() - start;
+    if (diff) *diff = d;
+    return 0;
+}
+
+void manifest_get_path(const char *ini_path, const char *project_name,
+                       char *out, size_t out_size) {
+    char dir[BACKUP_MAX_PATH];
+    char name[BACKUP_MAX_PATH];
+    path_dirname(ini_path, dir, sizeof(dir));
+    snprintf(name, sizeof(name), ".%s.manifest", project_name);
+    path_join(out, out_size, dir[0] ? dir : ".", name);
+}
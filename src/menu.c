@@ -4,23 +4,167 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 
 #include "menu.h"
 #include "util.h"
 
+#define MENU_ARENA_BLOCK 4096
+#define MENU_MAX_DEPTH 16
+
+struct MenuArenaBlock {
+    MenuArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
 static int next_menu_id = 2000;
 
+static void *menu_alloc(MenuSet *set, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    MenuArenaBlock *b = set->arena;
+    if (!b || b->size - b->used < size) {
+        size_t n = size > MENU_ARENA_BLOCK ? size : MENU_ARENA_BLOCK;
+        b = malloc(sizeof(MenuArenaBlock) + n);
+        if (!b) return NULL;
+        b->used = 0;
+        b->size = n;
+        b->next = set->arena;
+        set->arena = b;
+    }
+    void *p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+static const char *menu_strdup(MenuSet *set, const char *s, size_t len) {
+    char *copy = menu_alloc(set, len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+static MenuItem *menu_add_item(Menu *menu) {
+    if (menu->item_count == menu->item_capacity) {
+        size_t cap = menu->item_capacity ? menu->item_capacity * 2 : 16;
+        MenuItem *items = realloc(menu->items, cap * sizeof(MenuItem));
+        if (!items) return NULL;
+        menu->items = items;
+        menu->item_capacity = cap;
+    }
+    MenuItem *item = &menu->items[menu->item_count++];
+    memset(item, 0, sizeof(*item));
+    item->label = "";
+    item->command = "";
+    item->accelerator = "";
+    return item;
+}
+
+static Menu *menu_add_menu(MenuSet *set, const char *name) {
+    if (set->menu_count == set->menu_capacity) {
+        size_t cap = set->menu_capacity ? set->menu_capacity * 2 : 8;
+        Menu *menus = realloc(set->menus, cap * sizeof(Menu));
+        if (!menus) return NULL;
+        set->menus = menus;
+        set->menu_capacity = cap;
+    }
+    Menu *menu = &set->menus[set->menu_count++];
+    memset(menu, 0, sizeof(*menu));
+    menu->name = name;
+    return menu;
+}
+
+static size_t accel_slot(int key, size_t capacity) {
+    return (size_t)((unsigned)key * 2654435761u) & (capacity - 1);
+}
+
+/* Fill the id and accelerator tables from menu and its submenus. Item
+ * arrays no longer move once loading is done. */
+static void menu_index(MenuSet *set, Menu *menu) {
+    for (size_t i = 0; i < menu->item_count; i++) {
+        MenuItem *item = &menu->items[i];
+        if (item->submenu) menu_index(set, item->submenu);
+        if (item->id) set->by_id[item->id - set->first_id] = item;
+        if (!item->accel_key) continue;
+        
+        size_t mask = set->accel_capacity - 1;
+        size_t s = accel_slot(item->accel_key, set->accel_capacity);
+        while (set->by_accel[s] && set->by_accel[s]->accel_key != item->accel_key) {
+            s = (s + 1) & mask;
+        }
+        if (!set->by_accel[s]) set->by_accel[s] = item;
+    }
+}
+
+/* One line of menuini.txt: a separator, Label[\tAccel],command, or a
+ * label alone, which opens a submenu */
+static MenuItem *menu_parse_item(MenuSet *set, Menu *menu, char *line) {
+    MenuItem *item = menu_add_item(menu);
+    if (!item) return NULL;
+    
+    if (strcmp(line, "-") == 0) {
+        item->is_separator = 1;
+        return item;
+    }
+    
+    char *comma = strchr(line, ',');
+    if (comma) *comma = '\0';
+    char *tab = strchr(line, '\t');
+    if (tab) {
+        *tab = '\0';
+        char *accel = str_trim(tab + 1);
+        item->accelerator = menu_strdup(set, accel, strlen(accel));
+        item->accel_key = menu_parse_accel(accel);
+    }
+    item->label = menu_strdup(set, line, strlen(line));
+    
+    if (comma) {
+        item->command = menu_strdup(set, comma + 1, strlen(comma + 1));
+        item->id = next_menu_id++;
+    } else {
+        item->submenu = menu_alloc(set, sizeof(Menu));
+        if (item->submenu) {
+            memset(item->submenu, 0, sizeof(Menu));
+            item->submenu->name = item->label;
+        }
+    }
+    if (!item->label || !item->command || !item->accelerator ||
+        (!comma && !item->submenu)) {
+        return NULL;
+    }
+    return item;
+}
+
 int menu_load_ini(MenuSet *set, const char *path) {
-    FILE *f = fopen(path, "r");
-    if (!f) return -1;
+    size_t size;
+    char *text = file_read_all(path, &size);
+    if (!text) return -1;
     
-    memset(set, 0, sizeof(*set));
+    menu_free(set);
+    set->first_id = next_menu_id;
     
-    char line[512];
-    Menu *current_menu = NULL;
+    /* Submenus open at each indent; a line goes in the innermost one
+     * whose header is indented less */
+    struct {
+        int indent;
+        Menu *menu;
+    } open[MENU_MAX_DEPTH];
+    int depth = 0;
+    Menu *section = NULL;
+    size_t accels = 0;
+    int result = 0;
     
-    while (fgets(line, sizeof(line), f)) {
-        str_trim(line);
+    char *next = text;
+    while (next && *next && result == 0) {
+        char *line = next;
+        next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        
+        int indent = 0;
+        while (*line == ' ' || *line == '\t') indent += *line++ == '\t' ? 4 : 1;
+        line = str_trim(line);
         
         /* Skip empty lines and comments */
         if (line[0] == '\0' || line[0] == ';') continue;
@@ -28,62 +172,139 @@ int menu_load_ini(MenuSet *set, const char *path) {
         /* Section header [MenuName] */
         if (line[0] == '[') {
             char *end = strchr(line, ']');
-            if (end && set->menu_count < MAX_MENUS) {
-                *end = '\0';
-                current_menu = &set->menus[set->menu_count++];
-                strncpy(current_menu->name, line + 1, sizeof(current_menu->name) - 1);
+            if (end) {
+                const char *name = menu_strdup(set, line + 1, (size_t)(end - line - 1));
+                section = name ? menu_add_menu(set, name) : NULL;
+                if (!section) result = -1;
+                depth = 0;
             }
             continue;
         }
         
-        if (!current_menu) continue;
-        if (current_menu->item_count >= MAX_MENU_ITEMS) continue;
+        if (!section) continue;
+        while (depth > 0 && open[depth - 1].indent >= indent) depth--;
+        Menu *menu = depth > 0 ? open[depth - 1].menu : section;
         
-        /* Separator */
-        if (strcmp(line, "-") == 0) {
-            MenuItem *item = &current_menu->items[current_menu->item_count++];
-            item->is_separator = 1;
-            item->id = 0;
-            continue;
+        MenuItem *item = menu_parse_item(set, menu, line);
+        if (!item) {
+            result = -1;
+            break;
         }
-        
-        /* Menu item: Label,Command */
-        char *comma = strchr(line, ',');
-        if (comma) {
-            *comma = '\0';
-            MenuItem *item = &current_menu->items[current_menu->item_count++];
-            strncpy(item->label, line, sizeof(item->label) - 1);
-            strncpy(item->command, comma + 1, sizeof(item->command) - 1);
-            item->is_separator = 0;
-            item->id = next_menu_id++;
-            
-            /* Extract accelerator from label */
-            char *tab = strchr(item->label, '\t');
-            if (tab) {
-                strncpy(item->accelerator, tab + 1, sizeof(item->accelerator) - 1);
+        if (item->accel_key) accels++;
+        if (item->submenu) {
+            /* Its items would land in the parent menu: reject the file */
+            if (depth == MENU_MAX_DEPTH) {
+                result = -1;
+                break;
             }
+            open[depth].indent = indent;
+            open[depth].menu = item->submenu;
+            depth++;
         }
     }
+    free(text);
+    
+    /* Ids handed out by this load are consecutive */
+    set->id_count = (size_t)(next_menu_id - set->first_id);
+    set->accel_capacity = 16;
+    while (set->accel_capacity < accels * 2) set->accel_capacity *= 2;
+    set->by_id = calloc(set->id_count ? set->id_count : 1, sizeof(MenuItem *));
+    set->by_accel = calloc(set->accel_capacity, sizeof(MenuItem *));
+    if (result != 0 || !set->by_id || !set->by_accel) {
+        menu_free(set);
+        return -1;
+    }
     
-    fclose(f);
+    for (size_t m = 0; m < set->menu_count; m++) menu_index(set, &set->menus[m]);
     return 0;
 }
 
+static void menu_free_items(Menu *menu) {
+    for (size_t i = 0; i < menu->item_count; i++) {
+        if (menu->items[i].submenu) menu_free_items(menu->items[i].submenu);
+    }
+    free(menu->items);
+}
+
 void menu_free(MenuSet *set) {
+    for (size_t m = 0; m < set->menu_count; m++) menu_free_items(&set->menus[m]);
+    free(set->menus);
+    free(set->by_id);
+    free(set->by_accel);
+    
+    MenuArenaBlock *b = set->arena;
+    while (b) {
+        MenuArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    
     memset(set, 0, sizeof(*set));
 }
 
 const MenuItem *menu_find_by_id(MenuSet *set, int id) {
-    for (size_t m = 0; m < set->menu_count; m++) {
-        for (size_t i = 0; i < set->menus[m].item_count; i++) {
-            if (set->menus[m].items[i].id == id) {
-                return &set->menus[m].items[i];
-            }
-        }
+    if (id < set->first_id || (size_t)(id - set->first_id) >= set->id_count) return NULL;
+    return set->by_id[id - set->first_id];
+}
+
+const MenuItem *menu_find_by_accel(MenuSet *set, int key) {
+    if (!key || !set->by_accel) return NULL;
+    
+    size_t mask = set->accel_capacity - 1;
+    for (size_t s = accel_slot(key, set->accel_capacity); set->by_accel[s]; s = (s + 1) & mask) {
+        if (set->by_accel[s]->accel_key == key) return set->by_accel[s];
     }
     return NULL;
 }
 
+/* Case-insensitive match of the n characters at s against word */
+static int accel_word(const char *s, size_t n, const char *word) {
+    if (strlen(word) != n) return 0;
+    for (size_t i = 0; i < n; i++) {
+        if (tolower((unsigned char)s[i]) != word[i]) return 0;
+    }
+    return 1;
+}
+
+int menu_parse_accel(const char *text) {
+    static const struct {
+        const char *name;
+        int key;
+    } keys[] = {
+        {"tab", '\t'}, {"enter", '\r'}, {"return", '\r'}, {"esc", 27}, {"escape", 27},
+        {"space", ' '}, {"backspace", '\b'}, {"del", 127}, {"delete", 127},
+        {"ins", MENU_KEY_INSERT}, {"insert", MENU_KEY_INSERT}, {"home", MENU_KEY_HOME},
+        {"end", MENU_KEY_END}, {"pgup", MENU_KEY_PAGEUP}, {"pageup", MENU_KEY_PAGEUP},
+        {"pgdn", MENU_KEY_PAGEDOWN}, {"pagedown", MENU_KEY_PAGEDOWN}, {"up", MENU_KEY_UP},
+        {"down", MENU_KEY_DOWN}, {"left", MENU_KEY_LEFT}, {"right", MENU_KEY_RIGHT},
+    };
+    
+    int mods = 0;
+    const char *s = text;
+    for (;;) {
+        /* "Ctrl++" is Ctrl with the + key */
+        const char *plus = strchr(s, '+');
+        if (!plus || plus == s || plus[1] == '\0') break;
+        size_t n = (size_t)(plus - s);
+        if (accel_word(s, n, "ctrl") || accel_word(s, n, "control")) mods |= MENU_MOD_CTRL;
+        else if (accel_word(s, n, "shift")) mods |= MENU_MOD_SHIFT;
+        else if (accel_word(s, n, "alt")) mods |= MENU_MOD_ALT;
+        else return 0;
+        s = plus + 1;
+    }
+    
+    size_t n = strlen(s);
+    if (n == 1) return mods | toupper((unsigned char)s[0]);
+    if (n <= 3 && (s[0] == 'F' || s[0] == 'f') && isdigit((unsigned char)s[1])) {
+        int f = atoi(s + 1);
+        return f >= 1 && f <= 24 ? mods | (MENU_KEY_F1 + f - 1) : 0;
+    }
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (accel_word(s, n, keys[i].name)) return mods | keys[i].key;
+    }
+    return 0;
+}
+
 void menu_substitute_vars(char *out, size_t max, const char *cmd,
                           const char *filepath, const char *exe_dir) {
     char base[260] = {0};
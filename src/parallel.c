@@ -0,0 +1,98 @@
+/*
+ * parallel.c - Minimal worker pool helpers
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parallel.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+int parallel_cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+#ifdef _WIN32
+
+/* No pool on native Windows builds; Cosmopolitan uses the pthread path */
+int parallel_for(size_t count, int threads, ParallelFn fn, void *ctx) {
+    (void)threads;
+    for (size_t i = 0; i < count; i++) fn(i, ctx);
+    return 0;
+}
+
+#else
+
+typedef struct ParallelJob {
+    pthread_mutex_t lock;
+    size_t next;
+    size_t count;
+    ParallelFn fn;
+    void *ctx;
+} ParallelJob;
+
+static void *parallel_worker(void *arg) {
+    ParallelJob *job = arg;
+    
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        
+        if (i >= job->count) break;
+        job->fn(i, job->ctx);
+    }
+    return NULL;
+}
+
+int parallel_for(size_t count, int threads, ParallelFn fn, void *ctx) {
+    if (!fn) return -1;
+    if (count == 0) return 0;
+    
+    if (threads <= 0) threads = parallel_cpu_count();
+    if ((size_t)threads > count) threads = (int)count;
+    
+    ParallelJob job;
+    pthread_mutex_init(&job.lock, NULL);
+    job.next = 0;
+    job.count = count;
+    job.fn = fn;
+    job.ctx = ctx;
+    
+    /* The calling thread is one of the workers */
+    pthread_t *tids = NULL;
+    int spawned = 0;
+    if (threads > 1) {
+        tids = calloc((size_t)threads - 1, sizeof(pthread_t));
+        if (tids) {
+            for (int t = 0; t < threads - 1; t++) {
+                if (pthread_create(&tids[t], NULL, parallel_worker, &job) != 0) break;
+                spawned++;
+            }
+        }
+    }
+    
+    parallel_worker(&job);
+    
+    for (int t = 0; t < spawned; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+    pthread_mutex_destroy(&job.lock);
+    return 0;
+}
+
+#endif
@@ -13,11 +13,15 @@
 
 #include "platform.h"
 #include "app.h"
+#include "autobackup.h"
 #include "editor.h"
 #include "build.h"
+#include "buildall.h"
+#include "diag.h"
 #include "menu.h"
 #include "util.h"
 #include "syntax.h"
+#include "symindex.h"
 
 /* cimgui headers */
 #define CIMGUI_DEFINE_ENUMS_AND_STRUCTS
@@ -30,10 +34,35 @@
 static AppState *g_app = NULL;
 static GLFWwindow *g_window = NULL;
 static char g_text_buffer[1024 * 1024]; /* 1MB text buffer for editor */
+static int g_text_changed = 0;          /* Edited since the last sync */
 static int g_show_about = 0;
 static int g_show_find = 0;
 static char g_find_text[256] = {0};
 static char g_replace_text[256] = {0};
+static int g_show_goto_def = 0;
+static int g_show_output = 0;
+static int g_run_after_build = 0;   /* Build && Run: run once the build succeeds */
+static int g_output_follow = 0;     /* Jump to the end of the output pane */
+
+/* Build All in progress (polled like a single build) */
+static BuildBatch g_batch;
+static int g_batch_active = 0;
+
+/* Cache entry to record if the running build succeeds */
+static int g_build_cacheable = 0;
+static uint64_t g_build_key = 0;
+static char g_build_out[260] = {0};
+static char g_def_name[128] = {0};
+
+/* Results of the last definition lookup (copied out of the index) */
+typedef struct DefResult {
+    char file[260];
+    unsigned line;
+    SymbolKind kind;
+} DefResult;
+
+static DefResult g_def_results[32];
+static size_t g_def_count = 0;
 
 /* Colors for syntax highlighting */
 static ImU32 color_default;
@@ -43,6 +72,10 @@ static ImU32 color_directive;
 static ImU32 color_number;
 static ImU32 color_string;
 static ImU32 color_comment;
+static ImU32 color_stderr;
+static ImU32 color_error;
+static ImU32 color_warning;
+static ImU32 color_selection;
 
 static void setup_colors(void) {
     color_default   = IM_COL32(220, 220, 220, 255);
@@ -52,10 +85,15 @@ static void setup_colors(void) {
     color_number    = IM_COL32(181, 206, 168, 255);  /* Light green */
     color_string    = IM_COL32(206, 145, 120, 255);  /* Orange */
     color_comment   = IM_COL32(106, 153, 85, 255);   /* Green */
+    color_stderr    = IM_COL32(240, 120, 110, 255);  /* Red */
+    color_error     = IM_COL32(240, 70, 60, 255);    /* Bright red */
+    color_warning   = IM_COL32(230, 190, 80, 255);   /* Yellow */
+    color_selection = IM_COL32(38, 79, 120, 255);    /* Dark blue */
 }
 
 static void sync_buffer_to_imgui(void) {
     EditorState *ed = app_get_active_editor(g_app);
+    g_text_changed = 0;
     if (!ed) {
         g_text_buffer[0] = '\0';
         return;
@@ -72,12 +110,50 @@ static void sync_imgui_to_buffer(void) {
     EditorState *ed = app_get_active_editor(g_app);
     if (!ed) return;
     
+    /* The folded view edits the editor buffer directly */
+    if (ed->folds->fold_count > 0) return;
+    
     editor_set_text(ed, g_text_buffer, strlen(g_text_buffer));
+    g_text_changed = 0;
+}
+
+/* Output pane line sink; diagnostics are picked out as lines arrive */
+static void collect_output(void *ctx, const char *line, size_t len, int is_stderr) {
+    BuildOutput *out = ctx;
+    size_t index = out->line_count;
+    if (build_output_append(out, line, len, is_stderr) == 0) {
+        diag_parse_line(&g_app->diags, line, len, index);
+    }
 }
 
-static void do_build(void) {
+static int build_busy(void) {
+    return g_app->build_proc.running || g_batch_active;
+}
+
+/* Start cmd in the background; its output goes to the output pane */
+static int start_command(const char *cmd) {
+    BuildOutput *out = &g_app->build_output;
+    if (build_busy()) return -1;
+    diag_clear(&g_app->diags);
+    
+    char line[1100];
+    int len = snprintf(line, sizeof(line), "$ %s", cmd);
+    build_output_clear(out);
+    build_output_append(out, line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1, 0);
+    g_show_output = 1;
+    g_output_follow = 1;
+    
+    if (build_process_start(&g_app->build_proc, cmd, collect_output, out) != 0) {
+        build_output_append(out, "[Failed to start]", 17, 1);
+        return -1;
+    }
+    return 0;
+}
+
+/* Returns 1 if a build was started, 0 if the output is up to date */
+static int do_build(int force) {
     EditorState *ed = app_get_active_editor(g_app);
-    if (!ed || !ed->file_path[0]) return;
+    if (!ed || !ed->file_path[0] || build_busy()) return -1;
     
     sync_imgui_to_buffer();
     app_save_file(g_app, ed->file_path);
@@ -85,20 +161,114 @@ static void do_build(void) {
     char cmd[1024];
     menu_substitute_vars(cmd, sizeof(cmd), g_app->build.build_cmd,
                          ed->file_path, g_app->exe_dir);
-    build_run_command(cmd);
+    
+    g_build_cacheable = app_build_target(g_app, ed->file_path, g_build_out,
+                                         sizeof(g_build_out)) == 0 &&
+                        build_cache_key(cmd, ed->file_path, &g_build_key) == 0;
+    if (g_build_cacheable && !force && build_cache_lookup(&g_app->build_cache, g_build_key, g_build_out)) {
+        char line[320];
+        int len = snprintf(line, sizeof(line), "[Cache hit: %s is up to date]", g_build_out);
+        build_output_clear(&g_app->build_output);
+        diag_clear(&g_app->diags);
+        build_output_append(&g_app->build_output, line,
+                            (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1, 0);
+        g_build_cacheable = 0;
+        return 0;
+    }
+    
+    if (start_command(cmd) != 0) {
+        g_build_cacheable = 0;
+        return -1;
+    }
+    return 1;
 }
 
 static void do_run(void) {
     EditorState *ed = app_get_active_editor(g_app);
-    if (!ed || !ed->file_path[0]) return;
+    if (!ed || !ed->file_path[0] || build_busy()) return;
     
     char cmd[1024];
     menu_substitute_vars(cmd, sizeof(cmd), g_app->build.run_cmd,
                          ed->file_path, g_app->exe_dir);
-    build_run_command(cmd);
+    start_command(cmd);
+}
+
+/* Build every open editor that has a file, in parallel */
+static void do_build_all(void) {
+    if (build_busy()) return;
+    
+    sync_imgui_to_buffer();
+    build_batch_init(&g_batch, 0, &g_app->build_cache, collect_output, &g_app->build_output);
+    for (size_t i = 0; i < g_app->editor_count; i++) {
+        EditorState *ed = g_app->editors[i];
+        if (!ed->file_path[0]) continue;
+        if (ed->dirty) editor_save_file(ed, NULL);
+        build_batch_add(&g_batch, &g_app->build, ed->file_path, g_app->exe_dir);
+    }
+    
+    build_output_clear(&g_app->build_output);
+    diag_clear(&g_app->diags);
+    g_show_output = 1;
+    g_output_follow = 1;
+    
+    char line[96];
+    int len = snprintf(line, sizeof(line), "Building %zu files on %d workers",
+                       g_batch.count, g_batch.workers);
+    build_output_append(&g_app->build_output, line, (size_t)len, 0);
+    g_batch_active = 1;
+}
+
+static void poll_build_all(void) {
+    if (!g_batch_active || build_batch_poll(&g_batch, 0)) return;
+    
+    build_output_append(&g_app->build_output, "", 0, 0);
+    build_batch_summary(&g_batch, collect_output, &g_app->build_output);
+    build_batch_free(&g_batch);
+    g_batch_active = 0;
+}
+
+static void cancel_build(void) {
+    build_process_cancel(&g_app->build_proc);
+    if (g_batch_active) build_batch_cancel(&g_batch);
+}
+
+static void goto_diagnostic(const Diagnostic *d) {
+    if (!d) return;
+    sync_imgui_to_buffer();
+    app_goto_location(g_app, diag_file(&g_app->diags, d), d->line, d->col);
+    sync_buffer_to_imgui();
+}
+
+/* Called once per frame: collect output without blocking the render loop */
+static void poll_build(void) {
+    BuildProcess *proc = &g_app->build_proc;
+    if (!proc->running || build_process_poll(proc, 0)) return;
+    
+    char line[128];
+    int len = snprintf(line, sizeof(line), "[%s: exit code %d, %.2fs, %zu errors, %zu warnings]",
+                       proc->cancelled ? "Cancelled" : "Finished",
+                       proc->exit_code, build_process_elapsed(proc),
+                       g_app->diags.errors, g_app->diags.warnings);
+    build_output_append(&g_app->build_output, line, (size_t)len, 0);
+    
+    if (g_build_cacheable) {
+        g_build_cacheable = 0;
+        if (proc->exit_code == 0 && !proc->cancelled) {
+            build_cache_store(&g_app->build_cache, g_build_key, g_build_out);
+        }
+    }
+    
+    if (g_run_after_build) {
+        g_run_after_build = 0;
+        if (proc->exit_code == 0 && !proc->cancelled) do_run();
+    }
 }
 
 static void render_menu_bar(void) {
+    if (igIsKeyPressed_Bool(ImGuiKey_F12, false)) {
+        g_show_goto_def = 1;
+    }
+    
     if (igBeginMainMenuBar()) {
         /* File Menu */
         if (igBeginMenu("File", true)) {
@@ -161,20 +331,44 @@ static void render_menu_bar(void) {
             if (igMenuItem_Bool("Find...", "Ctrl+F", false, true)) {
                 g_show_find = 1;
             }
+            if (igMenuItem_Bool("Go to Definition...", "F12", false, true)) {
+                g_show_goto_def = 1;
+            }
             igEndMenu();
         }
         
         /* Build Menu - like tEditor's Project/Assemble */
         if (igBeginMenu("Build", true)) {
             if (igMenuItem_Bool("Build", "F7", false, true)) {
-                do_build();
+                do_build(0);
+            }
+            if (igMenuItem_Bool("Rebuild", NULL, false, true)) {
+                do_build(1);
             }
             if (igMenuItem_Bool("Run", "F5", false, true)) {
                 do_run();
             }
             if (igMenuItem_Bool("Build && Run", "Ctrl+F5", false, true)) {
-                do_build();
-                do_run();
+                int started = do_build(0);
+                if (started == 0) do_run();
+                g_run_after_build = started == 1;
+            }
+            if (igMenuItem_Bool("Build All", "Ctrl+Shift+B", false, !build_busy())) {
+                do_build_all();
+            }
+            if (igMenuItem_Bool("Cancel Build", NULL, false, build_busy())) {
+                cancel_build();
+            }
+            int have_diags = g_app->diags.errors + g_app->diags.warnings > 0;
+            if (igMenuItem_Bool("Next Error", "F4", false, have_diags)) {
+                goto_diagnostic(diag_step(&g_app->diags, 1));
+            }
+            if (igMenuItem_Bool("Previous Error", "Shift+F4", false, have_diags)) {
+                goto_diagnostic(diag_step(&g_app->diags, -1));
+            }
+            igSeparator();
+            if (igMenuItem_Bool("Output", NULL, g_show_output, true)) {
+                g_show_output = !g_show_output;
             }
             igEndMenu();
         }
@@ -211,6 +405,332 @@ static float get_gutter_width(int line_count) {
 /* Track scroll position for syncing */
 static float g_editor_scroll_y = 0.0f;
 
+/* Width of the fold marker column at the left of the gutter */
+#define FOLD_MARKER_WIDTH 12.0f
+
+static ImU32 token_color(TokenType type) {
+    switch (type) {
+        case TOK_KEYWORD:   return color_keyword;
+        case TOK_REGISTER:  return color_register;
+        case TOK_DIRECTIVE: return color_directive;
+        case TOK_NUMBER:    return color_number;
+        case TOK_STRING:    return color_string;
+        case TOK_COMMENT:   return color_comment;
+        default:            return color_default;
+    }
+}
+
+/* Visual column after advancing over text (tabs stop every 4 columns) */
+static size_t advance_columns(size_t col, const char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        col = text[i] == '\t' ? (col / 4 + 1) * 4 : col + 1;
+    }
+    return col;
+}
+
+/* Draw one syntax-highlighted line at pos */
+static void draw_line(ImDrawList *draw_list, ImVec2 pos, float char_width,
+                      Language lang, const char *line, size_t len) {
+    SyntaxToken tokens[256];
+    int count = syntax_tokenize_line(lang, line, len, tokens, 256);
+    
+    size_t col = 0, done = 0;
+    for (int t = 0; t < count; t++) {
+        col = advance_columns(col, line + done, tokens[t].start - done);
+        ImVec2 text_pos = {pos.x + col * char_width, pos.y};
+        const char *tok = line + tokens[t].start;
+        ImDrawList_AddText_Vec2(draw_list, text_pos, token_color(tokens[t].type),
+                                tok, tok + tokens[t].length);
+        col = advance_columns(col, tok, tokens[t].length);
+        done = tokens[t].start + tokens[t].length;
+    }
+}
+
+/* Selection background of a buffer line (0-based) drawn as text at pos;
+ * a selected line break shows as one extra column */
+static void draw_selection(ImDrawList *draw_list, EditorState *ed, size_t line, ImVec2 pos,
+                           float line_height, float char_width, const char *text, size_t len) {
+    size_t start = blocks_line_start(ed->blocks, line);
+    if (ed->selection_end <= start || ed->selection_start > start + len) return;
+    
+    size_t from = ed->selection_start > start ? ed->selection_start - start : 0;
+    size_t to = ed->selection_end - start < len ? ed->selection_end - start : len;
+    float x0 = pos.x + advance_columns(0, text, from) * char_width;
+    float x1 = pos.x + advance_columns(0, text, to) * char_width;
+    if (ed->selection_end > start + len) x1 += char_width;
+    ImDrawList_AddRectFilled(draw_list, (ImVec2){x0, pos.y}, (ImVec2){x1, pos.y + line_height},
+                             color_selection, 0.0f, 0);
+}
+
+/* Fold or unfold the region at a buffer line (0-based) from the gutter */
+static void toggle_fold(EditorState *ed, size_t line) {
+    if (fold_get(ed->folds, line)) {
+        fold_remove(ed->folds, line);
+        return;
+    }
+    
+    /* Folding switches to the folded view, which renders and edits the
+     * editor buffer, so pick up any pending edits first */
+    if (ed->folds->fold_count == 0) {
+        int dirty = ed->dirty;
+        sync_imgui_to_buffer();
+        ed->dirty = dirty;
+    }
+    editor_fold(ed, line + 1);
+}
+
+/* Copy a buffer line (0-based, truncated to max) into out */
+static size_t get_line_text(EditorState *ed, size_t line, char *out, size_t max) {
+    size_t start = blocks_line_start(ed->blocks, line);
+    size_t end = line + 1 < blocks_line_count(ed->blocks)
+               ? blocks_line_start(ed->blocks, line + 1) - 1
+               : editor_get_length(ed);
+    size_t len = end - start < max ? end - start : max;
+    return buffer_copy_range(ed->buffer, start, len, out);
+}
+
+/* Byte in a line nearest to visual column col */
+static size_t column_to_byte(const char *text, size_t len, float col) {
+    size_t c = 0;
+    for (size_t i = 0; i < len; i++) {
+        size_t next = advance_columns(c, text + i, 1);
+        if (col < (c + next) * 0.5f) return i;
+        c = next;
+    }
+    return len;
+}
+
+static size_t utf8_encode(unsigned c, char *out) {
+    if (c < 0x80) {
+        out[0] = (char)c;
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = (char)(0xC0 | (c >> 6));
+        out[1] = (char)(0x80 | (c & 0x3F));
+        return 2;
+    }
+    if (c < 0x10000) {
+        out[0] = (char)(0xE0 | (c >> 12));
+        out[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (c & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (c >> 18));
+    out[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (c & 0x3F));
+    return 4;
+}
+
+/* Offset one character before or after pos */
+static size_t step_char(EditorState *ed, size_t pos, int dir) {
+    size_t len = editor_get_length(ed);
+    if (dir < 0) {
+        if (pos == 0) return 0;
+        pos--;
+        while (pos > 0 && (buffer_char_at(ed->buffer, pos) & 0xC0) == 0x80) pos--;
+    } else if (pos < len) {
+        pos++;
+        while (pos < len && (buffer_char_at(ed->buffer, pos) & 0xC0) == 0x80) pos++;
+    }
+    return pos;
+}
+
+/* Move the cursor to visible row, keeping the column where the line
+ * allows */
+static void goto_row(EditorState *ed, size_t row) {
+    size_t rows = fold_visible_count(ed->folds);
+    if (row >= rows) row = rows - 1;
+    editor_goto(ed, fold_visible_to_line(ed->folds, row) + 1, ed->cursor_col);
+}
+
+/* Selection anchor of the folded view (byte offset); the selection runs
+ * from it to the cursor */
+static size_t g_fold_anchor = 0;
+static int g_fold_dragging = 0;
+
+static int has_selection(EditorState *ed) {
+    return ed->selection_start < ed->selection_end;
+}
+
+static void clear_selection(EditorState *ed) {
+    ed->selection_start = 0;
+    ed->selection_end = 0;
+}
+
+/* After the cursor moved from offset from: with extend, select from the
+ * anchor to the cursor, otherwise drop the selection */
+static void update_selection(EditorState *ed, size_t from, int extend) {
+    size_t pos = editor_offset(ed, ed->cursor_line, ed->cursor_col);
+    if (!extend) {
+        clear_selection(ed);
+        g_fold_anchor = pos;
+        return;
+    }
+    if (!has_selection(ed)) g_fold_anchor = from;
+    ed->selection_start = g_fold_anchor < pos ? g_fold_anchor : pos;
+    ed->selection_end = g_fold_anchor < pos ? pos : g_fold_anchor;
+}
+
+/* Replace the selection, or insert at pos, as one undo step and put the
+ * cursor after the text */
+static void replace_selection(EditorState *ed, size_t pos, const char *text, size_t len) {
+    editor_begin_batch(ed);
+    if (has_selection(ed)) {
+        pos = ed->selection_start;
+        editor_delete(ed, pos, ed->selection_end - pos);
+    }
+    if (len > 0) editor_insert(ed, pos, text, len);
+    editor_end_batch(ed);
+    editor_goto_offset(ed, pos + len);
+    update_selection(ed, pos + len, 0);
+}
+
+/* Move the cursor to the mouse position */
+static void mouse_goto(EditorState *ed, ImVec2 origin, float line_height, float char_width) {
+    ImVec2 mouse;
+    igGetMousePos(&mouse);
+    float y = (mouse.y - origin.y) / line_height;
+    goto_row(ed, y > 0 ? (size_t)y : 0);
+    
+    char text[1024];
+    size_t line = ed->cursor_line - 1;
+    size_t len = get_line_text(ed, line, text, sizeof(text));
+    editor_goto(ed, line + 1, column_to_byte(text, len, (mouse.x - origin.x) / char_width) + 1);
+}
+
+/* Ctrl shortcuts of the folded view: select all, clipboard, undo */
+static void folded_view_shortcuts(EditorState *ed, size_t pos, int shift) {
+    if (igIsKeyPressed_Bool(ImGuiKey_A, false)) {
+        editor_select_all(ed);
+        g_fold_anchor = 0;
+        editor_goto_offset(ed, ed->selection_end);
+        return;
+    }
+    
+    int cut = igIsKeyPressed_Bool(ImGuiKey_X, false);
+    if (cut || igIsKeyPressed_Bool(ImGuiKey_C, false)) {
+        size_t len;
+        char *text = editor_get_selection(ed, &len);
+        if (!text) return;
+        platform_clipboard_set(text);
+        free(text);
+        if (cut && !ed->readonly) replace_selection(ed, pos, "", 0);
+        return;
+    }
+    if (ed->readonly) return;
+    
+    if (igIsKeyPressed_Bool(ImGuiKey_V, false)) {
+        char *text = platform_clipboard_get();
+        if (!text) return;
+        replace_selection(ed, pos, text, strlen(text));
+        free(text);
+        return;
+    }
+    
+    int redo = igIsKeyPressed_Bool(ImGuiKey_Y, true) ||
+               (shift && igIsKeyPressed_Bool(ImGuiKey_Z, true));
+    int undo = !shift && igIsKeyPressed_Bool(ImGuiKey_Z, true);
+    if (undo || redo) {
+        if (undo) editor_undo(ed);
+        else editor_redo(ed);
+        
+        /* The cursor may now be past the end of its line */
+        editor_goto(ed, ed->cursor_line, ed->cursor_col);
+        update_selection(ed, pos, 0);
+    }
+}
+
+/* Mouse and keyboard input for the folded view. Edits go through the
+ * editor, so folds around them stay and folds they touch open up. */
+static void folded_view_input(EditorState *ed, ImVec2 origin, float line_height,
+                              float char_width) {
+    ImGuiIO *io = igGetIO();
+    size_t pos = editor_offset(ed, ed->cursor_line, ed->cursor_col);
+    
+    /* Click to place the cursor, Shift+click or drag to select */
+    if (igIsWindowHovered(0) && igIsMouseClicked_Bool(ImGuiMouseButton_Left, false)) {
+        mouse_goto(ed, origin, line_height, char_width);
+        update_selection(ed, pos, io->KeyShift);
+        g_fold_dragging = 1;
+    } else if (g_fold_dragging && igIsMouseDown_Nil(ImGuiMouseButton_Left)) {
+        if (igIsMouseDragging(ImGuiMouseButton_Left, -1.0f)) {
+            mouse_goto(ed, origin, line_height, char_width);
+            update_selection(ed, pos, 1);
+        }
+    } else {
+        g_fold_dragging = 0;
+    }
+    if (!igIsWindowFocused(0)) return;
+    
+    pos = editor_offset(ed, ed->cursor_line, ed->cursor_col);
+    if (io->KeyCtrl) {
+        folded_view_shortcuts(ed, pos, io->KeyShift);
+        return;
+    }
+    
+    size_t row = fold_line_to_visible(ed->folds, ed->cursor_line - 1);
+    int moved = 1;
+    if (igIsKeyPressed_Bool(ImGuiKey_UpArrow, true)) {
+        if (row > 0) goto_row(ed, row - 1);
+    } else if (igIsKeyPressed_Bool(ImGuiKey_DownArrow, true)) {
+        goto_row(ed, row + 1);
+    } else if (igIsKeyPressed_Bool(ImGuiKey_Home, true)) {
+        editor_goto(ed, ed->cursor_line, 1);
+    } else if (igIsKeyPressed_Bool(ImGuiKey_End, true)) {
+        editor_goto(ed, ed->cursor_line, (size_t)-1);
+    } else if (igIsKeyPressed_Bool(ImGuiKey_LeftArrow, true) ||
+               igIsKeyPressed_Bool(ImGuiKey_RightArrow, true)) {
+        size_t next = step_char(ed, pos, igIsKeyPressed_Bool(ImGuiKey_LeftArrow, true) ? -1 : 1);
+        
+        /* Stepping into a folded region skips over it */
+        size_t line = blocks_line_of(ed->blocks, next);
+        if (next != pos && fold_line_hidden(ed->folds, line)) {
+            row = fold_line_to_visible(ed->folds, line);
+            if (next > pos) row++;
+            goto_row(ed, row);
+            editor_goto(ed, ed->cursor_line, next > pos ? 1 : (size_t)-1);
+        } else {
+            editor_goto_offset(ed, next);
+        }
+    } else {
+        moved = 0;
+    }
+    if (moved) {
+        update_selection(ed, pos, io->KeyShift);
+        return;
+    }
+    if (ed->readonly) return;
+    
+    char text[64];
+    size_t len = 0;
+    for (int i = 0; i < io->InputQueueCharacters.Size && len + 4 <= sizeof(text); i++) {
+        unsigned c = io->InputQueueCharacters.Data[i];
+        if (c >= 0x20 && c != 0x7F) len += utf8_encode(c, text + len);
+    }
+    if (igIsKeyPressed_Bool(ImGuiKey_Enter, true) ||
+        igIsKeyPressed_Bool(ImGuiKey_KeypadEnter, true)) {
+        text[len++] = '\n';
+    }
+    if (igIsKeyPressed_Bool(ImGuiKey_Tab, true)) text[len++] = '\t';
+    
+    int backspace = igIsKeyPressed_Bool(ImGuiKey_Backspace, true);
+    int del = igIsKeyPressed_Bool(ImGuiKey_Delete, true);
+    if (len > 0 || (has_selection(ed) && (backspace || del))) {
+        replace_selection(ed, pos, text, len);
+    } else if (backspace && pos > 0) {
+        size_t prev = step_char(ed, pos, -1);
+        editor_delete(ed, prev, pos - prev);
+        editor_goto_offset(ed, prev);
+        update_selection(ed, prev, 0);
+    } else if (del) {
+        size_t next = step_char(ed, pos, 1);
+        if (next > pos) editor_delete(ed, pos, next - pos);
+        update_selection(ed, pos, 0);
+    }
+}
+
 static void render_editor(void) {
     ImGuiIO *io = igGetIO();
     
@@ -229,13 +749,40 @@ static void render_editor(void) {
                              ImGuiWindowFlags_NoScrollbar;
     
     if (igBegin("Editor", NULL, flags)) {
-        int line_count = count_lines(g_text_buffer);
-        float gutter_width = get_gutter_width(line_count);
+        EditorState *ed = app_get_active_editor(g_app);
+        int folded = ed && ed->folds->fold_count > 0;
+        
+        /* Leaving the folded view: the editor buffer has its edits */
+        static int was_folded = 0;
+        if (was_folded && !folded) sync_buffer_to_imgui();
+        was_folded = folded;
+        
+        /* Fold markers come from the editor's block index, so bring it up
+         * to date with the text widget's edits from the last frame */
+        if (!folded && ed && g_text_changed) {
+            size_t line = ed->cursor_line, col = ed->cursor_col;
+            sync_imgui_to_buffer();
+            editor_goto(ed, line, col);
+        }
+        
+        /* Rows are visible lines; without folds they are the lines of the
+         * ImGui text buffer */
+        size_t line_count = folded ? blocks_line_count(ed->blocks)
+                                   : (size_t)count_lines(g_text_buffer);
+        size_t row_count = folded ? fold_visible_count(ed->folds) : line_count;
+        
+        float gutter_width = get_gutter_width((int)line_count) + FOLD_MARKER_WIDTH;
         float line_height = igGetTextLineHeight();
         
         ImVec2 content_size;
         igGetContentRegionAvail(&content_size);
         
+        /* Only the rows inside the viewport are drawn */
+        size_t first_row = (size_t)(g_editor_scroll_y / line_height);
+        size_t last_row = first_row + (size_t)(content_size.y / line_height) + 2;
+        if (first_row > row_count) first_row = row_count;
+        if (last_row > row_count) last_row = row_count;
+        
         /* === LINE NUMBER GUTTER === */
         ImVec2 gutter_size = {gutter_width, content_size.y};
         
@@ -253,15 +800,19 @@ static void render_editor(void) {
             ImU32 line_num_color = IM_COL32(140, 140, 140, 255);  /* Gray */
             ImU32 gutter_bg = IM_COL32(30, 30, 30, 255);          /* Dark background */
             
-            /* Gutter background */
-            ImVec2 gutter_min = cursor_pos;
-            ImVec2 gutter_max = {cursor_pos.x + gutter_width - 5, cursor_pos.y + line_count * line_height};
+            /* Gutter background for the visible rows */
+            ImVec2 gutter_min = {cursor_pos.x, cursor_pos.y + first_row * line_height};
+            ImVec2 gutter_max = {cursor_pos.x + gutter_width - 5, cursor_pos.y + last_row * line_height};
             ImDrawList_AddRectFilled(draw_list, gutter_min, gutter_max, gutter_bg, 0.0f, 0);
             
-            /* Draw each line number */
-            for (int i = 1; i <= line_count; i++) {
-                char line_str[16];
-                snprintf(line_str, sizeof(line_str), "%d", i);
+            int diag_file_id = ed ? diag_find_file(&g_app->diags, ed->file_path) : -1;
+            
+            for (size_t row = first_row; row < last_row; row++) {
+                size_t line = folded ? fold_visible_to_line(ed->folds, row) : row;
+                float y = cursor_pos.y + row * line_height;
+                
+                char line_str[24];
+                snprintf(line_str, sizeof(line_str), "%zu", line + 1);
                 
                 /* Right-align line numbers */
                 ImVec2 text_size;
@@ -269,13 +820,47 @@ static void render_editor(void) {
                 
                 ImVec2 text_pos;
                 text_pos.x = cursor_pos.x + gutter_width - text_size.x - 10;
-                text_pos.y = cursor_pos.y + (i - 1) * line_height;
+                text_pos.y = y;
+                
+                /* Diagnostic marker: colored number and a bar, message on hover */
+                const Diagnostic *d = diag_at(&g_app->diags, diag_file_id, (unsigned)(line + 1));
+                ImU32 number_color = line_num_color;
+                if (d && d->severity != DIAG_NOTE) {
+                    number_color = d->severity == DIAG_ERROR ? color_error : color_warning;
+                    ImVec2 bar_min = {cursor_pos.x + gutter_width - 8, y + 1};
+                    ImVec2 bar_max = {cursor_pos.x + gutter_width - 5, y + line_height - 1};
+                    ImDrawList_AddRectFilled(draw_list, bar_min, bar_max, number_color, 0.0f, 0);
+                    ImVec2 hover_min = {cursor_pos.x, y};
+                    if (igIsMouseHoveringRect(hover_min, bar_max, true)) {
+                        igSetTooltip("%s: %s", diag_severity_name(d->severity), d->message);
+                    }
+                }
+                
+                ImDrawList_AddText_Vec2(draw_list, text_pos, number_color, line_str, NULL);
                 
-                ImDrawList_AddText_Vec2(draw_list, text_pos, line_num_color, line_str, NULL);
+                /* Fold marker: "+" on folded headers, "-" on foldable lines */
+                if (!ed) continue;
+                const char *marker = NULL;
+                if (fold_get(ed->folds, line)) {
+                    marker = "+";
+                } else if (fold_find_region(ed->blocks, ed->buffer, line, NULL) == 0) {
+                    marker = "-";
+                }
+                if (!marker) continue;
+                
+                ImDrawList_AddText_Vec2(draw_list, (ImVec2){cursor_pos.x + 2, y},
+                                        line_num_color, marker, NULL);
+                igSetCursorScreenPos((ImVec2){cursor_pos.x, y});
+                igPushID_Int((int)line);
+                if (igInvisibleButton("##fold", (ImVec2){FOLD_MARKER_WIDTH, line_height}, 0)) {
+                    toggle_fold(ed, line);
+                }
+                igPopID();
             }
             
-            /* Reserve space for all lines */
-            igDummy((ImVec2){gutter_width, line_count * line_height});
+            /* Reserve space for all rows */
+            igSetCursorScreenPos(cursor_pos);
+            igDummy((ImVec2){gutter_width, row_count * line_height});
         }
         igEndChild();
         
@@ -287,23 +872,79 @@ static void render_editor(void) {
         editor_size.x = content_size.x - gutter_width;
         editor_size.y = content_size.y;
         
-        ImGuiInputTextFlags input_flags = ImGuiInputTextFlags_AllowTabInput;
-        
-        /* Use a child window to capture scroll */
-        igBeginChild_Str("##editor_child", editor_size, false, 0);
-        {
-            ImVec2 input_size = {-1, -1};
-            
-            if (igInputTextMultiline("##editor", g_text_buffer, sizeof(g_text_buffer),
-                                      input_size, input_flags, NULL, NULL)) {
-                EditorState *ed = app_get_active_editor(g_app);
-                if (ed) ed->dirty = 1;
+        if (folded) {
+            /* Folded view: draws only the visible rows and edits the
+             * editor buffer in place */
+            igBeginChild_Str("##folded_view", editor_size, false,
+                             ImGuiWindowFlags_HorizontalScrollbar);
+            {
+                ImDrawList *draw_list = igGetWindowDrawList();
+                ImVec2 origin;
+                igGetCursorScreenPos(&origin);
+                
+                ImVec2 char_size;
+                igCalcTextSize(&char_size, "M", NULL, false, 0);
+                
+                folded_view_input(ed, origin, line_height, char_size.x);
+                
+                /* The input may have changed the rows */
+                row_count = fold_visible_count(ed->folds);
+                if (last_row > row_count) last_row = row_count;
+                if (first_row > last_row) first_row = last_row;
+                
+                size_t cursor_row = fold_line_to_visible(ed->folds, ed->cursor_line - 1);
+                for (size_t row = first_row; row < last_row; row++) {
+                    size_t line = fold_visible_to_line(ed->folds, row);
+                    char text[1024];
+                    size_t len = get_line_text(ed, line, text, sizeof(text));
+                    
+                    ImVec2 pos = {origin.x, origin.y + row * line_height};
+                    if (has_selection(ed)) {
+                        draw_selection(draw_list, ed, line, pos, line_height, char_size.x,
+                                       text, len);
+                    }
+                    draw_line(draw_list, pos, char_size.x, ed->language, text, len);
+                    
+                    const FoldRange *r = fold_get(ed->folds, line);
+                    if (r) {
+                        char note[32];
+                        snprintf(note, sizeof(note), " ... [%zu lines]", r->end - r->start);
+                        ImVec2 note_pos = {pos.x + (advance_columns(0, text, len) + 1) * char_size.x, pos.y};
+                        ImDrawList_AddText_Vec2(draw_list, note_pos, color_comment, note, NULL);
+                    }
+                    
+                    if (row == cursor_row) {
+                        size_t col = ed->cursor_col - 1 < len ? ed->cursor_col - 1 : len;
+                        float x = pos.x + advance_columns(0, text, col) * char_size.x;
+                        ImDrawList_AddRectFilled(draw_list, (ImVec2){x, pos.y},
+                                                 (ImVec2){x + 1, pos.y + line_height},
+                                                 color_default, 0.0f, 0);
+                    }
+                }
+                
+                igDummy((ImVec2){editor_size.x, row_count * line_height});
+                g_editor_scroll_y = igGetScrollY();
             }
+            igEndChild();
+        } else {
+            ImGuiInputTextFlags input_flags = ImGuiInputTextFlags_AllowTabInput;
             
-            /* Capture scroll position for gutter sync */
-            g_editor_scroll_y = igGetScrollY();
+            /* Use a child window to capture scroll */
+            igBeginChild_Str("##editor_child", editor_size, false, 0);
+            {
+                ImVec2 input_size = {-1, -1};
+                
+                if (igInputTextMultiline("##editor", g_text_buffer, sizeof(g_text_buffer),
+                                          input_size, input_flags, NULL, NULL)) {
+                    if (ed) ed->dirty = 1;
+                    g_text_changed = 1;
+                }
+                
+                /* Capture scroll position for gutter sync */
+                g_editor_scroll_y = igGetScrollY();
+            }
+            igEndChild();
         }
-        igEndChild();
     }
     igEnd();
 }
@@ -341,6 +982,100 @@ static void render_status_bar(void) {
         } else {
             igText("Ready");
         }
+        
+        if (g_app->diags.errors + g_app->diags.warnings > 0) {
+            igSameLine(0, 20);
+            igText("| %zu errors, %zu warnings", g_app->diags.errors, g_app->diags.warnings);
+        }
+        
+        BuildCache *cache = &g_app->build_cache;
+        if (cache->hits + cache->misses > 0) {
+            igSameLine(0, 20);
+            igText("| Build cache: %zu hits, %zu misses", cache->hits, cache->misses);
+        }
+        
+        BuildProcess *proc = &g_app->build_proc;
+        if (proc->running) {
+            igSameLine(0, 20);
+            igText("| %s %.1fs", proc->cancelled ? "Cancelling" : "Building", build_process_elapsed(proc));
+        } else if (g_batch_active) {
+            igSameLine(0, 20);
+            igText("| Building %zu/%zu files", g_batch.finished, g_batch.count);
+        }
+        
+        char backup[128];
+        if (autobackup_status(g_app->autobackup, backup, sizeof(backup))) {
+            igSameLine(0, 20);
+            igText("| %s", backup);
+        }
+    }
+    igEnd();
+}
+
+static void render_output_window(void) {
+    if (!g_show_output) return;
+    
+    BuildProcess *proc = &g_app->build_proc;
+    BuildOutput *out = &g_app->build_output;
+    
+    igSetNextWindowSize((ImVec2){700, 250}, ImGuiCond_FirstUseEver);
+    if (igBegin("Build Output", &g_show_output, 0)) {
+        if (proc->running || g_batch_active) {
+            if (g_batch_active) {
+                igText("Built %zu of %zu files, %zu running", g_batch.finished, g_batch.count,
+                       g_batch.running);
+            } else {
+                igText("Running %.1fs", build_process_elapsed(proc));
+            }
+            igSameLine(0, 20);
+            if (igButton("Cancel", (ImVec2){80, 0})) {
+                cancel_build();
+            }
+        } else if (proc->start != 0) {
+            igText("Exit code %d in %.2fs", proc->exit_code, build_process_elapsed(proc));
+        } else {
+            igText("No build yet");
+        }
+        igSameLine(0, 20);
+        if (igButton("Clear", (ImVec2){80, 0})) {
+            build_output_clear(out);
+        }
+        igSeparator();
+        
+        igBeginChild_Str("##output", (ImVec2){0, 0}, false, ImGuiWindowFlags_HorizontalScrollbar);
+        
+        /* Only the visible lines are submitted, so long logs stay cheap */
+        ImGuiListClipper *clipper = ImGuiListClipper_ImGuiListClipper();
+        ImGuiListClipper_Begin(clipper, (int)out->line_count, -1.0f);
+        while (ImGuiListClipper_Step(clipper)) {
+            for (int i = clipper->DisplayStart; i < clipper->DisplayEnd; i++) {
+                const char *text = build_output_line(out, (size_t)i);
+                const Diagnostic *d = diag_for_output_line(&g_app->diags, (size_t)i);
+                ImU32 color = 0;
+                if (d && d->severity != DIAG_NOTE) {
+                    color = d->severity == DIAG_ERROR ? color_error : color_warning;
+                } else if (out->is_stderr[i]) {
+                    color = color_stderr;
+                }
+                
+                if (color) igPushStyleColor_U32(ImGuiCol_Text, color);
+                igTextUnformatted(text, NULL);
+                if (color) igPopStyleColor(1);
+                
+                /* Click a diagnostic to jump to it */
+                if (d && igIsItemClicked(ImGuiMouseButton_Left)) {
+                    g_app->diags.current = (size_t)(d - g_app->diags.items);
+                    goto_diagnostic(d);
+                }
+            }
+        }
+        ImGuiListClipper_End(clipper);
+        ImGuiListClipper_destroy(clipper);
+        
+        /* Follow new output unless the user scrolled up */
+        if (g_output_follow || igGetScrollY() >= igGetScrollMaxY()) igSetScrollHereY(1.0f);
+        g_output_follow = 0;
+        igEndChild();
     }
     igEnd();
 }
@@ -391,6 +1126,69 @@ static void render_find_dialog(void) {
     igEnd();
 }
 
+static void lookup_definition(void) {
+    char index_path[512];
+    symindex_get_path(".", index_path, sizeof(index_path));
+    
+    SymIndex *idx = symindex_open(index_path);
+    if (!idx) {
+        /* First lookup in this project: build the index */
+        if (symindex_update(".", index_path, 0, NULL) != 0) return;
+        idx = symindex_open(index_path);
+        if (!idx) return;
+    }
+    
+    SymbolMatch matches[32];
+    size_t found = symindex_find(idx, g_def_name, matches, 32);
+    g_def_count = found < 32 ? found : 32;
+    
+    for (size_t i = 0; i < g_def_count; i++) {
+        strncpy(g_def_results[i].file, matches[i].file,
+                sizeof(g_def_results[i].file) - 1);
+        g_def_results[i].line = matches[i].line;
+        g_def_results[i].kind = matches[i].kind;
+    }
+    symindex_close(idx);
+}
+
+static void render_goto_def_dialog(void) {
+    if (!g_show_goto_def) return;
+    
+    igSetNextWindowSize((ImVec2){450, 250}, ImGuiCond_FirstUseEver);
+    if (igBegin("Go to Definition", &g_show_goto_def, 0)) {
+        igText("Symbol:");
+        if (igInputText("##defname", g_def_name, sizeof(g_def_name),
+                        ImGuiInputTextFlags_EnterReturnsTrue, NULL, NULL)) {
+            lookup_definition();
+        }
+        igSameLine(0, 10);
+        if (igButton("Find", (ImVec2){80, 0})) {
+            lookup_definition();
+        }
+        if (igButton("Rebuild Index", (ImVec2){120, 0})) {
+            char index_path[512];
+            symindex_get_path(".", index_path, sizeof(index_path));
+            symindex_update(".", index_path, 0, NULL);
+        }
+        
+        igSeparator();
+        for (size_t i = 0; i < g_def_count; i++) {
+            char label[320];
+            snprintf(label, sizeof(label), "%s:%u (%s)##def%zu",
+                     g_def_results[i].file, g_def_results[i].line,
+                     symindex_kind_name(g_def_results[i].kind), i);
+            if (igSelectable_Bool(label, false, 0, (ImVec2){0, 0})) {
+                if (app_open_file(g_app, g_def_results[i].file) == 0) {
+                    EditorState *ed = app_get_active_editor(g_app);
+                    if (ed) editor_goto_line(ed, g_def_results[i].line);
+                    sync_buffer_to_imgui();
+                }
+            }
+        }
+    }
+    igEnd();
+}
+
 static void glfw_error_callback(int error, const char *description) {
     fprintf(stderr, "GLFW Error %d: %s\n", error, description);
 }
@@ -451,6 +1249,9 @@ int platform_init(AppState *app) {
 int platform_run(AppState *app) {
     while (!glfwWindowShouldClose(g_window) && app->running) {
         glfwPollEvents();
+        autobackup_poll(app->autobackup);
+        poll_build();
+        poll_build_all();
         
         /* Start ImGui frame */
         ImGui_ImplOpenGL3_NewFrame();
@@ -461,8 +1262,10 @@ int platform_run(AppState *app) {
         render_menu_bar();
         render_editor();
         render_status_bar();
+        render_output_window();
         render_about_dialog();
         render_find_dialog();
+        render_goto_def_dialog();
         
         /* Render */
         igRender();
@@ -487,6 +1290,8 @@ int platform_run(AppState *app) {
 void platform_shutdown(AppState *app) {
     (void)app;
     
+    if (g_batch_active) build_batch_free(&g_batch);
+    
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     igDestroyContext(NULL);
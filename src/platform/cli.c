@@ -9,13 +9,19 @@
 
 #include "platform.h"
 #include "app.h"
+#include "autobackup.h"
 #include "editor.h"
 #include "build.h"
+#include "buildall.h"
+#include "diag.h"
 #include "menu.h"
+#include "script.h"
 #include "util.h"
 #include "syntax.h"
+#include "symindex.h"
 
 static AppState *g_app = NULL;
+static size_t g_output_lines = 0;   /* Lines of output from the current command */
 
 static void print_help(void) {
     printf("Commands:\n");
@@ -23,14 +29,27 @@ static void print_help(void) {
     printf("  open <path>          - Open file\n");
     printf("  save [path]          - Save file\n");
     printf("  build                - Build current file (cosmocc)\n");
+    printf("  build!               - Build even if the build cache is up to date\n");
     printf("  run                  - Run built executable\n");
     printf("  buildrun             - Build and run\n");
+    printf("  buildall [pattern]   - Build all open files (or files matching pattern) in parallel\n");
+    printf("  errors               - List diagnostics from the last build\n");
+    printf("  next / prev          - Go to the next/previous error or warning\n");
     printf("  insert <text>        - Insert text at cursor\n");
     printf("  template <file>      - Insert template from textape/\n");
+    printf("  script <file.qse>    - Run a QSE script\n");
     printf("  show                 - Show buffer contents\n");
     printf("  goto <line>          - Go to line\n");
+    printf("  match [line [col]]   - Find the matching bracket/block\n");
+    printf("  fold [line]          - Fold the block or comment starting at line\n");
+    printf("  unfold [line]        - Unfold at line (all folds if omitted)\n");
+    printf("  folds                - List folded regions\n");
+    printf("  index [dir]          - Build/update the project symbol index\n");
+    printf("  backup               - Run the scheduled backup now\n");
+    printf("  def <name>           - Go to definition of a symbol\n");
     printf("  lang <language>      - Set syntax (cosmo|amd64|aarch64|masm64|masm32)\n");
-    printf("  menu <ini_path>      - Load menu from INI\n");
+    printf("  menu [ini_path]      - Load menu from INI (show the loaded menus if omitted)\n");
+    printf("  key <accelerator>    - Show the menu item a key such as Ctrl+B runs\n");
     printf("  undo                 - Undo last edit\n");
     printf("  redo                 - Redo last undone edit\n");
     printf("  history              - Show history info\n");
@@ -41,33 +60,152 @@ static void print_help(void) {
 }
 
 static void print_status(void) {
+    char backup[192];
+    autobackup_status(g_app->autobackup, backup, sizeof(backup));
+    
+    BuildCache *cache = &g_app->build_cache;
+    if (cache->hits + cache->misses > 0) {
+        size_t used = strlen(backup);
+        snprintf(backup + used, sizeof(backup) - used, "%sBuild cache: %zu hits, %zu misses",
+                 used ? " | " : "", cache->hits, cache->misses);
+    }
+    
     EditorState *ed = app_get_active_editor(g_app);
     if (!ed) {
-        printf("[No file]\n");
+        printf("[No file]%s%s\n", backup[0] ? " | " : "", backup);
         return;
     }
     
     size_t line, col;
     editor_get_cursor_pos(ed, &line, &col);
     
-    printf("[%s%s] %s | Line %zu, Col %zu | %zu bytes\n",
+    printf("[%s%s] %s | Line %zu, Col %zu | %zu bytes%s%s\n",
            ed->file_path[0] ? ed->file_path : "Untitled",
            ed->dirty ? " *" : "",
            syntax_language_name(ed->language),
-           line, col, editor_get_length(ed));
+           line, col, editor_get_length(ed),
+           backup[0] ? " | " : "", backup);
+}
+
+static void collect_diag(void *ctx, const char *line, size_t len, int is_stderr) {
+    (void)is_stderr;
+    diag_parse_line(ctx, line, len, g_output_lines++);
+}
+
+/* Run a build or run command, picking diagnostics out of its output */
+static int run_command(const char *cmd) {
+    diag_clear(&g_app->diags);
+    g_output_lines = 0;
+    int result = build_run_command_lines(cmd, collect_diag, &g_app->diags);
+    if (g_app->diags.errors + g_app->diags.warnings > 0) {
+        printf("%zu errors, %zu warnings ('errors', 'next', 'prev')\n",
+               g_app->diags.errors, g_app->diags.warnings);
+    }
+    return result;
+}
+
+static void print_collect_line(void *ctx, const char *line, size_t len, int is_stderr) {
+    printf("%.*s\n", (int)len, line);
+    collect_diag(ctx, line, len, is_stderr);
+}
+
+static void print_line(void *ctx, const char *line, size_t len, int is_stderr) {
+    (void)ctx;
+    (void)is_stderr;
+    printf("%.*s\n", (int)len, line);
+}
+
+static void do_build_all(const char *pattern) {
+    BuildBatch batch;
+    build_batch_init(&batch, 0, &g_app->build_cache, print_collect_line, &g_app->diags);
+    if (pattern[0]) {
+        build_batch_add_glob(&batch, &g_app->build, pattern, g_app->exe_dir);
+    } else {
+        for (size_t i = 0; i < g_app->editor_count; i++) {
+            const char *path = g_app->editors[i]->file_path;
+            if (path[0]) build_batch_add(&batch, &g_app->build, path, g_app->exe_dir);
+        }
+    }
+    if (batch.count == 0) {
+        printf(pattern[0] ? "No files match: %s\n" : "No open files to build.%s\n", pattern);
+        build_batch_free(&batch);
+        return;
+    }
+    
+    diag_clear(&g_app->diags);
+    g_output_lines = 0;
+    printf("Building %zu files on %d workers\n", batch.count, batch.workers);
+    build_batch_run(&batch);
+    
+    printf("\n");
+    build_batch_summary(&batch, print_line, NULL);
+    if (g_app->diags.errors + g_app->diags.warnings > 0) {
+        printf("%zu errors, %zu warnings ('errors', 'next', 'prev')\n",
+               g_app->diags.errors, g_app->diags.warnings);
+    }
+    build_batch_free(&batch);
+}
+
+static void print_diag(const Diagnostic *d, int current) {
+    printf("%c %s:%u", current ? '>' : ' ', diag_file(&g_app->diags, d), d->line);
+    if (d->col) printf(":%u", d->col);
+    printf(": %s: %s\n", diag_severity_name(d->severity), d->message);
+}
+
+static void do_errors(void) {
+    DiagList *diags = &g_app->diags;
+    for (size_t i = 0; i < diags->count; i++) {
+        print_diag(&diags->items[i], i == diags->current);
+    }
+    printf("%zu errors, %zu warnings\n", diags->errors, diags->warnings);
+}
+
+/* Jump to the next/previous diagnostic and print it with its source line */
+static void do_step_error(int direction) {
+    const Diagnostic *d = diag_step(&g_app->diags, direction);
+    if (!d) {
+        printf("No errors or warnings.\n");
+        return;
+    }
+    print_diag(d, 1);
+    
+    EditorState *ed = app_goto_location(g_app, diag_file(&g_app->diags, d), d->line, d->col);
+    if (!ed) return;
+    size_t lines = blocks_line_count(ed->blocks);
+    size_t start = blocks_line_start(ed->blocks, ed->cursor_line - 1);
+    size_t end = ed->cursor_line < lines ? blocks_line_start(ed->blocks, ed->cursor_line) - 1
+                                         : editor_get_length(ed);
+    char text[256];
+    size_t len = end - start < sizeof(text) ? end - start : sizeof(text);
+    buffer_copy_range(ed->buffer, start, len, text);
+    printf("  %5zu | %.*s\n", ed->cursor_line, (int)len, text);
 }
 
-static void do_build(void) {
+static int do_build(int force) {
     EditorState *ed = app_get_active_editor(g_app);
     if (!ed || !ed->file_path[0]) {
         printf("No file to build. Save first.\n");
-        return;
+        return -1;
     }
     
     char cmd[1024];
     menu_substitute_vars(cmd, sizeof(cmd), g_app->build.build_cmd,
                          ed->file_path, g_app->exe_dir);
-    build_run_command(cmd);
+    
+    /* Skip the build when the source, command and compiler are unchanged
+     * and the output is still what that build produced */
+    char out[260];
+    uint64_t key;
+    int cacheable = app_build_target(g_app, ed->file_path, out, sizeof(out)) == 0 &&
+                    build_cache_key(cmd, ed->file_path, &key) == 0;
+    if (cacheable && !force && build_cache_lookup(&g_app->build_cache, key, out)) {
+        printf("[Cache hit: %s is up to date]\n", out);
+        return 0;
+    }
+    
+    int result = run_command(cmd);
+    if (cacheable && result == 0) build_cache_store(&g_app->build_cache, key, out);
+    return result;
 }
 
 static void do_run(void) {
@@ -83,6 +221,114 @@ static void do_run(void) {
     build_run_command(cmd);
 }
 
+static void print_menu(const Menu *menu, int depth) {
+    for (size_t i = 0; i < menu->item_count; i++) {
+        const MenuItem *item = &menu->items[i];
+        if (item->is_separator) {
+            printf("%*s-\n", depth * 2, "");
+        } else if (item->submenu) {
+            printf("%*s%s >\n", depth * 2, "", item->label);
+            print_menu(item->submenu, depth + 1);
+        } else {
+            printf("%*s%-32s %s", depth * 2, "", item->label, item->command);
+            if (item->accelerator[0]) printf("  [%s]", item->accelerator);
+            putchar('\n');
+        }
+    }
+}
+
+static void do_script(const char *path) {
+    ScriptContext ctx;
+    script_init(&ctx);
+    ctx.editor = app_get_active_editor(g_app);
+    if (script_run_file(&ctx, path) != 0) {
+        printf("%s\n", ctx.error_msg);
+    }
+    script_free(&ctx);
+}
+
+static void do_index(const char *dir) {
+    char index_path[512];
+    symindex_get_path(dir, index_path, sizeof(index_path));
+    
+    SymIndexStats stats;
+    if (symindex_update(dir, index_path, 0, &stats) != 0) {
+        printf("Failed to write symbol index: %s\n", index_path);
+        return;
+    }
+    printf("Indexed %zu files (%zu scanned, %zu unchanged), %zu symbols in %.3fs\n",
+           stats.files, stats.scanned, stats.reused, stats.symbols, stats.seconds);
+}
+
+static void do_definition(const char *name) {
+    char index_path[512];
+    symindex_get_path(".", index_path, sizeof(index_path));
+    
+    SymIndex *idx = symindex_open(index_path);
+    if (!idx) {
+        do_index(".");
+        idx = symindex_open(index_path);
+        if (!idx) return;
+    }
+    
+    SymbolMatch matches[16];
+    size_t found = symindex_find(idx, name, matches, 16);
+    if (found == 0) {
+        printf("No definition found: %s\n", name);
+        symindex_close(idx);
+        return;
+    }
+    
+    for (size_t i = 0; i < found && i < 16; i++) {
+        printf("  %s:%u (%s)\n", matches[i].file, matches[i].line,
+               symindex_kind_name(matches[i].kind));
+    }
+    if (found > 16) printf("  ... %zu more\n", found - 16);
+    
+    /* Jump to the first definition */
+    if (app_open_file(g_app, matches[0].file) == 0) {
+        EditorState *ed = app_get_active_editor(g_app);
+        if (ed) editor_goto_line(ed, matches[0].line);
+    }
+    symindex_close(idx);
+}
+
+/* Print the visible lines; a folded region shows as its header line */
+static void do_show(EditorState *ed) {
+    size_t len = editor_get_length(ed);
+    char *buf = malloc(len + 1);
+    if (!buf) return;
+    editor_get_text(ed, buf, len + 1);
+    
+    /* Lines with build diagnostics get an E/W marker */
+    int diag_file_id = diag_find_file(&g_app->diags, ed->file_path);
+    
+    printf("--- Buffer contents ---\n");
+    size_t rows = fold_visible_count(ed->folds);
+    size_t lines = blocks_line_count(ed->blocks);
+    for (size_t row = 0; row < rows; row++) {
+        size_t line = fold_visible_to_line(ed->folds, row);
+        size_t start = blocks_line_start(ed->blocks, line);
+        size_t end = line + 1 < lines ? blocks_line_start(ed->blocks, line + 1) - 1 : len;
+        
+        if (diag_file_id >= 0) {
+            const Diagnostic *d = diag_at(&g_app->diags, diag_file_id, (unsigned)(line + 1));
+            printf("%s", !d || d->severity == DIAG_NOTE ? "  "
+                         : d->severity == DIAG_ERROR ? "E " : "W ");
+        }
+        
+        const FoldRange *r = fold_get(ed->folds, line);
+        if (r) {
+            printf("%.*s ... [%zu lines]\n", (int)(end - start), buf + start,
+                   r->end - r->start);
+        } else {
+            printf("%.*s\n", (int)(end - start), buf + start);
+        }
+    }
+    printf("--- End ---\n");
+    free(buf);
+}
+
 static void handle_command(const char *line) {
     char cmd[64] = {0};
     char arg[512] = {0};
@@ -131,26 +377,29 @@ static void handle_command(const char *line) {
             printf("Usage: save <path>\n");
         }
     }
-    else if (strcmp(cmd, "build") == 0) {
-        do_build();
+    else if (strcmp(cmd, "build") == 0 || strcmp(cmd, "build!") == 0) {
+        do_build(cmd[5] == '!');
     }
     else if (strcmp(cmd, "run") == 0) {
         do_run();
     }
     else if (strcmp(cmd, "buildrun") == 0 || strcmp(cmd, "br") == 0) {
-        do_build();
-        do_run();
+        if (do_build(0) == 0) do_run();
+    }
+    else if (strcmp(cmd, "buildall") == 0) {
+        do_build_all(arg);
+    }
+    else if (strcmp(cmd, "errors") == 0) {
+        do_errors();
+    }
+    else if (strcmp(cmd, "next") == 0) {
+        do_step_error(1);
+    }
+    else if (strcmp(cmd, "prev") == 0) {
+        do_step_error(-1);
     }
     else if (strcmp(cmd, "show") == 0) {
-        if (ed) {
-            size_t len = editor_get_length(ed);
-            char *buf = malloc(len + 1);
-            if (buf) {
-                editor_get_text(ed, buf, len + 1);
-                printf("--- Buffer contents ---\n%s\n--- End ---\n", buf);
-                free(buf);
-            }
-        }
+        if (ed) do_show(ed);
     }
     else if (strcmp(cmd, "insert") == 0) {
         if (ed && arg[0]) {
@@ -168,6 +417,70 @@ static void handle_command(const char *line) {
             }
         }
     }
+    else if (strcmp(cmd, "match") == 0) {
+        if (ed) {
+            size_t line = ed->cursor_line, col = 1;
+            sscanf(arg, "%zu %zu", &line, &col);
+            
+            size_t ml, mc;
+            if (editor_find_match(ed, line, col, &ml, &mc) == 0) {
+                printf("Match at line %zu, col %zu\n", ml, mc);
+            } else {
+                printf("No match on line %zu from col %zu\n", line, col);
+            }
+        }
+    }
+    else if (strcmp(cmd, "fold") == 0) {
+        if (ed) {
+            size_t line = arg[0] ? (size_t)atoi(arg) : ed->cursor_line;
+            if (editor_fold(ed, line) == 0) {
+                const FoldRange *r = fold_get(ed->folds, line - 1);
+                printf("Folded lines %zu-%zu\n", r->start + 2, r->end + 1);
+            } else {
+                printf("Nothing to fold at line %zu\n", line);
+            }
+        }
+    }
+    else if (strcmp(cmd, "unfold") == 0) {
+        if (ed) {
+            size_t line = arg[0] ? (size_t)atoi(arg) : 0;
+            if (editor_unfold(ed, line) != 0) {
+                printf("No fold at line %zu\n", line);
+            } else if (line) {
+                printf("Unfolded line %zu\n", line);
+            } else {
+                printf("Unfolded all\n");
+            }
+        }
+    }
+    else if (strcmp(cmd, "folds") == 0) {
+        if (ed) {
+            for (const FoldRange *r = fold_next(ed->folds, 0); r;
+                 r = fold_next(ed->folds, r->start + 1)) {
+                printf("  %zu-%zu\n", r->start + 1, r->end + 1);
+            }
+            printf("%zu folds, %zu of %zu lines visible\n", ed->folds->fold_count,
+                   fold_visible_count(ed->folds), blocks_line_count(ed->blocks));
+        }
+    }
+    else if (strcmp(cmd, "index") == 0) {
+        do_index(arg[0] ? arg : ".");
+    }
+    else if (strcmp(cmd, "backup") == 0) {
+        if (g_app->autobackup) {
+            autobackup_trigger(g_app->autobackup);
+            printf("Backup started in the background.\n");
+        } else {
+            printf("No scheduled backup: set interval and destination in [schedule] of backup.ini\n");
+        }
+    }
+    else if (strcmp(cmd, "def") == 0) {
+        if (arg[0]) {
+            do_definition(arg);
+        } else {
+            printf("Usage: def <name>\n");
+        }
+    }
     else if (strcmp(cmd, "lang") == 0) {
         if (ed && arg[0]) {
             Language lang = LANG_NONE;
@@ -191,10 +504,29 @@ static void handle_command(const char *line) {
     else if (strcmp(cmd, "menu") == 0) {
         if (arg[0]) {
             if (menu_load_ini(&g_app->menus, arg) == 0) {
-                printf("Loaded menu: %s (%zu menus)\n", arg, g_app->menus.menu_count);
+                printf("Loaded menu: %s (%zu menus, %zu commands)\n", arg,
+                       g_app->menus.menu_count, g_app->menus.id_count);
             } else {
                 printf("Failed to load menu: %s\n", arg);
             }
+        } else if (g_app->menus.menu_count == 0) {
+            printf("No menu loaded.\n");
+        } else {
+            for (size_t m = 0; m < g_app->menus.menu_count; m++) {
+                printf("[%s]\n", g_app->menus.menus[m].name);
+                print_menu(&g_app->menus.menus[m], 1);
+            }
+        }
+    }
+    else if (strcmp(cmd, "key") == 0) {
+        int key = menu_parse_accel(arg);
+        const MenuItem *item = menu_find_by_accel(&g_app->menus, key);
+        if (!key) {
+            printf("Usage: key <accelerator>, e.g. key Ctrl+Shift+B\n");
+        } else if (item) {
+            printf("%s: %s\n", item->label, item->command);
+        } else {
+            printf("No menu item for %s\n", arg);
         }
     }
     else if (strcmp(cmd, "template") == 0 || strcmp(cmd, "tpl") == 0) {
@@ -222,6 +554,13 @@ static void handle_command(const char *line) {
             printf("  Looks in textape/ directory by default\n");
         }
     }
+    else if (strcmp(cmd, "script") == 0) {
+        if (arg[0]) {
+            do_script(arg);
+        } else {
+            printf("Usage: script <file.qse>\n");
+        }
+    }
     else if (strcmp(cmd, "undo") == 0 || strcmp(cmd, "u") == 0) {
         if (ed) {
             editor_undo(ed);
@@ -285,6 +624,7 @@ int platform_run(AppState *app) {
     char line[1024];
     
     while (app->running) {
+        autobackup_poll(app->autobackup);
         print_status();
         printf("> ");
         fflush(stdout);
@@ -0,0 +1,936 @@
+/*
+ * restore.c - Restore and verify backup archives
+ *
+ * Index member format (one line per record, in archive order):
+ *
+ *   <header offset> <size> <xxh64 hex, or - when unknown> <path>
+ *
+ * Locator member contents: "tedit-index <index header offset> <index size>"
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+#include "restore.h"
+#include "backup.h"
+#include "deflate.h"
+#include "hash.h"
+#include "parallel.h"
+#include "util.h"
+
+#define TAR_BLOCK 512
+
+/* Destination directory plus a member name */
+#define RESTORE_MAX_PATH (BACKUP_MAX_PATH + ARCHIVE_MAX_NAME)
+
+/* ==========================================================================
+ * Tar headers
+ * ========================================================================== */
+
+typedef struct TarMember {
+    char *path;                     /* Owned; freed by member_clear */
+    uint64_t offset;                /* Header offset in the tar stream */
+    uint64_t data;                  /* Offset of the contents */
+    uint64_t size;
+    uint64_t hash;
+    int has_hash;
+    int64_t mtime;
+    unsigned int mode;
+    char type;
+} TarMember;
+
+typedef struct MemberList {
+    TarMember *items;
+    size_t count;
+    size_t capacity;
+} MemberList;
+
+/* Octal, or base-256 when the high bit of the first byte is set */
+static uint64_t tar_number(const unsigned char *field, size_t len) {
+    uint64_t v = 0;
+    if (field[0] & 0x80) {
+        v = field[0] & 0x7f;
+        for (size_t i = 1; i < len; i++) v = (v << 8) | field[i];
+        return v;
+    }
+    
+    size_t i = 0;
+    while (i < len && field[i] == ' ') i++;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+        v = (v << 3) | (uint64_t)(field[i] - '0');
+    }
+    return v;
+}
+
+static int tar_block_is_zero(const unsigned char *block) {
+    for (int i = 0; i < TAR_BLOCK; i++) {
+        if (block[i]) return 0;
+    }
+    return 1;
+}
+
+static int tar_checksum_ok(const unsigned char *h) {
+    unsigned int sum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++) {
+        sum += (i >= 148 && i < 156) ? ' ' : h[i];
+    }
+    return sum == (unsigned int)tar_number(h + 148, 8);
+}
+
+static void member_clear(TarMember *m) {
+    free(m->path);
+    m->path = NULL;
+}
+
+/* Parse a header block into m (path allocated); -1 if its checksum is
+ * wrong, leaving m without a path */
+static int tar_parse(const unsigned char *h, uint64_t offset, TarMember *m) {
+    memset(m, 0, sizeof(*m));
+    if (!tar_checksum_ok(h)) return -1;
+    
+    char name[101];
+    char prefix[156];
+    memcpy(name, h, 100);
+    name[100] = '\0';
+    memcpy(prefix, h + 345, 155);
+    prefix[155] = '\0';
+    
+    size_t len = strlen(prefix) + strlen(name) + 2;
+    m->path = malloc(len);
+    if (!m->path) return -1;
+    if (memcmp(h + 257, "ustar", 5) == 0 && prefix[0]) {
+        snprintf(m->path, len, "%s/%s", prefix, name);
+    } else {
+        snprintf(m->path, len, "%s", name);
+    }
+    
+    m->offset = offset;
+    m->mode = (unsigned int)tar_number(h + 100, 8) & 07777;
+    m->size = tar_number(h + 124, 12);
+    m->mtime = (int64_t)tar_number(h + 136, 12);
+    m->type = (char)h[156];
+    return 0;
+}
+
+static uint64_t tar_padded(uint64_t size) {
+    return (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+}
+
+/* Apply the records of a PAX extended header ("<len> key=value\n") to
+ * the member that follows it. Returns -1 on a malformed record or a
+ * path that cannot be stored, so the member is never used under the
+ * truncated ustar name. */
+static int tar_apply_pax(const char *records, size_t len, TarMember *m) {
+    size_t pos = 0;
+    while (pos < len) {
+        size_t rec_len = 0;
+        size_t i = pos;
+        while (i < len && records[i] >= '0' && records[i] <= '9' && rec_len <= len) {
+            rec_len = rec_len * 10 + (size_t)(records[i++] - '0');
+        }
+        if (rec_len == 0 || rec_len > len - pos || i >= len || records[i] != ' ') return -1;
+        
+        const char *key = records + i + 1;
+        const char *end = records + pos + rec_len - 1;     /* The newline */
+        if (key > end || *end != '\n') return -1;
+        const char *eq = memchr(key, '=', (size_t)(end - key));
+        if (!eq) return -1;
+        
+        size_t key_len = (size_t)(eq - key);
+        const char *value = eq + 1;
+        size_t value_len = (size_t)(end - value);
+        if (key_len == 4 && memcmp(key, "path", 4) == 0) {
+            if (value_len == 0 || memchr(value, '\0', value_len)) return -1;
+            char *path = malloc(value_len + 1);
+            if (!path) return -1;
+            memcpy(path, value, value_len);
+            path[value_len] = '\0';
+            free(m->path);
+            m->path = path;
+        } else if ((key_len == 4 && memcmp(key, "size", 4) == 0) ||
+                   (key_len == 5 && memcmp(key, "mtime", 5) == 0)) {
+            char number[32];
+            if (value_len >= sizeof(number)) return -1;
+            memcpy(number, value, value_len);
+            number[value_len] = '\0';
+            if (key_len == 4) {
+                m->size = strtoull(number, NULL, 10);
+            } else {
+                m->mtime = strtoll(number, NULL, 10);
+            }
+        }
+        pos += rec_len;
+    }
+    return 0;
+}
+
+static TarMember *members_add(MemberList *list) {
+    if (list->count == list->capacity) {
+        size_t cap = list->capacity ? list->capacity * 2 : 256;
+        TarMember *items = realloc(list->items, cap * sizeof(TarMember));
+        if (!items) return NULL;
+        list->items = items;
+        list->capacity = cap;
+    }
+    TarMember *m = &list->items[list->count++];
+    memset(m, 0, sizeof(*m));
+    return m;
+}
+
+static void members_free(MemberList *list) {
+    for (size_t i = 0; i < list->count; i++) member_clear(&list->items[i]);
+    free(list->items);
+    memset(list, 0, sizeof(*list));
+}
+
+/* Members are kept in offset order */
+static TarMember *members_find_offset(const MemberList *list, uint64_t offset) {
+    size_t lo = 0;
+    size_t hi = list->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (list->items[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < list->count && list->items[lo].offset == offset ? &list->items[lo] : NULL;
+}
+
+/* Parse index text into members. Returns -1 on a malformed line. */
+static int index_parse(const char *text, size_t len, MemberList *out) {
+    char *copy = malloc(len + 1);
+    if (!copy) return -1;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    
+    int result = 0;
+    char *line = copy;
+    while (*line) {
+        char *end = strchr(line, '\n');
+        if (end) *end = '\0';
+        
+        if (line[0]) {
+            char *p = line;
+            unsigned long long offset = strtoull(p, &p, 10);
+            unsigned long long size = strtoull(p, &p, 10);
+            while (*p == ' ') p++;
+            char *hash = p;
+            char *path = strchr(p, ' ');
+            TarMember *m = path ? members_add(out) : NULL;
+            if (!m) {
+                result = -1;
+                break;
+            }
+            *path++ = '\0';
+            m->offset = offset;
+            m->size = size;
+            if (strcmp(hash, "-") != 0) {
+                m->hash = strtoull(hash, NULL, 16);
+                m->has_hash = 1;
+            }
+            m->path = str_dup(path);
+            if (!m->path) {
+                out->count--;
+                result = -1;
+                break;
+            }
+        }
+        
+        if (!end) break;
+        line = end + 1;
+    }
+    
+    free(copy);
+    return result;
+}
+
+/* ==========================================================================
+ * Plain tar: mapped, indexed access
+ * ========================================================================== */
+
+typedef struct TarMap {
+    const unsigned char *data;
+    size_t len;
+} TarMap;
+
+/* Parse the record at offset, folding a PAX extended header into the
+ * member it describes; -1 on a bad checksum or a truncated record */
+static int map_parse(const TarMap *map, uint64_t offset, TarMember *m) {
+    if (offset + TAR_BLOCK > map->len) return -1;
+    if (tar_parse(map->data + offset, offset, m) != 0) return -1;
+    m->data = offset + TAR_BLOCK;
+    if (m->type != 'x') return 0;
+    
+    uint64_t pax_data = m->data;
+    uint64_t pax_size = m->size;
+    uint64_t next = pax_data + tar_padded(pax_size);
+    member_clear(m);
+    if (pax_size > map->len - pax_data || next + TAR_BLOCK > map->len) return -1;
+    if (tar_parse(map->data + next, offset, m) != 0) return -1;
+    m->data = next + TAR_BLOCK;
+    if (tar_apply_pax((const char *)map->data + pax_data, (size_t)pax_size, m) != 0) {
+        member_clear(m);
+        return -1;
+    }
+    return 0;
+}
+
+/* Find the locator at the end of the archive and load the index it
+ * points to. Returns -1 if the archive has none. */
+static int map_load_index(const TarMap *map, MemberList *out) {
+    size_t end = map->len / TAR_BLOCK * TAR_BLOCK;
+    while (end >= TAR_BLOCK && tar_block_is_zero(map->data + end - TAR_BLOCK)) {
+        end -= TAR_BLOCK;
+    }
+    if (end < 2 * TAR_BLOCK) return -1;
+    
+    TarMember locator;
+    if (tar_parse(map->data + end - 2 * TAR_BLOCK, end - 2 * TAR_BLOCK, &locator) != 0) {
+        return -1;
+    }
+    int is_locator = strcmp(locator.path, ARCHIVE_LOCATOR_NAME) == 0;
+    member_clear(&locator);
+    if (!is_locator || locator.size >= TAR_BLOCK) return -1;
+    
+    char text[TAR_BLOCK];
+    memcpy(text, map->data + end - TAR_BLOCK, (size_t)locator.size);
+    text[locator.size] = '\0';
+    
+    char magic[32];
+    unsigned long long index_offset;
+    unsigned long long index_size;
+    if (sscanf(text, "%31s %llu %llu", magic, &index_offset, &index_size) != 3 ||
+        strcmp(magic, ARCHIVE_LOCATOR_MAGIC) != 0 ||
+        index_offset + TAR_BLOCK + index_size > map->len) {
+        return -1;
+    }
+    
+    TarMember index;
+    if (map_parse(map, index_offset, &index) != 0) return -1;
+    int is_index = strcmp(index.path, ARCHIVE_INDEX_NAME) == 0;
+    member_clear(&index);
+    if (!is_index || index.size != index_size || index.data + index_size > map->len) {
+        return -1;
+    }
+    
+    if (index_parse((const char *)map->data + index.data,
+                    (size_t)index_size, out) != 0) {
+        members_free(out);
+        return -1;
+    }
+    
+    /* Offsets must be increasing and inside the archive */
+    uint64_t prev = 0;
+    for (size_t i = 0; i < out->count; i++) {
+        TarMember *m = &out->items[i];
+        if ((i > 0 && m->offset <= prev) || m->offset + TAR_BLOCK + m->size > index_offset) {
+            members_free(out);
+            return -1;
+        }
+        prev = m->offset;
+    }
+    return 0;
+}
+
+/* No index: walk the headers. Stops at the end blocks or at a bad
+ * header (counted in header_errors, since nothing after it can be
+ * located). */
+static void map_scan(const TarMap *map, MemberList *out, RestoreStats *st) {
+    uint64_t pos = 0;
+    while (pos + TAR_BLOCK <= map->len) {
+        if (tar_block_is_zero(map->data + pos)) break;
+        
+        TarMember parsed;
+        if (map_parse(map, pos, &parsed) != 0) {
+            st->header_errors++;
+            break;
+        }
+        if (parsed.size > map->len - parsed.data) {
+            member_clear(&parsed);
+            st->header_errors++;
+            break;
+        }
+        
+        uint64_t next = parsed.data + tar_padded(parsed.size);
+        if (strcmp(parsed.path, ARCHIVE_INDEX_NAME) != 0 &&
+            strcmp(parsed.path, ARCHIVE_LOCATOR_NAME) != 0) {
+            TarMember *m = members_add(out);
+            if (!m) {
+                member_clear(&parsed);
+                break;
+            }
+            *m = parsed;
+        } else {
+            member_clear(&parsed);
+        }
+        pos = next;
+    }
+}
+
+static int map_members(const TarMap *map, MemberList *out, RestoreStats *st) {
+    memset(out, 0, sizeof(*out));
+    if (map_load_index(map, out) == 0) {
+        st->indexed = 1;
+        return 0;
+    }
+    map_scan(map, out, st);
+    return 0;
+}
+
+/* Per-record outcome of the parallel workers */
+enum {
+    CHECK_OK = 0,
+    CHECK_HEADER,                   /* Bad checksum or header/index mismatch */
+    CHECK_HASH,                     /* Contents do not match the index */
+    CHECK_UNHASHED,                 /* Nothing recorded to compare with */
+    CHECK_WRITE                     /* Restore: could not write the file */
+};
+
+/* Re-read a record's header and check it against the member list. The
+ * header holds no path afterwards; only its data, mode and mtime are used. */
+static int map_check_header(const TarMap *map, const TarMember *m, TarMember *header) {
+    if (map_parse(map, m->offset, header) != 0) return -1;
+    int same = strcmp(header->path, m->path) == 0 && header->size == m->size;
+    member_clear(header);
+    if (!same || header->size > map->len - header->data) return -1;
+    return 0;
+}
+
+static int check_hash(const TarMember *m, const unsigned char *data) {
+    if (!m->has_hash) return CHECK_UNHASHED;
+    return hash_xxh64(m->size ? data : (const unsigned char *)"", (size_t)m->size, 0) == m->hash
+           ? CHECK_OK : CHECK_HASH;
+}
+
+typedef struct VerifyJob {
+    const TarMap *map;
+    const MemberList *members;
+    unsigned char *result;
+} VerifyJob;
+
+static void verify_worker(size_t index, void *ctx) {
+    VerifyJob *job = ctx;
+    const TarMember *m = &job->members->items[index];
+    
+    TarMember header;
+    if (map_check_header(job->map, m, &header) != 0) {
+        job->result[index] = CHECK_HEADER;
+        return;
+    }
+    job->result[index] = (unsigned char)check_hash(m, job->map->data + header.data);
+}
+
+/* ==========================================================================
+ * Restore targets
+ * ========================================================================== */
+
+/* Requested paths, normalized to project-relative form */
+typedef struct RestoreFilter {
+    char **paths;
+    size_t count;
+    unsigned char *hit;
+} RestoreFilter;
+
+static int filter_init(RestoreFilter *f, const char *const *paths, size_t count) {
+    memset(f, 0, sizeof(*f));
+    if (count == 0) return 0;
+    
+    f->paths = calloc(count, sizeof(char *));
+    f->hit = calloc(count, 1);
+    if (!f->paths || !f->hit) return -1;
+    
+    for (size_t i = 0; i < count; i++) {
+        const char *p = paths[i];
+        while (p[0] == '.' && p[1] == '/') p += 2;
+        if (strncmp(p, RESTORE_PREFIX, strlen(RESTORE_PREFIX)) == 0) p += strlen(RESTORE_PREFIX);
+        
+        char *copy = str_dup(p);
+        if (!copy) return -1;
+        for (char *c = copy; *c; c++) {
+            if (*c == '\\') *c = '/';
+        }
+        size_t len = strlen(copy);
+        while (len > 0 && copy[len - 1] == '/') copy[--len] = '\0';
+        f->paths[f->count++] = copy;
+    }
+    return 0;
+}
+
+static void filter_free(RestoreFilter *f) {
+    for (size_t i = 0; i < f->count; i++) free(f->paths[i]);
+    free(f->paths);
+    free(f->hit);
+}
+
+/* Project-relative path of a member to restore, or NULL to skip it */
+static const char *filter_select(RestoreFilter *f, const TarMember *m) {
+    if (m->type != '0' && m->type != '\0') return NULL;
+    if (strncmp(m->path, RESTORE_PREFIX, strlen(RESTORE_PREFIX)) != 0) return NULL;
+    const char *rel = m->path + strlen(RESTORE_PREFIX);
+    if (!rel[0]) return NULL;
+    if (f->count == 0) return rel;
+    
+    const char *match = NULL;
+    for (size_t i = 0; i < f->count; i++) {
+        size_t len = strlen(f->paths[i]);
+        if (len == 0 || (strncmp(rel, f->paths[i], len) == 0 &&
+                         (rel[len] == '\0' || rel[len] == '/'))) {
+            f->hit[i] = 1;
+            match = rel;
+        }
+    }
+    return match;
+}
+
+/* Open dest_dir/rel for writing, creating directories */
+static FILE *restore_open(const char *dest_dir, const char *rel, char *out_path, size_t size) {
+    if (!path_is_safe(rel)) return NULL;
+    if (strlen(dest_dir) + strlen(rel) + 1 >= size) return NULL;
+    
+    char dir[RESTORE_MAX_PATH];
+    path_join(out_path, size, dest_dir, rel);
+    path_dirname(out_path, dir, sizeof(dir));
+    if (dir[0]) path_make_dirs(dir);
+    return fopen(out_path, "wb");
+}
+
+/* Close a restored file and give it the archived mode and mtime */
+static int restore_close(FILE *out, const char *path, const TarMember *header) {
+    int result = fclose(out) == 0 ? 0 : -1;
+#ifndef _WIN32
+    if (header->mode) chmod(path, header->mode & 0777);
+#endif
+    struct utimbuf times;
+    times.actime = (time_t)header->mtime;
+    times.modtime = (time_t)header->mtime;
+    utime(path, &times);
+    return result;
+}
+
+typedef struct RestoreJob {
+    const TarMap *map;
+    const MemberList *members;
+    const char **rel;               /* Per member; NULL = not selected */
+    const char *dest_dir;
+    unsigned char *result;
+} RestoreJob;
+
+static void restore_worker(size_t index, void *ctx) {
+    RestoreJob *job = ctx;
+    const TarMember *m = &job->members->items[index];
+    if (!job->rel[index]) return;
+    
+    TarMember header;
+    if (map_check_header(job->map, m, &header) != 0) {
+        job->result[index] = CHECK_HEADER;
+        return;
+    }
+    
+    const unsigned char *data = job->map->data + header.data;
+    char out_path[RESTORE_MAX_PATH];
+    FILE *out = restore_open(job->dest_dir, job->rel[index], out_path, sizeof(out_path));
+    if (!out) {
+        job->result[index] = CHECK_WRITE;
+        return;
+    }
+    
+    int failed = fwrite(data, 1, (size_t)m->size, out) != m->size;
+    if (restore_close(out, out_path, &header) != 0) failed = 1;
+    
+    if (failed) {
+        job->result[index] = CHECK_WRITE;
+    } else {
+        job->result[index] = (unsigned char)check_hash(m, data);
+    }
+}
+
+/* ==========================================================================
+ * Compressed archives: one sequential pass
+ * ========================================================================== */
+
+typedef struct StreamPass {
+    GzipReader *gz;
+    RestoreFilter *filter;          /* NULL when only verifying */
+    const char *dest_dir;
+    MemberList seen;                /* Records with their computed hashes */
+    unsigned char *result;          /* Per seen record, grown with it */
+    char *index;                    /* Index member contents */
+    size_t index_len;
+    uint64_t pos;
+    int error;                      /* Inflate failed: the rest is unreadable */
+} StreamPass;
+
+static int stream_read_file(void *ctx, void *buf, size_t len) {
+    size_t n = fread(buf, 1, len, (FILE *)ctx);
+    return n > 0 ? (int)n : (ferror((FILE *)ctx) ? -1 : 0);
+}
+
+/* Exactly len bytes of the tar stream; -1 on corrupt or truncated input */
+static int stream_read(StreamPass *sp, void *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        long n = gzip_reader_read(sp->gz, (char *)buf + got, len - got);
+        if (n <= 0) {
+            sp->error = 1;
+            return -1;
+        }
+        got += (size_t)n;
+    }
+    sp->pos += len;
+    return 0;
+}
+
+/* Takes ownership of header's path */
+static void stream_record(StreamPass *sp, RestoreStats *st, TarMember *header,
+                          char *buf, size_t buf_size) {
+    TarMember *m = members_add(&sp->seen);
+    unsigned char *result = m ? realloc(sp->result, sp->seen.capacity) : NULL;
+    if (!m || !result) {
+        if (m) sp->seen.count--;
+        member_clear(header);
+        sp->error = 1;
+        return;
+    }
+    sp->result = result;
+    *m = *header;
+    size_t slot = sp->seen.count - 1;
+    sp->result[slot] = CHECK_UNHASHED;
+    
+    int is_index = strcmp(m->path, ARCHIVE_INDEX_NAME) == 0;
+    int is_meta = is_index || strcmp(m->path, ARCHIVE_LOCATOR_NAME) == 0;
+    if (is_index) {
+        free(sp->index);
+        sp->index = malloc((size_t)m->size + 1);
+        sp->index_len = 0;
+    }
+    
+    const char *rel = sp->filter && !is_meta ? filter_select(sp->filter, m) : NULL;
+    char out_path[RESTORE_MAX_PATH];
+    FILE *out = NULL;
+    if (rel) {
+        out = restore_open(sp->dest_dir, rel, out_path, sizeof(out_path));
+        if (!out) sp->result[slot] = CHECK_WRITE;
+    }
+    
+    HashXxh64 hs;
+    hash_xxh64_init(&hs, 0);
+    uint64_t left = tar_padded(m->size);
+    uint64_t data_left = m->size;
+    int write_failed = 0;
+    while (left > 0) {
+        size_t n = left < buf_size ? (size_t)left : buf_size;
+        if (stream_read(sp, buf, n) != 0) break;
+        
+        size_t data = data_left < n ? (size_t)data_left : n;
+        hash_xxh64_update(&hs, buf, data);
+        if (out && fwrite(buf, 1, data, out) != data) write_failed = 1;
+        if (is_index && sp->index) {
+            memcpy(sp->index + sp->index_len, buf, data);
+            sp->index_len += data;
+        }
+        data_left -= data;
+        left -= n;
+    }
+    
+    m->hash = hash_xxh64_final(&hs);
+    m->has_hash = 1;
+    
+    if (out) {
+        if (restore_close(out, out_path, m) != 0) write_failed = 1;
+        if (write_failed || sp->error) sp->result[slot] = CHECK_WRITE;
+    }
+    if (rel && sp->result[slot] != CHECK_WRITE) {
+        st->files++;
+        st->bytes += m->size;
+    } else if (!sp->filter && !is_meta) {
+        st->files++;
+        st->bytes += m->size;
+    }
+    if (!rel && sp->filter) {
+        /* Not restored: nothing to report */
+        member_clear(m);
+        sp->seen.count--;
+    }
+}
+
+/* If m is a PAX extended header, read its records and the header that
+ * follows, and leave the combined member in m */
+static int stream_pax(StreamPass *sp, TarMember *m, unsigned char *header, char *buf) {
+    if (m->type != 'x') return 0;
+    uint64_t padded = tar_padded(m->size);
+    if (padded > DEFLATE_BLOCK_SIZE) return -1;
+    if (stream_read(sp, buf, (size_t)padded) != 0) return -1;
+    
+    size_t records = (size_t)m->size;
+    uint64_t offset = m->offset;
+    member_clear(m);
+    if (stream_read(sp, header, TAR_BLOCK) != 0) return -1;
+    if (tar_parse(header, offset, m) != 0) return -1;
+    return tar_apply_pax(buf, records, m);
+}
+
+/* Inflate the whole archive, restoring selected members as they pass,
+ * then check the computed hashes against the index */
+static void stream_archive(FILE *f, RestoreFilter *filter, const char *dest_dir,
+                           RestoreStats *st) {
+    StreamPass sp;
+    memset(&sp, 0, sizeof(sp));
+    sp.filter = filter;
+    sp.dest_dir = dest_dir;
+    sp.gz = gzip_reader_create(stream_read_file, f);
+    char *buf = malloc(DEFLATE_BLOCK_SIZE);
+    if (!sp.gz || !buf) {
+        gzip_reader_free(sp.gz);
+        free(buf);
+        st->header_errors++;
+        return;
+    }
+    
+    unsigned char header[TAR_BLOCK];
+    while (!sp.error) {
+        uint64_t offset = sp.pos;
+        if (stream_read(&sp, header, TAR_BLOCK) != 0) break;
+        if (tar_block_is_zero(header)) break;
+        
+        TarMember m;
+        if (tar_parse(header, offset, &m) != 0 || stream_pax(&sp, &m, header, buf) != 0) {
+            member_clear(&m);
+            st->header_errors++;
+            break;
+        }
+        if (strcmp(m.path, ARCHIVE_INDEX_NAME) != 0 && strcmp(m.path, ARCHIVE_LOCATOR_NAME) != 0) {
+            st->members++;
+        }
+        stream_record(&sp, st, &m, buf, DEFLATE_BLOCK_SIZE);
+    }
+    
+    /* Read to the end so the gzip CRC and length are checked */
+    while (!sp.error && gzip_reader_read(sp.gz, buf, DEFLATE_BLOCK_SIZE) > 0) {}
+    if (sp.gz->error) sp.error = 1;
+    if (sp.error) st->header_errors++;
+    
+    /* Compare against the index */
+    MemberList index;
+    memset(&index, 0, sizeof(index));
+    if (sp.index && index_parse(sp.index, sp.index_len, &index) == 0 && index.count > 0) {
+        st->indexed = 1;
+        for (size_t i = 0; i < sp.seen.count; i++) {
+            if (sp.result[i] == CHECK_UNHASHED) sp.result[i] = CHECK_OK;
+        }
+        
+        for (size_t i = 0; i < index.count; i++) {
+            const TarMember *want = &index.items[i];
+            TarMember *got = members_find_offset(&sp.seen, want->offset);
+            if (!got) {
+                /* Verifying, every record must be there; restoring, only
+                 * the selected ones were kept */
+                if (!filter) st->header_errors++;
+                continue;
+            }
+            size_t slot = (size_t)(got - sp.seen.items);
+            if (strcmp(got->path, want->path) != 0 || got->size != want->size) {
+                sp.result[slot] = CHECK_HEADER;
+            } else if (!want->has_hash) {
+                if (sp.result[slot] == CHECK_OK) sp.result[slot] = CHECK_UNHASHED;
+            } else if (got->hash != want->hash && sp.result[slot] == CHECK_OK) {
+                sp.result[slot] = CHECK_HASH;
+            }
+        }
+    }
+    
+    for (size_t i = 0; i < sp.seen.count; i++) {
+        const TarMember *m = &sp.seen.items[i];
+        int is_meta = strcmp(m->path, ARCHIVE_INDEX_NAME) == 0 ||
+                      strcmp(m->path, ARCHIVE_LOCATOR_NAME) == 0;
+        switch (sp.result[i]) {
+            case CHECK_HEADER: st->header_errors++; break;
+            case CHECK_HASH: st->hash_errors++; break;
+            case CHECK_UNHASHED: if (!is_meta) st->unhashed++; break;
+            case CHECK_WRITE: st->skipped++; break;
+            default: break;
+        }
+    }
+    
+    members_free(&index);
+    members_free(&sp.seen);
+    free(sp.result);
+    free(sp.index);
+    free(buf);
+    gzip_reader_free(sp.gz);
+}
+
+/* ==========================================================================
+ * Entry points
+ * ========================================================================== */
+
+/* gzip magic at the start of the file */
+static int archive_is_gzip(FILE *f) {
+    unsigned char magic[2];
+    int gz = fread(magic, 1, 2, f) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+    rewind(f);
+    return gz;
+}
+
+static void tally(RestoreStats *st, const unsigned char *result, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        switch (result[i]) {
+            case CHECK_HEADER: st->header_errors++; break;
+            case CHECK_HASH: st->hash_errors++; break;
+            case CHECK_UNHASHED: st->unhashed++; break;
+            case CHECK_WRITE: st->skipped++; break;
+            default: break;
+        }
+    }
+}
+
+int archive_verify(const char *archive, int threads, RestoreStats *stats) {
+    RestoreStats st;
+    memset(&st, 0, sizeof(st));
+    double start = time_now();
+    if (threads <= 0) threads = parallel_cpu_count();
+    st.threads = 1;
+    
+    FILE *f = fopen(archive, "rb");
+    if (!f) return -1;
+    
+    if (archive_is_gzip(f)) {
+        st.compressed = 1;
+        stream_archive(f, NULL, NULL, &st);
+        fclose(f);
+    } else {
+        fclose(f);
+        TarMap map;
+        map.data = (const unsigned char *)file_map(archive, &map.len);
+        if (!map.data) return -1;
+        
+        MemberList members;
+        map_members(&map, &members, &st);
+        unsigned char *result = calloc(members.count ? members.count : 1, 1);
+        if (result) {
+            VerifyJob job;
+            job.map = &map;
+            job.members = &members;
+            job.result = result;
+            parallel_for(members.count, threads, verify_worker, &job);
+            st.threads = threads;
+            
+            tally(&st, result, members.count);
+            st.members = members.count;
+            for (size_t i = 0; i < members.count; i++) {
+                if (result[i] != CHECK_HEADER) {
+                    st.files++;
+                    st.bytes += members.items[i].size;
+                }
+            }
+        } else {
+            st.header_errors++;
+        }
+        
+        free(result);
+        members_free(&members);
+        file_unmap((char *)map.data, map.len);
+    }
+    
+    st.seconds = time_now() - start;
+    if (stats) *stats = st;
+    return st.header_errors || st.hash_errors ? -1 : 0;
+}
+
+int archive_restore(const char *archive, const char *dest_dir,
+                    const char *const *paths, size_t path_count,
+                    int threads, RestoreStats *stats) {
+    RestoreStats st;
+    memset(&st, 0, sizeof(st));
+    double start = time_now();
+    if (threads <= 0) threads = parallel_cpu_count();
+    st.threads = 1;
+    
+    RestoreFilter filter;
+    if (filter_init(&filter, paths, path_count) != 0) {
+        filter_free(&filter);
+        return -1;
+    }
+    
+    FILE *f = fopen(archive, "rb");
+    if (!f) {
+        filter_free(&filter);
+        return -1;
+    }
+    path_make_dirs(dest_dir);
+    
+    if (archive_is_gzip(f)) {
+        st.compressed = 1;
+        stream_archive(f, &filter, dest_dir, &st);
+        fclose(f);
+    } else {
+        fclose(f);
+        TarMap map;
+        map.data = (const unsigned char *)file_map(archive, &map.len);
+        if (!map.data) {
+            filter_free(&filter);
+            return -1;
+        }
+        
+        MemberList members;
+        map_members(&map, &members, &st);
+        size_t n = members.count;
+        const char **rel = calloc(n ? n : 1, sizeof(char *));
+        unsigned char *result = calloc(n ? n : 1, 1);
+        if (rel && result) {
+            for (size_t i = 0; i < n; i++) {
+                /* Index lines carry no type; the worker checks the header */
+                if (st.indexed) members.items[i].type = '0';
+                rel[i] = filter_select(&filter, &members.items[i]);
+            }
+            
+            RestoreJob job;
+            job.map = &map;
+            job.members = &members;
+            job.rel = rel;
+            job.dest_dir = dest_dir;
+            job.result = result;
+            parallel_for(n, threads, restore_worker, &job);
+            st.threads = threads;
+            st.members = n;
+            
+            for (size_t i = 0; i < n; i++) {
+                if (!rel[i]) continue;
+                if (result[i] == CHECK_UNHASHED) {
+                    /* Restored fine; nothing recorded to check against */
+                    result[i] = CHECK_OK;
+                }
+                if (result[i] == CHECK_OK || result[i] == CHECK_HASH) {
+                    st.files++;
+                    st.bytes += members.items[i].size;
+                }
+            }
+            tally(&st, result, n);
+        } else {
+            st.skipped++;
+        }
+        
+        free(rel);
+        free(result);
+        members_free(&members);
+        file_unmap((char *)map.data, map.len);
+    }
+    
+    for (size_t i = 0; i < filter.count; i++) {
+        if (!filter.hit[i]) st.missing++;
+    }
+    filter_free(&filter);
+    
+    st.seconds = time_now() - start;
+    if (stats) *stats = st;
+    return st.skipped || st.missing || st.header_errors || st.hash_errors ? -1 : 0;
+}
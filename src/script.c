@@ -1,97 +1,271 @@
 /*
  * script.c - QSE script engine
  */
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 #include "script.h"
+#include "build.h"
+#include "hash.h"
+#include "parallel.h"
 #include "util.h"
 #include "platform.h"
 
-/* File handles for script */
-static FILE *script_files[16] = {0};
+/* ==========================================================================
+ * Context: arena, interned strings and variables
+ * ========================================================================== */
+
+#define SCRIPT_ARENA_BLOCK 8192
+
+struct ScriptArenaBlock {
+    ScriptArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+struct ScriptInterned {
+    const char *text;               /* NULL for an empty slot */
+    size_t len;
+    uint64_t hash;
+};
+
+static void script_jobs_free(ScriptContext *ctx);
 
 int script_init(ScriptContext *ctx) {
     memset(ctx, 0, sizeof(*ctx));
-    getcwd(ctx->cwd, sizeof(ctx->cwd));
+    if (!getcwd(ctx->cwd, sizeof(ctx->cwd))) strcpy(ctx->cwd, ".");
     return 0;
 }
 
 void script_free(ScriptContext *ctx) {
     /* Close any open files */
-    for (int i = 0; i < 16; i++) {
-        if (script_files[i]) {
-            fclose(script_files[i]);
-            script_files[i] = NULL;
-        }
+    for (int i = 0; i < SCRIPT_MAX_FILES; i++) {
+        if (ctx->files[i]) fclose(ctx->files[i]);
     }
     
-    /* Free string variables */
-    for (size_t i = 0; i < ctx->var_count; i++) {
-        if (ctx->vars[i].type == VAR_STRING && ctx->vars[i].value.string) {
-            free(ctx->vars[i].value.string);
-        }
+    script_jobs_free(ctx);
+    
+    /* Everything else is in the arena, apart from long strings */
+    for (size_t i = 0; i < ctx->var_capacity; i++) {
+        ScriptVar *var = ctx->vars[i];
+        if (var && var->heap) free((char *)var->value.string);
     }
+    free(ctx->vars);
+    free(ctx->strings);
     
-    if (ctx->gettext_result) {
-        free(ctx->gettext_result);
+    ScriptArenaBlock *b = ctx->arena;
+    while (b) {
+        ScriptArenaBlock *next = b->next;
+        free(b);
+        b = next;
     }
     
     memset(ctx, 0, sizeof(*ctx));
 }
 
-static ScriptVar *find_var(ScriptContext *ctx, const char *name) {
-    for (size_t i = 0; i < ctx->var_count; i++) {
-        if (strcmp(ctx->vars[i].name, name) == 0) {
-            return &ctx->vars[i];
-        }
+static void *script_alloc(ScriptContext *ctx, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ScriptArenaBlock *b = ctx->arena;
+    if (!b || b->size - b->used < size) {
+        size_t n = size > SCRIPT_ARENA_BLOCK ? size : SCRIPT_ARENA_BLOCK;
+        b = malloc(sizeof(ScriptArenaBlock) + n);
+        if (!b) return NULL;
+        b->used = 0;
+        b->size = n;
+        b->next = ctx->arena;
+        ctx->arena = b;
+    }
+    void *p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+static int script_grow_strings(ScriptContext *ctx) {
+    size_t cap = ctx->string_capacity ? ctx->string_capacity * 2 : 64;
+    ScriptInterned *table = calloc(cap, sizeof(ScriptInterned));
+    if (!table) return -1;
+    
+    for (size_t i = 0; i < ctx->string_capacity; i++) {
+        const ScriptInterned *e = &ctx->strings[i];
+        if (!e->text) continue;
+        size_t j = (size_t)e->hash & (cap - 1);
+        while (table[j].text) j = (j + 1) & (cap - 1);
+        table[j] = *e;
+    }
+    free(ctx->strings);
+    ctx->strings = table;
+    ctx->string_capacity = cap;
+    return 0;
+}
+
+const char *script_intern(ScriptContext *ctx, const char *s, size_t len) {
+    if ((ctx->string_count + 1) * 4 > ctx->string_capacity * 3 &&
+        script_grow_strings(ctx) != 0) {
+        return NULL;
+    }
+    
+    uint64_t hash = hash_xxh64(s, len, 0);
+    size_t mask = ctx->string_capacity - 1;
+    size_t i = (size_t)hash & mask;
+    for (; ctx->strings[i].text; i = (i + 1) & mask) {
+        const ScriptInterned *e = &ctx->strings[i];
+        if (e->hash == hash && e->len == len && memcmp(e->text, s, len) == 0) return e->text;
     }
-    return NULL;
+    
+    char *copy = script_alloc(ctx, len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    ctx->strings[i].text = copy;
+    ctx->strings[i].len = len;
+    ctx->strings[i].hash = hash;
+    ctx->string_count++;
+    return copy;
+}
+
+static int script_grow_vars(ScriptContext *ctx) {
+    size_t cap = ctx->var_capacity ? ctx->var_capacity * 2 : 32;
+    ScriptVar **table = calloc(cap, sizeof(ScriptVar *));
+    if (!table) return -1;
+    
+    for (size_t i = 0; i < ctx->var_capacity; i++) {
+        ScriptVar *var = ctx->vars[i];
+        if (!var) continue;
+        size_t j = (size_t)var->hash & (cap - 1);
+        while (table[j]) j = (j + 1) & (cap - 1);
+        table[j] = var;
+    }
+    free(ctx->vars);
+    ctx->vars = table;
+    ctx->var_capacity = cap;
+    return 0;
+}
+
+/* Slot holding name, or the empty slot where it would go */
+static ScriptVar **var_slot(ScriptContext *ctx, const char *name, uint64_t hash) {
+    size_t mask = ctx->var_capacity - 1;
+    size_t i = (size_t)hash & mask;
+    while (ctx->vars[i] && (ctx->vars[i]->hash != hash || strcmp(ctx->vars[i]->name, name) != 0)) {
+        i = (i + 1) & mask;
+    }
+    return &ctx->vars[i];
+}
+
+ScriptVar *script_find_var(ScriptContext *ctx, const char *name) {
+    if (ctx->var_count == 0) return NULL;
+    return *var_slot(ctx, name, hash_xxh64(name, strlen(name), 0));
 }
 
 static ScriptVar *create_var(ScriptContext *ctx, const char *name, ScriptVarType type) {
-    if (ctx->var_count >= 128) return NULL;
+    if ((ctx->var_count + 1) * 4 > ctx->var_capacity * 3 && script_grow_vars(ctx) != 0) {
+        return NULL;
+    }
+    
+    size_t len = strlen(name);
+    uint64_t hash = hash_xxh64(name, len, 0);
+    ScriptVar **slot = var_slot(ctx, name, hash);
+    if (*slot) return *slot;
     
-    ScriptVar *var = &ctx->vars[ctx->var_count++];
-    strncpy(var->name, name, sizeof(var->name) - 1);
+    ScriptVar *var = script_alloc(ctx, sizeof(ScriptVar));
+    const char *interned = script_intern(ctx, name, len);
+    if (!var || !interned) return NULL;
+    
+    var->name = interned;
+    var->hash = hash;
     var->type = type;
-    var->value.integer = 0;
+    var->heap = 0;
+    if (type == VAR_STRING) {
+        var->value.string = "";
+    } else {
+        var->value.integer = 0;
+    }
+    *slot = var;
+    ctx->var_count++;
     return var;
 }
 
-int script_fcreate(ScriptContext *ctx, const char *filename) {
-    (void)ctx;
+/* Store a string in a variable: interned if short, otherwise its own copy.
+ * owned, if not NULL, is a malloc'd copy of s the variable may keep. */
+static int script_set_string(ScriptContext *ctx, ScriptVar *var, const char *s, char *owned) {
+    size_t len = strlen(s);
+    const char *stored;
+    int heap = 0;
+    if (len <= SCRIPT_INTERN_MAX) {
+        stored = script_intern(ctx, s, len);
+        free(owned);
+    } else {
+        stored = owned ? owned : str_dup(s);
+        heap = 1;
+    }
+    if (!stored) return -1;
     
+    /* s may be the old value, so it is released last */
+    if (var->heap) free((char *)var->value.string);
+    var->value.string = stored;
+    var->heap = heap;
+    return 0;
+}
+
+/* ==========================================================================
+ * Builtins
+ * ========================================================================== */
+
+/* Resolve path against the script's working directory, which chdir
+ * changes without touching the process's */
+static void script_path(const ScriptContext *ctx, const char *path, char *out, size_t max) {
+    if (path[0] == '/' || path[0] == '\\' || (isalpha((unsigned char)path[0]) && path[1] == ':')) {
+        snprintf(out, max, "%s", path);
+    } else {
+        path_join(out, max, ctx->cwd, path);
+    }
+}
+
+int script_fcreate(ScriptContext *ctx, const char *filename) {
     /* Find free handle */
     int handle = -1;
-    for (int i = 1; i < 16; i++) {
-        if (!script_files[i]) {
+    for (int i = 1; i < SCRIPT_MAX_FILES; i++) {
+        if (!ctx->files[i]) {
             handle = i;
             break;
         }
     }
     if (handle < 0) return -1;
     
-    script_files[handle] = fopen(filename, "w");
-    if (!script_files[handle]) return -1;
+    char path[520];
+    script_path(ctx, filename, path, sizeof(path));
+    ctx->files[handle] = fopen(path, "w");
+    if (!ctx->files[handle]) return -1;
     
     return handle;
 }
 
 int script_fprint(ScriptContext *ctx, int handle, const char *text) {
-    (void)ctx;
-    if (handle < 1 || handle >= 16 || !script_files[handle]) return -1;
-    fprintf(script_files[handle], "%s\n", text);
+    if (handle < 1 || handle >= SCRIPT_MAX_FILES || !ctx->files[handle]) return -1;
+    fprintf(ctx->files[handle], "%s\n", text);
     return 0;
 }
 
 int script_fclose(ScriptContext *ctx, int handle) {
-    (void)ctx;
-    if (handle < 1 || handle >= 16 || !script_files[handle]) return -1;
-    fclose(script_files[handle]);
-    script_files[handle] = NULL;
+    if (handle < 1 || handle >= SCRIPT_MAX_FILES || !ctx->files[handle]) return -1;
+    fclose(ctx->files[handle]);
+    ctx->files[handle] = NULL;
     return 0;
 }
 
@@ -102,21 +276,19 @@ int script_gettext(ScriptContext *ctx, const char *prompt, const char *title, co
     
     char buf[512];
     if (fgets(buf, sizeof(buf), stdin)) {
-        str_trim(buf);
-        if (buf[0] == '\0' && default_val) {
-            strcpy(buf, default_val);
+        const char *text = str_trim(buf);
+        if (text[0] == '\0' && default_val) {
+            text = default_val;
         }
         
-        if (ctx->gettext_result) free(ctx->gettext_result);
-        ctx->gettext_result = str_dup(buf);
+        const char *result = script_intern(ctx, text, strlen(text));
+        if (!result) return -1;
+        ctx->gettext_result = result;
         
         /* Set $0 variable */
-        ScriptVar *v = find_var(ctx, "$0");
+        ScriptVar *v = script_find_var(ctx, "$0");
         if (!v) v = create_var(ctx, "$0", VAR_STRING);
-        if (v) {
-            if (v->value.string) free(v->value.string);
-            v->value.string = str_dup(buf);
-        }
+        if (v && v->type == VAR_STRING) script_set_string(ctx, v, result, NULL);
         
         return 0;
     }
@@ -129,103 +301,1773 @@ int script_getfolder(ScriptContext *ctx, const char *prompt, const char *title)
     (void)title;
     
     if (fgets(path, sizeof(path), stdin)) {
-        str_trim(path);
-        
-        if (ctx->gettext_result) free(ctx->gettext_result);
-        ctx->gettext_result = str_dup(path);
-        
+        const char *text = str_trim(path);
+        const char *result = script_intern(ctx, text, strlen(text));
+        if (!result) return -1;
+        ctx->gettext_result = result;
         return 0;
     }
     return -1;
 }
 
+/* cmd prefixed with a cd to the script's working directory (malloc'd) */
+static char *script_command_line(const ScriptContext *ctx, const char *cmd) {
+#ifdef _WIN32
+    /* Windows paths cannot contain '"' */
+    size_t max = strlen(ctx->cwd) + strlen(cmd) + 16;
+    char *line = malloc(max);
+    if (!line) return NULL;
+    snprintf(line, max, "cd /d \"%s\" && %s", ctx->cwd, cmd);
+#else
+    /* Single-quoted so $, ` and " in the path stay literal; each ' becomes '\'' */
+    size_t max = strlen(ctx->cwd) * 4 + strlen(cmd) + 16;
+    char *line = malloc(max);
+    if (!line) return NULL;
+    char *p = line;
+    memcpy(p, "cd '", 4);
+    p += 4;
+    for (const char *c = ctx->cwd; *c; c++) {
+        if (*c == '\'') {
+            memcpy(p, "'\\''", 4);
+            p += 4;
+        } else {
+            *p++ = *c;
+        }
+    }
+    snprintf(p, max - (size_t)(p - line), "' && %s", cmd);
+#endif
+    return line;
+}
+
+/* Runs in the script's working directory; returns the exit status */
 int script_run_cmd(ScriptContext *ctx, const char *cmd) {
-    (void)ctx;
-    return system(cmd);
+    char *line = script_command_line(ctx, cmd);
+    if (!line) return -1;
+    int status = system(line);
+    free(line);
+#ifndef _WIN32
+    if (status != -1 && WIFEXITED(status)) status = WEXITSTATUS(status);
+#endif
+    return status;
 }
 
 int script_chdir(ScriptContext *ctx, const char *path) {
-    if (chdir(path) == 0) {
-        strncpy(ctx->cwd, path, sizeof(ctx->cwd) - 1);
+    char joined[520];
+    script_path(ctx, path, joined, sizeof(joined));
+    
+    char full[4096];
+#ifdef _WIN32
+    if (!_fullpath(full, joined, sizeof(full))) return -1;
+#else
+    if (!realpath(joined, full)) return -1;
+#endif
+    struct stat st;
+    if (stat(full, &st) != 0 || !S_ISDIR(st.st_mode) || strlen(full) >= sizeof(ctx->cwd)) {
+        return -1;
+    }
+    strcpy(ctx->cwd, full);
+    return 0;
+}
+
+/* ==========================================================================
+ * Jobs
+ * ========================================================================== */
+
+struct ScriptJob {
+    BuildProcess proc;
+    BuildCapture capture;
+    int running;
+    int status;
+};
+
+static void script_job_finish(ScriptContext *ctx, ScriptJob *job) {
+    job->running = 0;
+    job->status = job->proc.exit_code;
+    ctx->jobs_running--;
+    
+    /* All of a job's output at once, so parallel jobs never interleave */
+    if (build_capture_truncated(&job->capture)) {
+        printf("[... %llu bytes of earlier output dropped]\n",
+               (unsigned long long)(job->capture.total - job->capture.len));
+    }
+    const char *text = build_capture_text(&job->capture);
+    fwrite(text, 1, job->capture.len, stdout);
+    if (job->capture.len > 0 && text[job->capture.len - 1] != '\n') putchar('\n');
+    fflush(stdout);
+}
+
+/* Collect output and finish jobs that exited, waiting up to timeout_ms
+ * for any of them to write or exit */
+static void script_jobs_poll(ScriptContext *ctx, int timeout_ms) {
+#ifndef _WIN32
+    struct pollfd fds[128];
+    nfds_t nfds = 0;
+    for (size_t i = 0; i < ctx->job_count && nfds + 2 <= 128; i++) {
+        ScriptJob *job = ctx->jobs[i];
+        if (!job->running) continue;
+        for (int s = 0; s < 2; s++) {
+            if (job->proc.fds[s] < 0) continue;
+            fds[nfds].fd = job->proc.fds[s];
+            fds[nfds].events = POLLIN;
+            fds[nfds].revents = 0;
+            nfds++;
+        }
+    }
+    if (timeout_ms > 0) {
+        if (nfds > 0) {
+            poll(fds, nfds, timeout_ms);
+        } else {
+            /* Pipes closed, processes not reaped yet */
+            time_sleep(0.005);
+        }
+    }
+#else
+    (void)timeout_ms;
+#endif
+    
+    for (size_t i = 0; i < ctx->job_count; i++) {
+        ScriptJob *job = ctx->jobs[i];
+        if (job->running && !build_process_poll(&job->proc, 0)) script_job_finish(ctx, job);
+    }
+}
+
+static int script_job_limit(const ScriptContext *ctx) {
+    int limit = ctx->in_block && ctx->block_jobs > 0 ? ctx->block_jobs : ctx->max_jobs;
+    return limit > 0 ? limit : parallel_cpu_count();
+}
+
+/* Start cmd once fewer than the job limit are running. Returns its job
+ * id, or -1 if it could not be started. */
+static int script_spawn(ScriptContext *ctx, const char *cmd) {
+    while (ctx->jobs_running >= (size_t)script_job_limit(ctx)) script_jobs_poll(ctx, 100);
+    
+    if (ctx->job_count == ctx->job_capacity) {
+        size_t cap = ctx->job_capacity ? ctx->job_capacity * 2 : 16;
+        ScriptJob **jobs = realloc(ctx->jobs, cap * sizeof(ScriptJob *));
+        if (!jobs) return -1;
+        ctx->jobs = jobs;
+        ctx->job_capacity = cap;
+    }
+    
+    /* Jobs are allocated one by one: the process writes into the capture */
+    ScriptJob *job = calloc(1, sizeof(ScriptJob));
+    char *line = script_command_line(ctx, cmd);
+    if (!job || !line) {
+        free(job);
+        free(line);
+        return -1;
+    }
+    build_capture_init(&job->capture, BUILD_CAPTURE_LIMIT);
+    int started = build_process_start_capture(&job->proc, line, &job->capture);
+    free(line);
+    if (started != 0) {
+        build_capture_free(&job->capture);
+        free(job);
+        return -1;
+    }
+    
+    ctx->jobs[ctx->job_count++] = job;
+    job->running = 1;
+    ctx->jobs_running++;
+    
+    /* Native Windows runs the command inside start */
+    if (!job->proc.running) script_job_finish(ctx, job);
+    return (int)ctx->job_count;
+}
+
+static ScriptJob *script_job(ScriptContext *ctx, long id) {
+    return id >= 1 && (size_t)id <= ctx->job_count ? ctx->jobs[id - 1] : NULL;
+}
+
+static int script_job_wait(ScriptContext *ctx, ScriptJob *job) {
+    while (job->running) script_jobs_poll(ctx, 100);
+    return job->status;
+}
+
+/* Wait for every job from first on; returns how many exited non-zero */
+static size_t script_jobs_wait(ScriptContext *ctx, size_t first) {
+    size_t failed = 0;
+    for (size_t i = first; i < ctx->job_count; i++) {
+        if (script_job_wait(ctx, ctx->jobs[i]) != 0) failed++;
+    }
+    return failed;
+}
+
+static void script_jobs_cancel(ScriptContext *ctx) {
+    for (size_t i = 0; i < ctx->job_count; i++) {
+        if (ctx->jobs[i]->running) build_process_cancel(&ctx->jobs[i]->proc);
+    }
+}
+
+static void script_jobs_free(ScriptContext *ctx) {
+    script_jobs_cancel(ctx);
+    for (size_t i = 0; i < ctx->job_count; i++) {
+        ScriptJob *job = ctx->jobs[i];
+        if (job->running) build_process_wait(&job->proc);
+        build_capture_free(&job->capture);
+        free(job);
+    }
+    free(ctx->jobs);
+}
+
+/* Set an integer result variable such as $failed */
+static void script_set_number(ScriptContext *ctx, const char *name, long value) {
+    ScriptVar *var = script_find_var(ctx, name);
+    if (!var) var = create_var(ctx, name, VAR_INTEGER);
+    if (!var) return;
+    
+    if (var->type == VAR_INTEGER) {
+        var->value.integer = value;
+    } else {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%ld", value);
+        script_set_string(ctx, var, buf, NULL);
+    }
+}
+
+/* ==========================================================================
+ * Editing
+ *
+ * The first of these in a run opens an editor batch, which script_execute
+ * closes. Meanwhile the cursor is kept as a byte offset and only turned
+ * back into a line and column when asked for, so a loop of find, delete
+ * and insert never has to bring the editor's line index up to date.
+ * find selects its match and puts the cursor at the start; the next find
+ * carries on after it.
+ * ========================================================================== */
+
+static EditorState *script_editor(ScriptContext *ctx) {
+    EditorState *ed = ctx->editor;
+    if (ed && !ctx->editing) {
+        editor_begin_batch(ed);
+        ctx->editing = 1;
+        ctx->cursor = editor_offset(ed, ed->cursor_line, ed->cursor_col);
+    }
+    return ed;
+}
+
+static EditorState *script_editor_writable(ScriptContext *ctx) {
+    EditorState *ed = script_editor(ctx);
+    return ed && !ed->readonly ? ed : NULL;
+}
+
+/* Give the editor its cursor back as a line and column */
+static void script_sync_cursor(ScriptContext *ctx) {
+    if (ctx->editing) editor_goto_offset(ctx->editor, ctx->cursor);
+}
+
+static int script_has_selection(const EditorState *ed) {
+    return ed->selection_start < ed->selection_end;
+}
+
+/* Move the cursor to pos and drop the selection */
+static void script_move(ScriptContext *ctx, size_t pos) {
+    ctx->cursor = pos;
+    ctx->editor->selection_start = 0;
+    ctx->editor->selection_end = 0;
+}
+
+int script_goto(ScriptContext *ctx, long line, long col) {
+    EditorState *ed = script_editor(ctx);
+    if (!ed) return -1;
+    script_move(ctx, editor_offset(ed, line > 0 ? (size_t)line : 1, col > 0 ? (size_t)col : 1));
+    return 0;
+}
+
+int script_find(ScriptContext *ctx, const char *text) {
+    EditorState *ed = script_editor(ctx);
+    if (!ed) return -1;
+    
+    size_t len = strlen(text);
+    size_t from = script_has_selection(ed) ? ed->selection_end : ctx->cursor;
+    size_t at;
+    if (editor_find(ed, from, text, len, &at) != 0) return 0;
+    
+    ctx->cursor = at;
+    ed->selection_start = at;
+    ed->selection_end = at + len;
+    return 1;
+}
+
+long script_replace(ScriptContext *ctx, const char *from, const char *to) {
+    EditorState *ed = script_editor_writable(ctx);
+    if (!ed) return -1;
+    
+    /* Within the selection if there is one, else the whole text */
+    int selected = script_has_selection(ed);
+    size_t pos = selected ? ed->selection_start : 0;
+    size_t end = selected ? ed->selection_end : editor_get_length(ed);
+    size_t from_len = strlen(from), to_len = strlen(to);
+    long count = 0;
+    size_t at;
+    while (editor_find(ed, pos, from, from_len, &at) == 0 && at + from_len <= end) {
+        editor_delete(ed, at, from_len);
+        if (to_len > 0) editor_insert(ed, at, to, to_len);
+        if (ctx->cursor > at) {
+            ctx->cursor = ctx->cursor < at + from_len ? at : ctx->cursor - from_len + to_len;
+        }
+        pos = at + to_len;
+        end = end - from_len + to_len;
+        count++;
+    }
+    if (selected) ed->selection_end = end;
+    return count;
+}
+
+int script_insert(ScriptContext *ctx, const char *text) {
+    EditorState *ed = script_editor_writable(ctx);
+    if (!ed) return -1;
+    
+    size_t len = strlen(text);
+    if (len > 0) editor_insert(ed, ctx->cursor, text, len);
+    script_move(ctx, ctx->cursor + len);
+    return 0;
+}
+
+long script_delete(ScriptContext *ctx, long count) {
+    EditorState *ed = script_editor_writable(ctx);
+    if (!ed) return -1;
+    
+    size_t pos, len;
+    if (count < 0) {
+        pos = script_has_selection(ed) ? ed->selection_start : ctx->cursor;
+        len = script_has_selection(ed) ? ed->selection_end - pos : 0;
+    } else {
+        pos = ctx->cursor;
+        size_t left = editor_get_length(ed) - pos;
+        len = (size_t)count < left ? (size_t)count : left;
+    }
+    if (len > 0) editor_delete(ed, pos, len);
+    script_move(ctx, pos);
+    return (long)len;
+}
+
+int script_select(ScriptContext *ctx, long line, long col) {
+    EditorState *ed = script_editor(ctx);
+    if (!ed) return -1;
+    
+    /* From the cursor to line, col, whichever comes first */
+    size_t a = ctx->cursor;
+    size_t b = editor_offset(ed, line > 0 ? (size_t)line : 1, col > 0 ? (size_t)col : 1);
+    ed->selection_start = a < b ? a : b;
+    ed->selection_end = a < b ? b : a;
+    return 0;
+}
+
+/* ==========================================================================
+ * Bytecode
+ *
+ * A stack machine. Each instruction is an opcode byte, followed by a
+ * 32-bit operand for the opcodes up to OP_CALL. Variables are referred to
+ * by their index in the program's name table and bound to the context's
+ * variables once per run, so the loop never looks a name up.
+ * ========================================================================== */
+
+typedef enum ScriptOp {
+    OP_INT,                         /* operand: value */
+    OP_STR,                         /* operand: offset in strings */
+    OP_LOAD,                        /* operand: name */
+    OP_STORE,                       /* operand: name */
+    OP_DECL_INT,                    /* operand: name */
+    OP_DECL_STR,                    /* operand: name */
+    OP_JUMP,                        /* operand: code offset */
+    OP_JUMP_FALSE,                  /* operand: code offset; pops the condition */
+    OP_CALL,                        /* operand: builtin | argc << 8 */
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_AND,
+    OP_OR,
+    OP_NEG,
+    OP_NOT,
+    OP_POP,
+    OP_HALT,                        /* `end` */
+    OP_RETURN                       /* End of the program */
+} ScriptOp;
+
+#define OP_HAS_OPERAND(op) ((op) <= OP_CALL)
+
+/* Change in stack depth for each opcode (OP_CALL: 1 - argc) */
+static const int op_stack_effect[] = {
+    [OP_INT] = 1, [OP_STR] = 1, [OP_LOAD] = 1, [OP_STORE] = -1,
+    [OP_JUMP_FALSE] = -1, [OP_CALL] = 1,
+    [OP_ADD] = -1, [OP_SUB] = -1, [OP_MUL] = -1, [OP_DIV] = -1, [OP_MOD] = -1,
+    [OP_EQ] = -1, [OP_NE] = -1, [OP_LT] = -1, [OP_LE] = -1, [OP_GT] = -1, [OP_GE] = -1,
+    [OP_AND] = -1, [OP_OR] = -1, [OP_POP] = -1,
+    [OP_RETURN] = 0
+};
+
+typedef enum ScriptBuiltin {
+    FN_CHDIR,
+    FN_RUN,
+    FN_FCREATE,
+    FN_FPRINT,
+    FN_FCLOSE,
+    FN_GETTEXT,
+    FN_GETFOLDER,
+    FN_PRINT,
+    FN_LEN,
+    FN_STR,
+    FN_VAL,
+    FN_CHR,
+    FN_SPAWN,
+    FN_WAIT,
+    FN_OUTPUT,
+    FN_PARALLEL,                    /* PARALLEL [jobs] */
+    FN_ENDPARALLEL,
+    FN_GOTO,                        /* Editing: FN_GOTO to FN_CURRCOL */
+    FN_FIND,
+    FN_REPLACE,
+    FN_INSERT,
+    FN_DELETE,
+    FN_SELECT,
+    FN_SELECTION,
+    FN_CURRLINE,
+    FN_CURRCOL
+} ScriptBuiltin;
+
+#define SCRIPT_MAX_ARGS 8
+
+static const struct {
+    const char *name;
+    int min_args;
+    int max_args;
+    int raw;                        /* Unquoted argument is literal text */
+} script_builtins[] = {
+    {"chdir", 1, 1, 1},
+    {"run", 1, 1, 1},
+    {"fcreate", 1, 1, 0},
+    {"fprint", 2, 2, 0},
+    {"fclose", 1, 1, 0},
+    {"gettext", 1, 3, 0},
+    {"getfolder", 1, 2, 0},
+    {"print", 0, SCRIPT_MAX_ARGS, 0},
+    {"len", 1, 1, 0},
+    {"str", 1, 1, 0},
+    {"val", 1, 1, 0},
+    {"chr", 1, 1, 0},
+    {"spawn", 1, 1, 1},
+    {"wait", 0, 1, 0},
+    {"output", 1, 1, 0},
+    {"#parallel", 0, 1, 0},         /* Statements, not callable by name */
+    {"#endparallel", 0, 0, 0},
+    {"goto", 1, 2, 0},
+    {"find", 1, 1, 0},
+    {"replace", 2, 2, 0},
+    {"insert", 1, 1, 0},
+    {"delete", 0, 1, 0},
+    {"select", 1, 2, 0},
+    {"selection", 0, 0, 0},
+    {"currline", 0, 0, 0},
+    {"currcol", 0, 0, 0},
+};
+
+#define SCRIPT_BUILTIN_COUNT (sizeof(script_builtins) / sizeof(script_builtins[0]))
+#define SCRIPT_STACK_MAX 256
+
+typedef struct ScriptLine {
+    uint32_t offset;                /* First instruction of the statement */
+    unsigned line;
+} ScriptLine;
+
+struct ScriptProgram {
+    uint8_t *code;
+    size_t code_len;
+    size_t code_cap;
+    char *strings;                  /* Constants, each NUL-terminated */
+    size_t strings_len;
+    size_t strings_cap;
+    char (*names)[SCRIPT_NAME_MAX];
+    size_t name_count;
+    size_t name_cap;
+    ScriptLine *lines;              /* For error messages */
+    size_t line_count;
+    size_t line_cap;
+    int refs;                       /* Runs using it (script_run_file) */
+    int cached;                     /* Still in the file cache */
+};
+
+void script_program_free(ScriptProgram *prog) {
+    if (!prog) return;
+    free(prog->code);
+    free(prog->strings);
+    free(prog->names);
+    free(prog->lines);
+    free(prog);
+}
+
+/* Make room for needed items of size bytes. Returns the array, which may
+ * have moved, or NULL if out of memory (the old array is untouched). */
+static void *script_reserve(void *items, size_t *capacity, size_t needed, size_t size) {
+    if (needed <= *capacity) return items;
+    size_t cap = *capacity ? *capacity : 64;
+    while (cap < needed) cap *= 2;
+    void *grown = realloc(items, cap * size);
+    if (grown) *capacity = cap;
+    return grown;
+}
+
+static unsigned script_line_at(const ScriptProgram *prog, size_t offset) {
+    size_t lo = 0, hi = prog->line_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (prog->lines[mid].offset <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo ? prog->lines[lo - 1].line : 0;
+}
+
+/* ==========================================================================
+ * Compiler
+ *
+ * One pass: a hand-written lexer feeds a recursive descent parser that
+ * emits code as it goes. Forward jumps (IF, WHILE) are patched when their
+ * block closes.
+ * ========================================================================== */
+
+typedef enum ScriptTokenType {
+    LEX_EOF,
+    LEX_NEWLINE,
+    LEX_NUMBER,
+    LEX_STRING,
+    LEX_NAME,
+    LEX_OP
+} ScriptTokenType;
+
+/* Two-character operators in ScriptToken.op */
+enum {
+    TOP_LE = 256,
+    TOP_GE,
+    TOP_NE,
+    TOP_EQ
+};
+
+typedef struct ScriptToken {
+    ScriptTokenType type;
+    const char *start;
+    size_t len;
+    unsigned line;
+    long number;
+    int op;                         /* Character, or TOP_* */
+} ScriptToken;
+
+typedef enum ScriptBlockKind {
+    NEST_IF,
+    NEST_ELSE,
+    NEST_WHILE,
+    NEST_PARALLEL
+} ScriptBlockKind;
+
+typedef struct ScriptBlock {
+    ScriptBlockKind kind;
+    unsigned line;
+    uint32_t patch;                 /* Operand of the jump out of the block */
+    uint32_t start;                 /* WHILE: condition to jump back to */
+} ScriptBlock;
+
+typedef struct ScriptParser {
+    const char *pos;
+    const char *end;
+    unsigned line;
+    ScriptToken tok;
+    ScriptProgram *prog;
+    int depth;                      /* Expression nesting */
+    int stack;                      /* Stack depth at this point of the code */
+    int max_stack;
+    ScriptBlock blocks[32];
+    int block_count;
+    char *error;
+    size_t error_max;
+    int failed;
+} ScriptParser;
+
+static void parse_error(ScriptParser *p, const char *fmt, ...) {
+    if (p->failed) return;
+    p->failed = 1;
+    
+    int n = snprintf(p->error, p->error_max, "Line %u: ", p->tok.line);
+    if (n < 0 || (size_t)n >= p->error_max) return;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(p->error + n, p->error_max - (size_t)n, fmt, ap);
+    va_end(ap);
+}
+
+static int is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '$';
+}
+
+/* Case-insensitive match of the current token against a keyword */
+static int tok_is(const ScriptParser *p, const char *word) {
+    if (p->tok.type != LEX_NAME || strlen(word) != p->tok.len) return 0;
+    for (size_t i = 0; i < p->tok.len; i++) {
+        if (tolower((unsigned char)p->tok.start[i]) != word[i]) return 0;
+    }
+    return 1;
+}
+
+static int tok_is_op(const ScriptParser *p, int op) {
+    return p->tok.type == LEX_OP && p->tok.op == op;
+}
+
+static void lex_next(ScriptParser *p) {
+    ScriptToken *t = &p->tok;
+    while (p->pos < p->end && (*p->pos == ' ' || *p->pos == '\t' || *p->pos == '\r')) p->pos++;
+    if (p->pos < p->end && *p->pos == ';') {
+        while (p->pos < p->end && *p->pos != '\n') p->pos++;
+    }
+    
+    t->start = p->pos;
+    t->len = 0;
+    t->line = p->line;
+    if (p->pos >= p->end || p->failed) {
+        t->type = LEX_EOF;
+        return;
+    }
+    
+    char c = *p->pos;
+    if (c == '\n') {
+        t->type = LEX_NEWLINE;
+        p->pos++;
+        p->line++;
+    } else if (isdigit((unsigned char)c)) {
+        int base = 10;
+        if (c == '0' && p->end - p->pos > 2 && (p->pos[1] == 'x' || p->pos[1] == 'X')) {
+            base = 16;
+            p->pos += 2;
+        }
+        long v = 0;
+        while (p->pos < p->end && isxdigit((unsigned char)*p->pos)) {
+            int d = isdigit((unsigned char)*p->pos) ? *p->pos - '0'
+                                                   : tolower((unsigned char)*p->pos) - 'a' + 10;
+            if (d >= base) break;
+            v = v * base + d;
+            if (v > INT32_MAX) {
+                parse_error(p, "Number too large");
+                t->type = LEX_EOF;
+                return;
+            }
+            p->pos++;
+        }
+        t->type = LEX_NUMBER;
+        t->number = v;
+    } else if (c == '"') {
+        /* No escapes, so Windows paths can be written as they are */
+        const char *s = ++p->pos;
+        while (p->pos < p->end && *p->pos != '"' && *p->pos != '\n') p->pos++;
+        if (p->pos >= p->end || *p->pos != '"') {
+            parse_error(p, "Unterminated string");
+            t->type = LEX_EOF;
+            return;
+        }
+        t->type = LEX_STRING;
+        t->start = s;
+        t->len = (size_t)(p->pos - s);
+        p->pos++;
+        return;
+    } else if (isalpha((unsigned char)c) || c == '_' || c == '$') {
+        while (p->pos < p->end && is_name_char(*p->pos)) p->pos++;
+        t->type = LEX_NAME;
+    } else {
+        char n = p->end - p->pos > 1 ? p->pos[1] : '\0';
+        t->type = LEX_OP;
+        t->op = c;
+        if (c == '<' && n == '=') t->op = TOP_LE;
+        if (c == '>' && n == '=') t->op = TOP_GE;
+        if ((c == '<' && n == '>') || (c == '!' && n == '=')) t->op = TOP_NE;
+        if (c == '=' && n == '=') t->op = TOP_EQ;
+        p->pos += t->op >= 256 ? 2 : 1;
+        if (t->op < 256 && (c == '\0' || !strchr("+-*/%<>=(),", c))) {
+            parse_error(p, "Unexpected character '%c'", c);
+            t->type = LEX_EOF;
+            return;
+        }
+    }
+    t->len = (size_t)(p->pos - t->start);
+}
+
+/* ---- Emitting ---------------------------------------------------------- */
+
+static void emit_bytes(ScriptParser *p, const void *data, size_t len) {
+    ScriptProgram *prog = p->prog;
+    uint8_t *code = script_reserve(prog->code, &prog->code_cap, prog->code_len + len, 1);
+    if (!code) {
+        parse_error(p, "Out of memory");
+        return;
+    }
+    prog->code = code;
+    memcpy(prog->code + prog->code_len, data, len);
+    prog->code_len += len;
+}
+
+static void emit_stack(ScriptParser *p, int effect) {
+    p->stack += effect;
+    if (p->stack > p->max_stack) p->max_stack = p->stack;
+}
+
+static void emit(ScriptParser *p, ScriptOp op) {
+    uint8_t byte = (uint8_t)op;
+    emit_bytes(p, &byte, 1);
+    emit_stack(p, op_stack_effect[op]);
+}
+
+/* Returns the operand's offset, for patching a jump */
+static uint32_t emit_arg(ScriptParser *p, ScriptOp op, uint32_t arg) {
+    uint8_t byte = (uint8_t)op;
+    emit_bytes(p, &byte, 1);
+    uint32_t at = (uint32_t)p->prog->code_len;
+    emit_bytes(p, &arg, sizeof(arg));
+    emit_stack(p, op_stack_effect[op]);
+    return at;
+}
+
+static void patch_jump(ScriptParser *p, uint32_t at) {
+    uint32_t target = (uint32_t)p->prog->code_len;
+    if (!p->failed) memcpy(p->prog->code + at, &target, sizeof(target));
+}
+
+static uint32_t add_string(ScriptParser *p, const char *s, size_t len) {
+    ScriptProgram *prog = p->prog;
+    char *strings = script_reserve(prog->strings, &prog->strings_cap,
+                                   prog->strings_len + len + 1, 1);
+    if (!strings) {
+        parse_error(p, "Out of memory");
         return 0;
     }
+    prog->strings = strings;
+    uint32_t at = (uint32_t)prog->strings_len;
+    memcpy(strings + at, s, len);
+    strings[at + len] = '\0';
+    prog->strings_len += len + 1;
+    return at;
+}
+
+static int find_name(const ScriptProgram *prog, const char *s, size_t len) {
+    for (size_t i = 0; i < prog->name_count; i++) {
+        if (strncmp(prog->names[i], s, len) == 0 && prog->names[i][len] == '\0') return (int)i;
+    }
     return -1;
 }
 
-int script_run_line(ScriptContext *ctx, const char *line) {
-    char buf[512];
-    strncpy(buf, line, sizeof(buf) - 1);
-    char *s = str_trim(buf);
+/* Index of the current token's name, added to the table if new */
+static uint32_t add_name(ScriptParser *p) {
+    ScriptProgram *prog = p->prog;
+    int found = find_name(prog, p->tok.start, p->tok.len);
+    if (found >= 0) return (uint32_t)found;
     
-    /* Skip empty lines and comments */
-    if (s[0] == '\0' || s[0] == ';') return 0;
-    
-    /* Variable declaration: INTEGER varname */
-    if (strncmp(s, "INTEGER ", 8) == 0) {
-        create_var(ctx, str_trim(s + 8), VAR_INTEGER);
+    if (p->tok.len >= SCRIPT_NAME_MAX) {
+        parse_error(p, "Name too long: %.*s", (int)p->tok.len, p->tok.start);
+        return 0;
+    }
+    char (*names)[SCRIPT_NAME_MAX] = script_reserve(prog->names, &prog->name_cap,
+                                                    prog->name_count + 1, SCRIPT_NAME_MAX);
+    if (!names) {
+        parse_error(p, "Out of memory");
         return 0;
     }
+    prog->names = names;
+    memcpy(names[prog->name_count], p->tok.start, p->tok.len);
+    names[prog->name_count][p->tok.len] = '\0';
+    return (uint32_t)prog->name_count++;
+}
+
+static void mark_line(ScriptParser *p) {
+    ScriptProgram *prog = p->prog;
+    if (prog->line_count > 0 && prog->lines[prog->line_count - 1].offset == prog->code_len) {
+        prog->lines[prog->line_count - 1].line = p->tok.line;
+        return;
+    }
+    ScriptLine *lines = script_reserve(prog->lines, &prog->line_cap, prog->line_count + 1,
+                                       sizeof(ScriptLine));
+    if (!lines) {
+        parse_error(p, "Out of memory");
+        return;
+    }
+    prog->lines = lines;
+    lines[prog->line_count].offset = (uint32_t)prog->code_len;
+    lines[prog->line_count].line = p->tok.line;
+    prog->line_count++;
+}
+
+/* ---- Expressions ------------------------------------------------------- */
+
+static int is_keyword(const ScriptParser *p) {
+    static const char *const words[] = {
+        "integer", "string", "if", "else", "endif", "while", "wend", "end",
+        "and", "or", "not", "parallel", "endparallel"
+    };
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        if (tok_is(p, words[i])) return 1;
+    }
+    return 0;
+}
+
+static int find_builtin(const ScriptParser *p) {
+    for (size_t i = 0; i < SCRIPT_BUILTIN_COUNT; i++) {
+        if (tok_is(p, script_builtins[i].name)) return (int)i;
+    }
+    return -1;
+}
+
+static int at_line_end(const ScriptParser *p) {
+    return p->tok.type == LEX_NEWLINE || p->tok.type == LEX_EOF;
+}
+
+static void parse_expr(ScriptParser *p);
+
+/* chdir C:\src, run make all: when the argument is not a string, a
+ * parenthesised list or a variable, take the rest of the line (up to a
+ * comment) as written.
+ * Looks ahead from the builtin's name, before the lexer sees the text. */
+static int parse_raw_argument(ScriptParser *p, int fn) {
+    const char *s = p->pos;
+    while (s < p->end && (*s == ' ' || *s == '\t')) s++;
+    if (!script_builtins[fn].raw || s == p->end || strchr("\"(;\r\n", *s)) return 0;
     
-    /* Variable declaration: STRING varname$ */
-    if (strncmp(s, "STRING ", 7) == 0) {
-        create_var(ctx, str_trim(s + 7), VAR_STRING);
+    const char *w = s;
+    while (w < p->end && is_name_char(*w)) w++;
+    if (w > s && (*s == '$' || w[-1] == '$' || find_name(p->prog, s, (size_t)(w - s)) >= 0)) {
         return 0;
     }
     
-    /* End script */
-    if (strcmp(s, "end") == 0) {
-        return 1; /* Signal end */
+    const char *e = s;
+    while (e < p->end && *e != '\n' && *e != ';') e++;
+    while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) e--;
+    emit_arg(p, OP_STR, add_string(p, s, (size_t)(e - s)));
+    p->pos = e;
+    lex_next(p);
+    return 1;
+}
+
+static void parse_args(ScriptParser *p, int *argc) {
+    for (;;) {
+        parse_expr(p);
+        (*argc)++;
+        if (!tok_is_op(p, ',')) break;
+        if (*argc == SCRIPT_MAX_ARGS) {
+            parse_error(p, "More than %d arguments", SCRIPT_MAX_ARGS);
+            return;
+        }
+        lex_next(p);
+    }
+}
+
+static int in_parallel(const ScriptParser *p) {
+    for (int i = 0; i < p->block_count; i++) {
+        if (p->blocks[i].kind == NEST_PARALLEL) return 1;
+    }
+    return 0;
+}
+
+/* builtin(args), or as a command, builtin args to the end of the line */
+static void parse_call(ScriptParser *p, int fn) {
+    int argc = 0;
+    if (parse_raw_argument(p, fn)) {
+        argc = 1;
+    } else {
+        lex_next(p);
+        if (tok_is_op(p, '(')) {
+            lex_next(p);
+            if (!tok_is_op(p, ')')) parse_args(p, &argc);
+            if (!tok_is_op(p, ')')) {
+                parse_error(p, "Expected ')'");
+                return;
+            }
+            lex_next(p);
+        } else if (!at_line_end(p) && !tok_is_op(p, ')') && !tok_is_op(p, ',')) {
+            parse_args(p, &argc);
+        }
     }
     
-    /* chdir path */
-    if (strncmp(s, "chdir ", 6) == 0) {
-        return script_chdir(ctx, str_trim(s + 6));
+    if (argc < script_builtins[fn].min_args || argc > script_builtins[fn].max_args) {
+        parse_error(p, "Wrong number of arguments to %s", script_builtins[fn].name);
+        return;
     }
     
-    /* run "command" */
-    if (strncmp(s, "run ", 4) == 0) {
-        char *cmd = str_trim(s + 4);
-        /* Remove quotes if present */
-        if (cmd[0] == '"') {
-            cmd++;
-            char *end = strchr(cmd, '"');
-            if (end) *end = '\0';
+    /* Every run in a PARALLEL block is started without waiting */
+    if (fn == FN_RUN && in_parallel(p)) fn = FN_SPAWN;
+    emit_arg(p, OP_CALL, (uint32_t)fn | (uint32_t)argc << 8);
+    emit_stack(p, -argc);
+}
+
+static void parse_primary(ScriptParser *p) {
+    if (p->tok.type == LEX_NUMBER) {
+        emit_arg(p, OP_INT, (uint32_t)p->tok.number);
+        lex_next(p);
+    } else if (p->tok.type == LEX_STRING) {
+        emit_arg(p, OP_STR, add_string(p, p->tok.start, p->tok.len));
+        lex_next(p);
+    } else if (tok_is_op(p, '(')) {
+        lex_next(p);
+        parse_expr(p);
+        if (!tok_is_op(p, ')')) {
+            parse_error(p, "Expected ')'");
+            return;
+        }
+        lex_next(p);
+    } else if (p->tok.type == LEX_NAME && !is_keyword(p)) {
+        int fn = find_builtin(p);
+        if (fn >= 0) {
+            parse_call(p, fn);
+        } else {
+            emit_arg(p, OP_LOAD, add_name(p));
+            lex_next(p);
         }
-        return script_run_cmd(ctx, cmd);
+    } else {
+        parse_error(p, "Expected an expression");
+    }
+}
+
+static void parse_unary(ScriptParser *p) {
+    if (tok_is_op(p, '-')) {
+        lex_next(p);
+        parse_unary(p);
+        emit(p, OP_NEG);
+    } else {
+        parse_primary(p);
+    }
+}
+
+static void parse_term(ScriptParser *p) {
+    parse_unary(p);
+    while (!p->failed && (tok_is_op(p, '*') || tok_is_op(p, '/') || tok_is_op(p, '%'))) {
+        int op = p->tok.op;
+        lex_next(p);
+        parse_unary(p);
+        emit(p, op == '*' ? OP_MUL : op == '/' ? OP_DIV : OP_MOD);
+    }
+}
+
+static void parse_sum(ScriptParser *p) {
+    parse_term(p);
+    while (!p->failed && (tok_is_op(p, '+') || tok_is_op(p, '-'))) {
+        int op = p->tok.op;
+        lex_next(p);
+        parse_term(p);
+        emit(p, op == '+' ? OP_ADD : OP_SUB);
+    }
+}
+
+static void parse_compare(ScriptParser *p) {
+    parse_sum(p);
+    while (!p->failed && p->tok.type == LEX_OP) {
+        ScriptOp op;
+        switch (p->tok.op) {
+            case '=':
+            case TOP_EQ: op = OP_EQ; break;
+            case TOP_NE: op = OP_NE; break;
+            case '<':    op = OP_LT; break;
+            case TOP_LE: op = OP_LE; break;
+            case '>':    op = OP_GT; break;
+            case TOP_GE: op = OP_GE; break;
+            default:     return;
+        }
+        lex_next(p);
+        parse_sum(p);
+        emit(p, op);
+    }
+}
+
+static void parse_not(ScriptParser *p) {
+    if (tok_is(p, "not")) {
+        lex_next(p);
+        parse_not(p);
+        emit(p, OP_NOT);
+    } else {
+        parse_compare(p);
     }
+}
+
+static void parse_and(ScriptParser *p) {
+    parse_not(p);
+    while (!p->failed && tok_is(p, "and")) {
+        lex_next(p);
+        parse_not(p);
+        emit(p, OP_AND);
+    }
+}
+
+static void parse_expr(ScriptParser *p) {
+    if (++p->depth > 32) {
+        parse_error(p, "Expression nested too deeply");
+        return;
+    }
+    parse_and(p);
+    while (!p->failed && tok_is(p, "or")) {
+        lex_next(p);
+        parse_and(p);
+        emit(p, OP_OR);
+    }
+    p->depth--;
+}
+
+/* ---- Statements -------------------------------------------------------- */
+
+static void parse_declaration(ScriptParser *p, ScriptOp op) {
+    lex_next(p);
+    for (;;) {
+        if (p->tok.type != LEX_NAME || is_keyword(p) || find_builtin(p) >= 0) {
+            parse_error(p, "Expected a variable name");
+            return;
+        }
+        emit_arg(p, op, add_name(p));
+        lex_next(p);
+        if (!tok_is_op(p, ',')) break;
+        lex_next(p);
+    }
+}
+
+static ScriptBlock *open_block(ScriptParser *p, ScriptBlockKind kind) {
+    if (p->block_count == (int)(sizeof(p->blocks) / sizeof(p->blocks[0]))) {
+        parse_error(p, "Blocks nested too deeply");
+        return NULL;
+    }
+    ScriptBlock *b = &p->blocks[p->block_count++];
+    b->kind = kind;
+    b->line = p->tok.line;
+    b->start = (uint32_t)p->prog->code_len;
+    return b;
+}
+
+static void parse_statement(ScriptParser *p) {
+    mark_line(p);
+    ScriptBlock *top = p->block_count ? &p->blocks[p->block_count - 1] : NULL;
     
-    /* Handle assignments and function calls - simplified */
-    /* TODO: Full parser for complex expressions */
+    if (at_line_end(p)) {
+        /* Blank line or comment */
+    } else if (tok_is(p, "integer")) {
+        parse_declaration(p, OP_DECL_INT);
+    } else if (tok_is(p, "string")) {
+        parse_declaration(p, OP_DECL_STR);
+    } else if (tok_is(p, "if")) {
+        ScriptBlock *b = open_block(p, NEST_IF);
+        lex_next(p);
+        parse_expr(p);
+        if (b) b->patch = emit_arg(p, OP_JUMP_FALSE, 0);
+    } else if (tok_is(p, "else")) {
+        if (!top || top->kind != NEST_IF) {
+            parse_error(p, "ELSE without IF");
+            return;
+        }
+        uint32_t skip = emit_arg(p, OP_JUMP, 0);
+        patch_jump(p, top->patch);
+        top->patch = skip;
+        top->kind = NEST_ELSE;
+        lex_next(p);
+    } else if (tok_is(p, "endif")) {
+        if (!top || (top->kind != NEST_IF && top->kind != NEST_ELSE)) {
+            parse_error(p, "ENDIF without IF");
+            return;
+        }
+        patch_jump(p, top->patch);
+        p->block_count--;
+        lex_next(p);
+    } else if (tok_is(p, "while")) {
+        ScriptBlock *b = open_block(p, NEST_WHILE);
+        lex_next(p);
+        parse_expr(p);
+        if (b) b->patch = emit_arg(p, OP_JUMP_FALSE, 0);
+    } else if (tok_is(p, "wend")) {
+        if (!top || top->kind != NEST_WHILE) {
+            parse_error(p, "WEND without WHILE");
+            return;
+        }
+        emit_arg(p, OP_JUMP, top->start);
+        patch_jump(p, top->patch);
+        p->block_count--;
+        lex_next(p);
+    } else if (tok_is(p, "parallel")) {
+        if (in_parallel(p)) {
+            parse_error(p, "PARALLEL blocks cannot be nested");
+            return;
+        }
+        open_block(p, NEST_PARALLEL);
+        lex_next(p);
+        int argc = 0;
+        if (!at_line_end(p)) {
+            parse_expr(p);
+            argc = 1;
+        }
+        emit_arg(p, OP_CALL, FN_PARALLEL | (uint32_t)argc << 8);
+        emit_stack(p, -argc);
+        emit(p, OP_POP);
+    } else if (tok_is(p, "endparallel")) {
+        if (!top || top->kind != NEST_PARALLEL) {
+            parse_error(p, "ENDPARALLEL without PARALLEL");
+            return;
+        }
+        emit_arg(p, OP_CALL, FN_ENDPARALLEL);
+        emit(p, OP_POP);
+        p->block_count--;
+        lex_next(p);
+    } else if (tok_is(p, "end")) {
+        emit(p, OP_HALT);
+        lex_next(p);
+    } else if (p->tok.type == LEX_NAME && find_builtin(p) >= 0) {
+        parse_call(p, find_builtin(p));
+        emit(p, OP_POP);
+    } else if (p->tok.type == LEX_NAME && !is_keyword(p)) {
+        uint32_t name = add_name(p);
+        lex_next(p);
+        if (!tok_is_op(p, '=')) {
+            parse_error(p, "Expected '=' or a command");
+            return;
+        }
+        lex_next(p);
+        parse_expr(p);
+        emit_arg(p, OP_STORE, name);
+    } else {
+        parse_error(p, "Expected a statement");
+        return;
+    }
     
-    return 0;
+    if (!at_line_end(p)) {
+        parse_error(p, "Unexpected text after statement");
+        return;
+    }
+    lex_next(p);
 }
 
-int script_run_file(ScriptContext *ctx, const char *path) {
-    FILE *f = fopen(path, "r");
-    if (!f) {
-        snprintf(ctx->error_msg, sizeof(ctx->error_msg), 
-                 "Cannot open script: %s", path);
-        ctx->error = 1;
-        return -1;
+ScriptProgram *script_compile(const char *source, size_t len, char *error, size_t error_max) {
+    ScriptParser p;
+    memset(&p, 0, sizeof(p));
+    p.pos = source;
+    p.end = source + len;
+    p.line = 1;
+    p.error = error;
+    p.error_max = error_max;
+    if (error_max) error[0] = '\0';
+    
+    p.prog = calloc(1, sizeof(ScriptProgram));
+    if (!p.prog) {
+        snprintf(error, error_max, "Out of memory");
+        return NULL;
     }
     
-    char line[512];
-    int line_num = 0;
+    lex_next(&p);
+    while (!p.failed && p.tok.type != LEX_EOF) {
+        parse_statement(&p);
+    }
+    if (!p.failed && p.block_count > 0) {
+        const ScriptBlock *b = &p.blocks[p.block_count - 1];
+        p.tok.line = b->line;
+        parse_error(&p, b->kind == NEST_WHILE ? "WHILE without WEND"
+                        : b->kind == NEST_PARALLEL ? "PARALLEL without ENDPARALLEL"
+                        : "IF without ENDIF");
+    }
+    mark_line(&p);
+    emit(&p, OP_RETURN);
+    if (!p.failed && p.max_stack > SCRIPT_STACK_MAX) {
+        parse_error(&p, "Expression too complex");
+    }
     
-    while (fgets(line, sizeof(line), f)) {
-        line_num++;
-        int result = script_run_line(ctx, line);
-        if (result == 1) break; /* End command */
-        if (result < 0) {
-            snprintf(ctx->error_msg, sizeof(ctx->error_msg),
-                     "Error on line %d", line_num);
-            ctx->error = 1;
-            fclose(f);
+    if (p.failed) {
+        script_program_free(p.prog);
+        return NULL;
+    }
+    return p.prog;
+}
+
+/* ==========================================================================
+ * Interpreter
+ * ========================================================================== */
+
+typedef struct ScriptValue {
+    ScriptVarType type;
+    long integer;
+    const char *string;
+    char *owned;                    /* Set when string was allocated for the value */
+} ScriptValue;
+
+static long value_int(const ScriptValue *v) {
+    return v->type == VAR_INTEGER ? v->integer : strtol(v->string, NULL, 0);
+}
+
+static const char *value_text(const ScriptValue *v, char buf[32]) {
+    if (v->type == VAR_STRING) return v->string;
+    snprintf(buf, 32, "%ld", v->integer);
+    return buf;
+}
+
+static int value_true(const ScriptValue *v) {
+    return v->type == VAR_INTEGER ? v->integer != 0 : v->string[0] != '\0';
+}
+
+static void value_release(ScriptValue *v) {
+    free(v->owned);
+    v->owned = NULL;
+}
+
+static ScriptValue value_of_int(long n) {
+    ScriptValue v = {VAR_INTEGER, n, NULL, NULL};
+    return v;
+}
+
+/* Takes ownership of s; NULL (out of memory) becomes "" */
+static ScriptValue value_of_owned(char *s) {
+    ScriptValue v = {VAR_STRING, 0, s ? s : "", s};
+    return v;
+}
+
+static int script_runtime_error(ScriptContext *ctx, const ScriptProgram *prog, size_t at,
+                                const char *fmt, ...) {
+    int n = snprintf(ctx->error_msg, sizeof(ctx->error_msg), "Line %u: ",
+                     script_line_at(prog, at));
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(ctx->error_msg + n, sizeof(ctx->error_msg) - (size_t)n, fmt, ap);
+    va_end(ap);
+    ctx->error = 1;
+    return -1;
+}
+
+/* Store a value in a variable, converting it to the variable's type */
+static int script_assign(ScriptContext *ctx, ScriptVar *var, ScriptValue *v) {
+    if (var->type == VAR_INTEGER) {
+        var->value.integer = value_int(v);
+        value_release(v);
+        return 0;
+    }
+    
+    char buf[32];
+    char *owned = v->owned;
+    v->owned = NULL;
+    return script_set_string(ctx, var, value_text(v, buf), owned);
+}
+
+/* Run a builtin; args are released by the caller. Returns -1 with
+ * ctx->error_msg holding the message on failure. */
+static int script_call(ScriptContext *ctx, ScriptBuiltin fn, ScriptValue *args, int argc,
+                       ScriptValue *result) {
+    char buf[3][32];
+    const char *text[3] = {"", "", NULL};
+    for (int i = 0; i < argc && i < 3; i++) text[i] = value_text(&args[i], buf[i]);
+    
+    *result = value_of_int(0);
+    if (fn >= FN_GOTO && fn <= FN_CURRCOL) {
+        if (!script_editor(ctx)) {
+            snprintf(ctx->error_msg, sizeof(ctx->error_msg), "No file is open");
+            return -1;
+        }
+        if ((fn == FN_REPLACE || fn == FN_INSERT || fn == FN_DELETE) && ctx->editor->readonly) {
+            snprintf(ctx->error_msg, sizeof(ctx->error_msg), "File is read-only");
             return -1;
         }
     }
     
-    fclose(f);
+    switch (fn) {
+        case FN_CHDIR:
+            if (script_chdir(ctx, text[0]) != 0) {
+                snprintf(ctx->error_msg, sizeof(ctx->error_msg), "Cannot chdir to %s", text[0]);
+                return -1;
+            }
+            break;
+        case FN_RUN:
+            result->integer = script_run_cmd(ctx, text[0]);
+            break;
+        case FN_FCREATE:
+            result->integer = script_fcreate(ctx, text[0]);
+            break;
+        case FN_FPRINT:
+            if (script_fprint(ctx, (int)value_int(&args[0]), text[1]) != 0) {
+                snprintf(ctx->error_msg, sizeof(ctx->error_msg), "Bad file handle");
+                return -1;
+            }
+            break;
+        case FN_FCLOSE:
+            if (script_fclose(ctx, (int)value_int(&args[0])) != 0) {
+                snprintf(ctx->error_msg, sizeof(ctx->error_msg), "Bad file handle");
+                return -1;
+            }
+            break;
+        case FN_GETTEXT:
+        case FN_GETFOLDER: {
+            int got = fn == FN_GETTEXT ? script_gettext(ctx, text[0], text[1], text[2])
+                                       : script_getfolder(ctx, text[0], text[1]);
+            /* Interned, so it outlives the call */
+            result->type = VAR_STRING;
+            result->string = got == 0 && ctx->gettext_result ? ctx->gettext_result : "";
+            break;
+        }
+        case FN_PRINT:
+            for (int i = 0; i < argc; i++) {
+                char num[32];
+                fputs(value_text(&args[i], num), stdout);
+            }
+            putchar('\n');
+            break;
+        case FN_LEN:
+            result->integer = (long)strlen(text[0]);
+            break;
+        case FN_STR:
+            *result = value_of_owned(str_dup(text[0]));
+            break;
+        case FN_VAL:
+            result->integer = value_int(&args[0]);
+            break;
+        case FN_CHR: {
+            /* chr(10) is a newline; strings have no escapes */
+            char *c = malloc(2);
+            if (c) {
+                c[0] = (char)value_int(&args[0]);
+                c[1] = '\0';
+            }
+            *result = value_of_owned(c);
+            break;
+        }
+        case FN_SPAWN: {
+            int id = script_spawn(ctx, text[0]);
+            if (id < 0) {
+                snprintf(ctx->error_msg, sizeof(ctx->error_msg), "Cannot start: %s", text[0]);
+                return -1;
+            }
+            result->integer = id;
+            break;
+        }
+        case FN_WAIT:
+        case FN_OUTPUT: {
+            if (argc == 0) {
+                result->integer = (long)script_jobs_wait(ctx, 0);
+                break;
+            }
+            ScriptJob *job = script_job(ctx, value_int(&args[0]));
+            if (!job) {
+                snprintf(ctx->error_msg, sizeof(ctx->error_msg), "No such job: %s", text[0]);
+                return -1;
+            }
+            int status = script_job_wait(ctx, job);
+            if (fn == FN_WAIT) {
+                result->integer = status;
+                break;
+            }
+            
+            /* Like $(...) in a shell: without the final newline */
+            const char *out = build_capture_text(&job->capture);
+            size_t len = job->capture.len;
+            while (len > 0 && (out[len - 1] == '\n' || out[len - 1] == '\r')) len--;
+            char *copy = malloc(len + 1);
+            if (copy) {
+                memcpy(copy, out, len);
+                copy[len] = '\0';
+            }
+            *result = value_of_owned(copy);
+            break;
+        }
+        case FN_PARALLEL:
+            ctx->in_block = 1;
+            ctx->block_start = ctx->job_count;
+            ctx->block_jobs = argc ? (int)value_int(&args[0]) : 0;
+            break;
+        case FN_ENDPARALLEL: {
+            /* Exit statuses in $1, $2, ... in the order the jobs started */
+            size_t failed = script_jobs_wait(ctx, ctx->block_start);
+            for (size_t i = ctx->block_start; i < ctx->job_count; i++) {
+                char name[32];
+                snprintf(name, sizeof(name), "$%zu", i - ctx->block_start + 1);
+                script_set_number(ctx, name, ctx->jobs[i]->status);
+            }
+            script_set_number(ctx, "$failed", (long)failed);
+            ctx->in_block = 0;
+            result->integer = (long)failed;
+            break;
+        }
+        case FN_GOTO:
+            script_goto(ctx, value_int(&args[0]), argc > 1 ? value_int(&args[1]) : 1);
+            break;
+        case FN_FIND:
+            result->integer = script_find(ctx, text[0]);
+            break;
+        case FN_REPLACE:
+            result->integer = script_replace(ctx, text[0], text[1]);
+            break;
+        case FN_INSERT:
+            script_insert(ctx, text[0]);
+            break;
+        case FN_DELETE:
+            result->integer = script_delete(ctx, argc ? value_int(&args[0]) : -1);
+            break;
+        case FN_SELECT:
+            script_select(ctx, value_int(&args[0]), argc > 1 ? value_int(&args[1]) : 1);
+            break;
+        case FN_SELECTION: {
+            size_t len;
+            char *sel = editor_get_selection(ctx->editor, &len);
+            *result = value_of_owned(sel ? sel : str_dup(""));
+            break;
+        }
+        case FN_CURRLINE:
+            script_sync_cursor(ctx);
+            result->integer = (long)ctx->editor->cursor_line;
+            break;
+        case FN_CURRCOL:
+            script_sync_cursor(ctx);
+            result->integer = (long)ctx->editor->cursor_col;
+            break;
+    }
     return 0;
 }
 
+int script_execute(ScriptContext *ctx, const ScriptProgram *prog) {
+    /* Bind names to variables once; later lookups are an array index */
+    ScriptVar **slots = calloc(prog->name_count ? prog->name_count : 1, sizeof(ScriptVar *));
+    if (!slots) return -1;
+    for (size_t i = 0; i < prog->name_count; i++) {
+        slots[i] = script_find_var(ctx, prog->names[i]);
+    }
+    
+    ScriptValue stack[SCRIPT_STACK_MAX];
+    size_t sp = 0;
+    const uint8_t *code = prog->code;
+    size_t pc = 0;
+    int result = 0;
+    
+    for (;;) {
+        size_t at = pc;
+        ScriptOp op = (ScriptOp)code[pc++];
+        uint32_t arg = 0;
+        if (OP_HAS_OPERAND(op)) {
+            memcpy(&arg, code + pc, sizeof(arg));
+            pc += sizeof(arg);
+        }
+        
+        switch (op) {
+            case OP_INT:
+                stack[sp++] = value_of_int((int32_t)arg);
+                break;
+            case OP_STR:
+                stack[sp].type = VAR_STRING;
+                stack[sp].string = prog->strings + arg;
+                stack[sp].owned = NULL;
+                sp++;
+                break;
+            case OP_LOAD: {
+                /* Builtins such as gettext can create variables mid-run */
+                if (!slots[arg]) slots[arg] = script_find_var(ctx, prog->names[arg]);
+                ScriptVar *var = slots[arg];
+                if (!var) {
+                    result = script_runtime_error(ctx, prog, at, "Undefined variable %s",
+                                                  prog->names[arg]);
+                    break;
+                }
+                if (var->type == VAR_INTEGER) {
+                    stack[sp] = value_of_int(var->value.integer);
+                } else {
+                    stack[sp].type = VAR_STRING;
+                    stack[sp].string = var->value.string;
+                    stack[sp].owned = NULL;
+                }
+                sp++;
+                break;
+            }
+            case OP_STORE:
+            case OP_DECL_INT:
+            case OP_DECL_STR: {
+                if (!slots[arg]) slots[arg] = script_find_var(ctx, prog->names[arg]);
+                if (!slots[arg]) {
+                    ScriptVarType type = op == OP_DECL_INT ? VAR_INTEGER
+                                       : op == OP_DECL_STR ? VAR_STRING : stack[sp - 1].type;
+                    slots[arg] = create_var(ctx, prog->names[arg], type);
+                    if (!slots[arg]) {
+                        result = script_runtime_error(ctx, prog, at, "Out of memory");
+                        break;
+                    }
+                }
+                if (op == OP_STORE && script_assign(ctx, slots[arg], &stack[--sp]) != 0) {
+                    result = script_runtime_error(ctx, prog, at, "Out of memory");
+                }
+                break;
+            }
+            case OP_JUMP:
+                pc = arg;
+                break;
+            case OP_JUMP_FALSE:
+                sp--;
+                if (!value_true(&stack[sp])) pc = arg;
+                value_release(&stack[sp]);
+                break;
+            case OP_CALL: {
+                int argc = (int)(arg >> 8);
+                ScriptValue *args = &stack[sp - (size_t)argc];
+                ScriptValue value;
+                int failed = script_call(ctx, (ScriptBuiltin)(arg & 0xff), args, argc, &value);
+                for (int i = 0; i < argc; i++) value_release(&args[i]);
+                sp -= (size_t)argc;
+                if (failed) {
+                    char msg[sizeof(ctx->error_msg)];
+                    memcpy(msg, ctx->error_msg, sizeof(msg));
+                    result = script_runtime_error(ctx, prog, at, "%s", msg);
+                    break;
+                }
+                stack[sp++] = value;
+                break;
+            }
+            case OP_ADD: {
+                ScriptValue *l = &stack[sp - 2], *r = &stack[sp - 1];
+                if (l->type == VAR_INTEGER && r->type == VAR_INTEGER) {
+                    l->integer += r->integer;
+                    sp--;
+                    break;
+                }
+                
+                /* Either side a string: concatenate */
+                char lb[32], rb[32];
+                const char *ls = value_text(l, lb), *rs = value_text(r, rb);
+                size_t ll = strlen(ls), rl = strlen(rs);
+                char *s = malloc(ll + rl + 1);
+                if (!s) {
+                    result = script_runtime_error(ctx, prog, at, "Out of memory");
+                    break;
+                }
+                memcpy(s, ls, ll);
+                memcpy(s + ll, rs, rl + 1);
+                value_release(l);
+                value_release(r);
+                *l = value_of_owned(s);
+                sp--;
+                break;
+            }
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_MOD:
+            case OP_AND:
+            case OP_OR: {
+                ScriptValue *l = &stack[sp - 2], *r = &stack[sp - 1];
+                long a = op == OP_AND || op == OP_OR ? value_true(l) : value_int(l);
+                long b = op == OP_AND || op == OP_OR ? value_true(r) : value_int(r);
+                if ((op == OP_DIV || op == OP_MOD) && b == 0) {
+                    result = script_runtime_error(ctx, prog, at, "Division by zero");
+                    break;
+                }
+                long n = op == OP_SUB ? a - b : op == OP_MUL ? a * b : op == OP_DIV ? a / b
+                       : op == OP_MOD ? a % b : op == OP_AND ? (a && b) : (a || b);
+                value_release(l);
+                value_release(r);
+                *l = value_of_int(n);
+                sp--;
+                break;
+            }
+            case OP_EQ:
+            case OP_NE:
+            case OP_LT:
+            case OP_LE:
+            case OP_GT:
+            case OP_GE: {
+                ScriptValue *l = &stack[sp - 2], *r = &stack[sp - 1];
+                int cmp;
+                if (l->type == VAR_STRING && r->type == VAR_STRING) {
+                    cmp = strcmp(l->string, r->string);
+                } else {
+                    long a = value_int(l), b = value_int(r);
+                    cmp = a < b ? -1 : a > b;
+                }
+                int truth = op == OP_EQ ? cmp == 0 : op == OP_NE ? cmp != 0
+                          : op == OP_LT ? cmp < 0 : op == OP_LE ? cmp <= 0
+                          : op == OP_GT ? cmp > 0 : cmp >= 0;
+                value_release(l);
+                value_release(r);
+                *l = value_of_int(truth);
+                sp--;
+                break;
+            }
+            case OP_NEG:
+            case OP_NOT: {
+                ScriptValue *v = &stack[sp - 1];
+                long n = op == OP_NEG ? -value_int(v) : !value_true(v);
+                value_release(v);
+                *v = value_of_int(n);
+                break;
+            }
+            case OP_POP:
+                value_release(&stack[--sp]);
+                break;
+            case OP_HALT:
+                result = 1;
+                break;
+            case OP_RETURN:
+                break;
+        }
+        if (result != 0 || op == OP_RETURN) break;
+    }
+    
+    /* The script's jobs finish with it; after an error they are stopped */
+    if (ctx->jobs_running > 0) {
+        if (result < 0) script_jobs_cancel(ctx);
+        script_jobs_wait(ctx, 0);
+    }
+    ctx->in_block = 0;
+    
+    /* The run's edits become one undo step */
+    if (ctx->editing) {
+        script_sync_cursor(ctx);
+        editor_end_batch(ctx->editor);
+        ctx->editing = 0;
+    }
+    
+    while (sp > 0) value_release(&stack[--sp]);
+    free(slots);
+    return result;
+}
+
+/* ==========================================================================
+ * Running scripts
+ * ========================================================================== */
+
+/* Compiled files, reused while the file's mtime and size are unchanged.
+ * Shared by every context, so it is locked; a program evicted while a
+ * script is still running it is freed when that run releases it. */
+#define SCRIPT_CACHE_SIZE 16
+
+typedef struct ScriptCacheEntry {
+    char path[260];
+    time_t mtime;
+    long long size;
+    unsigned long used;             /* For evicting the least recently used */
+    ScriptProgram *prog;
+} ScriptCacheEntry;
+
+static ScriptCacheEntry script_cache[SCRIPT_CACHE_SIZE];
+static unsigned long script_cache_clock;
+
+#ifdef _WIN32
+#define script_cache_lock() ((void)0)
+#define script_cache_unlock() ((void)0)
+#else
+static pthread_mutex_t script_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define script_cache_lock() pthread_mutex_lock(&script_cache_mutex)
+#define script_cache_unlock() pthread_mutex_unlock(&script_cache_mutex)
+#endif
+
+/* Called with the cache locked */
+static void script_cache_drop(ScriptCacheEntry *e) {
+    if (!e->prog) return;
+    e->prog->cached = 0;
+    if (e->prog->refs == 0) script_program_free(e->prog);
+    e->prog = NULL;
+}
+
+void script_cache_clear(void) {
+    script_cache_lock();
+    for (int i = 0; i < SCRIPT_CACHE_SIZE; i++) {
+        script_cache_drop(&script_cache[i]);
+    }
+    memset(script_cache, 0, sizeof(script_cache));
+    script_cache_unlock();
+}
+
+static void script_release(ScriptProgram *prog) {
+    script_cache_lock();
+    prog->refs--;
+    int unused = prog->refs == 0 && !prog->cached;
+    script_cache_unlock();
+    if (unused) script_program_free(prog);
+}
+
+/* Compiled program for path, from the cache when the file is unchanged.
+ * The caller releases it with script_release. */
+static ScriptProgram *script_load(ScriptContext *ctx, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        snprintf(ctx->error_msg, sizeof(ctx->error_msg), "Cannot open script: %s", path);
+        return NULL;
+    }
+    
+    script_cache_lock();
+    for (int i = 0; i < SCRIPT_CACHE_SIZE; i++) {
+        ScriptCacheEntry *e = &script_cache[i];
+        if (e->prog && strcmp(e->path, path) == 0 && e->mtime == st.st_mtime &&
+            e->size == (long long)st.st_size) {
+            ScriptProgram *prog = e->prog;
+            e->used = ++script_cache_clock;
+            prog->refs++;
+            script_cache_unlock();
+            return prog;
+        }
+    }
+    script_cache_unlock();
+    
+    /* Compile without holding the lock */
+    size_t len;
+    char *source = file_read_all(path, &len);
+    if (!source) {
+        snprintf(ctx->error_msg, sizeof(ctx->error_msg), "Cannot open script: %s", path);
+        return NULL;
+    }
+    char error[192];
+    ScriptProgram *prog = script_compile(source, len, error, sizeof(error));
+    free(source);
+    if (!prog) {
+        snprintf(ctx->error_msg, sizeof(ctx->error_msg), "%s: %s", path, error);
+        return NULL;
+    }
+    
+    /* Replace the file's old entry, or the least recently used one */
+    script_cache_lock();
+    ScriptCacheEntry *slot = &script_cache[0];
+    for (int i = 0; i < SCRIPT_CACHE_SIZE; i++) {
+        ScriptCacheEntry *e = &script_cache[i];
+        if (e->prog && strcmp(e->path, path) == 0) {
+            slot = e;
+            break;
+        }
+        if (e->used < slot->used) slot = e;
+    }
+    script_cache_drop(slot);
+    strncpy(slot->path, path, sizeof(slot->path) - 1);
+    slot->path[sizeof(slot->path) - 1] = '\0';
+    slot->mtime = st.st_mtime;
+    slot->size = (long long)st.st_size;
+    slot->used = ++script_cache_clock;
+    slot->prog = prog;
+    prog->cached = 1;
+    prog->refs = 1;
+    script_cache_unlock();
+    return prog;
+}
+
+int script_run_line(ScriptContext *ctx, const char *line) {
+    char error[192];
+    ScriptProgram *prog = script_compile(line, strlen(line), error, sizeof(error));
+    if (!prog) {
+        snprintf(ctx->error_msg, sizeof(ctx->error_msg), "%s", error);
+        ctx->error = 1;
+        return -1;
+    }
+    int result = script_execute(ctx, prog);
+    script_program_free(prog);
+    return result;
+}
+
+int script_run_file(ScriptContext *ctx, const char *path) {
+    ScriptProgram *prog = script_load(ctx, path);
+    if (!prog) {
+        ctx->error = 1;
+        return -1;
+    }
+    
+    int result = script_execute(ctx, prog);
+    script_release(prog);
+    if (result < 0) {
+        char msg[sizeof(ctx->error_msg)];
+        memcpy(msg, ctx->error_msg, sizeof(msg));
+        
+        /* Without room for the path, the message alone says more */
+        int len = snprintf(ctx->error_msg, sizeof(ctx->error_msg), "%s: %s", path, msg);
+        if (len < 0 || len >= (int)sizeof(ctx->error_msg)) {
+            memcpy(ctx->error_msg, msg, sizeof(msg));
+        }
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,659 @@
+/*
+ * symindex.c - Project-wide symbol index
+ *
+ * Definitions are extracted line by line from the syntax_tokenize_line
+ * token stream: C function definitions and #defines, MASM proc/macro/equ
+ * and assembly labels. The index is rebuilt incrementally: files whose
+ * size and mtime are unchanged keep their symbols from the previous index
+ * without being read.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+#include "symindex.h"
+#include "syntax.h"
+#include "parallel.h"
+#include "util.h"
+
+#define SYM_MAX_TOKENS 128
+#define SYM_MAX_NAME   256
+
+/* Symbols found in one source file (names packed in one buffer) */
+typedef struct SymEntry {
+    uint32_t name;          /* Offset into SymList.names */
+    uint32_t line;
+    uint32_t kind;
+} SymEntry;
+
+typedef struct SymList {
+    SymEntry *items;
+    size_t count;
+    size_t capacity;
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+} SymList;
+
+typedef struct SymSource {
+    char *path;
+    uint64_t size;
+    int64_t mtime;
+    Language lang;
+    int reused;             /* Symbols copied from the previous index */
+    SymList syms;
+} SymSource;
+
+typedef struct SymSourceSet {
+    SymSource *items;
+    size_t count;
+    size_t capacity;
+} SymSourceSet;
+
+/* Line scanner state (C definitions may span several lines) */
+typedef struct SymScan {
+    SymList *out;
+    char pending[SYM_MAX_NAME];
+    uint32_t pending_line;
+    int has_pending;
+} SymScan;
+
+static int symlist_add(SymList *list, const char *name, size_t name_len,
+                       uint32_t line, SymbolKind kind) {
+    if (name_len == 0) return 0;
+    if (name_len >= SYM_MAX_NAME) name_len = SYM_MAX_NAME - 1;
+    
+    if (list->count >= list->capacity) {
+        size_t new_cap = list->capacity ? list->capacity * 2 : 16;
+        SymEntry *items = realloc(list->items, new_cap * sizeof(SymEntry));
+        if (!items) return -1;
+        list->items = items;
+        list->capacity = new_cap;
+    }
+    if (list->names_len + name_len + 1 > list->names_cap) {
+        size_t new_cap = list->names_cap ? list->names_cap * 2 : 256;
+        while (new_cap < list->names_len + name_len + 1) new_cap *= 2;
+        char *names = realloc(list->names, new_cap);
+        if (!names) return -1;
+        list->names = names;
+        list->names_cap = new_cap;
+    }
+    
+    SymEntry *e = &list->items[list->count++];
+    e->name = (uint32_t)list->names_len;
+    e->line = line;
+    e->kind = (uint32_t)kind;
+    memcpy(list->names + list->names_len, name, name_len);
+    list->names[list->names_len + name_len] = '\0';
+    list->names_len += name_len + 1;
+    return 0;
+}
+
+static void symlist_free(SymList *list) {
+    free(list->items);
+    free(list->names);
+    memset(list, 0, sizeof(*list));
+}
+
+/* ---- Extraction ---- */
+
+static int tok_is(const char *line, const SyntaxToken *tok, const char *word) {
+    size_t n = strlen(word);
+    return tok->length == n && strncasecmp(line + tok->start, word, n) == 0;
+}
+
+static int tok_is_op(const char *line, const SyntaxToken *tok, char c) {
+    return tok->type == TOK_OPERATOR && line[tok->start] == c;
+}
+
+static int tok_is_name(const SyntaxToken *tok) {
+    return tok->type == TOK_IDENTIFIER;
+}
+
+/* Words that start a column-0 C line but never a function definition */
+static const char *c_not_definition[] = {
+    "typedef", "return", "if", "else", "while", "for", "switch", "do",
+    "case", "goto", "extern",
+    NULL
+};
+
+static void scan_c_line(SymScan *sc, const char *line,
+                        const SyntaxToken *tok, int n, uint32_t line_no) {
+    int has_semicolon = 0;
+    for (int t = 0; t < n; t++) {
+        if (tok_is_op(line, &tok[t], ';')) has_semicolon = 1;
+    }
+    
+    /* Signature continued from an earlier line: indented parameter lines
+     * until the opening brace, or a prototype ending in ';' */
+    if (sc->has_pending) {
+        int has_brace = 0;
+        for (int t = 0; t < n; t++) {
+            if (tok_is_op(line, &tok[t], '{')) has_brace = 1;
+        }
+        
+        if (has_semicolon || (tok[0].start == 0 && !tok_is_op(line, &tok[0], '{'))) {
+            sc->has_pending = 0;
+        } else if (has_brace) {
+            symlist_add(sc->out, sc->pending, strlen(sc->pending),
+                        sc->pending_line, SYM_FUNCTION);
+            sc->has_pending = 0;
+            return;
+        }
+    }
+    
+    /* Definitions start in column 0 with a type or storage class */
+    if (tok[0].start != 0) return;
+    if (tok[0].type != TOK_IDENTIFIER && tok[0].type != TOK_KEYWORD) return;
+    for (int i = 0; c_not_definition[i]; i++) {
+        if (tok_is(line, &tok[0], c_not_definition[i])) return;
+    }
+    
+    int paren = -1;
+    for (int t = 1; t < n; t++) {
+        if (tok_is_op(line, &tok[t], '=')) return;
+        if (tok_is_op(line, &tok[t], '(')) {
+            if (tok_is_name(&tok[t-1])) paren = t;
+            break;
+        }
+    }
+    if (paren < 0 || has_semicolon) return;
+    
+    const SyntaxToken *name = &tok[paren - 1];
+    for (int t = paren + 1; t < n; t++) {
+        if (tok_is_op(line, &tok[t], '{')) {
+            symlist_add(sc->out, line + name->start, name->length,
+                        line_no, SYM_FUNCTION);
+            sc->has_pending = 0;
+            return;
+        }
+    }
+    
+    /* Signature continues or the brace is on the next line */
+    size_t len = name->length < SYM_MAX_NAME ? name->length : SYM_MAX_NAME - 1;
+    memcpy(sc->pending, line + name->start, len);
+    sc->pending[len] = '\0';
+    sc->pending_line = line_no;
+    sc->has_pending = 1;
+}
+
+static void scan_asm_line(SymScan *sc, Language lang, const char *line,
+                          const SyntaxToken *tok, int n, uint32_t line_no) {
+    if (n < 2) return;
+    
+    /* name: (MASM also allows name::) */
+    if (tok_is_name(&tok[0]) && tok_is_op(line, &tok[1], ':') &&
+        tok[1].start == tok[0].start + tok[0].length) {
+        /* Skip GNU as local labels (.L*) */
+        if (!(tok[0].length > 2 && line[tok[0].start] == '.' &&
+              line[tok[0].start + 1] == 'L')) {
+            symlist_add(sc->out, line + tok[0].start, tok[0].length,
+                        line_no, SYM_LABEL);
+        }
+        return;
+    }
+    
+    if (lang == LANG_MASM64 || lang == LANG_MASM32) {
+        if (tok[0].start != 0 || !tok_is_name(&tok[0])) return;
+        
+        SymbolKind kind = 0;
+        if (tok_is(line, &tok[1], "proc")) kind = SYM_PROC;
+        else if (tok_is(line, &tok[1], "macro")) kind = SYM_MACRO;
+        else if (tok_is(line, &tok[1], "equ")) kind = SYM_DEFINE;
+        
+        if (kind) {
+            symlist_add(sc->out, line + tok[0].start, tok[0].length,
+                        line_no, kind);
+        }
+    } else if (tok_is(line, &tok[0], ".set") || tok_is(line, &tok[0], ".equ")) {
+        if (tok_is_name(&tok[1])) {
+            symlist_add(sc->out, line + tok[1].start, tok[1].length,
+                        line_no, SYM_DEFINE);
+        }
+    }
+}
+
+static void scan_line(SymScan *sc, Language lang, const char *line,
+                      size_t len, uint32_t line_no) {
+    SyntaxToken tok[SYM_MAX_TOKENS];
+    int n = syntax_tokenize_line(lang, line, len, tok, SYM_MAX_TOKENS);
+    if (n <= 0) return;
+    
+    /* #define NAME (C and preprocessed assembly) */
+    if (n >= 3 && tok_is_op(line, &tok[0], '#') &&
+        tok_is(line, &tok[1], "define") && tok_is_name(&tok[2])) {
+        symlist_add(sc->out, line + tok[2].start, tok[2].length,
+                    line_no, SYM_DEFINE);
+        return;
+    }
+    if (tok_is_op(line, &tok[0], '#')) return;
+    
+    if (lang == LANG_COSMO_C) {
+        scan_c_line(sc, line, tok, n, line_no);
+    } else {
+        scan_asm_line(sc, lang, line, tok, n, line_no);
+    }
+}
+
+static void scan_source(SymSource *src) {
+    size_t len;
+    char *text = file_map(src->path, &len);
+    if (!text) return;
+    
+    src->lang = syntax_detect_language_content(src->path, text, len);
+    
+    SymScan sc;
+    memset(&sc, 0, sizeof(sc));
+    sc.out = &src->syms;
+    
+    size_t pos = 0;
+    uint32_t line_no = 1;
+    while (pos < len) {
+        const char *nl = memchr(text + pos, '\n', len - pos);
+        size_t line_len = nl ? (size_t)(nl - (text + pos)) : len - pos;
+        scan_line(&sc, src->lang, text + pos, line_len, line_no++);
+        pos += line_len + 1;
+    }
+    
+    file_unmap(text, len);
+}
+
+static void scan_worker(size_t index, void *ctx) {
+    SymSource **todo = ctx;
+    scan_source(todo[index]);
+}
+
+/* ---- Project walk ---- */
+
+static int sources_add(SymSourceSet *set, const char *path,
+                       uint64_t size, int64_t mtime) {
+    if (set->count >= set->capacity) {
+        size_t new_cap = set->capacity ? set->capacity * 2 : 256;
+        SymSource *items = realloc(set->items, new_cap * sizeof(SymSource));
+        if (!items) return -1;
+        set->items = items;
+        set->capacity = new_cap;
+    }
+    
+    SymSource *src = &set->items[set->count];
+    memset(src, 0, sizeof(*src));
+    src->path = str_dup(path);
+    if (!src->path) return -1;
+    src->size = size;
+    src->mtime = mtime;
+    set->count++;
+    return 0;
+}
+
+static void sources_walk(SymSourceSet *set, const char *dir) {
+#ifndef _WIN32
+    DIR *d = opendir(dir);
+    if (!d) return;
+    
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        
+        char path[1024];
+        int n = snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (n < 0 || n >= (int)sizeof(path)) continue;
+        
+        /* Follow links to files, but not to directories: they may loop */
+        struct stat st;
+        if (lstat(path, &st) != 0) continue;
+        int is_link = S_ISLNK(st.st_mode);
+        if (is_link && stat(path, &st) != 0) continue;
+        
+        if (S_ISDIR(st.st_mode)) {
+            if (is_link) continue;
+            sources_walk(set, path);
+        } else if (S_ISREG(st.st_mode) &&
+                   syntax_detect_language(entry->d_name) != LANG_NONE) {
+            sources_add(set, path, (uint64_t)st.st_size, (int64_t)st.st_mtime);
+        }
+    }
+    
+    closedir(d);
+#else
+    (void)set;
+    (void)dir;
+#endif
+}
+
+/* Open-addressed path -> old file index table */
+static uint32_t path_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void reuse_old_index(SymSourceSet *set, SymIndex *old) {
+    uint32_t nfiles = old->header->file_count;
+    if (nfiles == 0) return;
+    
+    size_t slots = 16;
+    while (slots < (size_t)nfiles * 2) slots *= 2;
+    
+    uint32_t *table = malloc(slots * sizeof(uint32_t));
+    int32_t *old_to_src = malloc(nfiles * sizeof(int32_t));
+    if (!table || !old_to_src) {
+        free(table);
+        free(old_to_src);
+        return;
+    }
+    memset(table, 0xff, slots * sizeof(uint32_t));
+    
+    for (uint32_t f = 0; f < nfiles; f++) {
+        size_t h = path_hash(old->strings + old->files[f].path) & (slots - 1);
+        while (table[h] != UINT32_MAX) h = (h + 1) & (slots - 1);
+        table[h] = f;
+        old_to_src[f] = -1;
+    }
+    
+    /* Match unchanged files by path, size and mtime */
+    for (size_t i = 0; i < set->count; i++) {
+        SymSource *src = &set->items[i];
+        size_t h = path_hash(src->path) & (slots - 1);
+        while (table[h] != UINT32_MAX) {
+            const SymFileRec *rec = &old->files[table[h]];
+            if (strcmp(old->strings + rec->path, src->path) == 0) {
+                if (rec->size == src->size && rec->mtime == src->mtime) {
+                    src->reused = 1;
+                    src->lang = (Language)rec->language;
+                    old_to_src[table[h]] = (int32_t)i;
+                }
+                break;
+            }
+            h = (h + 1) & (slots - 1);
+        }
+    }
+    
+    /* Copy the symbols of reused files in one pass over the old table */
+    for (uint32_t s = 0; s < old->header->symbol_count; s++) {
+        const SymRec *rec = &old->symbols[s];
+        if (rec->file >= nfiles || old_to_src[rec->file] < 0) continue;
+        
+        const char *name = old->strings + rec->name;
+        symlist_add(&set->items[old_to_src[rec->file]].syms, name,
+                    strlen(name), rec->line, (SymbolKind)rec->kind);
+    }
+    
+    free(table);
+    free(old_to_src);
+}
+
+/* ---- Writing ---- */
+
+typedef struct SymSort {
+    const char *name;
+    uint32_t file;
+    uint32_t line;
+    uint32_t kind;
+} SymSort;
+
+static int symsort_cmp(const void *a, const void *b) {
+    const SymSort *x = a;
+    const SymSort *y = b;
+    int c = strcmp(x->name, y->name);
+    if (c) return c;
+    if (x->file != y->file) return x->file < y->file ? -1 : 1;
+    return x->line < y->line ? -1 : (x->line > y->line);
+}
+
+static int write_index(SymSourceSet *set, const char *index_path,
+                       size_t *symbol_count) {
+    size_t total = 0;
+    size_t strings_size = 0;
+    for (size_t i = 0; i < set->count; i++) {
+        total += set->items[i].syms.count;
+        strings_size += strlen(set->items[i].path) + 1 + set->items[i].syms.names_len;
+    }
+    if (strings_size > UINT32_MAX) return -1;
+    
+    SymSort *sorted = malloc((total ? total : 1) * sizeof(SymSort));
+    SymFileRec *files = malloc((set->count ? set->count : 1) * sizeof(SymFileRec));
+    SymRec *recs = malloc((total ? total : 1) * sizeof(SymRec));
+    char *strings = malloc(strings_size ? strings_size : 1);
+    if (!sorted || !files || !recs || !strings) {
+        free(sorted);
+        free(files);
+        free(recs);
+        free(strings);
+        return -1;
+    }
+    
+    size_t n = 0;
+    size_t str_len = 0;
+    for (size_t i = 0; i < set->count; i++) {
+        SymSource *src = &set->items[i];
+        size_t plen = strlen(src->path) + 1;
+        
+        files[i].path = (uint32_t)str_len;
+        files[i].language = (uint32_t)src->lang;
+        files[i].size = src->size;
+        files[i].mtime = src->mtime;
+        memcpy(strings + str_len, src->path, plen);
+        str_len += plen;
+        
+        for (size_t s = 0; s < src->syms.count; s++) {
+            sorted[n].name = src->syms.names + src->syms.items[s].name;
+            sorted[n].file = (uint32_t)i;
+            sorted[n].line = src->syms.items[s].line;
+            sorted[n].kind = src->syms.items[s].kind;
+            n++;
+        }
+    }
+    
+    qsort(sorted, n, sizeof(SymSort), symsort_cmp);
+    
+    /* Equal names are adjacent after sorting and share one string */
+    uint32_t last_off = 0;
+    for (size_t s = 0; s < n; s++) {
+        if (s == 0 || strcmp(sorted[s].name, sorted[s-1].name) != 0) {
+            size_t len = strlen(sorted[s].name) + 1;
+            last_off = (uint32_t)str_len;
+            memcpy(strings + str_len, sorted[s].name, len);
+            str_len += len;
+        }
+        recs[s].name = last_off;
+        recs[s].file = sorted[s].file;
+        recs[s].line = sorted[s].line;
+        recs[s].kind = sorted[s].kind;
+    }
+    
+    SymIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SYMINDEX_MAGIC, 8);
+    header.version = SYMINDEX_VERSION;
+    header.file_count = (uint32_t)set->count;
+    header.symbol_count = (uint32_t)n;
+    header.strings_size = str_len;
+    
+    /* Write to a temporary file and rename so readers never see a torn index */
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", index_path);
+    
+    int result = -1;
+    FILE *f = fopen(tmp_path, "wb");
+    if (f) {
+        int ok = fwrite(&header, sizeof(header), 1, f) == 1;
+        if (ok && set->count) ok = fwrite(files, sizeof(SymFileRec), set->count, f) == set->count;
+        if (ok && n) ok = fwrite(recs, sizeof(SymRec), n, f) == n;
+        if (ok && str_len) ok = fwrite(strings, 1, str_len, f) == str_len;
+        if (fclose(f) != 0) ok = 0;
+        
+        if (ok && rename(tmp_path, index_path) == 0) {
+            result = 0;
+        } else {
+            remove(tmp_path);
+        }
+    }
+    
+    if (symbol_count) *symbol_count = n;
+    free(sorted);
+    free(files);
+    free(recs);
+    free(strings);
+    return result;
+}
+
+int symindex_update(const char *project_dir, const char *index_path,
+                    int threads, SymIndexStats *stats) {
+    if (!project_dir || !index_path) return -1;
+    
+    double start = time_now();
+    SymSourceSet set;
+    memset(&set, 0, sizeof(set));
+    
+    sources_walk(&set, project_dir);
+    
+    SymIndex *old = symindex_open(index_path);
+    if (old) {
+        reuse_old_index(&set, old);
+        symindex_close(old);
+    }
+    
+    /* Tokenize new and changed files in parallel */
+    SymSource **todo = malloc((set.count ? set.count : 1) * sizeof(SymSource *));
+    size_t todo_count = 0;
+    if (todo) {
+        for (size_t i = 0; i < set.count; i++) {
+            if (!set.items[i].reused) todo[todo_count++] = &set.items[i];
+        }
+        parallel_for(todo_count, threads, scan_worker, todo);
+        free(todo);
+    }
+    
+    size_t symbols = 0;
+    int result = todo ? write_index(&set, index_path, &symbols) : -1;
+    
+    if (stats) {
+        stats->files = set.count;
+        stats->scanned = todo_count;
+        stats->reused = set.count - todo_count;
+        stats->symbols = symbols;
+        stats->seconds = time_now() - start;
+    }
+    
+    for (size_t i = 0; i < set.count; i++) {
+        free(set.items[i].path);
+        symlist_free(&set.items[i].syms);
+    }
+    free(set.items);
+    return result;
+}
+
+/* ---- Lookup ---- */
+
+SymIndex *symindex_open(const char *index_path) {
+    size_t size;
+    char *data = file_map(index_path, &size);
+    if (!data) return NULL;
+    
+    const SymIndexHeader *header = (const SymIndexHeader *)data;
+    if (size < sizeof(*header) || memcmp(header->magic, SYMINDEX_MAGIC, 8) != 0 ||
+        header->version > SYMINDEX_VERSION) {
+        file_unmap(data, size);
+        return NULL;
+    }
+    
+    size_t tables = sizeof(*header) +
+                    (size_t)header->file_count * sizeof(SymFileRec) +
+                    (size_t)header->symbol_count * sizeof(SymRec);
+    if (tables > size || size - tables < header->strings_size) {
+        file_unmap(data, size);
+        return NULL;
+    }
+    
+    /* Check every offset once here so lookups can trust the tables: the
+     * string table ends in a NUL, so any offset inside it is a string */
+    const SymFileRec *files = (const SymFileRec *)(data + sizeof(*header));
+    const SymRec *symbols = (const SymRec *)(files + header->file_count);
+    const char *strings = (const char *)(symbols + header->symbol_count);
+    uint64_t str_size = header->strings_size;
+    int valid = str_size == 0 ? header->file_count == 0 && header->symbol_count == 0
+                              : strings[str_size - 1] == '\0';
+    for (uint32_t f = 0; valid && f < header->file_count; f++) {
+        valid = files[f].path < str_size;
+    }
+    for (uint32_t s = 0; valid && s < header->symbol_count; s++) {
+        valid = symbols[s].name < str_size && symbols[s].file < header->file_count;
+    }
+    
+    SymIndex *idx = valid ? calloc(1, sizeof(SymIndex)) : NULL;
+    if (!idx) {
+        file_unmap(data, size);
+        return NULL;
+    }
+    
+    idx->data = data;
+    idx->size = size;
+    idx->header = header;
+    idx->files = files;
+    idx->symbols = symbols;
+    idx->strings = strings;
+    return idx;
+}
+
+void symindex_close(SymIndex *idx) {
+    if (idx) {
+        file_unmap(idx->data, idx->size);
+        free(idx);
+    }
+}
+
+size_t symindex_find(SymIndex *idx, const char *name,
+                     SymbolMatch *out, size_t max) {
+    if (!idx || !name) return 0;
+    
+    /* Lower bound binary search over the name-sorted table */
+    size_t lo = 0;
+    size_t hi = idx->header->symbol_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(idx->strings + idx->symbols[mid].name, name) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    size_t found = 0;
+    for (size_t s = lo; s < idx->header->symbol_count; s++) {
+        const SymRec *rec = &idx->symbols[s];
+        if (strcmp(idx->strings + rec->name, name) != 0) break;
+        
+        if (found < max && out) {
+            out[found].name = idx->strings + rec->name;
+            out[found].file = idx->strings + idx->files[rec->file].path;
+            out[found].line = rec->line;
+            out[found].kind = (SymbolKind)rec->kind;
+        }
+        found++;
+    }
+    return found;
+}
+
+const char *symindex_kind_name(SymbolKind kind) {
+    switch (kind) {
+        case SYM_FUNCTION: return "function";
+        case SYM_PROC:     return "proc";
+        case SYM_MACRO:    return "macro";
+        case SYM_LABEL:    return "label";
+        case SYM_DEFINE:   return "define";
+        default:           return "symbol";
+    }
+}
+
+void symindex_get_path(const char *project_dir, char *out, size_t out_size) {
+    path_join(out, out_size, project_dir, SYMINDEX_FILE);
+}
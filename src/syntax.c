@@ -76,6 +76,31 @@ static const char *masm_directives[] = {
     NULL
 };
 
+/* GNU as directives */
+static const char *gas_directives[] = {
+    ".text", ".globl", ".global", ".section", ".type", ".size", ".align",
+    ".p2align", ".balign", ".quad", ".long", ".asciz", ".ascii", ".bss",
+    ".rodata", ".intel_syntax", ".att_syntax", ".arch", ".cfi_startproc",
+    ".cfi_endproc", ".file", ".ident",
+    NULL
+};
+
+/* Words only MASM uses, counted as evidence when detecting the dialect.
+ * Operand words (ptr, offset, qword...) and conditionals also appear in
+ * GNU as Intel syntax, C and macro text, so they do not count. */
+static const char *masm_evidence[] = {
+    ".code", ".data", ".const", ".data?", ".stack",
+    "proc", "endp", "includelib", "invoke", "macro", "endm",
+    NULL
+};
+
+/* MASM32-only processor and model directives */
+static const char *masm32_directives[] = {
+    ".386", ".386p", ".486", ".486p", ".586", ".586p", ".686", ".686p",
+    ".model", ".mmx", ".xmm", "flat", "stdcall",
+    NULL
+};
+
 static int is_keyword(const char *word, const char **list) {
     for (int i = 0; list[i]; i++) {
         if (strcasecmp(word, list[i]) == 0) return 1;
@@ -83,6 +108,43 @@ static int is_keyword(const char *word, const char **list) {
     return 0;
 }
 
+/* AArch64 general-purpose registers: x0-x30, w0-w30 and zero registers */
+static int is_aarch64_gpr(const char *word) {
+    char c = (char)tolower((unsigned char)word[0]);
+    if ((c == 'x' || c == 'w') && isdigit((unsigned char)word[1])) {
+        const char *p = word + 1;
+        int n = 0;
+        while (isdigit((unsigned char)*p)) n = n * 10 + (*p++ - '0');
+        return *p == '\0' && p - word <= 3 && n <= 30;
+    }
+    return strcasecmp(word, "xzr") == 0 || strcasecmp(word, "wzr") == 0 ||
+           strcasecmp(word, "wsp") == 0;
+}
+
+/* AArch64 load/store pair and address mnemonics with no x86 namesake,
+ * counted as evidence when detecting the dialect */
+static const char *aarch64_evidence[] = {
+    "ldr", "ldrb", "ldrh", "ldur", "ldp", "stp", "stur", "adrp",
+    "cbz", "cbnz", "movz", "movk",
+    NULL
+};
+
+/* AArch64 registers including SIMD/FP views (v0-v31, q/d/s/h/b0-b31) */
+static int is_aarch64_register(const char *word) {
+    if (is_aarch64_gpr(word) || strcasecmp(word, "sp") == 0 ||
+        strcasecmp(word, "lr") == 0 || strcasecmp(word, "fp") == 0) {
+        return 1;
+    }
+    
+    char c = (char)tolower((unsigned char)word[0]);
+    if (!strchr("vqdshb", c) || !isdigit((unsigned char)word[1])) return 0;
+    
+    const char *p = word + 1;
+    int n = 0;
+    while (isdigit((unsigned char)*p)) n = n * 10 + (*p++ - '0');
+    return *p == '\0' && p - word <= 3 && n <= 31;
+}
+
 int syntax_tokenize_line(Language lang, const char *line, size_t len,
                          SyntaxToken *tokens, size_t max_tokens) {
     size_t token_count = 0;
@@ -163,6 +225,8 @@ int syntax_tokenize_line(Language lang, const char *line, size_t len,
             } else if ((lang == LANG_AMD64 || lang == LANG_MASM64 || lang == LANG_MASM32) 
                        && is_keyword(word, amd64_registers)) {
                 tok->type = TOK_REGISTER;
+            } else if (lang == LANG_AARCH64 && is_aarch64_register(word)) {
+                tok->type = TOK_REGISTER;
             } else if ((lang == LANG_MASM64 || lang == LANG_MASM32)
                        && is_keyword(word, masm_directives)) {
                 tok->type = TOK_DIRECTIVE;
@@ -184,3 +248,89 @@ int syntax_tokenize_line(Language lang, const char *line, size_t len,
     return (int)token_count;
 }
 
+
+/* Evidence gathered from a content sample */
+typedef struct DetectStats {
+    int masm;       /* MASM directives (.code, proc, endp, invoke...) */
+    int masm32;     /* MASM32 processor/model directives (.686, .model) */
+    int gas;        /* GNU as directives (.text, .globl, .section...) */
+    int x86_64;     /* 64-bit x86 registers (rax, r8...) */
+    int x86_32;     /* 32/16/8-bit x86 registers (eax, ax, al...) */
+    int aarch64;    /* AArch64 operands and mnemonics (x0, w0, ldr, stp...) */
+} DetectStats;
+
+static void detect_scan_line(const char *line, size_t len, DetectStats *st) {
+    SyntaxToken tokens[128];
+    
+    /* Tokenize language-neutrally so comment syntax is handled here */
+    int count = syntax_tokenize_line(LANG_NONE, line, len, tokens, 128);
+    
+    for (int t = 0; t < count; t++) {
+        SyntaxToken *tok = &tokens[t];
+        const char *w = line + tok->start;
+        
+        if (tok->type == TOK_OPERATOR) {
+            /* ';' (MASM), '//' (GNU as), '#' at line start. '@' is not a
+             * comment here: x86 GNU as writes @function and MASM @@ */
+            if (*w == ';') break;
+            if (*w == '#' && t == 0) break;
+            if (*w == '/' && t + 1 < count &&
+                tokens[t+1].start == tok->start + 1 && w[1] == '/') break;
+            continue;
+        }
+        if (tok->type != TOK_IDENTIFIER || tok->length >= 32) continue;
+        
+        char word[32];
+        memcpy(word, w, tok->length);
+        word[tok->length] = '\0';
+        
+        if (is_keyword(word, masm32_directives)) {
+            st->masm32++;
+            st->masm++;
+        } else if (is_keyword(word, masm_evidence)) {
+            st->masm++;
+        } else if (is_keyword(word, gas_directives)) {
+            st->gas++;
+        } else if (is_keyword(word, amd64_registers)) {
+            if (tolower((unsigned char)word[0]) == 'r') st->x86_64++;
+            else st->x86_32++;
+        } else if (is_aarch64_gpr(word) || is_keyword(word, aarch64_evidence)) {
+            st->aarch64++;
+        }
+    }
+}
+
+Language syntax_detect_language_content(const char *filename,
+                                        const char *text, size_t len) {
+    Language by_ext = syntax_detect_language(filename);
+    
+    /* Only assembly dialects are ambiguous by extension */
+    if (by_ext != LANG_MASM64 && by_ext != LANG_AMD64) return by_ext;
+    if (!text || len == 0) return by_ext;
+    
+    if (len > SYNTAX_SAMPLE_SIZE) len = SYNTAX_SAMPLE_SIZE;
+    
+    DetectStats st = {0};
+    size_t pos = 0;
+    while (pos < len) {
+        const char *nl = memchr(text + pos, '\n', len - pos);
+        size_t line_len = nl ? (size_t)(nl - (text + pos)) : len - pos;
+        detect_scan_line(text + pos, line_len, &st);
+        pos += line_len + 1;
+    }
+    
+    /* Score the two syntax families; the extension breaks ties */
+    int masm_score = st.masm * 3 + (by_ext == LANG_MASM64 ? 1 : 0);
+    int gas_score = st.gas * 3 + st.aarch64 + (by_ext == LANG_AMD64 ? 1 : 0);
+    
+    if (masm_score > gas_score) {
+        /* Processor/model directives or purely 32-bit registers mean MASM32 */
+        if (st.masm32 > 0 || (st.x86_64 == 0 && st.x86_32 > 0)) {
+            return LANG_MASM32;
+        }
+        return LANG_MASM64;
+    }
+    
+    if (st.aarch64 > st.x86_64 + st.x86_32) return LANG_AARCH64;
+    return LANG_AMD64;
+}
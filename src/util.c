@@ -5,6 +5,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
 #include "util.h"
 
@@ -87,6 +93,31 @@ void path_dirname(const char *path, char *dir, size_t max) {
     }
 }
 
+static int path_is_sep(char c) {
+    return c == '/' || c == '\\';
+}
+
+int path_same_file(const char *a, const char *b) {
+    while (a[0] == '.' && path_is_sep(a[1])) a += 2;
+    while (b[0] == '.' && path_is_sep(b[1])) b += 2;
+    
+    size_t i = strlen(a);
+    size_t j = strlen(b);
+    if (i == 0 || j == 0) return 0;
+    
+    while (i > 0 && j > 0) {
+        char ca = a[i - 1];
+        char cb = b[j - 1];
+        if (ca != cb && !(path_is_sep(ca) && path_is_sep(cb))) return 0;
+        i--;
+        j--;
+    }
+    /* The shorter one must start at a component boundary of the other */
+    if (i > 0) return path_is_sep(a[i - 1]);
+    if (j > 0) return path_is_sep(b[j - 1]);
+    return 1;
+}
+
 void path_join(char *out, size_t max, const char *a, const char *b) {
     if (!out || max == 0) return;
     
@@ -109,3 +140,25 @@ void path_join(char *out, size_t max, const char *a, const char *b) {
     }
 }
 
+
+double time_now(void) {
+    struct timespec ts;
+#ifdef _WIN32
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void time_sleep(double seconds) {
+    if (seconds <= 0) return;
+#ifdef _WIN32
+    Sleep((DWORD)(seconds * 1000));
+#else
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+#endif
+}
@@ -0,0 +1,602 @@
+/*
+ * walk.c - Project directory walker with gitignore-style exclude rules
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "walk.h"
+#include "backup.h"
+#include "parallel.h"
+#include "util.h"
+
+/* ============================================================================
+ * Exclude rules
+ * ============================================================================ */
+
+void walk_rules_init(WalkRules *rules) {
+    memset(rules, 0, sizeof(*rules));
+}
+
+int walk_rules_add(WalkRules *rules, const char *pattern) {
+    while (*pattern == ' ' || *pattern == '\t') pattern++;
+    if (pattern[0] == '\0' || pattern[0] == '#') return 0;
+    if (rules->count >= WALK_MAX_RULES) return -1;
+    
+    WalkRule *rule = &rules->rules[rules->count];
+    memset(rule, 0, sizeof(*rule));
+    
+    if (pattern[0] == '!') {
+        rule->negate = 1;
+        pattern++;
+    }
+    if (pattern[0] == '/') {
+        rule->anchored = 1;
+        pattern++;
+    }
+    
+    strncpy(rule->pattern, pattern, WALK_MAX_PATTERN - 1);
+    size_t len = strlen(rule->pattern);
+    if (len > 0 && rule->pattern[len - 1] == '/') {
+        rule->dir_only = 1;
+        rule->pattern[--len] = '\0';
+    }
+    if (len == 0) return 0;
+    
+    /* A slash anywhere else ties the pattern to the root, like git */
+    if (strchr(rule->pattern, '/')) rule->anchored = 1;
+    
+    rules->count++;
+    return 0;
+}
+
+/* Match one [...] class at p against c; returns the text after the class,
+ * or NULL when c is not in it */
+static const char *walk_class(const char *p, char c, int *matched) {
+    int negate = 0;
+    p++;
+    if (*p == '!' || *p == '^') {
+        negate = 1;
+        p++;
+    }
+    
+    int found = 0;
+    int first = 1;
+    while (*p && (*p != ']' || first)) {
+        char lo = *p;
+        char hi = lo;
+        if (p[1] == '-' && p[2] && p[2] != ']') {
+            hi = p[2];
+            p += 2;
+        }
+        if (c >= lo && c <= hi) found = 1;
+        p++;
+        first = 0;
+    }
+    if (*p != ']') return NULL;     /* Unterminated: not a class */
+    
+    *matched = found != negate;
+    return p + 1;
+}
+
+int walk_glob(const char *p, const char *s) {
+    while (*p) {
+        if (p[0] == '*' && p[1] == '*') {
+            p += 2;
+            if (*p == '/') {
+                /* "**" + "/" matches zero or more whole directories */
+                p++;
+                for (;;) {
+                    if (walk_glob(p, s)) return 1;
+                    s = strchr(s, '/');
+                    if (!s) return 0;
+                    s++;
+                }
+            }
+            for (;; s++) {
+                if (walk_glob(p, s)) return 1;
+                if (!*s) return 0;
+            }
+        }
+        
+        if (*p == '*') {
+            p++;
+            for (;; s++) {
+                if (walk_glob(p, s)) return 1;
+                if (!*s || *s == '/') return 0;
+            }
+        }
+        
+        if (!*s) return 0;
+        
+        if (*p == '?') {
+            if (*s == '/') return 0;
+            p++;
+        } else if (*p == '[') {
+            int matched = 0;
+            const char *next = walk_class(p, *s, &matched);
+            if (next) {
+                if (!matched || *s == '/') return 0;
+                p = next;
+            } else {
+                if (*s != '[') return 0;
+                p++;
+            }
+        } else {
+            if (*p == '\\' && p[1]) p++;
+            if (*p != *s) return 0;
+            p++;
+        }
+        s++;
+    }
+    return *s == '\0';
+}
+
+int walk_rules_match(const WalkRules *rules, const char *rel_path, int is_dir) {
+    if (!rules) return 0;
+    
+    const char *base = strrchr(rel_path, '/');
+    base = base ? base + 1 : rel_path;
+    
+    int excluded = 0;
+    for (size_t i = 0; i < rules->count; i++) {
+        const WalkRule *rule = &rules->rules[i];
+        if (rule->dir_only && !is_dir) continue;
+        if (rule->negate != excluded) {
+            /* Cannot change the outcome */
+            continue;
+        }
+        if (walk_glob(rule->pattern, rule->anchored ? rel_path : base)) {
+            excluded = !rule->negate;
+        }
+    }
+    return excluded;
+}
+
+/* ============================================================================
+ * Directory walk
+ * ============================================================================ */
+
+typedef enum WalkType {
+    WALK_OTHER = 0,                 /* Devices, sockets, fifos: skipped */
+    WALK_FILE,
+    WALK_DIR,
+    WALK_UNKNOWN                    /* No d_type: stat to find out */
+} WalkType;
+
+typedef struct WalkItem {
+    char *name;
+    WalkType type;
+    int is_link;
+} WalkItem;
+
+typedef struct WalkList {
+    WalkItem *items;
+    size_t count;
+    size_t capacity;
+} WalkList;
+
+typedef struct WalkCtx {
+    const WalkRules *rules;
+} WalkCtx;
+
+static int walk_list_push(WalkList *list, const char *name, WalkType type, int is_link) {
+    if (list->count == list->capacity) {
+        size_t cap = list->capacity ? list->capacity * 2 : 32;
+        WalkItem *items = realloc(list->items, cap * sizeof(WalkItem));
+        if (!items) return -1;
+        list->items = items;
+        list->capacity = cap;
+    }
+    char *copy = str_dup(name);
+    if (!copy) return -1;
+    
+    WalkItem *item = &list->items[list->count++];
+    item->name = copy;
+    item->type = type;
+    item->is_link = is_link;
+    return 0;
+}
+
+static void walk_list_free(WalkList *list) {
+    for (size_t i = 0; i < list->count; i++) free(list->items[i].name);
+    free(list->items);
+    memset(list, 0, sizeof(*list));
+}
+
+static int walk_item_cmp(const void *a, const void *b) {
+    return strcmp(((const WalkItem *)a)->name, ((const WalkItem *)b)->name);
+}
+
+/* dir + sep + name (malloc'd), or NULL when out of memory */
+static char *walk_join(const char *dir, char sep, const char *name) {
+    size_t dir_len = dir ? strlen(dir) : 0;
+    size_t name_len = strlen(name);
+    char *out = malloc(dir_len + name_len + 2);
+    if (!out) return NULL;
+    if (dir_len) {
+        memcpy(out, dir, dir_len);
+        out[dir_len++] = sep;
+    }
+    memcpy(out + dir_len, name, name_len + 1);
+    return out;
+}
+
+static int walk_add(Archive *out, const char *source, const char *dest,
+                    uint64_t size, int64_t mtime, unsigned int mode) {
+    if (archive_add_file(out, source, dest) != 0) return -1;
+    ArchiveEntry *entry = &out->entries[out->entry_count - 1];
+    entry->size = size;
+    entry->mtime = mtime;
+    entry->mode = mode;
+    entry->has_stat = 1;
+    return 0;
+}
+
+#ifndef _WIN32
+
+static WalkType walk_type_of(unsigned char d_type) {
+#ifdef DT_UNKNOWN
+    switch (d_type) {
+        case DT_REG: return WALK_FILE;
+        case DT_DIR: return WALK_DIR;
+        case DT_LNK:
+        case DT_UNKNOWN: return WALK_UNKNOWN;
+        default: return WALK_OTHER;
+    }
+#else
+    (void)d_type;
+    return WALK_UNKNOWN;
+#endif
+}
+
+/* Read the names in a directory, sorted */
+static void walk_read(DIR *d, WalkList *list) {
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        const char *name = de->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+#ifdef DT_UNKNOWN
+        WalkType type = walk_type_of(de->d_type);
+#else
+        WalkType type = WALK_UNKNOWN;
+#endif
+        if (walk_list_push(list, name, type, 0) != 0) break;
+    }
+    
+    /* readdir order is arbitrary; sorted names give reproducible archives */
+    if (list->count > 1) qsort(list->items, list->count, sizeof(WalkItem), walk_item_cmp);
+}
+
+static void walk_dir(WalkCtx *ctx, int dfd, const char *source, const char *rel,
+                     const char *dest, Archive *out, WalkStats *stats);
+
+/* Resolve, filter and collect one directory entry */
+static void walk_child(WalkCtx *ctx, int dfd, WalkItem *item, const char *child_source,
+                       const char *child_rel, const char *child_dest, Archive *out,
+                       WalkStats *stats) {
+    struct stat st;
+    int have_stat = 0;
+    
+    if (item->type == WALK_UNKNOWN) {
+        /* Symlink or a filesystem without d_type: look without following */
+        stats->stats++;
+        if (fstatat(dfd, item->name, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+        if (S_ISLNK(st.st_mode)) {
+            item->is_link = 1;
+            stats->stats++;
+            if (fstatat(dfd, item->name, &st, 0) != 0) return;  /* Dangling */
+        }
+        have_stat = 1;
+        item->type = S_ISREG(st.st_mode) ? WALK_FILE
+                   : S_ISDIR(st.st_mode) ? WALK_DIR : WALK_OTHER;
+    }
+    
+    if (item->type == WALK_OTHER) return;
+    if (item->type == WALK_DIR && item->is_link) return;   /* May loop */
+    
+    if (walk_rules_match(ctx->rules, child_rel, item->type == WALK_DIR)) {
+        stats->excluded++;
+        return;
+    }
+    
+    if (item->type == WALK_DIR) {
+        int child = openat(dfd, item->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if (child >= 0) {
+            walk_dir(ctx, child, child_source, child_rel, child_dest, out, stats);
+        }
+        return;
+    }
+    
+    if (!have_stat) {
+        stats->stats++;
+        if (fstatat(dfd, item->name, &st, 0) != 0) return;
+    }
+    if (walk_add(out, child_source, child_dest, (uint64_t)st.st_size,
+                 (int64_t)st.st_mtime, (unsigned int)(st.st_mode & 07777)) == 0) {
+        stats->files++;
+    } else {
+        stats->errors++;
+    }
+}
+
+/* Collect one directory entry under the paths it joins */
+static void walk_item(WalkCtx *ctx, int dfd, WalkItem *item, const char *source,
+                      const char *rel, const char *dest, Archive *out, WalkStats *stats) {
+    char *child_source = walk_join(source, '/', item->name);
+    char *child_rel = walk_join(rel, '/', item->name);
+    char *child_dest = walk_join(dest, '/', item->name);
+    if (child_source && child_rel && child_dest) {
+        walk_child(ctx, dfd, item, child_source, child_rel, child_dest, out, stats);
+    } else {
+        stats->errors++;
+    }
+    free(child_source);
+    free(child_rel);
+    free(child_dest);
+}
+
+/* Walk an open directory (takes ownership of dfd) */
+static void walk_dir(WalkCtx *ctx, int dfd, const char *source, const char *rel,
+                     const char *dest, Archive *out, WalkStats *stats) {
+    WalkList list;
+    memset(&list, 0, sizeof(list));
+    
+    DIR *d = fdopendir(dfd);
+    if (!d) {
+        close(dfd);
+        return;
+    }
+    stats->dirs++;
+    
+    walk_read(d, &list);
+    
+    for (size_t i = 0; i < list.count; i++) {
+        walk_item(ctx, dirfd(d), &list.items[i], source, rel, dest, out, stats);
+    }
+    
+    closedir(d);
+    walk_list_free(&list);
+}
+
+/* Parallel walk: each top-level subdirectory collects into its own
+ * archive, concatenated in name order afterwards */
+typedef struct WalkJobs {
+    WalkCtx *ctx;
+    int dfd;
+    WalkList *list;
+    const char *source;
+    const char *dest;
+    Archive **parts;
+    WalkStats *stats;
+} WalkJobs;
+
+static void walk_job(size_t index, void *arg) {
+    WalkJobs *jobs = arg;
+    WalkItem *item = &jobs->list->items[index];
+    if (item->type == WALK_FILE) return;    /* Added in order by the merge */
+    
+    Archive *part = archive_create("");
+    if (!part) return;
+    walk_item(jobs->ctx, jobs->dfd, item, jobs->source, "", jobs->dest, part,
+              &jobs->stats[index]);
+    jobs->parts[index] = part;
+}
+
+#endif
+
+int walk_directory(Archive *ar, const char *dir, const char *prefix,
+                   const WalkRules *rules, int threads, WalkStats *stats) {
+    if (!ar || !dir) return -1;
+    
+    WalkStats local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+    stats->threads = 1;
+    double start = time_now();
+    
+    WalkCtx ctx;
+    ctx.rules = rules;
+    const char *dest = prefix ? prefix : "";
+
+#ifdef _WIN32
+    (void)threads;
+    
+    /* Serial; FindFirstFile already reports size, mtime and attributes */
+    typedef struct WalkFrame {
+        char *source;
+        char *rel;
+        char *dest;
+    } WalkFrame;
+    
+    size_t cap = 16;
+    size_t top = 0;
+    WalkFrame *stack = malloc(cap * sizeof(WalkFrame));
+    if (!stack) return -1;
+    stack[0].source = str_dup(dir);
+    stack[0].rel = str_dup("");
+    stack[0].dest = str_dup(dest);
+    top = 1;
+    
+    while (top > 0) {
+        WalkFrame frame = stack[--top];
+        char *pattern = frame.source ? walk_join(frame.source, '\\', "*") : NULL;
+        HANDLE hFind = INVALID_HANDLE_VALUE;
+        WIN32_FIND_DATAA fd;
+        if (pattern && frame.rel && frame.dest) {
+            hFind = FindFirstFileA(pattern, &fd);
+        } else {
+            stats->errors++;
+        }
+        free(pattern);
+        if (hFind == INVALID_HANDLE_VALUE) {
+            free(frame.source);
+            free(frame.rel);
+            free(frame.dest);
+            continue;
+        }
+        stats->dirs++;
+        
+        /* Subdirectories are pushed in reverse so they pop in name order */
+        size_t first_child = top;
+        do {
+            const char *name = fd.cFileName;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+            
+            int is_dir = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT && is_dir) continue;
+            
+            char *rel = walk_join(frame.rel, '/', name);
+            if (!rel) {
+                stats->errors++;
+                continue;
+            }
+            if (walk_rules_match(rules, rel, is_dir)) {
+                stats->excluded++;
+                free(rel);
+                continue;
+            }
+            
+            char *source = walk_join(frame.source, '\\', name);
+            char *child_dest = walk_join(frame.dest, '/', name);
+            if (!source || !child_dest) {
+                stats->errors++;
+                free(rel);
+                free(source);
+                free(child_dest);
+                continue;
+            }
+            
+            if (is_dir) {
+                if (top == cap) {
+                    WalkFrame *grown = realloc(stack, cap * 2 * sizeof(WalkFrame));
+                    if (!grown) {
+                        stats->errors++;
+                        free(rel);
+                        free(source);
+                        free(child_dest);
+                        continue;
+                    }
+                    stack = grown;
+                    cap *= 2;
+                }
+                stack[top].source = source;
+                stack[top].rel = rel;
+                stack[top].dest = child_dest;
+                top++;
+                continue;
+            }
+            
+            /* FILETIME counts 100ns ticks since 1601 */
+            uint64_t ticks = ((uint64_t)fd.ftLastWriteTime.dwHighDateTime << 32) |
+                             fd.ftLastWriteTime.dwLowDateTime;
+            int64_t mtime = (int64_t)(ticks / 10000000ULL) - 11644473600LL;
+            uint64_t size = ((uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+            unsigned int mode = fd.dwFileAttributes & FILE_ATTRIBUTE_READONLY ? 0444 : 0644;
+            if (walk_add(ar, source, child_dest, size, mtime, mode) == 0) {
+                stats->files++;
+            } else {
+                stats->errors++;
+            }
+            free(rel);
+            free(source);
+            free(child_dest);
+        } while (FindNextFileA(hFind, &fd));
+        FindClose(hFind);
+        free(frame.source);
+        free(frame.rel);
+        free(frame.dest);
+        
+        for (size_t i = first_child, j = top; i + 1 < j; i++, j--) {
+            WalkFrame tmp = stack[i];
+            stack[i] = stack[j - 1];
+            stack[j - 1] = tmp;
+        }
+    }
+    
+    free(stack);
+#else
+    int dfd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (dfd < 0) return -1;
+    
+    if (threads == 0) threads = parallel_cpu_count();
+    if (threads <= 1) {
+        walk_dir(&ctx, dfd, dir, "", dest, ar, stats);
+        stats->seconds = time_now() - start;
+        return stats->errors ? -1 : 0;
+    }
+    
+    DIR *d = fdopendir(dfd);
+    if (!d) {
+        close(dfd);
+        return -1;
+    }
+    
+    WalkList list;
+    memset(&list, 0, sizeof(list));
+    walk_read(d, &list);
+    stats->dirs = 1;
+    
+    /* Worth splitting only when there are subtrees to share out */
+    size_t subdirs = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        if (list.items[i].type != WALK_FILE) subdirs++;
+    }
+    
+    Archive **parts = calloc(list.count ? list.count : 1, sizeof(Archive *));
+    WalkStats *part_stats = calloc(list.count ? list.count : 1, sizeof(WalkStats));
+    WalkJobs jobs;
+    jobs.ctx = &ctx;
+    jobs.dfd = dfd;
+    jobs.list = &list;
+    jobs.source = dir;
+    jobs.dest = dest;
+    jobs.parts = parts;
+    jobs.stats = part_stats;
+    if (subdirs >= 2 && parts && part_stats) {
+        parallel_for(list.count, threads, walk_job, &jobs);
+        stats->threads = threads < (int)subdirs ? threads : (int)subdirs;
+    }
+    
+    /* Merge in name order; top-level files and anything a worker could not
+     * take are walked here */
+    for (size_t i = 0; i < list.count; i++) {
+        Archive *part = parts ? parts[i] : NULL;
+        if (!part) {
+            walk_item(&ctx, dfd, &list.items[i], dir, "", dest, ar, stats);
+            continue;
+        }
+        for (size_t k = 0; k < part->entry_count; k++) {
+            ArchiveEntry *e = &part->entries[k];
+            if (walk_add(ar, e->source, e->path, e->size, e->mtime, e->mode) != 0) {
+                stats->errors++;
+            }
+        }
+        stats->dirs += part_stats[i].dirs;
+        stats->files += part_stats[i].files;
+        stats->excluded += part_stats[i].excluded;
+        stats->stats += part_stats[i].stats;
+        stats->errors += part_stats[i].errors;
+        archive_destroy(part);
+    }
+    
+    free(parts);
+    free(part_stats);
+    walk_list_free(&list);
+    closedir(d);
+#endif
+    
+    stats->seconds = time_now() - start;
+    return stats->errors ? -1 : 0;
+}